@@ -0,0 +1,275 @@
+/*
+ *  IXDNSCache.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXDNSCache.h"
+
+#include "IXDNSResolverPool.h"
+#include "IXNetSystem.h"
+#include <algorithm>
+#include <sstream>
+
+namespace ix
+{
+    // getaddrinfo does not tell the TTL of the records, one minute is a common
+    // value for services which move between hosts
+    const int DNSCache::kDefaultTTLSecs(60);
+    const int DNSCache::kDefaultNegativeTTLSecs(5);
+    const int DNSCache::kDefaultRefreshAheadSecs(10);
+    const size_t DNSCache::kDefaultMaxEntries(1024);
+    const int DNSCache::kWaitIntervalMs(10);
+
+    DNSCache::DNSCache()
+        : _ttlSecs(kDefaultTTLSecs)
+        , _negativeTTLSecs(kDefaultNegativeTTLSecs)
+        , _refreshAheadSecs(kDefaultRefreshAheadSecs)
+        , _maxEntries(kDefaultMaxEntries)
+        , _hitCount(0)
+        , _missCount(0)
+        , _coalescedCount(0)
+        , _refreshCount(0)
+    {
+        ;
+    }
+
+    std::shared_ptr<DNSCache> DNSCache::getInstance()
+    {
+        // Lookups in flight hold a reference too, so they can outlive this one
+        static auto instance = std::make_shared<DNSCache>();
+        return instance;
+    }
+
+    std::string DNSCache::makeKey(const std::string& hostname, int port)
+    {
+        std::stringstream ss;
+        ss << hostname << ":" << port;
+        return ss.str();
+    }
+
+    DNSCache::AddrInfoPtr DNSCache::resolve(const std::string& hostname,
+                                            int port,
+                                            std::string& errMsg,
+                                            const CancellationRequest& isCancellationRequested)
+    {
+        errMsg = "no error";
+
+        auto key = makeKey(hostname, port);
+        auto now = std::chrono::steady_clock::now();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto it = _entries.find(key);
+        if (it == _entries.end())
+        {
+            if (_entries.size() >= _maxEntries) evict();
+            it = _entries.emplace(key, Entry()).first;
+        }
+        auto& entry = it->second;
+
+        if (entry.resolved && now < entry.expiresAt)
+        {
+            _hitCount++;
+
+            // Hot entries are refreshed before they expire, so that their users
+            // never wait for a lookup. Short TTLs are not refreshed on every hit.
+            int refreshAheadSecs = std::min(_refreshAheadSecs, _ttlSecs / 2);
+            if (entry.res && !entry.inFlight && refreshAheadSecs > 0 &&
+                now + std::chrono::seconds(refreshAheadSecs) >= entry.expiresAt)
+            {
+                _refreshCount++;
+                startLookup(key, entry, hostname, port);
+            }
+
+            if (!entry.res) errMsg = entry.errMsg;
+            return entry.res;
+        }
+
+        _missCount++;
+        auto lookup = entry.inFlight;
+        if (lookup)
+        {
+            _coalescedCount++;
+        }
+        else
+        {
+            lookup = startLookup(key, entry, hostname, port);
+        }
+
+        while (!lookup->done)
+        {
+            if (isCancellationRequested && isCancellationRequested())
+            {
+                errMsg = "cancellation requested";
+                return nullptr;
+            }
+
+            _condition.wait_for(lock, std::chrono::milliseconds(kWaitIntervalMs));
+        }
+
+        if (!lookup->res) errMsg = lookup->errMsg;
+        return lookup->res;
+    }
+
+    std::shared_ptr<DNSCache::Lookup> DNSCache::startLookup(const std::string& key,
+                                                            Entry& entry,
+                                                            const std::string& hostname,
+                                                            int port)
+    {
+        auto lookup = std::make_shared<Lookup>();
+        entry.inFlight = lookup;
+
+        // getaddrinfo cannot be interrupted, it runs to completion in the background
+        // even if all its callers gave up
+        auto self = shared_from_this();
+        DNSResolverPool::getInstance().resolve(
+            hostname, port, [self, key, lookup](struct addrinfo* res, const std::string& errMsg) {
+                self->onLookupDone(key, lookup, res, errMsg);
+            });
+
+        return lookup;
+    }
+
+    void DNSCache::onLookupDone(const std::string& key,
+                                const std::shared_ptr<Lookup>& lookup,
+                                struct addrinfo* res,
+                                const std::string& errMsg)
+    {
+        AddrInfoPtr addr;
+        if (res != nullptr)
+        {
+            addr = AddrInfoPtr(res, [](const struct addrinfo* addr) {
+                freeaddrinfo(const_cast<struct addrinfo*>(addr));
+            });
+        }
+
+        // The previous result is released once the mutex is unlocked
+        AddrInfoPtr previous;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            lookup->done = true;
+            lookup->res = addr;
+            lookup->errMsg = errMsg;
+
+            // The entry might have been cleared meanwhile
+            auto it = _entries.find(key);
+            if (it != _entries.end() && it->second.inFlight == lookup)
+            {
+                auto& entry = it->second;
+                auto now = std::chrono::steady_clock::now();
+                if (addr)
+                {
+                    previous = std::move(entry.res);
+                    entry.res = addr;
+                    entry.errMsg.clear();
+                    entry.expiresAt = now + std::chrono::seconds(_ttlSecs);
+                }
+                else if (!(entry.res && now < entry.expiresAt))
+                {
+                    // A failed refresh keeps the previous addresses until they expire
+                    previous = std::move(entry.res);
+                    entry.errMsg = errMsg;
+                    entry.expiresAt = now + std::chrono::seconds(_negativeTTLSecs);
+                }
+
+                entry.resolved = true;
+                entry.inFlight.reset();
+            }
+        }
+
+        _condition.notify_all();
+    }
+
+    void DNSCache::evict()
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        for (auto it = _entries.begin(); it != _entries.end();)
+        {
+            if (!it->second.inFlight && it->second.expiresAt <= now)
+            {
+                it = _entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+
+        while (_entries.size() >= _maxEntries)
+        {
+            auto oldest = _entries.end();
+            for (auto it = _entries.begin(); it != _entries.end(); ++it)
+            {
+                if (it->second.inFlight) continue;
+                if (oldest == _entries.end() || it->second.expiresAt < oldest->second.expiresAt)
+                {
+                    oldest = it;
+                }
+            }
+
+            if (oldest == _entries.end()) break;
+            _entries.erase(oldest);
+        }
+    }
+
+    void DNSCache::setTTLSecs(int ttlSecs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ttlSecs = ttlSecs;
+    }
+
+    void DNSCache::setNegativeTTLSecs(int negativeTTLSecs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _negativeTTLSecs = negativeTTLSecs;
+    }
+
+    void DNSCache::setRefreshAheadSecs(int refreshAheadSecs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _refreshAheadSecs = refreshAheadSecs;
+    }
+
+    void DNSCache::setMaxEntries(size_t maxEntries)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _maxEntries = (maxEntries == 0) ? 1 : maxEntries;
+    }
+
+    void DNSCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Callers waiting for a lookup in flight still get its result
+        _entries.clear();
+    }
+
+    size_t DNSCache::getEntriesCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.size();
+    }
+
+    uint64_t DNSCache::getHitCount() const
+    {
+        return _hitCount;
+    }
+
+    uint64_t DNSCache::getMissCount() const
+    {
+        return _missCount;
+    }
+
+    uint64_t DNSCache::getCoalescedCount() const
+    {
+        return _coalescedCount;
+    }
+
+    uint64_t DNSCache::getRefreshCount() const
+    {
+        return _refreshCount;
+    }
+} // namespace ix
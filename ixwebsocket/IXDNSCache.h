@@ -0,0 +1,136 @@
+/*
+ *  IXDNSCache.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Process wide cache of DNS lookups, keyed by hostname and port. Concurrent
+ *  lookups of the same name share a single getaddrinfo call, failures are
+ *  cached for a short time, and entries still in use are refreshed in the
+ *  background before they expire.
+ */
+
+#pragma once
+
+#include "IXCancellationRequest.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct addrinfo;
+
+namespace ix
+{
+    class DNSCache : public std::enable_shared_from_this<DNSCache>
+    {
+    public:
+        // Freed with freeaddrinfo once the cache and all its users released it
+        using AddrInfoPtr = std::shared_ptr<const struct addrinfo>;
+
+        // Lookups run in the background with a reference to the cache, which must be
+        // created with std::make_shared
+        DNSCache();
+        ~DNSCache() = default;
+
+        // The cache used by SocketConnect
+        static std::shared_ptr<DNSCache> getInstance();
+
+        // Returns nullptr with errMsg set if the lookup failed or was cancelled. A
+        // cancelled lookup keeps running for the other callers, and for the cache.
+        AddrInfoPtr resolve(const std::string& hostname,
+                            int port,
+                            std::string& errMsg,
+                            const CancellationRequest& isCancellationRequested);
+
+        // 0 disables caching, concurrent lookups are still shared
+        void setTTLSecs(int ttlSecs);
+        void setNegativeTTLSecs(int negativeTTLSecs);
+        // Entries used in the last refreshAheadSecs before they expire are looked up
+        // again in the background. 0 disables refreshes.
+        void setRefreshAheadSecs(int refreshAheadSecs);
+        void setMaxEntries(size_t maxEntries);
+
+        // Forget all entries. Lookups in flight are not cancelled.
+        void clear();
+        size_t getEntriesCount();
+
+        // Lookups answered from the cache, failures included
+        uint64_t getHitCount() const;
+        // Lookups which waited for getaddrinfo, started by them or by another caller
+        uint64_t getMissCount() const;
+        // Misses which joined a lookup already in flight
+        uint64_t getCoalescedCount() const;
+        // Background refreshes of entries about to expire
+        uint64_t getRefreshCount() const;
+
+        const static int kDefaultTTLSecs;
+        const static int kDefaultNegativeTTLSecs;
+        const static int kDefaultRefreshAheadSecs;
+        const static size_t kDefaultMaxEntries;
+
+    private:
+        // A getaddrinfo call, shared by the callers waiting for it
+        struct Lookup
+        {
+            Lookup()
+                : done(false)
+            {
+            }
+
+            bool done;
+            AddrInfoPtr res;
+            std::string errMsg;
+        };
+
+        struct Entry
+        {
+            Entry()
+                : resolved(false)
+            {
+            }
+
+            AddrInfoPtr res;
+            std::string errMsg;
+            std::chrono::steady_clock::time_point expiresAt;
+            // A result (or a failure) was received at least once
+            bool resolved;
+            std::shared_ptr<Lookup> inFlight;
+        };
+
+        // Called with the mutex held
+        std::shared_ptr<Lookup> startLookup(const std::string& key,
+                                            Entry& entry,
+                                            const std::string& hostname,
+                                            int port);
+        void onLookupDone(const std::string& key,
+                          const std::shared_ptr<Lookup>& lookup,
+                          struct addrinfo* res,
+                          const std::string& errMsg);
+        // Drop expired entries, then the ones expiring first, to make room for a new one.
+        // Called with the mutex held.
+        void evict();
+
+        static std::string makeKey(const std::string& hostname, int port);
+
+        std::unordered_map<std::string, Entry> _entries;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+
+        int _ttlSecs;
+        int _negativeTTLSecs;
+        int _refreshAheadSecs;
+        size_t _maxEntries;
+
+        std::atomic<uint64_t> _hitCount;
+        std::atomic<uint64_t> _missCount;
+        std::atomic<uint64_t> _coalescedCount;
+        std::atomic<uint64_t> _refreshCount;
+
+        // Waiting for a lookup checks for cancellation that often
+        const static int kWaitIntervalMs;
+    };
+} // namespace ix
@@ -19,10 +19,10 @@
 
 #include "IXDNSLookup.h"
 
+#include "IXDNSResolverPool.h"
 #include "IXNetSystem.h"
 #include <chrono>
 #include <string.h>
-#include <thread>
 
 // mingw build quirks
 #if defined(_WIN32) && defined(__GNUC__)
@@ -32,14 +32,16 @@
 
 namespace ix
 {
-    const int64_t DNSLookup::kDefaultWait = 1; // ms
+    const int64_t DNSLookup::kDefaultWait = 10; // ms
 
     DNSLookup::DNSLookup(const std::string& hostname, int port, int64_t wait)
         : _hostname(hostname)
         , _port(port)
         , _wait(wait)
         , _res(nullptr)
+        , _started(false)
         , _done(false)
+        , _cancelled(false)
     {
         ;
     }
@@ -99,97 +101,85 @@ namespace ix
     {
         errMsg = "no error";
 
-        // Can only be called once, otherwise we would have to manage a pool
-        // of background thread which is overkill for our usage.
-        if (_done)
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Can only be called once, the result is handed over to the caller
+        if (_started)
         {
             return nullptr; // programming error, create a second DNSLookup instance
                             // if you need a second lookup.
         }
-
-        //
-        // Good resource on thread forced termination
-        // https://www.bo-yang.net/2017/11/19/cpp-kill-detached-thread
-        //
-        auto ptr = shared_from_this();
-        std::weak_ptr<DNSLookup> self(ptr);
-
-        int port = _port;
-        std::string hostname(_hostname);
-
-        // We make the background thread doing the work a shared pointer
-        // instead of a member variable, because it can keep running when
-        // this object goes out of scope, in case of cancellation
-        auto t = std::make_shared<std::thread>(&DNSLookup::run, this, self, hostname, port);
-        t->detach();
+        _started = true;
+
+        // The lookup can outlive this object in case of cancellation, it only keeps
+        // a weak reference to it. The cancellation request of the caller is not given
+        // to the resolver thread, it could refer to the stack of the caller.
+        std::weak_ptr<DNSLookup> self(shared_from_this());
+        DNSResolverPool::getInstance().resolve(
+            _hostname,
+            _port,
+            [self](struct addrinfo* res, const std::string& errMsg) {
+                if (auto lookup = self.lock())
+                {
+                    lookup->onResolved(res, errMsg);
+                }
+                else
+                {
+                    freeaddrinfo(res);
+                }
+            },
+            [self]() -> bool {
+                auto lookup = self.lock();
+                if (!lookup) return true;
+
+                std::lock_guard<std::mutex> lock(lookup->_mutex);
+                return lookup->_cancelled;
+            });
 
         while (!_done)
         {
-            // Wait for 1 milliseconds, to see if the bg thread has terminated.
-            // We do not use a condition variable to wait, as destroying this one
-            // if the bg thread is alive can cause undefined behavior.
-            std::this_thread::sleep_for(std::chrono::milliseconds(_wait));
-
             // Were we cancelled ?
             if (isCancellationRequested())
             {
+                _cancelled = true;
                 errMsg = "cancellation requested";
                 return nullptr;
             }
+
+            _condition.wait_for(lock, std::chrono::milliseconds(_wait));
         }
 
-        // Maybe a cancellation request got in before the bg terminated ?
+        // Maybe a cancellation request got in before the lookup completed ?
         if (isCancellationRequested())
         {
+            _cancelled = true;
+            if (_res != nullptr) freeaddrinfo(_res);
+            _res = nullptr;
+
             errMsg = "cancellation requested";
             return nullptr;
         }
 
-        errMsg = getErrMsg();
-        return getRes();
+        errMsg = _errMsg;
+        return _res;
     }
 
-    void DNSLookup::run(std::weak_ptr<DNSLookup> self,
-                        std::string hostname,
-                        int port) // thread runner
+    void DNSLookup::onResolved(struct addrinfo* res, const std::string& errMsg)
     {
-        // We don't want to read or write into members variables of an object that could be
-        // gone, so we use temporary variables (res) or we pass in by copy everything that
-        // getAddrInfo needs to work.
-        std::string errMsg;
-        struct addrinfo* res = getAddrInfo(hostname, port, errMsg);
-
-        if (auto lock = self.lock())
         {
-            // Copy result into the member variables
-            setRes(res);
-            setErrMsg(errMsg);
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (_cancelled)
+            {
+                if (res != nullptr) freeaddrinfo(res);
+                return;
+            }
 
+            _res = res;
+            _errMsg = errMsg;
             _done = true;
         }
-    }
-
-    void DNSLookup::setErrMsg(const std::string& errMsg)
-    {
-        std::lock_guard<std::mutex> lock(_errMsgMutex);
-        _errMsg = errMsg;
-    }
-
-    const std::string& DNSLookup::getErrMsg()
-    {
-        std::lock_guard<std::mutex> lock(_errMsgMutex);
-        return _errMsg;
-    }
-
-    void DNSLookup::setRes(struct addrinfo* addr)
-    {
-        std::lock_guard<std::mutex> lock(_resMutex);
-        _res = addr;
-    }
 
-    struct addrinfo* DNSLookup::getRes()
-    {
-        std::lock_guard<std::mutex> lock(_resMutex);
-        return _res;
+        _condition.notify_all();
     }
 } // namespace ix
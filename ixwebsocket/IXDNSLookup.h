@@ -4,17 +4,17 @@
  *  Copyright (c) 2018 Machine Zone, Inc. All rights reserved.
  *
  *  Resolve a hostname+port to a struct addrinfo obtained with getaddrinfo
- *  Does this in a background thread so that it can be cancelled, since
+ *  Does this on a resolver thread (see DNSResolverPool) so that it can be cancelled, since
  *  getaddrinfo is a blocking call, and we don't want to block the main thread on Mobile.
  */
 
 #pragma once
 
 #include "IXCancellationRequest.h"
-#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
 #include <mutex>
-#include <set>
 #include <string>
 
 struct addrinfo;
@@ -24,6 +24,8 @@ namespace ix
     class DNSLookup : public std::enable_shared_from_this<DNSLookup>
     {
     public:
+        // Cancellation is checked every wait ms while the lookup runs, its result wakes
+        // the caller up right away
         DNSLookup(const std::string& hostname, int port, int64_t wait = DNSLookup::kDefaultWait);
         ~DNSLookup() = default;
 
@@ -33,35 +35,33 @@ namespace ix
 
         void release(struct addrinfo* addr);
 
+        // Blocking getaddrinfo call
+        static struct addrinfo* getAddrInfo(const std::string& hostname,
+                                            int port,
+                                            std::string& errMsg);
+
     private:
         struct addrinfo* resolveCancellable(std::string& errMsg,
                                             const CancellationRequest& isCancellationRequested);
         struct addrinfo* resolveUnCancellable(std::string& errMsg,
                                               const CancellationRequest& isCancellationRequested);
 
-        static struct addrinfo* getAddrInfo(const std::string& hostname,
-                                            int port,
-                                            std::string& errMsg);
-
-        void run(std::weak_ptr<DNSLookup> self, std::string hostname, int port); // thread runner
-
-        void setErrMsg(const std::string& errMsg);
-        const std::string& getErrMsg();
-
-        void setRes(struct addrinfo* addr);
-        struct addrinfo* getRes();
+        // Invoked from the resolver thread
+        void onResolved(struct addrinfo* res, const std::string& errMsg);
 
         std::string _hostname;
         int _port;
         int64_t _wait;
         const static int64_t kDefaultWait;
 
+        // Guards the fields below, which are set by the resolver thread
+        std::mutex _mutex;
+        std::condition_variable _condition;
         struct addrinfo* _res;
-        std::mutex _resMutex;
-
         std::string _errMsg;
-        std::mutex _errMsgMutex;
-
-        std::atomic<bool> _done;
+        bool _started;
+        bool _done;
+        // Set once the caller gave up, a late result is released
+        bool _cancelled;
     };
 } // namespace ix
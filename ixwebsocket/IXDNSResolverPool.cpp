@@ -0,0 +1,120 @@
+/*
+ *  IXDNSResolverPool.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXDNSResolverPool.h"
+
+#include "IXDNSLookup.h"
+#include "IXSetThreadName.h"
+
+namespace ix
+{
+    // Lookups of different hosts run in parallel, and one slow DNS server does not
+    // hold back the others, without a thread per connection attempt
+    const size_t DNSResolverPool::kDefaultMaxThreads(4);
+
+    DNSResolverPool::DNSResolverPool(size_t maxThreads)
+        : _maxThreads(maxThreads == 0 ? 1 : maxThreads)
+        , _idleThreadsCount(0)
+        , _stop(false)
+    {
+        ;
+    }
+
+    DNSResolverPool::~DNSResolverPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _condition.notify_all();
+
+        for (auto&& thread : _threads)
+        {
+            thread.join();
+        }
+
+        for (auto&& job : _jobs)
+        {
+            job.callback(nullptr, "DNS resolver stopped");
+        }
+    }
+
+    DNSResolverPool& DNSResolverPool::getInstance()
+    {
+        static auto instance = new DNSResolverPool();
+        return *instance;
+    }
+
+    void DNSResolverPool::resolve(const std::string& hostname,
+                                  int port,
+                                  const OnResolvedCallback& callback,
+                                  const CancellationRequest& isCancellationRequested)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            Job job;
+            job.hostname = hostname;
+            job.port = port;
+            job.callback = callback;
+            job.isCancellationRequested = isCancellationRequested;
+            _jobs.push_back(std::move(job));
+
+            // A new thread is only needed when the idle ones all have a job already
+            if (_jobs.size() > _idleThreadsCount && _threads.size() < _maxThreads)
+            {
+                _threads.emplace_back(&DNSResolverPool::run, this);
+            }
+        }
+
+        _condition.notify_one();
+    }
+
+    void DNSResolverPool::run()
+    {
+        setThreadName("DNSResolver");
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true)
+        {
+            _idleThreadsCount++;
+            _condition.wait(lock, [this] { return _stop || !_jobs.empty(); });
+            _idleThreadsCount--;
+
+            if (_stop) return;
+
+            auto job = std::move(_jobs.front());
+            _jobs.pop_front();
+            lock.unlock();
+
+            if (job.isCancellationRequested && job.isCancellationRequested())
+            {
+                job.callback(nullptr, "cancellation requested");
+            }
+            else
+            {
+                std::string errMsg;
+                struct addrinfo* res = DNSLookup::getAddrInfo(job.hostname, job.port, errMsg);
+                job.callback(res, errMsg);
+            }
+
+            lock.lock();
+        }
+    }
+
+    size_t DNSResolverPool::getThreadsCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _threads.size();
+    }
+
+    size_t DNSResolverPool::getQueuedCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _jobs.size();
+    }
+} // namespace ix
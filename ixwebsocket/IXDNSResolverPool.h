@@ -0,0 +1,74 @@
+/*
+ *  IXDNSResolverPool.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  A bounded set of threads calling getaddrinfo for queued lookups. Threads are
+ *  started on demand, up to a maximum, and are then kept for the next lookups.
+ */
+
+#pragma once
+
+#include "IXCancellationRequest.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct addrinfo;
+
+namespace ix
+{
+    class DNSResolverPool
+    {
+    public:
+        // Invoked from a resolver thread. res is nullptr on error, otherwise the callback
+        // owns it and releases it with freeaddrinfo.
+        using OnResolvedCallback =
+            std::function<void(struct addrinfo* res, const std::string& errMsg)>;
+
+        DNSResolverPool(size_t maxThreads = DNSResolverPool::kDefaultMaxThreads);
+        // Lookups still queued fail, and lookups in progress are waited for
+        ~DNSResolverPool();
+
+        // Used by DNSLookup and DNSCache. It is never destroyed, since its threads
+        // can be blocked in getaddrinfo when the process exits.
+        static DNSResolverPool& getInstance();
+
+        // Thread safe. The cancellation request is checked when a thread picks the
+        // lookup up, cancelled lookups are not performed. It is called from that
+        // thread, and must not refer to the stack of the caller.
+        void resolve(const std::string& hostname,
+                     int port,
+                     const OnResolvedCallback& callback,
+                     const CancellationRequest& isCancellationRequested = nullptr);
+
+        size_t getThreadsCount();
+        size_t getQueuedCount();
+
+        const static size_t kDefaultMaxThreads;
+
+    private:
+        struct Job
+        {
+            std::string hostname;
+            int port;
+            OnResolvedCallback callback;
+            CancellationRequest isCancellationRequested;
+        };
+
+        void run();
+
+        std::deque<Job> _jobs;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+
+        std::vector<std::thread> _threads;
+        size_t _maxThreads;
+        size_t _idleThreadsCount;
+        bool _stop;
+    };
+} // namespace ix
@@ -0,0 +1,352 @@
+/*
+ *  IXEventLoop.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXEventLoop.h"
+
+#include "IXSetThreadName.h"
+#include <algorithm>
+#include <sstream>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace ix
+{
+    const int EventLoop::kMaxEvents(256);
+    const uint64_t EventLoop::kWakeUpId(0);
+
+    EventLoop::EventLoop()
+        : _epollFd(-1)
+        , _eventFd(-1)
+        , _stop(false)
+        , _nextId(kWakeUpId + 1)
+    {
+        ;
+    }
+
+    EventLoop::~EventLoop()
+    {
+        stop();
+
+#ifdef __linux__
+        if (_eventFd != -1) ::close(_eventFd);
+        if (_epollFd != -1) ::close(_epollFd);
+#endif
+    }
+
+    bool EventLoop::init(std::string& errorMsg)
+    {
+#ifdef __linux__
+        _epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epollFd == -1)
+        {
+            std::stringstream ss;
+            ss << "EventLoop::init() failed in epoll_create1: " << strerror(errno);
+            errorMsg = ss.str();
+            return false;
+        }
+
+        // Used by other threads to wake the loop up when a task is posted
+        _eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_eventFd == -1)
+        {
+            std::stringstream ss;
+            ss << "EventLoop::init() failed in eventfd: " << strerror(errno);
+            errorMsg = ss.str();
+            return false;
+        }
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = kWakeUpId;
+
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _eventFd, &event) == -1)
+        {
+            std::stringstream ss;
+            ss << "EventLoop::init() failed in epoll_ctl: " << strerror(errno);
+            errorMsg = ss.str();
+            return false;
+        }
+
+        return true;
+#else
+        errorMsg = "EventLoop::init() event loops are only supported on Linux";
+        return false;
+#endif
+    }
+
+    void EventLoop::start(const std::string& threadName)
+    {
+        if (_thread.joinable()) return; // we've already been started
+
+        _threadName = threadName;
+        _thread = std::thread(&EventLoop::run, this);
+    }
+
+    void EventLoop::stop()
+    {
+        if (!_thread.joinable()) return;
+
+        _stop = true;
+        wakeUp();
+        _thread.join();
+        _stop = false;
+    }
+
+    void EventLoop::post(const Task& task)
+    {
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> lock(_tasksMutex);
+            wasEmpty = _tasks.empty();
+            _tasks.push_back(task);
+        }
+
+        // Only the first task needs to wake the loop up, it will run all of them
+        if (wasEmpty)
+        {
+            wakeUp();
+        }
+    }
+
+    void EventLoop::wakeUp()
+    {
+#ifdef __linux__
+        uint64_t value = 1;
+        ssize_t ret = ::write(_eventFd, &value, sizeof(value));
+        (void) ret;
+#endif
+    }
+
+    uint64_t EventLoop::add(int fd, const OnEventCallback& callback, std::string& errorMsg)
+    {
+#ifdef __linux__
+        uint64_t id = _nextId++;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.u64 = id;
+
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            std::stringstream ss;
+            ss << "EventLoop::add() failed in epoll_ctl: " << strerror(errno);
+            errorMsg = ss.str();
+            return 0;
+        }
+
+        _callbacks[id] = std::make_shared<OnEventCallback>(callback);
+        return id;
+#else
+        (void) fd;
+        (void) callback;
+        errorMsg = "EventLoop::add() event loops are only supported on Linux";
+        return 0;
+#endif
+    }
+
+    void EventLoop::remove(uint64_t id)
+    {
+        _callbacks.erase(id);
+    }
+
+    void EventLoop::unwatch(uint64_t id, int fd)
+    {
+#ifdef __linux__
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+#else
+        (void) fd;
+#endif
+        remove(id);
+    }
+
+    void EventLoop::runAfter(int delayMs, const Task& task)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+        _timers.insert(std::make_pair(deadline, task));
+    }
+
+    bool EventLoop::isInLoopThread() const
+    {
+        return std::this_thread::get_id() == _thread.get_id();
+    }
+
+    size_t EventLoop::getRegistrationsCount() const
+    {
+        return _callbacks.size();
+    }
+
+    int EventLoop::getTimeoutMs() const
+    {
+        if (_timers.empty()) return -1;
+
+        auto now = std::chrono::steady_clock::now();
+        auto deadline = _timers.begin()->first;
+        if (deadline <= now) return 0;
+
+        // Round up, so that we do not wake up right before the deadline
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+        return (int) delay.count() + 1;
+    }
+
+    void EventLoop::runTasks()
+    {
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lock(_tasksMutex);
+            tasks.swap(_tasks);
+        }
+
+        for (auto&& task : tasks)
+        {
+            task();
+        }
+    }
+
+    void EventLoop::runTimers()
+    {
+        auto now = std::chrono::steady_clock::now();
+
+        // Timers can schedule new timers, so extract the expired ones first
+        std::vector<Task> expired;
+        auto it = _timers.begin();
+        while (it != _timers.end() && it->first <= now)
+        {
+            expired.push_back(std::move(it->second));
+            it = _timers.erase(it);
+        }
+
+        for (auto&& task : expired)
+        {
+            task();
+        }
+    }
+
+    void EventLoop::run()
+    {
+        setThreadName(_threadName);
+
+#ifdef __linux__
+        std::vector<struct epoll_event> events(kMaxEvents);
+
+        while (!_stop)
+        {
+            int count = epoll_wait(_epollFd, &events[0], kMaxEvents, getTimeoutMs());
+
+            if (count < 0 && errno != EINTR)
+            {
+                break;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                uint64_t id = events[i].data.u64;
+                uint32_t flags = events[i].events;
+
+                if (id == kWakeUpId)
+                {
+                    uint64_t value;
+                    ssize_t ret = ::read(_eventFd, &value, sizeof(value));
+                    (void) ret;
+                    continue;
+                }
+
+                // The connection might have been removed by a previous event of this batch
+                auto it = _callbacks.find(id);
+                if (it == _callbacks.end()) continue;
+
+                // Keep the callback alive, it can remove itself
+                auto callback = it->second;
+
+                // Errors and hang ups are reported as readable, the next read will tell why
+                bool readable = flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+                bool writable = flags & EPOLLOUT;
+
+                (*callback)(readable, writable);
+            }
+
+            runTasks();
+            runTimers();
+        }
+#endif
+
+        // Release the callbacks (and the connections they own) on the loop thread.
+        // Move them out first as destructors may call remove()
+        auto callbacks = std::move(_callbacks);
+        _callbacks.clear();
+        callbacks.clear();
+
+        _timers.clear();
+
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lock(_tasksMutex);
+            tasks.swap(_tasks);
+        }
+    }
+
+    EventLoopPool::EventLoopPool(size_t threads)
+        : _threads(threads)
+        , _next(0)
+    {
+        if (_threads == 0)
+        {
+            _threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+    }
+
+    EventLoopPool::~EventLoopPool()
+    {
+        stop();
+    }
+
+    bool EventLoopPool::start(const std::string& threadName, std::string& errorMsg)
+    {
+        for (size_t i = 0; i < _threads; ++i)
+        {
+            auto eventLoop = std::make_shared<EventLoop>();
+            if (!eventLoop->init(errorMsg))
+            {
+                stop();
+                return false;
+            }
+
+            std::stringstream ss;
+            ss << threadName << "::" << i;
+            eventLoop->start(ss.str());
+
+            _eventLoops.push_back(eventLoop);
+        }
+
+        return true;
+    }
+
+    void EventLoopPool::stop()
+    {
+        for (auto&& eventLoop : _eventLoops)
+        {
+            eventLoop->stop();
+        }
+        _eventLoops.clear();
+    }
+
+    EventLoopPtr EventLoopPool::getNextEventLoop()
+    {
+        return _eventLoops[_next++ % _eventLoops.size()];
+    }
+
+    const std::vector<EventLoopPtr>& EventLoopPool::getEventLoops() const
+    {
+        return _eventLoops;
+    }
+} // namespace ix
@@ -0,0 +1,109 @@
+/*
+ *  IXEventLoop.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  A small single threaded event loop multiplexing many non blocking sockets,
+ *  used to serve (or drive) a large number of connections with a fixed
+ *  number of threads. It relies on epoll and is only available on Linux,
+ *  init() returns false on other platforms.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ix
+{
+    class EventLoop
+    {
+    public:
+        using Task = std::function<void()>;
+
+        // Sockets are watched in edge triggered mode, so a callback must read (or write)
+        // until the socket would block before it will be notified again.
+        using OnEventCallback = std::function<void(bool readable, bool writable)>;
+
+        EventLoop();
+        ~EventLoop();
+
+        bool init(std::string& errorMsg);
+        void start(const std::string& threadName);
+        void stop();
+
+        // Thread safe. Tasks are executed in order on the loop thread.
+        void post(const Task& task);
+
+        // The methods below must be called from the loop thread (see post)
+        //
+        // Registrations are identified by an id instead of the file descriptor, since
+        // a closed file descriptor can be re-used by a new connection. A closed file
+        // descriptor is automatically unwatched by the kernel, and remove() only needs
+        // to be called to release the callback.
+        uint64_t add(int fd, const OnEventCallback& callback, std::string& errorMsg);
+        void remove(uint64_t id);
+        // Stop watching a file descriptor which stays open, such as a kept alive
+        // connection, so that it can be added again later, possibly to another loop
+        void unwatch(uint64_t id, int fd);
+        void runAfter(int delayMs, const Task& task);
+
+        bool isInLoopThread() const;
+        size_t getRegistrationsCount() const;
+
+    private:
+        void run();
+        void runTasks();
+        void runTimers();
+        int getTimeoutMs() const;
+        void wakeUp();
+
+        int _epollFd;
+        int _eventFd;
+
+        std::thread _thread;
+        std::string _threadName;
+        std::atomic<bool> _stop;
+
+        std::mutex _tasksMutex;
+        std::vector<Task> _tasks;
+
+        uint64_t _nextId;
+        std::unordered_map<uint64_t, std::shared_ptr<OnEventCallback>> _callbacks;
+
+        std::multimap<std::chrono::steady_clock::time_point, Task> _timers;
+
+        static const int kMaxEvents;
+        static const uint64_t kWakeUpId;
+    };
+
+    using EventLoopPtr = std::shared_ptr<EventLoop>;
+
+    // A fixed set of event loops, each running in its own thread. Connections are
+    // spread over the loops in a round robin fashion.
+    class EventLoopPool
+    {
+    public:
+        EventLoopPool(size_t threads);
+        ~EventLoopPool();
+
+        bool start(const std::string& threadName, std::string& errorMsg);
+        void stop();
+
+        EventLoopPtr getNextEventLoop();
+        const std::vector<EventLoopPtr>& getEventLoops() const;
+
+    private:
+        size_t _threads;
+        std::vector<EventLoopPtr> _eventLoops;
+        std::atomic<size_t> _next;
+    };
+} // namespace ix
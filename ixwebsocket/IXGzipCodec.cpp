@@ -184,4 +184,160 @@ namespace ix
 #endif // IXWEBSOCKET_USE_DEFLATE
 #endif // IXWEBSOCKET_USE_ZLIB
     }
+
+    GzipCompressor::GzipCompressor()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        memset(&_deflateState, 0, sizeof(_deflateState));
+
+        _deflateState.zalloc = Z_NULL;
+        _deflateState.zfree = Z_NULL;
+        _deflateState.opaque = Z_NULL;
+#endif
+    }
+
+    GzipCompressor::~GzipCompressor()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        deflateEnd(&_deflateState);
+#endif
+    }
+
+    bool GzipCompressor::init()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        // Same format as gzipCompress
+        const int windowBits = 15;
+        const int GZIP_ENCODING = 16;
+
+        return deflateInit2(&_deflateState,
+                            Z_DEFAULT_COMPRESSION,
+                            Z_DEFLATED,
+                            windowBits | GZIP_ENCODING,
+                            8,
+                            Z_DEFAULT_STRATEGY) == Z_OK;
+#else
+        return false;
+#endif
+    }
+
+    bool GzipCompressor::compress(const char* data, size_t size, bool finish, std::string& out)
+    {
+#ifndef IXWEBSOCKET_USE_ZLIB
+        data;
+        size;
+        finish;
+        out;
+        return false;
+#else
+        _deflateState.avail_in = (uInt) size;
+        _deflateState.next_in = (Bytef*) data;
+
+        // Retrieve the compressed bytes blockwise
+        do
+        {
+            _deflateState.avail_out = (uInt) _compressBuffer.size();
+            _deflateState.next_out = &_compressBuffer.front();
+
+            if (deflate(&_deflateState, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR)
+            {
+                return false;
+            }
+
+            out.append(reinterpret_cast<char*>(&_compressBuffer.front()),
+                       _compressBuffer.size() - _deflateState.avail_out);
+        } while (_deflateState.avail_out == 0);
+
+        return true;
+#endif // IXWEBSOCKET_USE_ZLIB
+    }
+
+    bool GzipCompressor::reset()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        return deflateReset(&_deflateState) == Z_OK;
+#else
+        return false;
+#endif
+    }
+
+    GzipDecompressor::GzipDecompressor()
+        : _done(false)
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        memset(&_inflateState, 0, sizeof(_inflateState));
+
+        _inflateState.zalloc = Z_NULL;
+        _inflateState.zfree = Z_NULL;
+        _inflateState.opaque = Z_NULL;
+        _inflateState.avail_in = 0;
+        _inflateState.next_in = Z_NULL;
+#endif
+    }
+
+    GzipDecompressor::~GzipDecompressor()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        inflateEnd(&_inflateState);
+#endif
+    }
+
+    bool GzipDecompressor::init()
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        return inflateInit2(&_inflateState, 16 + MAX_WBITS) == Z_OK;
+#else
+        return false;
+#endif
+    }
+
+    bool GzipDecompressor::decompress(const char* data, size_t size, const OnOutput& onOutput)
+    {
+#ifndef IXWEBSOCKET_USE_ZLIB
+        data;
+        size;
+        onOutput;
+        return false;
+#else
+        _inflateState.avail_in = (uInt) size;
+        _inflateState.next_in = (unsigned char*) (const_cast<char*>(data));
+
+        do
+        {
+            // A gzip file can be made of several members, one after the other
+            if (_done && _inflateState.avail_in != 0)
+            {
+                if (inflateReset(&_inflateState) != Z_OK) return false;
+                _done = false;
+            }
+
+            _inflateState.avail_out = (uInt) _decompressBuffer.size();
+            _inflateState.next_out = &_decompressBuffer.front();
+
+            int ret = inflate(&_inflateState, Z_NO_FLUSH);
+
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR ||
+                ret == Z_STREAM_ERROR)
+            {
+                return false;
+            }
+
+            size_t outputSize = _decompressBuffer.size() - _inflateState.avail_out;
+            if (outputSize != 0 &&
+                !onOutput(reinterpret_cast<char*>(&_decompressBuffer.front()), outputSize))
+            {
+                return false;
+            }
+
+            if (ret == Z_STREAM_END) _done = true;
+        } while (_inflateState.avail_in != 0 || (_inflateState.avail_out == 0 && !_done));
+
+        return true;
+#endif // IXWEBSOCKET_USE_ZLIB
+    }
+
+    bool GzipDecompressor::isDone() const
+    {
+        return _done;
+    }
 } // namespace ix
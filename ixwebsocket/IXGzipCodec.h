@@ -6,10 +6,63 @@
 
 #pragma once
 
+#ifdef IXWEBSOCKET_USE_ZLIB
+#include "zlib.h"
+#endif
+#include <array>
+#include <functional>
 #include <string>
 
 namespace ix
 {
     std::string gzipCompress(const std::string& str);
     bool gzipDecompress(const std::string& in, std::string& out);
+
+    // Compress content piece by piece into the gzip format, so that it is never held in
+    // memory at once
+    class GzipCompressor
+    {
+    public:
+        GzipCompressor();
+        ~GzipCompressor();
+
+        bool init();
+        // Append the compressed bytes to out. With finish, the compressed content is
+        // completed, and the compressor must be reset before being used again.
+        bool compress(const char* data, size_t size, bool finish, std::string& out);
+        bool reset();
+
+    private:
+        std::array<unsigned char, 1 << 14> _compressBuffer;
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        z_stream _deflateState;
+#endif
+    };
+
+    // Decompress gzip content piece by piece, as it is received, so that it is never
+    // held in memory at once
+    class GzipDecompressor
+    {
+    public:
+        // Receives decompressed bytes, returns false to stop decompressing
+        using OnOutput = std::function<bool(const char* data, size_t size)>;
+
+        GzipDecompressor();
+        ~GzipDecompressor();
+
+        bool init();
+        // Returns false on invalid content, or if onOutput returned false
+        bool decompress(const char* data, size_t size, const OnOutput& onOutput);
+        // Whether the end of the compressed content was reached
+        bool isDone() const;
+
+    private:
+        bool _done;
+        std::array<unsigned char, 1 << 14> _decompressBuffer;
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        z_stream _inflateState;
+#endif
+    };
 } // namespace ix
@@ -7,13 +7,165 @@
 #include "IXHttp.h"
 
 #include "IXCancellationRequest.h"
-#include "IXGzipCodec.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpParser.h"
+#include "IXHttpRequestBodyReader.h"
 #include "IXSocket.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <mutex>
 #include <sstream>
 #include <vector>
 
+namespace
+{
+    // Send a response body as it is produced. Without framing, the end of the body is
+    // marked by closing the connection.
+    bool sendBody(ix::Socket& socket, const ix::HttpBodyProviderPtr& bodyProvider, bool framed)
+    {
+        // Files of known size go straight from the page cache to the socket
+        int64_t size = bodyProvider->getSize();
+        int fd = bodyProvider->getFileDescriptor();
+        if (fd >= 0 && size >= 0)
+        {
+            return socket.writeFile(
+                fd, bodyProvider->getFileOffset(), (uint64_t) size, nullptr);
+        }
+
+        if (framed)
+        {
+            ix::HttpBodyWriter bodyWriter(bodyProvider, false);
+
+            std::string data;
+            while (true)
+            {
+                if (!bodyWriter.next(data)) return false;
+                if (data.empty()) return true;
+
+                if (!socket.writeBytes(data, nullptr)) return false;
+            }
+        }
+
+        std::vector<char> buffer(ix::HttpBodyWriter::kReadSize);
+        while (true)
+        {
+            int64_t ret = bodyProvider->read(&buffer[0], buffer.size());
+            if (ret < 0 || ret > (int64_t) buffer.size()) return false;
+            if (ret == 0) return true;
+
+            if (!socket.writeBytes(std::string(&buffer[0], (size_t) ret), nullptr)) return false;
+        }
+    }
+
+    // The value of the Date header of responses, such as Sun, 06 Nov 1994 08:49:37 GMT,
+    // formatted once per second
+    std::string getHttpDate()
+    {
+        static const char* days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char* months[] = {
+            "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+        static std::mutex mutex;
+        static time_t cachedTime = 0;
+        static std::string cachedDate;
+
+        time_t now = time(nullptr);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (now != cachedTime)
+        {
+            struct tm tm;
+#ifdef _WIN32
+            gmtime_s(&tm, &now);
+#else
+            gmtime_r(&now, &tm);
+#endif
+            char buffer[32];
+            snprintf(buffer,
+                     sizeof(buffer),
+                     "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                     days[tm.tm_wday],
+                     tm.tm_mday,
+                     months[tm.tm_mon],
+                     tm.tm_year + 1900,
+                     tm.tm_hour,
+                     tm.tm_min,
+                     tm.tm_sec);
+
+            cachedDate = buffer;
+            cachedTime = now;
+        }
+        return cachedDate;
+    }
+} // namespace
+
 namespace ix
 {
+    const size_t Http::kMaxCopiedResponseBodySize(16 * 1024);
+    const size_t Http::kMaxBodyReserveSize(1024 * 1024);
+
+    bool Http::hasConnectionToken(const WebSocketHttpHeaders& headers, const std::string& token)
+    {
+        auto it = headers.find("Connection");
+        if (it == headers.end()) return false;
+
+        std::stringstream ss(it->second);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            auto begin = item.find_first_not_of(" \t");
+            auto end = item.find_last_not_of(" \t");
+            if (begin == std::string::npos) continue;
+
+            item = item.substr(begin, end - begin + 1);
+            if (item.size() == token.size() && !CaseInsensitiveLess::cmp(item, token) &&
+                !CaseInsensitiveLess::cmp(token, item))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Http::isRedirection(int statusCode)
+    {
+        return statusCode == 301 || statusCode == 302 || statusCode == 303 ||
+               statusCode == 307 || statusCode == 308;
+    }
+
+    bool Http::isBodyless(int statusCode)
+    {
+        return (statusCode >= 100 && statusCode < 200) || statusCode == 204 || statusCode == 304;
+    }
+
+    bool Http::isIdempotent(const std::string& method)
+    {
+        return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" ||
+               method == "OPTIONS";
+    }
+
+    bool Http::parseContentLength(const std::string& value, uint64_t& contentLength)
+    {
+        if (value.empty()) return false;
+
+        const uint64_t maxContentLength = (uint64_t) std::numeric_limits<int64_t>::max();
+
+        contentLength = 0;
+        for (auto c : value)
+        {
+            if (c < '0' || c > '9') return false;
+
+            uint64_t digit = (uint64_t) (c - '0');
+            if (contentLength > (maxContentLength - digit) / 10) return false;
+
+            contentLength = contentLength * 10 + digit;
+        }
+
+        return true;
+    }
+
     std::string Http::trim(const std::string& str)
     {
         std::string out;
@@ -94,120 +246,250 @@ namespace ix
     }
 
     std::tuple<bool, std::string, HttpRequestPtr> Http::parseRequest(
-        std::unique_ptr<Socket>& socket, int timeoutSecs)
+        std::unique_ptr<Socket>& socket, int timeoutSecs, bool streamBody, int* errorStatusCode)
     {
         HttpRequestPtr httpRequest;
 
+        // Malformed requests are answered with 400, until they are found to be otherwise
+        int statusCode = 400;
+        if (!errorStatusCode) errorStatusCode = &statusCode;
+        *errorStatusCode = 400;
+
         std::atomic<bool> requestInitCancellation(false);
 
         auto isCancellationRequested =
             makeCancellationRequestWithTimeout(timeoutSecs, requestInitCancellation);
 
-        // Read first line
-        auto lineResult = socket->readLine(isCancellationRequested);
-        auto lineValid = lineResult.first;
-        auto line = lineResult.second;
+        // Read the request line and the headers
+        HttpRequestHead head;
+        auto parseResult = HttpParser::readRequest(*socket, isCancellationRequested, head);
 
-        if (!lineValid)
+        if (parseResult == HttpParseResult::ReadError)
         {
-            return std::make_tuple(false, "Error reading HTTP request line", httpRequest);
+            *errorStatusCode = 0;
+            return std::make_tuple(false, "Error reading HTTP request", httpRequest);
         }
-
-        // Parse request line (GET /foo HTTP/1.1\r\n)
-        auto requestLine = Http::parseRequestLine(line);
-        auto method = std::get<0>(requestLine);
-        auto uri = std::get<1>(requestLine);
-        auto httpVersion = std::get<2>(requestLine);
-
-        // Retrieve and validate HTTP headers
-        auto result = parseHttpHeaders(socket, isCancellationRequested);
-        auto headersValid = result.first;
-        auto headers = result.second;
-
-        if (!headersValid)
+        else if (parseResult == HttpParseResult::TooLarge)
         {
-            return std::make_tuple(false, "Error parsing HTTP headers", httpRequest);
+            *errorStatusCode = 431;
+            return std::make_tuple(false, "HTTP request header too large", httpRequest);
+        }
+        else if (parseResult != HttpParseResult::Complete)
+        {
+            return std::make_tuple(false, "Error parsing HTTP request", httpRequest);
         }
 
-        std::string body;
-        if (headers.find("Content-Length") != headers.end())
+        auto method = head.method.str();
+        auto uri = head.uri.str();
+        auto httpVersion = head.version.str();
+        auto headers = HttpParser::toHttpHeaders(head.headers);
+
+        // Bodies are either delimited by a Content-Length, or chunked (-1). Both are not
+        // allowed together, nor several lengths, the body could be framed differently by a
+        // proxy (RFC 7230 3.3.3).
+        auto isContentLength = [&headers](const HttpHeaderView& header) {
+            auto name = header.name.str();
+            return !headers.key_comp()(name, "Content-Length") &&
+                   !headers.key_comp()("Content-Length", name);
+        };
+        int64_t contentLength = 0;
+        if (headers.find("Content-Length") != headers.end() &&
+            headers.find("Transfer-Encoding") != headers.end())
         {
-            int contentLength = 0;
-            try
-            {
-                contentLength = std::stoi(headers["Content-Length"]);
-            }
-            catch (const std::exception&)
+            return std::make_tuple(
+                false, "Both Content-Length and Transfer-Encoding are set", httpRequest);
+        }
+        else if (std::count_if(head.headers.begin(), head.headers.end(), isContentLength) > 1)
+        {
+            return std::make_tuple(false, "Several Content-Length headers are set", httpRequest);
+        }
+        else if (headers.find("Content-Length") != headers.end())
+        {
+            uint64_t value = 0;
+            if (!parseContentLength(headers["Content-Length"], value))
             {
                 return std::make_tuple(
                     false, "Error parsing HTTP Header 'Content-Length'", httpRequest);
             }
-
-            if (contentLength < 0)
-            {
-                return std::make_tuple(
-                    false, "Error: 'Content-Length' should be a positive integer", httpRequest);
-            }
-
-            auto res = socket->readBytes(contentLength, nullptr, isCancellationRequested);
-            if (!res.first)
-            {
-                return std::make_tuple(
-                    false, std::string("Error reading request: ") + res.second, httpRequest);
-            }
-            body = res.second;
+            contentLength = (int64_t) value;
+        }
+        else if (headers.find("Transfer-Encoding") != headers.end() &&
+                 headers["Transfer-Encoding"] == "chunked")
+        {
+            contentLength = -1;
         }
 
-        // If the content was compressed with gzip, decode it
-        if (headers["Content-Encoding"] == "gzip")
+        // If the content was compressed with gzip, it is decoded while it is read
+        auto it = headers.find("Content-Encoding");
+        bool gzip = it != headers.end() && it->second == "gzip";
+#ifndef IXWEBSOCKET_USE_ZLIB
+        if (gzip)
         {
-#ifdef IXWEBSOCKET_USE_ZLIB
-            std::string decompressedPayload;
-            if (!gzipDecompress(body, decompressedPayload))
-            {
-                return std::make_tuple(
-                    false, std::string("Error during gzip decompression of the body"), httpRequest);
-            }
-            body = decompressedPayload;
-#else
             std::string errorMsg("ixwebsocket was not compiled with gzip support on");
             return std::make_tuple(false, errorMsg, httpRequest);
+        }
 #endif
+
+        auto bodyReader =
+            std::make_shared<HttpRequestBodyReader>(*socket, contentLength, gzip, timeoutSecs);
+
+        httpRequest =
+            std::make_shared<HttpRequest>(uri, method, httpVersion, std::string(), headers);
+
+        if (streamBody)
+        {
+            httpRequest->bodyReader = bodyReader;
+        }
+        else if (!bodyReader->readAll(httpRequest->body))
+        {
+            if (!bodyReader->isInvalid()) *errorStatusCode = 0;
+            return std::make_tuple(false, bodyReader->getErrorMsg(), HttpRequestPtr());
         }
 
-        httpRequest = std::make_shared<HttpRequest>(uri, method, httpVersion, body, headers);
         return std::make_tuple(true, "", httpRequest);
     }
 
-    bool Http::sendResponse(HttpResponsePtr response, std::unique_ptr<Socket>& socket)
+    bool Http::canKeepAlive(const HttpRequestPtr& request)
     {
-        // Write the response to the socket
-        std::stringstream ss;
-        ss << "HTTP/1.1 ";
-        ss << response->statusCode;
-        ss << " ";
-        ss << response->description;
-        ss << "\r\n";
+        // Bodies with a transfer encoding other than chunked are not read, the
+        // connection cannot be reused after them
+        auto it = request->headers.find("Transfer-Encoding");
+        if (it != request->headers.end() && it->second != "chunked") return false;
+
+        // Persistent connections are the default since HTTP/1.1
+        if (request->version == "HTTP/1.0")
+        {
+            return hasConnectionToken(request->headers, "keep-alive");
+        }
+        return !hasConnectionToken(request->headers, "close");
+    }
 
-        if (!socket->writeBytes(ss.str(), nullptr))
+    std::string Http::getConnectionHeader(const HttpRequestPtr& request,
+                                          const HttpResponsePtr& response,
+                                          bool& keepAlive)
+    {
+        // HTTP/1.0 clients do not know chunked transfer encoding, the end of a
+        // response of unknown size is marked by closing the connection
+        if (request->version == "HTTP/1.0" && response->bodyProvider &&
+            response->bodyProvider->getSize() < 0)
         {
-            return false;
+            keepAlive = false;
         }
 
-        // Write headers
-        ss.str("");
-        ss << "Content-Length: " << response->body.size() << "\r\n";
+        // Responses might be shared between requests, they are not modified
+        if (response->headers.find("Connection") != response->headers.end())
+        {
+            keepAlive = keepAlive && !hasConnectionToken(response->headers, "close");
+            return std::string();
+        }
+        else if (!keepAlive)
+        {
+            return "close";
+        }
+        else if (request->version == "HTTP/1.0")
+        {
+            return "keep-alive";
+        }
+        return std::string();
+    }
+
+    std::string Http::serializeResponseHead(const HttpResponsePtr& response,
+                                            const std::string& connection,
+                                            bool chunked,
+                                            bool headOnly,
+                                            bool& bodyIncluded)
+    {
+        int64_t bodySize = (int64_t) response->body.size();
+        if (response->bodyProvider) bodySize = response->bodyProvider->getSize();
+
+        // Such as 304 Not Modified, without any framing header
+        bool bodyless = isBodyless(response->statusCode);
+        bool hasDate = response->headers.find("Date") != response->headers.end();
+        std::string date = hasDate ? std::string() : getHttpDate();
+
+        // The status line and the headers are serialized in a single buffer, sized
+        // upfront, small bodies included, so that a small response takes a single write
+        size_t headSize = 64 + response->description.size() + date.size() + connection.size();
         for (auto&& it : response->headers)
         {
-            ss << it.first << ": " << it.second << "\r\n";
+            headSize += it.first.size() + it.second.size() + 4;
         }
-        ss << "\r\n";
 
-        if (!socket->writeBytes(ss.str(), nullptr))
+        bool copyBody = !headOnly && !bodyless && !response->bodyProvider &&
+                        response->body.size() <= kMaxCopiedResponseBodySize;
+        if (copyBody) headSize += response->body.size();
+
+        std::string head;
+        head.reserve(headSize);
+        head += "HTTP/1.1 ";
+        head += std::to_string(response->statusCode);
+        head += " ";
+        head += response->description;
+        head += "\r\n";
+
+        if (!bodyless)
+        {
+            if (bodySize >= 0)
+            {
+                head += "Content-Length: ";
+                head += std::to_string(bodySize);
+                head += "\r\n";
+            }
+            else if (chunked)
+            {
+                head += "Transfer-Encoding: chunked\r\n";
+            }
+        }
+        if (!hasDate)
+        {
+            head += "Date: ";
+            head += date;
+            head += "\r\n";
+        }
+        for (auto&& it : response->headers)
+        {
+            head += it.first;
+            head += ": ";
+            head += it.second;
+            head += "\r\n";
+        }
+        if (!connection.empty())
+        {
+            head += "Connection: ";
+            head += connection;
+            head += "\r\n";
+        }
+        head += "\r\n";
+
+        // Nothing follows the head of the answer to a HEAD request
+        bodyIncluded = copyBody || headOnly;
+        if (copyBody) head += response->body;
+        return head;
+    }
+
+    bool Http::sendResponse(HttpResponsePtr response,
+                            std::unique_ptr<Socket>& socket,
+                            const std::string& connection,
+                            bool chunked,
+                            bool headOnly)
+    {
+        bool bodyIncluded = false;
+        auto head = serializeResponseHead(response, connection, chunked, headOnly, bodyIncluded);
+
+        if (bodyIncluded || isBodyless(response->statusCode))
+        {
+            return socket->writeBytes(head, nullptr);
+        }
+        else if (response->bodyProvider)
         {
-            return false;
+            bool framed = response->bodyProvider->getSize() >= 0 || chunked;
+            return socket->writeBytes(head, nullptr) &&
+                   sendBody(*socket, response->bodyProvider, framed);
         }
 
-        return response->body.empty() ? true : socket->writeBytes(response->body, nullptr);
+        // Larger bodies are not copied, they are sent along with the head with writev
+        SocketBuffer buffers[2] = {{head.data(), head.size()},
+                                   {response->body.data(), response->body.size()}};
+        return socket->writeBuffers(buffers, 2, nullptr);
     }
 } // namespace ix
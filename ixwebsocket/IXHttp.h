@@ -13,6 +13,9 @@
 
 namespace ix
 {
+    class HttpBodyProvider;
+    class HttpRequestBodyReader;
+
     enum class HttpErrorCode : int
     {
         Ok = 0,
@@ -30,6 +33,8 @@ namespace ix
         TooManyRedirects = 12,
         ChunkReadError = 13,
         CannotReadBody = 14,
+        Cancelled = 15,
+        CannotWriteFile = 16,
         Invalid = 100
     };
 
@@ -43,6 +48,10 @@ namespace ix
         std::string errorMsg;
         uint64_t uploadSize;
         uint64_t downloadSize;
+        // HttpServer only: when set, the body is read from it while it is sent, instead of
+        // from body, with chunked transfer encoding if its size is not known. Such
+        // responses cannot be shared between requests.
+        std::shared_ptr<HttpBodyProvider> bodyProvider;
 
         HttpResponse(int s = 0,
                      const std::string& des = std::string(),
@@ -70,6 +79,15 @@ namespace ix
     using HttpFormDataParameters = std::unordered_map<std::string, std::string>;
     using Logger = std::function<void(const std::string&)>;
     using OnResponseCallback = std::function<void(const HttpResponsePtr&)>;
+    // Receives a piece of a response body, returns false to abort the transfer
+    using OnChunkCallback = std::function<bool(const char* data, size_t size)>;
+    // Bytes of the request body sent so far, out of total (-1 when unknown). Returns false
+    // to abort the transfer.
+    using OnUploadProgressCallback = std::function<bool(uint64_t current, int64_t total)>;
+    // Receives the status code and headers of a response before its body, returns false to
+    // abort the transfer
+    using OnResponseHeadersCallback =
+        std::function<bool(int statusCode, const WebSocketHttpHeaders& headers)>;
 
     struct HttpRequestArgs
     {
@@ -77,9 +95,15 @@ namespace ix
         std::string verb;
         WebSocketHttpHeaders extraHeaders;
         std::string body;
+        // When set, the body is read from it while it is sent, instead of from body.
+        // compressRequest compresses it on the fly.
+        std::shared_ptr<HttpBodyProvider> bodyProvider;
         std::string multipartBoundary;
         int connectTimeout = 60;
         int transferTimeout = 1800;
+        // Async requests only: limit in seconds from performRequest to the response,
+        // waiting in the queue, redirections and retries included. 0 means no limit.
+        int requestTimeout = 0;
         bool followRedirects = true;
         int maxRedirects = 5;
         bool verbose = false;
@@ -87,6 +111,16 @@ namespace ix
         bool compressRequest = false;
         Logger logger;
         OnProgressCallback onProgressCallback;
+        // When set, the body of the response is passed to it as it is received
+        // (decompressed if needed) instead of being stored in HttpResponse::body.
+        // It is called from the thread receiving the response, the response status
+        // and headers are delivered as usual once the body is complete.
+        OnChunkCallback onChunkCallback;
+        // Called before the body of a response is read, so that onChunkCallback knows what
+        // it receives. Redirections which are followed and bodyless responses have none.
+        OnResponseHeadersCallback onResponseHeadersCallback;
+        // Called as the bodyProvider is sent
+        OnUploadProgressCallback onUploadProgressCallback;
     };
 
     using HttpRequestArgsPtr = std::shared_ptr<HttpRequestArgs>;
@@ -98,6 +132,10 @@ namespace ix
         std::string version;
         std::string body;
         WebSocketHttpHeaders headers;
+        // Set instead of body for streaming handlers, see
+        // HttpServer::setOnStreamingConnectionCallback. It can only be used until the
+        // handler returns.
+        std::shared_ptr<HttpRequestBodyReader> bodyReader;
 
         HttpRequest(const std::string& u,
                     const std::string& m,
@@ -118,13 +156,66 @@ namespace ix
     class Http
     {
     public:
+        // With streamBody, the request body is not read, and is left to the
+        // request bodyReader. On failure, errorStatusCode is set to the status to answer
+        // with: 400, or 431 for headers that are too large. It is 0 when the request
+        // could not be received, there is nothing to answer then.
         static std::tuple<bool, std::string, HttpRequestPtr> parseRequest(
-            std::unique_ptr<Socket>& socket, int timeoutSecs);
-        static bool sendResponse(HttpResponsePtr response, std::unique_ptr<Socket>& socket);
+            std::unique_ptr<Socket>& socket,
+            int timeoutSecs,
+            bool streamBody = false,
+            int* errorStatusCode = nullptr);
+        // connection is the value of a Connection header to add to the response headers,
+        // unless it is empty. Without chunked (HTTP/1.0 clients), a body provider of
+        // unknown size is sent as is, and the connection must be closed after it.
+        // A Date header is added, unless the response has one. With headOnly (answers to
+        // HEAD requests), the headers describe the body but it is not sent.
+        static bool sendResponse(HttpResponsePtr response,
+                                 std::unique_ptr<Socket>& socket,
+                                 const std::string& connection = std::string(),
+                                 bool chunked = true,
+                                 bool headOnly = false);
+        // The status line and the headers sent by sendResponse, followed by the body when
+        // it is small enough to be copied, in which case bodyIncluded is set. With
+        // headOnly, bodyIncluded is set and no body is added.
+        static std::string serializeResponseHead(const HttpResponsePtr& response,
+                                                 const std::string& connection,
+                                                 bool chunked,
+                                                 bool headOnly,
+                                                 bool& bodyIncluded);
+
+        // Whether the client asks for its connection to be kept open after the response,
+        // and the request body framing allows it
+        static bool canKeepAlive(const HttpRequestPtr& request);
+        // The value of the Connection header to add to a response (empty for none).
+        // keepAlive is cleared if the response does not allow the connection to be kept.
+        static std::string getConnectionHeader(const HttpRequestPtr& request,
+                                               const HttpResponsePtr& response,
+                                               bool& keepAlive);
+
+        // Whether a Connection header holds a token, such as close or keep-alive.
+        // It is a comma separated list, and tokens are case insensitive.
+        static bool hasConnectionToken(const WebSocketHttpHeaders& headers,
+                                       const std::string& token);
+
+        // Responses which are followed with their Location header: 301, 302, 303, 307, 308
+        static bool isRedirection(int statusCode);
+        // Responses which never have a body, whatever their headers: 1xx, 204 and 304
+        static bool isBodyless(int statusCode);
+        // GET, HEAD, PUT, DELETE and OPTIONS requests, which can be sent again when the
+        // connection is lost before their response is received
+        static bool isIdempotent(const std::string& method);
+        // A Content-Length value, made of digits only and smaller than 2^63
+        static bool parseContentLength(const std::string& value, uint64_t& contentLength);
 
         static std::pair<std::string, int> parseStatusLine(const std::string& line);
         static std::tuple<std::string, std::string, std::string> parseRequestLine(
             const std::string& line);
         static std::string trim(const std::string& str);
+
+        // Larger response bodies are sent without being copied after the headers
+        const static size_t kMaxCopiedResponseBodySize;
+        // Received bodies are reserved up to that size, larger ones grow as they arrive
+        const static size_t kMaxBodyReserveSize;
     };
 } // namespace ix
@@ -0,0 +1,597 @@
+/*
+ *  IXHttpAsyncRequest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpAsyncRequest.h"
+
+#include "IXHttpConnectionPool.h"
+#include "IXHttpParser.h"
+#include "IXUrlParser.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace ix
+{
+    const size_t HttpAsyncRequest::kReceiveSize(64 * 1024);
+
+    HttpAsyncRequest::HttpAsyncRequest(HttpRequestArgsPtr args,
+                                       const OnResponseCallback& onResponseCallback,
+                                       const EventLoopPtr& eventLoop)
+        : redirects(0)
+        , retried(false)
+        , _args(args)
+        , _onResponseCallback(onResponseCallback)
+        , _port(0)
+        , _aborted(false)
+        , _abortErrorCode(HttpErrorCode::Ok)
+        , _eventLoop(eventLoop)
+        , _registrationId(0)
+        , _reused(false)
+        , _state(State::Connecting)
+        , _sentSize(0)
+        , _uploadSize(0)
+        , _sendingBody(false)
+        , _received(false)
+        , _statusCode(0)
+        , _reusable(false)
+        , _bodyRemaining(0)
+        , _chunkSize(0)
+        , _chunkRemaining(0)
+    {
+        if (_args->requestTimeout > 0)
+        {
+            _deadline = std::chrono::steady_clock::now() +
+                        std::chrono::seconds(_args->requestTimeout);
+        }
+    }
+
+    bool HttpAsyncRequest::setUrl(const std::string& url)
+    {
+        _url = url;
+
+        std::string query;
+        if (!UrlParser::parse(url, _protocol, _host, _path, query, _port))
+        {
+            _poolKey.clear();
+            return false;
+        }
+
+        _poolKey = HttpConnectionPool::makeKey(_protocol, _host, _port);
+        return true;
+    }
+
+    const HttpRequestArgsPtr& HttpAsyncRequest::getArgs() const
+    {
+        return _args;
+    }
+
+    const OnResponseCallback& HttpAsyncRequest::getOnResponseCallback() const
+    {
+        return _onResponseCallback;
+    }
+
+    const std::string& HttpAsyncRequest::getUrl() const
+    {
+        return _url;
+    }
+
+    const std::string& HttpAsyncRequest::getProtocol() const
+    {
+        return _protocol;
+    }
+
+    const std::string& HttpAsyncRequest::getHost() const
+    {
+        return _host;
+    }
+
+    const std::string& HttpAsyncRequest::getPath() const
+    {
+        return _path;
+    }
+
+    int HttpAsyncRequest::getPort() const
+    {
+        return _port;
+    }
+
+    const std::string& HttpAsyncRequest::getPoolKey() const
+    {
+        return _poolKey;
+    }
+
+    const EventLoopPtr& HttpAsyncRequest::getEventLoop() const
+    {
+        return _eventLoop;
+    }
+
+    bool HttpAsyncRequest::isPastDeadline() const
+    {
+        return _args->requestTimeout > 0 && std::chrono::steady_clock::now() >= _deadline;
+    }
+
+    void HttpAsyncRequest::abort(HttpErrorCode errorCode, const std::string& errorMsg)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_abortMutex);
+            if (_aborted) return;
+
+            _abortErrorCode = errorCode;
+            _abortErrorMsg = errorMsg;
+            _aborted = true;
+        }
+
+        if (!_eventLoop) return;
+
+        std::weak_ptr<HttpAsyncRequest> weakThis(shared_from_this());
+        _eventLoop->post([weakThis] {
+            auto self = weakThis.lock();
+            if (self) self->onAbort();
+        });
+    }
+
+    bool HttpAsyncRequest::isAborted() const
+    {
+        return _aborted;
+    }
+
+    HttpResponsePtr HttpAsyncRequest::makeAbortedResponse()
+    {
+        std::lock_guard<std::mutex> lock(_abortMutex);
+        return std::make_shared<HttpResponse>(0,
+                                              std::string(),
+                                              _abortErrorCode,
+                                              WebSocketHttpHeaders(),
+                                              std::string(),
+                                              _abortErrorMsg);
+    }
+
+    void HttpAsyncRequest::setBodyWriter(const std::shared_ptr<HttpBodyWriter>& bodyWriter)
+    {
+        _bodyWriter = bodyWriter;
+    }
+
+    bool HttpAsyncRequest::isRetryable(const HttpResponsePtr& response) const
+    {
+        if (!_reused || _received || retried || _aborted) return false;
+
+        // The server might have processed the request before closing the connection,
+        // unless nothing was sent
+        bool nothingSent = !_sendingBody && _sentSize == 0;
+        if (!Http::isIdempotent(_args->verb) && !nothingSent) return false;
+
+        return response->errorCode == HttpErrorCode::SendError ||
+               response->errorCode == HttpErrorCode::CannotReadStatusLine;
+    }
+
+    void HttpAsyncRequest::start(std::unique_ptr<Socket> socket,
+                                 bool reused,
+                                 const std::string& data,
+                                 const std::string& errorMsg,
+                                 const OnDoneCallback& onDone)
+    {
+        _socket = std::move(socket);
+        _reused = reused;
+        _data = data;
+        _onDone = onDone;
+        _state = State::Connecting;
+
+        _sentSize = 0;
+        _uploadSize = 0;
+        _sendingBody = false;
+        _received = false;
+        _statusCode = 0;
+        _description.clear();
+        _headers.clear();
+        _body.reset();
+        _reusable = false;
+        _bodyRemaining = 0;
+        _chunkSize = 0;
+        _chunkRemaining = 0;
+
+        if (!_socket)
+        {
+            finish(HttpErrorCode::CannotConnect, errorMsg);
+            return;
+        }
+
+        if (_aborted)
+        {
+            finish(HttpErrorCode::Cancelled, std::string());
+            return;
+        }
+
+        if (_bodyWriter && !_bodyWriter->rewind())
+        {
+            finish(HttpErrorCode::SendError, "Cannot rewind the request body to send it again");
+            return;
+        }
+
+        std::weak_ptr<HttpAsyncRequest> weakThis(shared_from_this());
+
+        std::string addErrorMsg;
+        _registrationId = _eventLoop->add(
+            _socket->getFd(),
+            [weakThis](bool readable, bool writable) {
+                auto self = weakThis.lock();
+                if (self) self->onEvent(readable, writable);
+            },
+            addErrorMsg);
+
+        if (_registrationId == 0)
+        {
+            finish(HttpErrorCode::CannotConnect, addErrorMsg);
+            return;
+        }
+
+        _state = State::ReadingHead;
+        _transferDeadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(_args->transferTimeout);
+
+        onEvent(false, true);
+    }
+
+    void HttpAsyncRequest::checkTimeouts()
+    {
+        if (_state == State::Connecting || _state == State::Done) return;
+
+        if (_args->transferTimeout > 0 && std::chrono::steady_clock::now() >= _transferDeadline)
+        {
+            finish(HttpErrorCode::Timeout, "Transfer timed out");
+        }
+    }
+
+    void HttpAsyncRequest::onAbort()
+    {
+        // Connecting requests are aborted by the connect thread
+        if (_state == State::Connecting || _state == State::Done) return;
+
+        finish(HttpErrorCode::Cancelled, std::string());
+    }
+
+    void HttpAsyncRequest::onEvent(bool readable, bool writable)
+    {
+        if (_state == State::Done) return;
+
+        if (writable && !flushSend()) return;
+
+        if (readable) receive();
+    }
+
+    bool HttpAsyncRequest::flushSend()
+    {
+        while (true)
+        {
+            while (_sentSize < _data.size())
+            {
+                ssize_t ret = _socket->send(&_data[_sentSize], _data.size() - _sentSize);
+
+                if (ret > 0)
+                {
+                    _sentSize += (size_t) ret;
+                }
+                else if (ret < 0 && Socket::isWaitNeeded())
+                {
+                    return true;
+                }
+                else
+                {
+                    finish(HttpErrorCode::SendError, "Cannot send request");
+                    return false;
+                }
+            }
+
+            if (!_bodyWriter || _bodyWriter->isDone()) return true;
+
+            if (_sendingBody && _args->onUploadProgressCallback &&
+                !_args->onUploadProgressCallback(_bodyWriter->getReadSize(),
+                                                 _bodyWriter->getSize()))
+            {
+                finish(HttpErrorCode::Cancelled, "Cancelled by the upload progress callback");
+                return false;
+            }
+
+            // Read the next piece of the body once the previous one was sent
+            _uploadSize += _data.size();
+            _sentSize = 0;
+            _sendingBody = true;
+
+            if (!_bodyWriter->next(_data))
+            {
+                finish(HttpErrorCode::SendError, "Cannot read the request body");
+                return false;
+            }
+        }
+    }
+
+    void HttpAsyncRequest::receive()
+    {
+        // Parse what was received every kReceiveSize bytes, so that streamed bodies
+        // are never buffered at once
+        while (true)
+        {
+            bool wouldBlock = false;
+            bool open = _socket->fillReadBuffer(_socket->getReadBufferSize() + kReceiveSize,
+                                                wouldBlock);
+            if (_socket->getReadBufferSize() != 0) _received = true;
+
+            while (_state != State::Done && parse())
+            {
+                ;
+            }
+
+            if (_state == State::Done) return;
+
+            if (!open)
+            {
+                if (_state == State::ReadingHead)
+                {
+                    finish(HttpErrorCode::CannotReadStatusLine, "Cannot retrieve status line");
+                }
+                else
+                {
+                    finish(HttpErrorCode::ChunkReadError, "Cannot read chunk");
+                }
+                return;
+            }
+
+            // Edge triggered, wait for more only once everything available was read
+            if (wouldBlock) return;
+        }
+    }
+
+    bool HttpAsyncRequest::writeBody(const char* data, size_t size)
+    {
+        if (_body->write(data, size)) return true;
+
+        finish(_body->getErrorCode(), _body->getErrorMsg());
+        return false;
+    }
+
+    bool HttpAsyncRequest::readLine(std::string& line)
+    {
+        const char* data = _socket->getReadBufferData();
+        size_t size = _socket->getReadBufferSize();
+
+        auto end = static_cast<const char*>(memchr(data, '\n', size));
+        if (end == nullptr) return false;
+
+        line.assign(data, end + 1 - data);
+        _socket->consumeReadBuffer(line.size());
+        return true;
+    }
+
+    bool HttpAsyncRequest::parse()
+    {
+        const char* data = _socket->getReadBufferData();
+        size_t size = _socket->getReadBufferSize();
+
+        switch (_state)
+        {
+            case State::ReadingHead:
+            {
+                HttpResponseHead head;
+                size_t headSize = 0;
+                auto result = HttpParser::parseResponse(data, size, head, headSize);
+                if (result == HttpParseResult::Incomplete) return false;
+
+                // The status code is only set once the status line was parsed
+                if ((result != HttpParseResult::Complete && head.statusCode == 0) ||
+                    !(head.version == "HTTP/1.1"))
+                {
+                    finish(HttpErrorCode::MissingStatus,
+                           "Cannot parse response code from status line");
+                    return false;
+                }
+
+                _statusCode = head.statusCode;
+                _description = head.reason.str();
+
+                if (result != HttpParseResult::Complete)
+                {
+                    finish(HttpErrorCode::HeaderParsingError, "Cannot parse http headers");
+                    return false;
+                }
+
+                _headers = HttpParser::toHttpHeaders(head.headers);
+                _socket->consumeReadBuffer(headSize);
+                _reusable = !Http::hasConnectionToken(_headers, "close");
+                _body.reset(new HttpBodySink(_args, _headers));
+
+                // Redirections are followed without reading their body
+                if (Http::isRedirection(_statusCode) && _args->followRedirects)
+                {
+                    _reusable = false;
+                    complete();
+                }
+                else if (_args->verb == "HEAD" || Http::isBodyless(_statusCode))
+                {
+                    complete();
+                }
+                else if (!_body->begin(_statusCode, _headers))
+                {
+                    finish(_body->getErrorCode(), _body->getErrorMsg());
+                }
+                else if (_headers.find("Content-Length") != _headers.end())
+                {
+                    uint64_t contentLength = 0;
+                    if (!Http::parseContentLength(_headers["Content-Length"], contentLength))
+                    {
+                        finish(HttpErrorCode::HeaderParsingError, "Invalid Content-Length header");
+                        return false;
+                    }
+
+                    // The body grows past the reserved size as it is received
+                    _bodyRemaining = (size_t) contentLength;
+                    if (!_body->isStreaming())
+                    {
+                        _body->getBody().reserve(
+                            std::min(_bodyRemaining, Http::kMaxBodyReserveSize));
+                    }
+                    _state = State::ReadingBody;
+                    return true;
+                }
+                else if (_headers.find("Transfer-Encoding") != _headers.end() &&
+                         _headers["Transfer-Encoding"] == "chunked")
+                {
+                    _state = State::ReadingChunkSize;
+                    return true;
+                }
+                else
+                {
+                    finish(HttpErrorCode::CannotReadBody, "Cannot read http body");
+                }
+                return false;
+            }
+
+            case State::ReadingBody:
+            {
+                size_t length = std::min(size, _bodyRemaining);
+                if (!writeBody(data, length)) return false;
+                _socket->consumeReadBuffer(length);
+                _bodyRemaining -= length;
+
+                size_t received = (size_t) _body->getReceivedSize();
+                if (length != 0 && _args->onProgressCallback &&
+                    !_args->onProgressCallback((int) received, (int) (received + _bodyRemaining)))
+                {
+                    finish(HttpErrorCode::ChunkReadError, "Cannot read chunk");
+                    return false;
+                }
+
+                if (_bodyRemaining == 0)
+                {
+                    complete();
+                }
+                return false;
+            }
+
+            case State::ReadingChunkSize:
+            {
+                std::string line;
+                if (!readLine(line))
+                {
+                    if (size > HttpParser::kMaxHeaderLineSize)
+                    {
+                        finish(HttpErrorCode::ChunkReadError, "Cannot read chunk");
+                    }
+                    return false;
+                }
+
+                _chunkSize = std::strtoull(line.c_str(), nullptr, 16);
+                _chunkRemaining = _chunkSize;
+                _state = State::ReadingChunk;
+                return true;
+            }
+
+            case State::ReadingChunk:
+            {
+                size_t length = (size_t) std::min((uint64_t) size, _chunkRemaining);
+                if (!writeBody(data, length)) return false;
+                _socket->consumeReadBuffer(length);
+                _chunkRemaining -= length;
+
+                if (_chunkRemaining != 0) return false;
+
+                _state = State::ReadingChunkEnd;
+                return true;
+            }
+
+            case State::ReadingChunkEnd:
+            {
+                // The line which terminates the chunk (\r\n)
+                std::string line;
+                if (!readLine(line))
+                {
+                    if (size > 2)
+                    {
+                        finish(HttpErrorCode::ChunkReadError, "Cannot read chunk");
+                    }
+                    return false;
+                }
+
+                if (_chunkSize == 0)
+                {
+                    complete();
+                    return false;
+                }
+
+                _state = State::ReadingChunkSize;
+                return true;
+            }
+
+            case State::Connecting:
+            case State::Done: return false;
+        }
+
+        return false;
+    }
+
+    void HttpAsyncRequest::complete()
+    {
+        // The server answered before the whole request was sent
+        if (_sentSize != _data.size() || (_bodyWriter && !_bodyWriter->isDone()))
+        {
+            _reusable = false;
+        }
+
+        if (!_body->end())
+        {
+            finish(_body->getErrorCode(), _body->getErrorMsg());
+            return;
+        }
+
+        finish(HttpErrorCode::Ok, std::string());
+    }
+
+    void HttpAsyncRequest::finish(HttpErrorCode errorCode, const std::string& errorMsg)
+    {
+        if (_state == State::Done) return;
+        _state = State::Done;
+
+        std::string message(errorMsg);
+        if (errorCode != HttpErrorCode::Ok && _aborted)
+        {
+            std::lock_guard<std::mutex> lock(_abortMutex);
+            errorCode = _abortErrorCode;
+            message = _abortErrorMsg;
+        }
+
+        if (_registrationId != 0)
+        {
+            _eventLoop->unwatch(_registrationId, _socket->getFd());
+            _registrationId = 0;
+        }
+
+        std::string body;
+        uint64_t downloadSize = 0;
+        if (_body)
+        {
+            body = std::move(_body->getBody());
+            downloadSize = _body->getReceivedSize();
+            _body.reset();
+        }
+
+        auto response = std::make_shared<HttpResponse>(_statusCode,
+                                                       _description,
+                                                       errorCode,
+                                                       _headers,
+                                                       body,
+                                                       message,
+                                                       _uploadSize + _sentSize,
+                                                       downloadSize);
+
+        std::unique_ptr<Socket> socket;
+        if (errorCode == HttpErrorCode::Ok && _reusable)
+        {
+            socket = std::move(_socket);
+        }
+        _socket.reset();
+
+        auto onDone = _onDone;
+        onDone(shared_from_this(), response, std::move(socket));
+    }
+} // namespace ix
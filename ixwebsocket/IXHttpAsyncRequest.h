@@ -0,0 +1,160 @@
+/*
+ *  IXHttpAsyncRequest.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  A request made with HttpClient::performRequest, from the moment it is queued
+ *  until its response is delivered. Once a connection is available, the request
+ *  is sent and its response is received from an event loop thread, without
+ *  blocking, so that a single thread can have many requests in flight.
+ */
+
+#pragma once
+
+#include "IXEventLoop.h"
+#include "IXHttp.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpBodySink.h"
+#include "IXSocket.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ix
+{
+    class HttpAsyncRequest : public std::enable_shared_from_this<HttpAsyncRequest>
+    {
+    public:
+        // Called once on the event loop thread. socket is the connection when it can be
+        // used by another request, nullptr otherwise.
+        using OnDoneCallback = std::function<void(const std::shared_ptr<HttpAsyncRequest>&,
+                                                  const HttpResponsePtr& response,
+                                                  std::unique_ptr<Socket> socket)>;
+
+        // Without an event loop, the request is performed synchronously by the client
+        HttpAsyncRequest(HttpRequestArgsPtr args,
+                         const OnResponseCallback& onResponseCallback,
+                         const EventLoopPtr& eventLoop);
+
+        // Target of the request, which changes when following redirections.
+        // Returns false if the url cannot be parsed.
+        bool setUrl(const std::string& url);
+
+        const HttpRequestArgsPtr& getArgs() const;
+        const OnResponseCallback& getOnResponseCallback() const;
+        const std::string& getUrl() const;
+        const std::string& getProtocol() const;
+        const std::string& getHost() const;
+        const std::string& getPath() const;
+        int getPort() const;
+        // Identifies the host in the connection pool, empty if the url is malformed
+        const std::string& getPoolKey() const;
+        const EventLoopPtr& getEventLoop() const;
+
+        // Past the requestTimeout of its arguments
+        bool isPastDeadline() const;
+
+        // Thread safe. The request fails with that error as soon as possible, unless
+        // its response was already received.
+        void abort(HttpErrorCode errorCode, const std::string& errorMsg);
+        bool isAborted() const;
+        HttpResponsePtr makeAbortedResponse();
+
+        // Streamed body, sent after the data given to start. Set before start.
+        void setBodyWriter(const std::shared_ptr<HttpBodyWriter>& bodyWriter);
+
+        // Event loop thread. The request is sent on socket, once connected. A nullptr
+        // socket means that connecting failed with errorMsg.
+        void start(std::unique_ptr<Socket> socket,
+                   bool reused,
+                   const std::string& data,
+                   const std::string& errorMsg,
+                   const OnDoneCallback& onDone);
+
+        // Event loop thread. Fail the request if it is past its transfer timeout.
+        void checkTimeouts();
+
+        // True when the request was sent on a kept alive connection which turned out to be
+        // closed, before any byte of the response was received. It can be sent again if
+        // it is idempotent, or if none of it was sent.
+        bool isRetryable(const HttpResponsePtr& response) const;
+
+        // Set by the client
+        int redirects;
+        bool retried;
+
+    private:
+        enum class State
+        {
+            Connecting,
+            ReadingHead,
+            ReadingBody,
+            ReadingChunkSize,
+            ReadingChunk,
+            ReadingChunkEnd,
+            Done
+        };
+
+        void onEvent(bool readable, bool writable);
+        void onAbort();
+        bool flushSend();
+        void receive();
+        // Returns true when progress was made, and parsing should go on
+        bool parse();
+        bool readLine(std::string& line);
+        // Finishes the request when the body sink stops the transfer
+        bool writeBody(const char* data, size_t size);
+        void complete();
+        void finish(HttpErrorCode errorCode, const std::string& errorMsg);
+
+        HttpRequestArgsPtr _args;
+        OnResponseCallback _onResponseCallback;
+
+        std::string _url;
+        std::string _protocol;
+        std::string _host;
+        std::string _path;
+        int _port;
+        std::string _poolKey;
+        std::chrono::steady_clock::time_point _deadline;
+
+        std::atomic<bool> _aborted;
+        std::mutex _abortMutex;
+        HttpErrorCode _abortErrorCode;
+        std::string _abortErrorMsg;
+
+        EventLoopPtr _eventLoop;
+
+        // Event loop thread only, below
+        uint64_t _registrationId;
+        std::unique_ptr<Socket> _socket;
+        bool _reused;
+        OnDoneCallback _onDone;
+        State _state;
+        std::chrono::steady_clock::time_point _transferDeadline;
+
+        // The request headers, then the pieces of the streamed body
+        std::string _data;
+        size_t _sentSize;
+        uint64_t _uploadSize;
+        std::shared_ptr<HttpBodyWriter> _bodyWriter;
+        bool _sendingBody;
+        bool _received;
+
+        int _statusCode;
+        std::string _description;
+        WebSocketHttpHeaders _headers;
+        std::unique_ptr<HttpBodySink> _body;
+        bool _reusable;
+        size_t _bodyRemaining;
+        uint64_t _chunkSize;
+        uint64_t _chunkRemaining;
+
+        // Received bytes are parsed by pieces of that size
+        const static size_t kReceiveSize;
+    };
+
+    using HttpAsyncRequestPtr = std::shared_ptr<HttpAsyncRequest>;
+} // namespace ix
@@ -0,0 +1,487 @@
+/*
+ *  IXHttpBodyProvider.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpBodyProvider.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+    class StringBodyProvider : public ix::HttpBodyProvider
+    {
+    public:
+        StringBodyProvider(const std::string& body)
+            : _body(body)
+            , _offset(0)
+        {
+            ;
+        }
+
+        int64_t getSize() const final
+        {
+            return (int64_t) _body.size();
+        }
+
+        int64_t read(char* buffer, size_t size) final
+        {
+            size_t length = std::min(size, _body.size() - _offset);
+            memcpy(buffer, _body.data() + _offset, length);
+            _offset += length;
+            return (int64_t) length;
+        }
+
+        bool rewind() final
+        {
+            _offset = 0;
+            return true;
+        }
+
+    private:
+        std::string _body;
+        size_t _offset;
+    };
+
+    // Files larger than 2GB need 64 bits offsets
+    bool seekFile(FILE* file, int64_t offset, int origin)
+    {
+#ifdef _WIN32
+        return _fseeki64(file, offset, origin) == 0;
+#else
+        return fseeko(file, (off_t) offset, origin) == 0;
+#endif
+    }
+
+    int64_t tellFile(FILE* file)
+    {
+#ifdef _WIN32
+        return _ftelli64(file);
+#else
+        return (int64_t) ftello(file);
+#endif
+    }
+
+    class FileBodyProvider : public ix::HttpBodyProvider
+    {
+    public:
+        FileBodyProvider(FILE* file, uint64_t offset, int64_t size)
+            : _file(file)
+            , _offset(offset)
+            , _size(size)
+            , _readSize(0)
+        {
+            ;
+        }
+
+        ~FileBodyProvider()
+        {
+            fclose(_file);
+        }
+
+        int64_t getSize() const final
+        {
+            return _size;
+        }
+
+        int64_t read(char* buffer, size_t size) final
+        {
+            // A range stops before the end of the file
+            if (_size >= 0)
+            {
+                size = (size_t) std::min((uint64_t) size, (uint64_t) _size - _readSize);
+                if (size == 0) return 0;
+            }
+
+            size_t length = fread(buffer, 1, size, _file);
+            if (length == 0 && ferror(_file)) return -1;
+
+            _readSize += length;
+            return (int64_t) length;
+        }
+
+        bool rewind() final
+        {
+            _readSize = 0;
+            return seekFile(_file, (int64_t) _offset, SEEK_SET);
+        }
+
+        int getFileDescriptor() const final
+        {
+            return fileno(_file);
+        }
+
+        uint64_t getFileOffset() const final
+        {
+            return _offset;
+        }
+
+    private:
+        FILE* _file;
+        uint64_t _offset;
+        int64_t _size;
+        uint64_t _readSize;
+    };
+
+    class CallbackBodyProvider : public ix::HttpBodyProvider
+    {
+    public:
+        CallbackBodyProvider(const ReadCallback& callback, int64_t size)
+            : _callback(callback)
+            , _size(size)
+            , _started(false)
+        {
+            ;
+        }
+
+        int64_t getSize() const final
+        {
+            return _size;
+        }
+
+        int64_t read(char* buffer, size_t size) final
+        {
+            _started = true;
+            return _callback(buffer, size);
+        }
+
+        bool rewind() final
+        {
+            return !_started;
+        }
+
+    private:
+        ReadCallback _callback;
+        int64_t _size;
+        bool _started;
+    };
+
+    class PartsBodyProvider : public ix::HttpBodyProvider
+    {
+    public:
+        PartsBodyProvider(const std::vector<ix::HttpBodyProviderPtr>& parts)
+            : _parts(parts)
+            , _current(0)
+        {
+            ;
+        }
+
+        int64_t getSize() const final
+        {
+            int64_t size = 0;
+            for (auto&& part : _parts)
+            {
+                int64_t partSize = part->getSize();
+                if (partSize < 0) return -1;
+                size += partSize;
+            }
+            return size;
+        }
+
+        int64_t read(char* buffer, size_t size) final
+        {
+            while (_current < _parts.size())
+            {
+                int64_t ret = _parts[_current]->read(buffer, size);
+                if (ret != 0) return ret;
+
+                _current++;
+            }
+            return 0;
+        }
+
+        bool rewind() final
+        {
+            for (auto&& part : _parts)
+            {
+                if (!part->rewind()) return false;
+            }
+
+            _current = 0;
+            return true;
+        }
+
+    private:
+        std::vector<ix::HttpBodyProviderPtr> _parts;
+        size_t _current;
+    };
+} // namespace
+
+namespace ix
+{
+    const size_t HttpBodyWriter::kReadSize(64 * 1024);
+
+    std::string HttpBodyProvider::getContentType() const
+    {
+        return std::string();
+    }
+
+    int HttpBodyProvider::getFileDescriptor() const
+    {
+        return -1;
+    }
+
+    uint64_t HttpBodyProvider::getFileOffset() const
+    {
+        return 0;
+    }
+
+    HttpBodyProviderPtr HttpBodyProvider::fromString(const std::string& body)
+    {
+        return std::make_shared<StringBodyProvider>(body);
+    }
+
+    HttpBodyProviderPtr HttpBodyProvider::fromFile(const std::string& path,
+                                                   uint64_t offset,
+                                                   int64_t length)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr) return nullptr;
+
+        // Files which cannot be seeked (pipes) are sent with chunked transfer encoding
+        int64_t size = -1;
+        if (seekFile(file, 0, SEEK_END))
+        {
+            size = tellFile(file);
+            if (size < 0 || !seekFile(file, (int64_t) offset, SEEK_SET)) size = -1;
+        }
+
+        if (size >= 0)
+        {
+            if (offset > (uint64_t) size ||
+                (length >= 0 && (uint64_t) length > (uint64_t) size - offset))
+            {
+                fclose(file);
+                return nullptr;
+            }
+            size = (length >= 0) ? length : size - (int64_t) offset;
+        }
+        else if (offset != 0)
+        {
+            fclose(file);
+            return nullptr;
+        }
+        else
+        {
+            size = length;
+        }
+
+        return std::make_shared<FileBodyProvider>(file, offset, size);
+    }
+
+    HttpBodyProviderPtr HttpBodyProvider::fromCallback(const ReadCallback& callback,
+                                                       int64_t size)
+    {
+        return std::make_shared<CallbackBodyProvider>(callback, size);
+    }
+
+    HttpBodyProviderPtr HttpBodyProvider::fromParts(const std::vector<HttpBodyProviderPtr>& parts)
+    {
+        return std::make_shared<PartsBodyProvider>(parts);
+    }
+
+    //
+    // Multipart
+    //
+    HttpMultipartBodyProvider::HttpMultipartBodyProvider(const std::string& boundary)
+        : _boundary(boundary)
+        , _closingBoundary(fromString("--" + boundary + "--\r\n"))
+        , _current(0)
+    {
+        ;
+    }
+
+    void HttpMultipartBodyProvider::addPart(const std::string& header,
+                                            const HttpBodyProviderPtr& content)
+    {
+        _segments.push_back(fromString(header));
+        _segments.push_back(content);
+        _segments.push_back(fromString("\r\n"));
+    }
+
+    void HttpMultipartBodyProvider::addField(const std::string& name, const std::string& value)
+    {
+        // Same layout as HttpClient::serializeHttpFormDataParameters
+        std::stringstream ss;
+        ss << "--" << _boundary << "\r\n"
+           << "Content-Disposition:"
+           << " form-data; name=\"" << name << "\";"
+           << "\r\n"
+           << "\r\n";
+
+        addPart(ss.str(), fromString(value));
+    }
+
+    void HttpMultipartBodyProvider::addFile(const std::string& name,
+                                            const std::string& filename,
+                                            const HttpBodyProviderPtr& content,
+                                            const std::string& contentType)
+    {
+        std::stringstream ss;
+        ss << "--" << _boundary << "\r\n"
+           << "Content-Disposition:"
+           << " form-data; name=\"" << name << "\";"
+           << " filename=\"" << filename << "\""
+           << "\r\n"
+           << "Content-Type: " << contentType << "\r\n"
+           << "\r\n";
+
+        addPart(ss.str(), content);
+    }
+
+    int64_t HttpMultipartBodyProvider::getSize() const
+    {
+        int64_t size = _closingBoundary->getSize();
+        for (auto&& segment : _segments)
+        {
+            int64_t segmentSize = segment->getSize();
+            if (segmentSize < 0) return -1;
+            size += segmentSize;
+        }
+        return size;
+    }
+
+    int64_t HttpMultipartBodyProvider::read(char* buffer, size_t size)
+    {
+        while (_current < _segments.size())
+        {
+            int64_t ret = _segments[_current]->read(buffer, size);
+            if (ret != 0) return ret;
+
+            _current++;
+        }
+
+        return _closingBoundary->read(buffer, size);
+    }
+
+    bool HttpMultipartBodyProvider::rewind()
+    {
+        for (auto&& segment : _segments)
+        {
+            if (!segment->rewind()) return false;
+        }
+
+        _current = 0;
+        return _closingBoundary->rewind();
+    }
+
+    std::string HttpMultipartBodyProvider::getContentType() const
+    {
+        return "multipart/form-data; boundary=" + _boundary;
+    }
+
+    //
+    // Writer
+    //
+    HttpBodyWriter::HttpBodyWriter(const HttpBodyProviderPtr& provider, bool compress)
+        : _provider(provider)
+        , _size(provider->getSize())
+        , _buffer(kReadSize)
+        , _readSize(0)
+        , _done(false)
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        if (compress)
+        {
+            _compressor.reset(new GzipCompressor());
+            if (!_compressor->init()) _compressor.reset();
+        }
+#else
+        (void) compress;
+#endif
+
+        // The compressed size is only known at the end
+        _chunked = _size < 0 || _compressor != nullptr;
+    }
+
+    bool HttpBodyWriter::isChunked() const
+    {
+        return _chunked;
+    }
+
+    int64_t HttpBodyWriter::getSize() const
+    {
+        return _size;
+    }
+
+    bool HttpBodyWriter::rewind()
+    {
+        // The provider might have been sent already by a previous request
+        if (!_provider->rewind()) return false;
+        if (_compressor && !_compressor->reset()) return false;
+
+        _readSize = 0;
+        _done = false;
+        return true;
+    }
+
+    bool HttpBodyWriter::next(std::string& data)
+    {
+        data.clear();
+
+        // Compression can take several reads to produce anything
+        while (!_done && data.empty())
+        {
+            size_t size = _buffer.size();
+            if (_size >= 0)
+            {
+                size = (size_t) std::min((uint64_t) size, (uint64_t) _size - _readSize);
+            }
+
+            int64_t ret = (size == 0) ? 0 : _provider->read(&_buffer[0], size);
+            if (ret < 0 || ret > (int64_t) size) return false;
+
+            _readSize += (uint64_t) ret;
+            _done = (ret == 0);
+
+            // The body is shorter than announced
+            if (_done && _size >= 0 && _readSize != (uint64_t) _size) return false;
+
+            if (!_chunked)
+            {
+                data.assign(&_buffer[0], (size_t) ret);
+                continue;
+            }
+
+            std::string payload;
+            if (_compressor)
+            {
+                if (!_compressor->compress(&_buffer[0], (size_t) ret, _done, payload))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                payload.assign(&_buffer[0], (size_t) ret);
+            }
+
+            if (!payload.empty())
+            {
+                std::stringstream ss;
+                ss << std::hex << payload.size() << "\r\n";
+                data = ss.str();
+                data += payload;
+                data += "\r\n";
+            }
+
+            if (_done) data += "0\r\n\r\n";
+        }
+
+        return true;
+    }
+
+    bool HttpBodyWriter::isDone() const
+    {
+        return _done;
+    }
+
+    uint64_t HttpBodyWriter::getReadSize() const
+    {
+        return _readSize;
+    }
+} // namespace ix
@@ -0,0 +1,127 @@
+/*
+ *  IXHttpBodyProvider.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Request bodies which are read piece by piece while they are sent, instead of
+ *  being held in memory at once: from a file, from a callback, or a multipart form
+ *  made of such parts.
+ */
+
+#pragma once
+
+#include "IXGzipCodec.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ix
+{
+    class HttpBodyProvider
+    {
+    public:
+        // Same contract as read
+        using ReadCallback = std::function<int64_t(char* buffer, size_t size)>;
+
+        virtual ~HttpBodyProvider() = default;
+
+        // Size of the body in bytes, or -1 when it is not known in advance. The body is
+        // then sent with chunked transfer encoding.
+        virtual int64_t getSize() const = 0;
+
+        // Copy the next bytes of the body to buffer, up to size. Returns the number of
+        // bytes copied, 0 once the whole body was read, or -1 on error.
+        virtual int64_t read(char* buffer, size_t size) = 0;
+
+        // Go back to the start of the body, before it is sent again (redirection, or
+        // retry on a new connection). Returns false if that is not possible.
+        virtual bool rewind() = 0;
+
+        // Default Content-Type header of the request
+        virtual std::string getContentType() const;
+
+        // For bodies read from a file, its descriptor, so that they can be sent with
+        // sendfile from getFileOffset. -1 otherwise.
+        virtual int getFileDescriptor() const;
+        virtual uint64_t getFileOffset() const;
+
+        static std::shared_ptr<HttpBodyProvider> fromString(const std::string& body);
+        // length bytes of a file from offset, up to its end by default. Returns nullptr if
+        // the file cannot be opened, or does not have that many bytes.
+        static std::shared_ptr<HttpBodyProvider> fromFile(const std::string& path,
+                                                          uint64_t offset = 0,
+                                                          int64_t length = -1);
+        // A body produced by a callback cannot be rewound once it was read
+        static std::shared_ptr<HttpBodyProvider> fromCallback(const ReadCallback& callback,
+                                                              int64_t size = -1);
+        // The bodies of parts, one after the other
+        static std::shared_ptr<HttpBodyProvider> fromParts(
+            const std::vector<std::shared_ptr<HttpBodyProvider>>& parts);
+    };
+
+    using HttpBodyProviderPtr = std::shared_ptr<HttpBodyProvider>;
+
+    // A multipart/form-data body, which streams the content of its file parts
+    class HttpMultipartBodyProvider : public HttpBodyProvider
+    {
+    public:
+        HttpMultipartBodyProvider(const std::string& boundary);
+
+        void addField(const std::string& name, const std::string& value);
+        void addFile(const std::string& name,
+                     const std::string& filename,
+                     const HttpBodyProviderPtr& content,
+                     const std::string& contentType = "application/octet-stream");
+
+        int64_t getSize() const final;
+        int64_t read(char* buffer, size_t size) final;
+        bool rewind() final;
+        std::string getContentType() const final;
+
+    private:
+        void addPart(const std::string& header, const HttpBodyProviderPtr& content);
+
+        std::string _boundary;
+        // Part headers, part contents and separators, the closing boundary last
+        std::vector<HttpBodyProviderPtr> _segments;
+        HttpBodyProviderPtr _closingBoundary;
+        size_t _current;
+    };
+
+    // Turns a body provider into the bytes sent after the request headers: compressed
+    // on the fly with compress, and framed with chunked transfer encoding unless its
+    // size is known in advance.
+    class HttpBodyWriter
+    {
+    public:
+        HttpBodyWriter(const HttpBodyProviderPtr& provider, bool compress);
+
+        bool isChunked() const;
+        // Size of the uncompressed body, -1 if unknown
+        int64_t getSize() const;
+
+        // Start (again) from the beginning of the body
+        bool rewind();
+
+        // Set data to the next bytes to send, empty once the whole body was produced.
+        // Returns false if the body cannot be read or does not match its size.
+        bool next(std::string& data);
+        bool isDone() const;
+
+        // Uncompressed bytes read from the provider so far
+        uint64_t getReadSize() const;
+
+        const static size_t kReadSize;
+
+    private:
+        HttpBodyProviderPtr _provider;
+        std::unique_ptr<GzipCompressor> _compressor;
+        bool _chunked;
+        int64_t _size;
+        std::vector<char> _buffer;
+        uint64_t _readSize;
+        bool _done;
+    };
+} // namespace ix
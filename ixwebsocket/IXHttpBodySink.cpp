@@ -0,0 +1,145 @@
+/*
+ *  IXHttpBodySink.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpBodySink.h"
+
+namespace
+{
+    const std::string kGzipError("Error decompressing payload");
+#ifndef IXWEBSOCKET_USE_ZLIB
+    const std::string kNoGzipSupportError("ixwebsocket was not compiled with gzip support on");
+#endif
+} // namespace
+
+namespace ix
+{
+    HttpBodySink::HttpBodySink(const HttpRequestArgsPtr& args,
+                               const WebSocketHttpHeaders& headers)
+        : _onChunkCallback(args->onChunkCallback)
+        , _onResponseHeadersCallback(args->onResponseHeadersCallback)
+        , _gzip(false)
+        , _receivedSize(0)
+        , _errorCode(HttpErrorCode::Ok)
+    {
+        auto it = headers.find("Content-Encoding");
+        _gzip = it != headers.end() && it->second == "gzip";
+
+        if (_gzip && _onChunkCallback)
+        {
+            _decompressor.reset(new GzipDecompressor());
+            if (!_decompressor->init()) _decompressor.reset();
+        }
+    }
+
+    bool HttpBodySink::begin(int statusCode, const WebSocketHttpHeaders& headers)
+    {
+        if (!_onResponseHeadersCallback || _onResponseHeadersCallback(statusCode, headers))
+        {
+            return true;
+        }
+        return fail(HttpErrorCode::Cancelled, "Cancelled by the response headers callback");
+    }
+
+    bool HttpBodySink::write(const char* data, size_t size)
+    {
+        if (_errorCode != HttpErrorCode::Ok) return false;
+        if (size == 0) return true;
+
+        _receivedSize += size;
+
+        if (!_onChunkCallback)
+        {
+            _body.append(data, size);
+            return true;
+        }
+
+        if (!_gzip)
+        {
+            if (_onChunkCallback(data, size)) return true;
+            return fail(HttpErrorCode::Cancelled, "Cancelled by the chunk callback");
+        }
+
+        if (!_decompressor)
+        {
+#ifdef IXWEBSOCKET_USE_ZLIB
+            return fail(HttpErrorCode::Gzip, kGzipError);
+#else
+            return fail(HttpErrorCode::Gzip, kNoGzipSupportError);
+#endif
+        }
+
+        bool cancelled = false;
+        bool success = _decompressor->decompress(
+            data, size, [this, &cancelled](const char* output, size_t outputSize) {
+                cancelled = !_onChunkCallback(output, outputSize);
+                return !cancelled;
+            });
+
+        if (cancelled) return fail(HttpErrorCode::Cancelled, "Cancelled by the chunk callback");
+        if (!success) return fail(HttpErrorCode::Gzip, kGzipError);
+        return true;
+    }
+
+    bool HttpBodySink::end()
+    {
+        if (_errorCode != HttpErrorCode::Ok) return false;
+        if (!_gzip) return true;
+
+        if (_onChunkCallback)
+        {
+            // The compressed content was cut short
+            if (_receivedSize != 0 && !_decompressor->isDone())
+            {
+                return fail(HttpErrorCode::Gzip, kGzipError);
+            }
+            return true;
+        }
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        std::string decompressedPayload;
+        if (!gzipDecompress(_body, decompressedPayload))
+        {
+            return fail(HttpErrorCode::Gzip, kGzipError);
+        }
+        _body = std::move(decompressedPayload);
+        return true;
+#else
+        return fail(HttpErrorCode::Gzip, kNoGzipSupportError);
+#endif
+    }
+
+    bool HttpBodySink::fail(HttpErrorCode errorCode, const std::string& errorMsg)
+    {
+        _errorCode = errorCode;
+        _errorMsg = errorMsg;
+        return false;
+    }
+
+    bool HttpBodySink::isStreaming() const
+    {
+        return (bool) _onChunkCallback;
+    }
+
+    std::string& HttpBodySink::getBody()
+    {
+        return _body;
+    }
+
+    uint64_t HttpBodySink::getReceivedSize() const
+    {
+        return _receivedSize;
+    }
+
+    HttpErrorCode HttpBodySink::getErrorCode() const
+    {
+        return _errorCode;
+    }
+
+    const std::string& HttpBodySink::getErrorMsg() const
+    {
+        return _errorMsg;
+    }
+} // namespace ix
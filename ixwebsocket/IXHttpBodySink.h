@@ -0,0 +1,58 @@
+/*
+ *  IXHttpBodySink.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Where the body of a response goes while it is received. It is either kept in
+ *  memory for HttpResponse::body, or passed to the onChunkCallback of the request,
+ *  decompressed on the fly when it is gzip encoded, so that large downloads use
+ *  a constant amount of memory.
+ */
+
+#pragma once
+
+#include "IXGzipCodec.h"
+#include "IXHttp.h"
+#include <memory>
+#include <string>
+
+namespace ix
+{
+    class HttpBodySink
+    {
+    public:
+        HttpBodySink(const HttpRequestArgsPtr& args, const WebSocketHttpHeaders& headers);
+
+        // Before the body is written, with the response status and headers. Returns false
+        // when the response headers callback aborted the transfer.
+        bool begin(int statusCode, const WebSocketHttpHeaders& headers);
+
+        // Returns false when the transfer should stop, because the content cannot be
+        // decoded or the chunk callback asked for it
+        bool write(const char* data, size_t size);
+        // Once the whole body was written. Returns false if it cannot be decoded.
+        bool end();
+
+        bool isStreaming() const;
+        // In memory bodies only, decoded once end was called
+        std::string& getBody();
+        // Bytes written, before decompression
+        uint64_t getReceivedSize() const;
+
+        HttpErrorCode getErrorCode() const;
+        const std::string& getErrorMsg() const;
+
+    private:
+        bool fail(HttpErrorCode errorCode, const std::string& errorMsg);
+
+        OnChunkCallback _onChunkCallback;
+        OnResponseHeadersCallback _onResponseHeadersCallback;
+        bool _gzip;
+        std::unique_ptr<GzipDecompressor> _decompressor;
+        std::string _body;
+        uint64_t _receivedSize;
+
+        HttpErrorCode _errorCode;
+        std::string _errorMsg;
+    };
+} // namespace ix
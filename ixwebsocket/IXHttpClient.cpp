@@ -7,18 +7,415 @@
 #include "IXHttpClient.h"
 
 #include "IXGzipCodec.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpBodySink.h"
+#include "IXHttpParser.h"
 #include "IXSocketFactory.h"
 #include "IXUrlParser.h"
 #include "IXUserAgent.h"
+#include "IXWebSocketClientLoop.h"
 #include "IXWebSocketHttpHeaders.h"
+#include <algorithm>
 #include <assert.h>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iomanip>
 #include <random>
 #include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <vector>
 #include <regex>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // A connection reserved in the pool for one request, given back when it goes out of
+    // scope. Only connections marked as reusable are kept open for the next requests.
+    class PooledConnection
+    {
+    public:
+        PooledConnection(ix::HttpConnectionPool& pool, const std::string& key)
+            : reusable(false)
+            , _pool(pool)
+            , _key(key)
+            , _acquired(false)
+        {
+            ;
+        }
+
+        ~PooledConnection()
+        {
+            release();
+        }
+
+        bool acquire(const ix::CancellationRequest& isCancellationRequested)
+        {
+            _acquired = _pool.acquire(_key, isCancellationRequested, socket);
+            return _acquired;
+        }
+
+        void release()
+        {
+            if (!_acquired) return;
+
+            _acquired = false;
+            _pool.release(_key, reusable ? std::move(socket) : nullptr);
+            socket.reset();
+            reusable = false;
+        }
+
+        std::unique_ptr<ix::Socket> socket;
+        bool reusable;
+
+    private:
+        ix::HttpConnectionPool& _pool;
+        std::string _key;
+        bool _acquired;
+    };
+
+    // Read length bytes of a body into the sink. Streamed bodies go through the socket
+    // read buffer, which stays small.
+    bool readBody(ix::Socket& socket,
+                  size_t length,
+                  ix::HttpBodySink& sink,
+                  const ix::HttpRequestArgsPtr& args,
+                  const ix::CancellationRequest& isCancellationRequested)
+    {
+        if (!sink.isStreaming())
+        {
+            // The length comes from the server, the body grows past the reserved size
+            sink.getBody().reserve(sink.getBody().size() +
+                                   std::min(length, ix::Http::kMaxBodyReserveSize));
+
+            auto chunkResult =
+                socket.readBytes(length, args->onProgressCallback, isCancellationRequested);
+            if (!chunkResult.first) return false;
+
+            return sink.write(chunkResult.second.data(), chunkResult.second.size());
+        }
+
+        size_t received = 0;
+        while (received != length)
+        {
+            if (socket.getReadBufferSize() == 0 &&
+                !socket.recvIntoReadBuffer(isCancellationRequested))
+            {
+                return false;
+            }
+
+            size_t size = std::min(socket.getReadBufferSize(), length - received);
+            if (!sink.write(socket.getReadBufferData(), size)) return false;
+
+            socket.consumeReadBuffer(size);
+            received += size;
+
+            if (args->onProgressCallback) args->onProgressCallback((int) received, (int) length);
+        }
+
+        return true;
+    }
+
+    // Send a streamed request body, after the request headers
+    std::pair<ix::HttpErrorCode, std::string> sendBody(
+        ix::Socket& socket,
+        ix::HttpBodyWriter& bodyWriter,
+        const ix::HttpRequestArgsPtr& args,
+        const ix::CancellationRequest& isCancellationRequested,
+        uint64_t& uploadSize)
+    {
+        std::string data;
+        while (true)
+        {
+            if (!bodyWriter.next(data))
+            {
+                return std::make_pair(ix::HttpErrorCode::SendError,
+                                      std::string("Cannot read the request body"));
+            }
+
+            if (data.empty()) break;
+
+            if (!socket.writeBytes(data, isCancellationRequested))
+            {
+                return std::make_pair(ix::HttpErrorCode::SendError,
+                                      std::string("Cannot send request"));
+            }
+            uploadSize += data.size();
+
+            if (args->onUploadProgressCallback &&
+                !args->onUploadProgressCallback(bodyWriter.getReadSize(), bodyWriter.getSize()))
+            {
+                return std::make_pair(ix::HttpErrorCode::Cancelled,
+                                      std::string("Cancelled by the upload progress callback"));
+            }
+        }
+
+        return std::make_pair(ix::HttpErrorCode::Ok, std::string());
+    }
+
+    ix::HttpResponsePtr makeBodyErrorResponse(int code,
+                                              const std::string& description,
+                                              const ix::WebSocketHttpHeaders& headers,
+                                              ix::HttpBodySink& sink,
+                                              uint64_t uploadSize)
+    {
+        // Either the chunk callback or the decoding of the body stopped the transfer,
+        // or the body could not be read
+        bool sinkError = sink.getErrorCode() != ix::HttpErrorCode::Ok;
+
+        return std::make_shared<ix::HttpResponse>(
+            code,
+            description,
+            sinkError ? sink.getErrorCode() : ix::HttpErrorCode::ChunkReadError,
+            headers,
+            sink.getBody(),
+            sinkError ? sink.getErrorMsg() : "Cannot read chunk",
+            uploadSize,
+            sink.getReceivedSize());
+    }
+
+    // -1 if the file does not exist
+    int64_t getFileSize(const std::string& path)
+    {
+#ifdef _WIN32
+        struct _stat64 st;
+        if (_stat64(path.c_str(), &st) != 0) return -1;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return -1;
+#endif
+        return (int64_t) st.st_size;
+    }
+
+    bool truncateFile(const std::string& path, uint64_t size)
+    {
+#ifdef _WIN32
+        int fd = _open(path.c_str(), _O_WRONLY | _O_BINARY);
+        if (fd < 0) return false;
+
+        bool success = _chsize_s(fd, (__int64) size) == 0;
+        _close(fd);
+        return success;
+#else
+        return truncate(path.c_str(), (off_t) size) == 0;
+#endif
+    }
+
+    // Writes a download at its offset in the output file. Each range of a parallel
+    // download has its own writer.
+    class DownloadFileWriter
+    {
+    public:
+        DownloadFileWriter()
+            : _file(nullptr)
+        {
+            ;
+        }
+
+        ~DownloadFileWriter()
+        {
+            close();
+        }
+
+        bool open(const std::string& path, uint64_t offset, bool truncate)
+        {
+            _file = fopen(path.c_str(), truncate ? "wb" : "r+b");
+            if (_file == nullptr) return false;
+
+#ifdef _WIN32
+            return _fseeki64(_file, (__int64) offset, SEEK_SET) == 0;
+#else
+            return fseeko(_file, (off_t) offset, SEEK_SET) == 0;
+#endif
+        }
+
+        bool isOpen() const
+        {
+            return _file != nullptr;
+        }
+
+        bool write(const char* data, size_t size)
+        {
+            return fwrite(data, 1, size, _file) == size;
+        }
+
+        bool close()
+        {
+            if (_file == nullptr) return true;
+
+            bool success = fclose(_file) == 0;
+            _file = nullptr;
+            return success;
+        }
+
+    private:
+        FILE* _file;
+    };
+
+    // Content-Range: bytes first-last/size, or bytes */size in 416 responses. The size is
+    // * when it is not known, -1 is returned then.
+    bool parseContentRange(const ix::WebSocketHttpHeaders& headers,
+                           uint64_t& first,
+                           uint64_t& last,
+                           int64_t& size)
+    {
+        auto it = headers.find("Content-Range");
+        if (it == headers.end() || it->second.compare(0, 6, "bytes ") != 0) return false;
+
+        const std::string& value = it->second;
+        auto slash = value.find('/');
+        if (slash == std::string::npos) return false;
+
+        char* end = nullptr;
+        std::string sizeValue = value.substr(slash + 1);
+        size = (sizeValue == "*") ? -1 : (int64_t) std::strtoull(sizeValue.c_str(), &end, 10);
+        if (sizeValue != "*" && (sizeValue.empty() || *end != '\0')) return false;
+
+        std::string rangeValue = value.substr(6, slash - 6);
+        if (rangeValue == "*") return true;
+
+        auto dash = rangeValue.find('-');
+        if (dash == std::string::npos || dash == 0) return false;
+
+        first = std::strtoull(rangeValue.c_str(), &end, 10);
+        if (end != rangeValue.c_str() + dash) return false;
+        last = std::strtoull(rangeValue.c_str() + dash + 1, &end, 10);
+        if (*end != '\0' || last < first) return false;
+
+        return size < 0 || last < (uint64_t) size;
+    }
+
+    // A range of a download, received by one request
+    struct DownloadRange
+    {
+        DownloadRange(uint64_t f, int64_t l)
+            : first(f)
+            , last(l)
+            , offset(f)
+            , written(0)
+            , size(-1)
+        {
+            ;
+        }
+
+        // Requested bytes, up to the end of the file when last is -1
+        uint64_t first;
+        int64_t last;
+        // Where the body was written: first, or 0 when the server sent the whole file
+        uint64_t offset;
+        uint64_t written;
+        // Size of the whole file given by the response, -1 when unknown
+        int64_t size;
+    };
+
+    // Receive a range of url into the file at the same offset. Only 206 responses for the
+    // requested range, and 200 responses with acceptWholeFile, are written to the file.
+    ix::HttpResponsePtr downloadRange(ix::HttpClient& httpClient,
+                                      const std::string& url,
+                                      const std::string& filePath,
+                                      const ix::HttpRequestArgsPtr& args,
+                                      DownloadRange& range,
+                                      bool acceptWholeFile)
+    {
+        auto rangeArgs = std::make_shared<ix::HttpRequestArgs>(*args);
+        if (range.first != 0 || range.last >= 0)
+        {
+            std::stringstream ss;
+            ss << "bytes=" << range.first << "-";
+            if (range.last >= 0) ss << range.last;
+            rangeArgs->extraHeaders["Range"] = ss.str();
+        }
+
+        DownloadFileWriter writer;
+        uint64_t expected = 0;
+        ix::HttpErrorCode errorCode = ix::HttpErrorCode::Ok;
+        std::string errorMsg;
+
+        rangeArgs->onResponseHeadersCallback =
+            [&](int statusCode, const ix::WebSocketHttpHeaders& headers) -> bool {
+            if (statusCode == 200)
+            {
+                if (!acceptWholeFile)
+                {
+                    errorCode = ix::HttpErrorCode::CannotReadBody;
+                    errorMsg = "The server sent the whole file instead of a range";
+                    return false;
+                }
+
+                range.offset = 0;
+                expected = 0;
+                if (writer.open(filePath, 0, true)) return true;
+
+                errorCode = ix::HttpErrorCode::CannotWriteFile;
+                errorMsg = "Cannot open " + filePath + " for writing";
+                return false;
+            }
+
+            // Error bodies are read but not written
+            if (statusCode != 206) return true;
+
+            uint64_t first = 0;
+            uint64_t last = 0;
+            if (!parseContentRange(headers, first, last, range.size) || first != range.first ||
+                (range.last >= 0 && last > (uint64_t) range.last) ||
+                headers.find("Content-Encoding") != headers.end())
+            {
+                errorCode = ix::HttpErrorCode::CannotReadBody;
+                errorMsg = "Unexpected Content-Range in the response to a range request";
+                return false;
+            }
+
+            expected = last - first + 1;
+            if (writer.open(filePath, first, false)) return true;
+
+            errorCode = ix::HttpErrorCode::CannotWriteFile;
+            errorMsg = "Cannot open " + filePath + " for writing";
+            return false;
+        };
+
+        rangeArgs->onChunkCallback = [&](const char* data, size_t size) -> bool {
+            if (!writer.isOpen()) return true;
+
+            if (!writer.write(data, size))
+            {
+                errorCode = ix::HttpErrorCode::CannotWriteFile;
+                errorMsg = "Cannot write to " + filePath;
+                return false;
+            }
+            range.written += size;
+            return true;
+        };
+
+        auto response = httpClient.get(url, rangeArgs);
+
+        if (!writer.close() && errorCode == ix::HttpErrorCode::Ok)
+        {
+            errorCode = ix::HttpErrorCode::CannotWriteFile;
+            errorMsg = "Cannot write to " + filePath;
+        }
+        else if (response->errorCode == ix::HttpErrorCode::Ok && response->statusCode == 206 &&
+                 range.written != expected)
+        {
+            errorCode = ix::HttpErrorCode::CannotReadBody;
+            errorMsg = "The body does not match its Content-Range";
+        }
+
+        if (errorCode != ix::HttpErrorCode::Ok)
+        {
+            response->errorCode = errorCode;
+            response->errorMsg = errorMsg;
+        }
+        return response;
+    }
+} // namespace
+
 namespace ix
 {
     // https://developer.mozilla.org/en-US/docs/Web/HTTP/Methods
@@ -29,21 +426,42 @@ namespace ix
     const std::string HttpClient::kPut = "PUT";
     const std::string HttpClient::kPatch = "PATCH";
 
+    const size_t HttpClient::kDefaultMaxInFlightRequests(64);
+    const uint64_t HttpClient::kMinDownloadPartSize(1024 * 1024);
+    const int HttpClient::kDispatchRetryDelayMs(10);
+    const int HttpClient::kTimeoutsCheckIntervalMs(100);
+
     HttpClient::HttpClient(bool async)
         : _async(async)
         , _stop(false)
+        , _maxInFlightRequests(kDefaultMaxInFlightRequests)
+        , _dispatchScheduled(false)
+        , _timeoutsCheckScheduled(false)
         , _forceBody(false)
     {
         if (!_async) return;
 
+        // A single event loop thread is enough to keep many requests in flight
+        std::unique_ptr<WebSocketClientLoop> clientLoop(new WebSocketClientLoop(1));
+        std::string errorMsg;
+        if (clientLoop->start(errorMsg))
+        {
+            _clientLoop = std::move(clientLoop);
+            return;
+        }
+
         _thread = std::thread(&HttpClient::run, this);
     }
 
     HttpClient::~HttpClient()
     {
+        _stop = true;
+
+        // Connect threads are stopped first, then the event loop and its requests
+        _clientLoop.reset();
+
         if (!_thread.joinable()) return;
 
-        _stop = true;
         _condition.notify_one();
         _thread.join();
     }
@@ -51,6 +469,19 @@ namespace ix
     void HttpClient::setTLSOptions(const SocketTLSOptions& tlsOptions)
     {
         _tlsOptions = tlsOptions;
+
+        // Connections made with the previous options should not be reused
+        _connectionPool.clear();
+    }
+
+    void HttpClient::setMaxConnectionsPerHost(size_t maxConnectionsPerHost)
+    {
+        _connectionPool.setMaxConnectionsPerHost(maxConnectionsPerHost);
+    }
+
+    void HttpClient::setIdleConnectionTimeoutSecs(int idleConnectionTimeoutSecs)
+    {
+        _connectionPool.setIdleTimeoutSecs(idleConnectionTimeoutSecs);
     }
 
     void HttpClient::setForceBody(bool value)
@@ -66,6 +497,12 @@ namespace ix
         return request;
     }
 
+    void HttpClient::setMaxInFlightRequests(size_t maxInFlightRequests)
+    {
+        _maxInFlightRequests = (maxInFlightRequests == 0) ? 1 : maxInFlightRequests;
+        if (_clientLoop) dispatchAsyncRequests();
+    }
+
     bool HttpClient::performRequest(HttpRequestArgsPtr args,
                                     const OnResponseCallback& onResponseCallback)
     {
@@ -73,27 +510,334 @@ namespace ix
                          "in order to call performRequest");
         if (!_async) return false;
 
+        EventLoopPtr eventLoop = _clientLoop ? _clientLoop->getNextEventLoop() : nullptr;
+        auto request = std::make_shared<HttpAsyncRequest>(args, onResponseCallback, eventLoop);
+
+        if (!request->setUrl(args->url) && eventLoop)
+        {
+            std::stringstream ss;
+            ss << "Cannot parse url: " << args->url;
+            auto response = std::make_shared<HttpResponse>(
+                0, std::string(), HttpErrorCode::UrlMalformed, WebSocketHttpHeaders(),
+                std::string(), ss.str());
+            eventLoop->post([onResponseCallback, response] { onResponseCallback(response); });
+            return true;
+        }
+
         // Enqueue the task
         {
             // acquire lock
             std::unique_lock<std::mutex> lock(_queueMutex);
 
             // add the task
-            _queue.push(std::make_pair(args, onResponseCallback));
+            _queue.push_back(request);
         } // release lock
 
-        // wake up one thread
-        _condition.notify_one();
+        if (!eventLoop)
+        {
+            // wake up one thread
+            _condition.notify_one();
+            return true;
+        }
 
+        scheduleTimeoutsCheck();
+        dispatchAsyncRequests();
         return true;
     }
 
+    void HttpClient::scheduleTimeoutsCheck()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            if (_timeoutsCheckScheduled) return;
+            _timeoutsCheckScheduled = true;
+        }
+
+        auto eventLoop = _clientLoop->getNextEventLoop();
+        eventLoop->post([this, eventLoop] {
+            eventLoop->runAfter(kTimeoutsCheckIntervalMs, [this] { checkTimeouts(); });
+        });
+    }
+
+    void HttpClient::checkTimeouts()
+    {
+        std::vector<HttpAsyncRequestPtr> requests;
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            _timeoutsCheckScheduled = false;
+
+            requests.insert(requests.end(), _queue.begin(), _queue.end());
+            requests.insert(requests.end(), _inFlightRequests.begin(), _inFlightRequests.end());
+        }
+
+        if (requests.empty()) return;
+
+        for (auto&& request : requests)
+        {
+            if (request->isPastDeadline())
+            {
+                abortAsyncRequest(request, HttpErrorCode::Timeout, "Request timed out");
+            }
+            else
+            {
+                // All the requests run on the same event loop as this check
+                request->checkTimeouts();
+            }
+        }
+
+        scheduleTimeoutsCheck();
+    }
+
+    bool HttpClient::cancelRequest(HttpRequestArgsPtr args)
+    {
+        HttpAsyncRequestPtr request;
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+
+            for (auto&& it : _queue)
+            {
+                if (it->getArgs() == args) request = it;
+            }
+            for (auto&& it : _inFlightRequests)
+            {
+                if (it->getArgs() == args) request = it;
+            }
+        }
+
+        if (!request) return false;
+
+        abortAsyncRequest(request, HttpErrorCode::Cancelled, "Request cancelled");
+        return true;
+    }
+
+    void HttpClient::abortAsyncRequest(const HttpAsyncRequestPtr& request,
+                                       HttpErrorCode errorCode,
+                                       const std::string& errorMsg)
+    {
+        // Requests in flight are aborted from their event loop, and queued requests are
+        // skipped by the background thread when there is no event loop
+        request->abort(errorCode, errorMsg);
+
+        auto eventLoop = request->getEventLoop();
+        if (!eventLoop) return;
+
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+
+            auto it = std::find(_queue.begin(), _queue.end(), request);
+            if (it == _queue.end()) return;
+            _queue.erase(it);
+        }
+
+        auto response = request->makeAbortedResponse();
+        eventLoop->post([this, request, response] {
+            if (!_stop) request->getOnResponseCallback()(response);
+        });
+    }
+
+    void HttpClient::dispatchAsyncRequests()
+    {
+        std::vector<std::pair<HttpAsyncRequestPtr, std::unique_ptr<Socket>>> ready;
+        bool scheduleDispatch = false;
+
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+
+            // Requests to a host which is at its connection limit do not hold back the
+            // requests to other hosts
+            auto it = _queue.begin();
+            while (it != _queue.end() && _inFlightRequests.size() < _maxInFlightRequests)
+            {
+                std::unique_ptr<Socket> socket;
+                if (!_connectionPool.tryAcquire((*it)->getPoolKey(), socket))
+                {
+                    ++it;
+                    continue;
+                }
+
+                _inFlightRequests.insert(*it);
+                ready.push_back(std::make_pair(*it, std::move(socket)));
+                it = _queue.erase(it);
+            }
+
+            // Dispatching is attempted again when a request completes. If none is in flight,
+            // the connections are used by synchronous requests, try again later.
+            if (!_queue.empty() && _inFlightRequests.empty() && !_dispatchScheduled)
+            {
+                _dispatchScheduled = true;
+                scheduleDispatch = true;
+            }
+        }
+
+        for (auto&& it : ready)
+        {
+            startAsyncRequest(it.first, std::move(it.second));
+        }
+
+        if (scheduleDispatch)
+        {
+            auto eventLoop = _clientLoop->getNextEventLoop();
+            eventLoop->post([this, eventLoop] {
+                eventLoop->runAfter(kDispatchRetryDelayMs, [this] {
+                    {
+                        std::lock_guard<std::mutex> lock(_queueMutex);
+                        _dispatchScheduled = false;
+                    }
+                    dispatchAsyncRequests();
+                });
+            });
+        }
+    }
+
+    void HttpClient::startAsyncRequest(const HttpAsyncRequestPtr& request,
+                                       std::unique_ptr<Socket> socket)
+    {
+        auto args = request->getArgs();
+        auto bodyWriter = makeBodyWriter(args->verb, args);
+        std::string data(buildRequest(args->verb,
+                                      request->getHost(),
+                                      request->getPath(),
+                                      args->body,
+                                      args,
+                                      bodyWriter.get()));
+
+        if (args->verbose)
+        {
+            std::stringstream ss;
+            ss << "Sending " << args->verb << " request "
+               << "to " << request->getHost() << ":" << request->getPort()
+               << (socket ? " on a kept alive connection" : "") << std::endl
+               << "request size: " << data.size() << " bytes" << std::endl
+               << "=============" << std::endl
+               << data << "=============" << std::endl
+               << std::endl;
+
+            log(ss.str(), args);
+        }
+
+        auto onDone = [this](const HttpAsyncRequestPtr& request,
+                             const HttpResponsePtr& response,
+                             std::unique_ptr<Socket> socket) {
+            onAsyncRequestDone(request, response, std::move(socket));
+        };
+        request->setBodyWriter(bodyWriter);
+
+        // Tasks are copied, the socket is moved through a shared holder
+        auto eventLoop = request->getEventLoop();
+        bool reused = socket != nullptr;
+        auto holder = std::make_shared<std::unique_ptr<Socket>>(std::move(socket));
+
+        if (reused)
+        {
+            eventLoop->post([request, holder, data, onDone] {
+                request->start(std::move(*holder), true, data, std::string(), onDone);
+            });
+            return;
+        }
+
+        // Connecting blocks (DNS lookup, TCP and TLS handshakes)
+        _clientLoop->runConnect([this, request, holder, data, onDone, eventLoop] {
+            auto args = request->getArgs();
+            bool tls = request->getProtocol() == "https";
+
+            std::string errorMsg;
+            auto socket = createSocket(tls, -1, errorMsg, _tlsOptions);
+
+            if (socket)
+            {
+                auto isTimedOut = makeCancellationRequestWithTimeout(args->connectTimeout, _stop);
+                auto isCancellationRequested = [&request, &isTimedOut]() -> bool {
+                    return request->isAborted() || isTimedOut();
+                };
+
+                std::string connectErrorMsg;
+                if (!socket->connect(request->getHost(),
+                                     request->getPort(),
+                                     connectErrorMsg,
+                                     isCancellationRequested))
+                {
+                    std::stringstream ss;
+                    ss << "Cannot connect to url: " << request->getUrl()
+                       << " / error : " << connectErrorMsg;
+                    errorMsg = ss.str();
+                    socket.reset();
+                }
+            }
+
+            *holder = std::move(socket);
+            eventLoop->post([request, holder, data, errorMsg, onDone] {
+                request->start(std::move(*holder), false, data, errorMsg, onDone);
+            });
+        });
+    }
+
+    void HttpClient::onAsyncRequestDone(const HttpAsyncRequestPtr& request,
+                                        HttpResponsePtr response,
+                                        std::unique_ptr<Socket> socket)
+    {
+        _connectionPool.release(request->getPoolKey(), std::move(socket));
+
+        bool requeue = false;
+        auto args = request->getArgs();
+        int code = response->statusCode;
+
+        if (request->isRetryable(response))
+        {
+            // The kept alive connection was closed by the server, send the request again
+            request->retried = true;
+            requeue = true;
+        }
+        else if (response->errorCode == HttpErrorCode::Ok && Http::isRedirection(code) &&
+                 args->followRedirects)
+        {
+            auto& headers = response->headers;
+            std::stringstream ss;
+
+            if (headers.find("Location") == headers.end())
+            {
+                response->errorCode = HttpErrorCode::MissingLocation;
+                response->errorMsg = "Missing location header for redirect";
+            }
+            else if (request->redirects >= args->maxRedirects)
+            {
+                ss << "Too many redirects: " << request->redirects;
+                response->errorCode = HttpErrorCode::TooManyRedirects;
+                response->errorMsg = ss.str();
+            }
+            else if (!request->setUrl(headers["Location"]))
+            {
+                ss << "Cannot parse url: " << headers["Location"];
+                response->errorCode = HttpErrorCode::UrlMalformed;
+                response->errorMsg = ss.str();
+            }
+            else
+            {
+                request->redirects++;
+                requeue = true;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_queueMutex);
+            _inFlightRequests.erase(request);
+
+            // Ahead of the requests which were queued after it
+            if (requeue) _queue.push_front(request);
+        }
+
+        if (!requeue)
+        {
+            if (!_stop) request->getOnResponseCallback()(response);
+        }
+
+        if (!_stop) dispatchAsyncRequests();
+    }
+
     void HttpClient::run()
     {
         while (true)
         {
-            HttpRequestArgsPtr args;
-            OnResponseCallback onResponseCallback;
+            HttpAsyncRequestPtr request;
 
             {
                 std::unique_lock<std::mutex> lock(_queueMutex);
@@ -105,17 +849,31 @@ namespace ix
 
                 if (_stop) return;
 
-                auto p = _queue.front();
-                _queue.pop();
-
-                args = p.first;
-                onResponseCallback = p.second;
+                request = _queue.front();
+                _queue.pop_front();
             }
 
             if (_stop) return;
 
-            HttpResponsePtr response = request(args->url, args->verb, args->body, args);
-            onResponseCallback(response);
+            auto args = request->getArgs();
+            HttpResponsePtr response;
+
+            if (request->isAborted())
+            {
+                response = request->makeAbortedResponse();
+            }
+            else if (request->isPastDeadline())
+            {
+                response = std::make_shared<HttpResponse>(
+                    0, std::string(), HttpErrorCode::Timeout, WebSocketHttpHeaders(),
+                    std::string(), "Request timed out");
+            }
+            else
+            {
+                response = this->request(args->url, args->verb, args->body, args);
+            }
+
+            request->getOnResponseCallback()(response);
 
             if (_stop) return;
         }
@@ -127,10 +885,6 @@ namespace ix
                                         HttpRequestArgsPtr args,
                                         int redirects)
     {
-        // We only have one socket connection, so we cannot
-        // make multiple requests concurrently.
-        std::lock_guard<std::recursive_mutex> lock(_mutex);
-
         uint64_t uploadSize = 0;
         uint64_t downloadSize = 0;
         int code = 0;
@@ -157,131 +911,168 @@ namespace ix
 
         bool tls = protocol == "https";
         std::string errorMsg;
-        _socket = createSocket(tls, -1, errorMsg, _tlsOptions);
 
-        if (!_socket)
-        {
-            return std::make_shared<HttpResponse>(code,
-                                                  description,
-                                                  HttpErrorCode::CannotCreateSocket,
-                                                  headers,
-                                                  payload,
-                                                  errorMsg,
-                                                  uploadSize,
-                                                  downloadSize);
-        }
-
-        // Build request string
-        std::stringstream ss;
-        ss << verb << " " << path << " HTTP/1.1\r\n";
-        ss << "Host: " << host << "\r\n";
-
-#ifdef IXWEBSOCKET_USE_ZLIB
-        if (args->compress)
-        {
-            ss << "Accept-Encoding: gzip"
-               << "\r\n";
-        }
-#endif
-
-        // Append extra headers
-        for (auto&& it : args->extraHeaders)
-        {
-            ss << it.first << ": " << it.second << "\r\n";
-        }
+        auto bodyWriter = makeBodyWriter(verb, args);
+        std::string req(buildRequest(verb, host, path, body, args, bodyWriter.get()));
 
-        // Set a default Accept header if none is present
-        if (args->extraHeaders.find("Accept") == args->extraHeaders.end())
-        {
-            ss << "Accept: */*"
-               << "\r\n";
-        }
+        PooledConnection connection(_connectionPool,
+                                    HttpConnectionPool::makeKey(protocol, host, port));
+        CancellationRequest isCancellationRequested;
+        HttpResponseHead head;
+        HttpParseResult parseResult = HttpParseResult::Invalid;
 
-        // Set a default User agent if none is present
-        if (args->extraHeaders.find("User-Agent") == args->extraHeaders.end())
+        // A kept alive connection can be closed by the server right when the request is
+        // sent on it. The request is then sent again, once, on a new connection.
+        for (int attempt = 0;; ++attempt)
         {
-            ss << "User-Agent: " << userAgent() << "\r\n";
-        }
+            // Make a cancellation object dealing with connection timeout
+            isCancellationRequested =
+                makeCancellationRequestWithTimeout(args->connectTimeout, _stop);
 
-        if (verb == kPost || verb == kPut || verb == kPatch || _forceBody)
-        {
-            // Set request compression header
-#ifdef IXWEBSOCKET_USE_ZLIB
-            if (args->compressRequest)
+            if (!connection.acquire(isCancellationRequested))
             {
-                ss << "Content-Encoding: gzip"
-                   << "\r\n";
+                std::stringstream ss2;
+                ss2 << "Cannot connect to url: " << url
+                    << " / error : Timed out waiting for a connection to the host";
+                return std::make_shared<HttpResponse>(code,
+                                                      description,
+                                                      HttpErrorCode::CannotConnect,
+                                                      headers,
+                                                      payload,
+                                                      ss2.str(),
+                                                      uploadSize,
+                                                      downloadSize);
             }
-#endif
-
-            ss << "Content-Length: " << body.size() << "\r\n";
 
-            // Set default Content-Type if unspecified
-            if (args->extraHeaders.find("Content-Type") == args->extraHeaders.end())
+            bool reused = connection.socket != nullptr;
+            if (!reused)
             {
-                if (args->multipartBoundary.empty())
+                connection.socket = createSocket(tls, -1, errorMsg, _tlsOptions);
+
+                if (!connection.socket)
                 {
-                    ss << "Content-Type: application/x-www-form-urlencoded"
-                       << "\r\n";
+                    return std::make_shared<HttpResponse>(code,
+                                                          description,
+                                                          HttpErrorCode::CannotCreateSocket,
+                                                          headers,
+                                                          payload,
+                                                          errorMsg,
+                                                          uploadSize,
+                                                          downloadSize);
                 }
-                else
+
+                std::string errMsg2;
+                bool success =
+                    connection.socket->connect(host, port, errMsg2, isCancellationRequested);
+                if (!success)
                 {
-                    ss << "Content-Type: multipart/form-data; boundary=" << args->multipartBoundary
-                       << "\r\n";
+                    std::stringstream ss2;
+                    ss2 << "Cannot connect to url: " << url << " / error : " << errMsg2;
+                    return std::make_shared<HttpResponse>(code,
+                                                          description,
+                                                          HttpErrorCode::CannotConnect,
+                                                          headers,
+                                                          payload,
+                                                          ss2.str(),
+                                                          uploadSize,
+                                                          downloadSize);
                 }
             }
-            ss << "\r\n";
-            ss << body;
-        }
-        else
-        {
-            ss << "\r\n";
-        }
 
-        std::string req(ss.str());
-        std::string errMsg2;
+            // Make a new cancellation object dealing with transfer timeout
+            isCancellationRequested =
+                makeCancellationRequestWithTimeout(args->transferTimeout, _stop);
+
+            if (args->verbose)
+            {
+                std::stringstream ss2;
+                ss2 << "Sending " << verb << " request "
+                    << "to " << host << ":" << port
+                    << (reused ? " on a kept alive connection" : "") << std::endl
+                    << "request size: " << req.size() << " bytes" << std::endl
+                    << "=============" << std::endl
+                    << req << "=============" << std::endl
+                    << std::endl;
+
+                log(ss2.str(), args);
+            }
+
+            // The server might have processed a request before closing the connection, only
+            // the ones which can be processed twice are sent again once they were written
+            bool retry = reused && attempt == 0;
+            bool idempotent = Http::isIdempotent(verb);
+
+            if (bodyWriter && !bodyWriter->rewind())
+            {
+                std::string errorMsg2("Cannot rewind the request body to send it again");
+                return std::make_shared<HttpResponse>(code,
+                                                      description,
+                                                      HttpErrorCode::SendError,
+                                                      headers,
+                                                      payload,
+                                                      errorMsg2,
+                                                      uploadSize,
+                                                      downloadSize);
+            }
+
+            HttpErrorCode sendErrorCode = HttpErrorCode::Ok;
+            std::string sendErrorMsg;
+            uploadSize = 0;
+            size_t sentSize = 0;
 
-        // Make a cancellation object dealing with connection timeout
-        auto isCancellationRequested =
-            makeCancellationRequestWithTimeout(args->connectTimeout, _stop);
+            if (!connection.socket->writeBytes(req, isCancellationRequested, &sentSize))
+            {
+                sendErrorCode = HttpErrorCode::SendError;
+                sendErrorMsg = "Cannot send request";
+            }
+            else
+            {
+                uploadSize = req.size();
+                if (bodyWriter)
+                {
+                    std::tie(sendErrorCode, sendErrorMsg) = sendBody(
+                        *connection.socket, *bodyWriter, args, isCancellationRequested, uploadSize);
+                }
+            }
 
-        bool success = _socket->connect(host, port, errMsg2, isCancellationRequested);
-        if (!success)
-        {
-            std::stringstream ss2;
-            ss2 << "Cannot connect to url: " << url << " / error : " << errMsg2;
-            return std::make_shared<HttpResponse>(code,
-                                                  description,
-                                                  HttpErrorCode::CannotConnect,
-                                                  headers,
-                                                  payload,
-                                                  ss2.str(),
-                                                  uploadSize,
-                                                  downloadSize);
-        }
+            if (sendErrorCode != HttpErrorCode::Ok)
+            {
+                if (retry && sendErrorCode == HttpErrorCode::SendError &&
+                    (idempotent || sentSize == 0))
+                {
+                    connection.release();
+                    continue;
+                }
 
-        // Make a new cancellation object dealing with transfer timeout
-        isCancellationRequested = makeCancellationRequestWithTimeout(args->transferTimeout, _stop);
+                return std::make_shared<HttpResponse>(code,
+                                                      description,
+                                                      sendErrorCode,
+                                                      headers,
+                                                      payload,
+                                                      sendErrorMsg,
+                                                      uploadSize,
+                                                      downloadSize);
+            }
 
-        if (args->verbose)
-        {
-            std::stringstream ss2;
-            ss2 << "Sending " << verb << " request "
-               << "to " << host << ":" << port << std::endl
-               << "request size: " << req.size() << " bytes" << std::endl
-               << "=============" << std::endl
-               << req << "=============" << std::endl
-               << std::endl;
+            // Read the status line and the headers
+            parseResult =
+                HttpParser::readResponse(*connection.socket, isCancellationRequested, head);
 
-            log(ss2.str(), args);
+            if (parseResult == HttpParseResult::ReadError && retry && idempotent &&
+                connection.socket->getReadBufferSize() == 0)
+            {
+                connection.release();
+                continue;
+            }
+            break;
         }
 
-        if (!_socket->writeBytes(req, isCancellationRequested))
+        if (parseResult == HttpParseResult::ReadError)
         {
-            std::string errorMsg2("Cannot send request");
+            std::string errorMsg2("Cannot retrieve status line");
             return std::make_shared<HttpResponse>(code,
                                                   description,
-                                                  HttpErrorCode::SendError,
+                                                  HttpErrorCode::CannotReadStatusLine,
                                                   headers,
                                                   payload,
                                                   errorMsg2,
@@ -289,18 +1080,14 @@ namespace ix
                                                   downloadSize);
         }
 
-        uploadSize = req.size();
-
-        auto lineResult = _socket->readLine(isCancellationRequested);
-        auto lineValid = lineResult.first;
-        auto line = lineResult.second;
-
-        if (!lineValid)
+        // The status code is only set once the status line was parsed
+        if ((parseResult != HttpParseResult::Complete && head.statusCode == 0) ||
+            !(head.version == "HTTP/1.1"))
         {
-            std::string errorMsg2("Cannot retrieve status line");
+            std::string errorMsg2("Cannot parse response code from status line");
             return std::make_shared<HttpResponse>(code,
                                                   description,
-                                                  HttpErrorCode::CannotReadStatusLine,
+                                                  HttpErrorCode::MissingStatus,
                                                   headers,
                                                   payload,
                                                   errorMsg2,
@@ -308,31 +1095,17 @@ namespace ix
                                                   downloadSize);
         }
 
+        code = head.statusCode;
+        description = head.reason.str();
+
         if (args->verbose)
         {
             std::stringstream ss2;
-            ss2 << "Status line " << line;
+            ss2 << "Status line " << head.version.str() << " " << code << " " << description;
             log(ss2.str(), args);
         }
 
-        if (sscanf(line.c_str(), "HTTP/1.1 %d", &code) != 1)
-        {
-            std::string errorMsg2("Cannot parse response code from status line");
-            return std::make_shared<HttpResponse>(code,
-                                                  description,
-                                                  HttpErrorCode::MissingStatus,
-                                                  headers,
-                                                  payload,
-                                                  errorMsg2,
-                                                  uploadSize,
-                                                  downloadSize);
-        }
-
-        auto result = parseHttpHeaders(_socket, isCancellationRequested);
-        auto headersValid = result.first;
-        headers = result.second;
-
-        if (!headersValid)
+        if (parseResult != HttpParseResult::Complete)
         {
             std::string errorMsg2("Cannot parse http headers");
             return std::make_shared<HttpResponse>(code,
@@ -345,8 +1118,10 @@ namespace ix
                                                   downloadSize);
         }
 
+        headers = HttpParser::toHttpHeaders(head.headers);
+
         // Redirect ?
-        if ((code >= 301 && code <= 308) && args->followRedirects)
+        if (Http::isRedirection(code) && args->followRedirects)
         {
             if (headers.find("Location") == headers.end())
             {
@@ -375,13 +1150,15 @@ namespace ix
                                                       downloadSize);
             }
 
-            // Recurse
+            // Recurse, the redirection might need a connection to the same host
+            connection.release();
             std::string location = headers["Location"];
             return request(location, verb, body, args, redirects + 1);
         }
 
-        if (verb == "HEAD")
+        if (verb == "HEAD" || Http::isBodyless(code))
         {
+            connection.reusable = !Http::hasConnectionToken(headers, "close");
             return std::make_shared<HttpResponse>(code,
                                                   description,
                                                   HttpErrorCode::Ok,
@@ -392,31 +1169,34 @@ namespace ix
                                                   downloadSize);
         }
 
+        HttpBodySink sink(args, headers);
+        if (!sink.begin(code, headers))
+        {
+            return makeBodyErrorResponse(code, description, headers, sink, uploadSize);
+        }
+
         // Parse response:
         if (headers.find("Content-Length") != headers.end())
         {
-            ssize_t contentLength = -1;
-            ss.str("");
-            ss << headers["Content-Length"];
-            ss >> contentLength;
-
-            payload.reserve(contentLength);
-
-            auto chunkResult = _socket->readBytes(
-                contentLength, args->onProgressCallback, isCancellationRequested);
-            if (!chunkResult.first)
+            uint64_t contentLength = 0;
+            if (!Http::parseContentLength(headers["Content-Length"], contentLength))
             {
-                errorMsg = "Cannot read chunk";
+                std::string errorMsg2("Invalid Content-Length header");
                 return std::make_shared<HttpResponse>(code,
                                                       description,
-                                                      HttpErrorCode::ChunkReadError,
+                                                      HttpErrorCode::HeaderParsingError,
                                                       headers,
                                                       payload,
-                                                      errorMsg,
+                                                      errorMsg2,
                                                       uploadSize,
                                                       downloadSize);
             }
-            payload += chunkResult.second;
+
+            if (!readBody(
+                    *connection.socket, (size_t) contentLength, sink, args, isCancellationRequested))
+            {
+                return makeBodyErrorResponse(code, description, headers, sink, uploadSize);
+            }
         }
         else if (headers.find("Transfer-Encoding") != headers.end() &&
                  headers["Transfer-Encoding"] == "chunked")
@@ -425,19 +1205,12 @@ namespace ix
 
             while (true)
             {
-                lineResult = _socket->readLine(isCancellationRequested);
-                line = lineResult.second;
+                auto lineResult = connection.socket->readLine(isCancellationRequested);
+                auto line = lineResult.second;
 
                 if (!lineResult.first)
                 {
-                    return std::make_shared<HttpResponse>(code,
-                                                          description,
-                                                          HttpErrorCode::ChunkReadError,
-                                                          headers,
-                                                          payload,
-                                                          errorMsg,
-                                                          uploadSize,
-                                                          downloadSize);
+                    return makeBodyErrorResponse(code, description, headers, sink, uploadSize);
                 }
 
                 uint64_t chunkSize;
@@ -452,47 +1225,27 @@ namespace ix
                     log(oss.str(), args);
                 }
 
-                payload.reserve(payload.size() + (size_t) chunkSize);
-
                 // Read a chunk
-                auto chunkResult = _socket->readBytes(
-                    (size_t) chunkSize, args->onProgressCallback, isCancellationRequested);
-                if (!chunkResult.first)
+                if (!readBody(*connection.socket,
+                              (size_t) chunkSize,
+                              sink,
+                              args,
+                              isCancellationRequested))
                 {
-                    errorMsg = "Cannot read chunk";
-                    return std::make_shared<HttpResponse>(code,
-                                                          description,
-                                                          HttpErrorCode::ChunkReadError,
-                                                          headers,
-                                                          payload,
-                                                          errorMsg,
-                                                          uploadSize,
-                                                          downloadSize);
+                    return makeBodyErrorResponse(code, description, headers, sink, uploadSize);
                 }
-                payload += chunkResult.second;
 
                 // Read the line that terminates the chunk (\r\n)
-                lineResult = _socket->readLine(isCancellationRequested);
+                lineResult = connection.socket->readLine(isCancellationRequested);
 
                 if (!lineResult.first)
                 {
-                    return std::make_shared<HttpResponse>(code,
-                                                          description,
-                                                          HttpErrorCode::ChunkReadError,
-                                                          headers,
-                                                          payload,
-                                                          errorMsg,
-                                                          uploadSize,
-                                                          downloadSize);
+                    return makeBodyErrorResponse(code, description, headers, sink, uploadSize);
                 }
 
                 if (chunkSize == 0) break;
             }
         }
-        else if (code == 204)
-        {
-            ; // 204 is NoContent response code
-        }
         else
         {
             std::string errorMsg2("Cannot read http body");
@@ -506,47 +1259,125 @@ namespace ix
                                                   downloadSize);
         }
 
-        downloadSize = payload.size();
+        // The whole response was read, the next request can be sent on the same connection
+        connection.reusable = !Http::hasConnectionToken(headers, "close");
+
+        downloadSize = sink.getReceivedSize();
+        sink.end();
+
+        return std::make_shared<HttpResponse>(code,
+                                              description,
+                                              sink.getErrorCode(),
+                                              headers,
+                                              sink.getBody(),
+                                              sink.getErrorMsg(),
+                                              uploadSize,
+                                              downloadSize);
+    }
+
+    std::string HttpClient::buildRequest(const std::string& verb,
+                                         const std::string& host,
+                                         const std::string& path,
+                                         const std::string& body,
+                                         HttpRequestArgsPtr args,
+                                         const HttpBodyWriter* bodyWriter)
+    {
+        std::stringstream ss;
+        ss << verb << " " << path << " HTTP/1.1\r\n";
+        ss << "Host: " << host << "\r\n";
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        if (args->compress)
+        {
+            ss << "Accept-Encoding: gzip"
+               << "\r\n";
+        }
+#endif
+
+        // Append extra headers
+        for (auto&& it : args->extraHeaders)
+        {
+            ss << it.first << ": " << it.second << "\r\n";
+        }
+
+        // Set a default Accept header if none is present
+        if (args->extraHeaders.find("Accept") == args->extraHeaders.end())
+        {
+            ss << "Accept: */*"
+               << "\r\n";
+        }
+
+        // Set a default User agent if none is present
+        if (args->extraHeaders.find("User-Agent") == args->extraHeaders.end())
+        {
+            ss << "User-Agent: " << userAgent() << "\r\n";
+        }
 
-        // If the content was compressed with gzip, decode it
-        if (headers["Content-Encoding"] == "gzip")
+        if (verb == kPost || verb == kPut || verb == kPatch || _forceBody)
         {
+            // Set request compression header
 #ifdef IXWEBSOCKET_USE_ZLIB
-            std::string decompressedPayload;
-            if (!gzipDecompress(payload, decompressedPayload))
+            if (args->compressRequest)
             {
-                std::string errorMsg2("Error decompressing payload");
-                return std::make_shared<HttpResponse>(code,
-                                                      description,
-                                                      HttpErrorCode::Gzip,
-                                                      headers,
-                                                      payload,
-                                                      errorMsg2,
-                                                      uploadSize,
-                                                      downloadSize);
+                ss << "Content-Encoding: gzip"
+                   << "\r\n";
             }
-            payload = decompressedPayload;
-#else
-            std::string errorMsg2("ixwebsocket was not compiled with gzip support on");
-            return std::make_shared<HttpResponse>(code,
-                                                  description,
-                                                  HttpErrorCode::Gzip,
-                                                  headers,
-                                                  payload,
-                                                  errorMsg2,
-                                                  uploadSize,
-                                                  downloadSize);
 #endif
+
+            // A streamed body is sent after the headers
+            if (bodyWriter == nullptr)
+            {
+                ss << "Content-Length: " << body.size() << "\r\n";
+            }
+            else if (bodyWriter->isChunked())
+            {
+                ss << "Transfer-Encoding: chunked"
+                   << "\r\n";
+            }
+            else
+            {
+                ss << "Content-Length: " << bodyWriter->getSize() << "\r\n";
+            }
+
+            // Set default Content-Type if unspecified
+            if (args->extraHeaders.find("Content-Type") == args->extraHeaders.end())
+            {
+                std::string contentType;
+                if (bodyWriter != nullptr) contentType = args->bodyProvider->getContentType();
+
+                if (!contentType.empty())
+                {
+                    ss << "Content-Type: " << contentType << "\r\n";
+                }
+                else if (args->multipartBoundary.empty())
+                {
+                    ss << "Content-Type: application/x-www-form-urlencoded"
+                       << "\r\n";
+                }
+                else
+                {
+                    ss << "Content-Type: multipart/form-data; boundary=" << args->multipartBoundary
+                       << "\r\n";
+                }
+            }
+            ss << "\r\n";
+            if (bodyWriter == nullptr) ss << body;
+        }
+        else
+        {
+            ss << "\r\n";
         }
 
-        return std::make_shared<HttpResponse>(code,
-                                              description,
-                                              HttpErrorCode::Ok,
-                                              headers,
-                                              payload,
-                                              std::string(),
-                                              uploadSize,
-                                              downloadSize);
+        return ss.str();
+    }
+
+    std::shared_ptr<HttpBodyWriter> HttpClient::makeBodyWriter(const std::string& verb,
+                                                               HttpRequestArgsPtr args)
+    {
+        if (!args->bodyProvider) return nullptr;
+        if (!(verb == kPost || verb == kPut || verb == kPatch || _forceBody)) return nullptr;
+
+        return std::make_shared<HttpBodyWriter>(args->bodyProvider, args->compressRequest);
     }
 
     HttpResponsePtr HttpClient::get(const std::string& url, HttpRequestArgsPtr args)
@@ -639,6 +1470,180 @@ namespace ix
         return request(url, kPatch, body, args);
     }
 
+    HttpResponsePtr HttpClient::download(const std::string& url,
+                                         const std::string& filePath,
+                                         HttpRequestArgsPtr args,
+                                         int parallelism)
+    {
+        // Ranges are counted on the file itself, not on a compressed version of it
+        auto downloadArgs = std::make_shared<HttpRequestArgs>(*args);
+        downloadArgs->compress = false;
+        downloadArgs->onProgressCallback = nullptr;
+        parallelism = std::max(parallelism, 1);
+
+        // An existing file is the beginning of an interrupted download
+        int64_t fileSize = getFileSize(filePath);
+        bool created = fileSize < 0;
+        if (created)
+        {
+            DownloadFileWriter writer;
+            if (!writer.open(filePath, 0, true) || !writer.close())
+            {
+                auto response = std::make_shared<HttpResponse>();
+                response->errorCode = HttpErrorCode::CannotWriteFile;
+                response->errorMsg = "Cannot open " + filePath + " for writing";
+                return response;
+            }
+            fileSize = 0;
+        }
+
+        // The last byte of the file is received again, so that the range can be satisfied
+        // when the download was complete. The size of the file is only known after the
+        // first request, which gets the first part of a parallel download.
+        uint64_t first = (fileSize > 0) ? (uint64_t) fileSize - 1 : 0;
+        auto makeFirstRange = [parallelism](uint64_t first) {
+            return DownloadRange(first,
+                                 parallelism > 1 ? (int64_t) (first + kMinDownloadPartSize - 1)
+                                                 : -1);
+        };
+
+        DownloadRange range = makeFirstRange(first);
+        auto response = downloadRange(*this, url, filePath, downloadArgs, range, true);
+
+        if (response->errorCode == HttpErrorCode::Ok && response->statusCode == 416)
+        {
+            uint64_t unused;
+            int64_t size = -1;
+            parseContentRange(response->headers, unused, unused, size);
+
+            // The file on the server is smaller than the existing one, it is downloaded
+            // again. An empty file cannot satisfy any range.
+            if (!truncateFile(filePath, 0))
+            {
+                response->errorCode = HttpErrorCode::CannotWriteFile;
+                response->errorMsg = "Cannot truncate " + filePath;
+                return response;
+            }
+
+            if (size == 0)
+            {
+                return std::make_shared<HttpResponse>(200,
+                                                      "OK",
+                                                      HttpErrorCode::Ok,
+                                                      response->headers,
+                                                      std::string(),
+                                                      std::string(),
+                                                      response->uploadSize,
+                                                      response->downloadSize);
+            }
+
+            range = makeFirstRange(0);
+            response = downloadRange(*this, url, filePath, downloadArgs, range, true);
+        }
+
+        uint64_t end = range.offset + range.written;
+        if (response->errorCode != HttpErrorCode::Ok ||
+            (response->statusCode != 200 && response->statusCode != 206))
+        {
+            // Kept up to the last byte received, to be resumed, or removed if nothing was
+            // received at all
+            if (range.written != 0)
+            {
+                truncateFile(filePath, end);
+            }
+            else if (created)
+            {
+                std::remove(filePath.c_str());
+            }
+            return response;
+        }
+
+        // The remaining bytes, split in ranges received concurrently
+        std::vector<DownloadRange> ranges;
+        if (response->statusCode == 206 && range.size < 0)
+        {
+            ranges.push_back(DownloadRange(end, -1));
+        }
+        else if (response->statusCode == 206 && end < (uint64_t) range.size)
+        {
+            uint64_t remaining = (uint64_t) range.size - end;
+            uint64_t count = (remaining + kMinDownloadPartSize - 1) / kMinDownloadPartSize;
+            count = std::min(count, (uint64_t) parallelism);
+
+            uint64_t partSize = remaining / count;
+            for (uint64_t i = 0; i < count; ++i)
+            {
+                uint64_t partFirst = end + i * partSize;
+                uint64_t partLast = (i + 1 == count) ? (uint64_t) range.size - 1
+                                                     : partFirst + partSize - 1;
+                ranges.push_back(DownloadRange(partFirst, (int64_t) partLast));
+            }
+        }
+
+        std::vector<HttpResponsePtr> responses(ranges.size());
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            auto run = [this, &url, &filePath, &downloadArgs, &ranges, &responses, i]() {
+                responses[i] =
+                    downloadRange(*this, url, filePath, downloadArgs, ranges[i], false);
+            };
+
+            if (ranges.size() == 1)
+            {
+                run();
+            }
+            else
+            {
+                threads.push_back(std::thread(run));
+            }
+        }
+
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+
+        uint64_t downloadSize = response->downloadSize;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            downloadSize += responses[i]->downloadSize;
+        }
+
+        // The file is kept up to its first missing byte, so that the download can be
+        // resumed after a failure
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            end = ranges[i].first + ranges[i].written;
+            bool complete = (ranges[i].last >= 0) ? end == (uint64_t) ranges[i].last + 1
+                                                  : (int64_t) end == ranges[i].size;
+
+            if (responses[i]->errorCode == HttpErrorCode::Ok &&
+                responses[i]->statusCode == 206 && !complete)
+            {
+                responses[i]->errorCode = HttpErrorCode::CannotReadBody;
+                responses[i]->errorMsg = "Range request answered with a different range";
+            }
+
+            if (responses[i]->errorCode != HttpErrorCode::Ok ||
+                responses[i]->statusCode != 206)
+            {
+                truncateFile(filePath, end);
+                responses[i]->downloadSize = downloadSize;
+                return responses[i];
+            }
+        }
+
+        return std::make_shared<HttpResponse>(200,
+                                              "OK",
+                                              HttpErrorCode::Ok,
+                                              response->headers,
+                                              std::string(),
+                                              std::string(),
+                                              response->uploadSize,
+                                              downloadSize);
+    }
+
     std::string HttpClient::urlDecode(const std::string& value)
     {
         std::ostringstream escaped;
@@ -7,21 +7,27 @@
 #pragma once
 
 #include "IXHttp.h"
+#include "IXHttpAsyncRequest.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpConnectionPool.h"
 #include "IXSocket.h"
 #include "IXSocketTLSOptions.h"
 #include "IXWebSocketHttpHeaders.h"
 #include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <set>
 #include <thread>
 
 namespace ix
 {
+    class WebSocketClientLoop;
+
     class HttpClient
     {
     public:
@@ -68,18 +74,51 @@ namespace ix
                                 const HttpFormDataParameters& httpFormDataParameters,
                                 HttpRequestArgsPtr args);
 
+        // Download url to filePath, writing the body to the file as it is received. An
+        // existing file is taken as the beginning of an interrupted download, only the
+        // rest of the file is requested with a Range header. With parallelism > 1, the
+        // file is split into that many range requests sent concurrently, on pooled
+        // connections (see setMaxConnectionsPerHost), each written at its offset. After a
+        // failure the file is truncated to its first missing byte, so that the download
+        // can be resumed. The status code is 200 once the file is complete, with the
+        // headers of the first response. compress, onProgressCallback and the body
+        // callbacks of args are not used.
+        HttpResponsePtr download(const std::string& url,
+                                 const std::string& filePath,
+                                 HttpRequestArgsPtr args,
+                                 int parallelism = 1);
+
         void setForceBody(bool value);
 
         // Async API
         HttpRequestArgsPtr createRequest(const std::string& url = std::string(),
                                          const std::string& verb = HttpClient::kGet);
 
+        // On Linux, requests are sent and their responses received from an event loop
+        // thread, which can have many requests in flight, and new connections are made
+        // from a few connect threads. Callbacks are invoked on the event loop thread and
+        // should not block. Elsewhere requests are performed one after the other from a
+        // background thread.
         bool performRequest(HttpRequestArgsPtr request,
                             const OnResponseCallback& onResponseCallback);
 
+        // A request given to performRequest fails with HttpErrorCode::Cancelled, unless its
+        // response was already received. Returns false if it is not queued or in flight.
+        bool cancelRequest(HttpRequestArgsPtr request);
+
+        // Requests in flight at the same time, to all hosts. The requests to each host are
+        // also capped by setMaxConnectionsPerHost.
+        void setMaxInFlightRequests(size_t maxInFlightRequests);
+
         // TLS
         void setTLSOptions( const SocketTLSOptions& tlsOptions );
 
+        // Keep-alive connections are reused by the following requests to the same host,
+        // including requests made concurrently from several threads. An idle timeout of
+        // 0 disables reuse.
+        void setMaxConnectionsPerHost(size_t maxConnectionsPerHost);
+        void setIdleConnectionTimeoutSecs(int idleConnectionTimeoutSecs);
+
         std::string serializeHttpParameters(const HttpParameters& httpParameters);
 
         std::string serializeHttpFormDataParameters(
@@ -99,23 +138,61 @@ namespace ix
         const static std::string kPut;
         const static std::string kPatch;
 
+        const static size_t kDefaultMaxInFlightRequests;
+        // Parallel downloads are not split into smaller ranges
+        const static uint64_t kMinDownloadPartSize;
+
     private:
         void log(const std::string& msg, HttpRequestArgsPtr args);
 
-        // Async API background thread runner
+        // With a body writer, the body is sent after the returned headers
+        std::string buildRequest(const std::string& verb,
+                                 const std::string& host,
+                                 const std::string& path,
+                                 const std::string& body,
+                                 HttpRequestArgsPtr args,
+                                 const HttpBodyWriter* bodyWriter = nullptr);
+        // nullptr unless the request has a body provider, and a verb which sends a body
+        std::shared_ptr<HttpBodyWriter> makeBodyWriter(const std::string& verb,
+                                                       HttpRequestArgsPtr args);
+
+        // Async API background thread runner, without event loop
         void run();
+
+        // Async API with an event loop
+        void dispatchAsyncRequests();
+        void startAsyncRequest(const HttpAsyncRequestPtr& request,
+                               std::unique_ptr<Socket> socket);
+        void onAsyncRequestDone(const HttpAsyncRequestPtr& request,
+                                HttpResponsePtr response,
+                                std::unique_ptr<Socket> socket);
+        void abortAsyncRequest(const HttpAsyncRequestPtr& request,
+                               HttpErrorCode errorCode,
+                               const std::string& errorMsg);
+        // Timeouts are checked periodically on the event loop while requests are pending,
+        // rather than with a timer per request
+        void scheduleTimeoutsCheck();
+        void checkTimeouts();
+
         // Async API
         bool _async;
-        std::queue<std::pair<HttpRequestArgsPtr, OnResponseCallback>> _queue;
+        std::deque<HttpAsyncRequestPtr> _queue;
+        std::set<HttpAsyncRequestPtr> _inFlightRequests;
         mutable std::mutex _queueMutex;
         std::condition_variable _condition;
         std::atomic<bool> _stop;
         std::thread _thread;
+        std::unique_ptr<WebSocketClientLoop> _clientLoop;
+        std::atomic<size_t> _maxInFlightRequests;
+        bool _dispatchScheduled;
+        bool _timeoutsCheckScheduled;
+
+        // Requests waiting for a host which is at its connection limit are dispatched again
+        // after that delay, when no request of this client is in flight
+        const static int kDispatchRetryDelayMs;
+        const static int kTimeoutsCheckIntervalMs;
 
-        std::unique_ptr<Socket> _socket;
-        std::recursive_mutex _mutex; // to protect accessing the _socket (only one socket per
-                                     // client) the mutex needs to be recursive as this function
-                                     // might be called recursively to follow HTTP redirections
+        HttpConnectionPool _connectionPool;
 
         SocketTLSOptions _tlsOptions;
 
@@ -0,0 +1,235 @@
+/*
+ *  IXHttpConnectionPool.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpConnectionPool.h"
+
+#include <sstream>
+#include <vector>
+
+namespace ix
+{
+    // Same limit as most web browsers
+    const size_t HttpConnectionPool::kDefaultMaxConnectionsPerHost(6);
+    // A bit less than the most common server side timeout (5 seconds), so that connections
+    // are rarely closed by the server right when a request is sent on them
+    const int HttpConnectionPool::kDefaultIdleTimeoutSecs(4);
+    const int HttpConnectionPool::kWaitIntervalMs(10);
+
+    HttpConnectionPool::HttpConnectionPool()
+        : _maxConnectionsPerHost(kDefaultMaxConnectionsPerHost)
+        , _idleTimeoutSecs(kDefaultIdleTimeoutSecs)
+    {
+        ;
+    }
+
+    HttpConnectionPool::~HttpConnectionPool()
+    {
+        clear();
+    }
+
+    void HttpConnectionPool::setMaxConnectionsPerHost(size_t maxConnectionsPerHost)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _maxConnectionsPerHost = (maxConnectionsPerHost == 0) ? 1 : maxConnectionsPerHost;
+        _condition.notify_all();
+    }
+
+    void HttpConnectionPool::setIdleTimeoutSecs(int idleTimeoutSecs)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _idleTimeoutSecs = idleTimeoutSecs;
+        }
+
+        if (idleTimeoutSecs <= 0) clear();
+    }
+
+    std::string HttpConnectionPool::makeKey(const std::string& protocol,
+                                            const std::string& host,
+                                            int port)
+    {
+        std::stringstream ss;
+        ss << protocol << "://" << host << ":" << port;
+        return ss.str();
+    }
+
+    bool HttpConnectionPool::isStale(Socket& socket)
+    {
+        // An idle connection should have nothing to read. Being readable means that the
+        // server closed it (or sent unexpected data), either way it cannot be used.
+        if (socket.getReadBufferSize() != 0) return true;
+
+        return socket.isReadyToRead(0) != PollResultType::Timeout;
+    }
+
+    void HttpConnectionPool::evictExpired(std::vector<std::unique_ptr<Socket>>& expired)
+    {
+        auto deadline =
+            std::chrono::steady_clock::now() - std::chrono::seconds(_idleTimeoutSecs);
+
+        for (auto it = _hosts.begin(); it != _hosts.end();)
+        {
+            auto& idle = it->second.idle;
+            while (!idle.empty() && idle.front().releasedAt <= deadline)
+            {
+                expired.push_back(std::move(idle.front().socket));
+                idle.pop_front();
+            }
+
+            if (idle.empty() && it->second.activeCount == 0)
+            {
+                it = _hosts.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    bool HttpConnectionPool::reserve(const std::string& key, std::unique_ptr<Socket>& socket)
+    {
+        auto& host = _hosts[key];
+
+        if (!host.idle.empty())
+        {
+            socket = std::move(host.idle.back().socket);
+            host.idle.pop_back();
+            host.activeCount++;
+            return true;
+        }
+
+        if (host.activeCount < _maxConnectionsPerHost)
+        {
+            host.activeCount++;
+            return true;
+        }
+
+        return false;
+    }
+
+    void HttpConnectionPool::replaceStale(const std::string& key,
+                                          std::unique_ptr<Socket>& socket,
+                                          std::vector<std::unique_ptr<Socket>>& expired)
+    {
+        // Look for a live connection among the idle ones, most recently used first
+        while (socket && isStale(*socket))
+        {
+            expired.push_back(std::move(socket));
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto& host = _hosts[key];
+            if (!host.idle.empty())
+            {
+                socket = std::move(host.idle.back().socket);
+                host.idle.pop_back();
+            }
+        }
+    }
+
+    bool HttpConnectionPool::acquire(const std::string& key,
+                                     const CancellationRequest& isCancellationRequested,
+                                     std::unique_ptr<Socket>& socket)
+    {
+        std::vector<std::unique_ptr<Socket>> expired;
+        socket.reset();
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            evictExpired(expired);
+
+            while (!reserve(key, socket))
+            {
+                if (isCancellationRequested && isCancellationRequested())
+                {
+                    return false;
+                }
+
+                _condition.wait_for(lock, std::chrono::milliseconds(kWaitIntervalMs));
+            }
+        }
+
+        replaceStale(key, socket, expired);
+        return true;
+    }
+
+    bool HttpConnectionPool::tryAcquire(const std::string& key, std::unique_ptr<Socket>& socket)
+    {
+        std::vector<std::unique_ptr<Socket>> expired;
+        socket.reset();
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            evictExpired(expired);
+
+            if (!reserve(key, socket)) return false;
+        }
+
+        replaceStale(key, socket, expired);
+        return true;
+    }
+
+    void HttpConnectionPool::release(const std::string& key, std::unique_ptr<Socket> socket)
+    {
+        std::vector<std::unique_ptr<Socket>> expired;
+
+        if (socket && socket->getReadBufferSize() != 0)
+        {
+            expired.push_back(std::move(socket));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            auto& host = _hosts[key];
+            if (host.activeCount > 0) host.activeCount--;
+
+            if (socket && _idleTimeoutSecs > 0)
+            {
+                IdleConnection connection;
+                connection.socket = std::move(socket);
+                connection.releasedAt = std::chrono::steady_clock::now();
+                host.idle.push_back(std::move(connection));
+            }
+
+            evictExpired(expired);
+        }
+
+        _condition.notify_all();
+    }
+
+    void HttpConnectionPool::clear()
+    {
+        std::vector<std::unique_ptr<Socket>> expired;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            for (auto&& it : _hosts)
+            {
+                for (auto&& connection : it.second.idle)
+                {
+                    expired.push_back(std::move(connection.socket));
+                }
+                it.second.idle.clear();
+            }
+        }
+
+        _condition.notify_all();
+    }
+
+    size_t HttpConnectionPool::getIdleConnectionsCount()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        size_t count = 0;
+        for (auto&& it : _hosts)
+        {
+            count += it.second.idle.size();
+        }
+        return count;
+    }
+} // namespace ix
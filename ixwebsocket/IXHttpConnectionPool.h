@@ -0,0 +1,109 @@
+/*
+ *  IXHttpConnectionPool.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Keep-alive connections of an HttpClient, keyed by scheme, host and port.
+ *  The number of connections to each host (in use or idle) is capped, idle
+ *  connections are closed after a timeout, and connections closed by the peer
+ *  while they were idle are detected before being handed out again.
+ */
+
+#pragma once
+
+#include "IXCancellationRequest.h"
+#include "IXSocket.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ix
+{
+    class HttpConnectionPool
+    {
+    public:
+        HttpConnectionPool();
+        ~HttpConnectionPool();
+
+        void setMaxConnectionsPerHost(size_t maxConnectionsPerHost);
+        // 0 disables connection reuse
+        void setIdleTimeoutSecs(int idleTimeoutSecs);
+
+        // Reserve a connection to a host, waiting while the host is at its connection
+        // limit. socket is set to an idle connection which is still open, or to nullptr
+        // when a new connection should be made. Returns false if cancelled while waiting.
+        bool acquire(const std::string& key,
+                     const CancellationRequest& isCancellationRequested,
+                     std::unique_ptr<Socket>& socket);
+
+        // Same as acquire, without waiting. Returns false if the host is at its limit.
+        bool tryAcquire(const std::string& key, std::unique_ptr<Socket>& socket);
+
+        // Give back a reserved connection. nullptr (or a connection with unread bytes)
+        // only frees the slot, other connections are kept for reuse.
+        void release(const std::string& key, std::unique_ptr<Socket> socket);
+
+        // Close all idle connections
+        void clear();
+
+        size_t getIdleConnectionsCount();
+
+        static std::string makeKey(const std::string& protocol,
+                                   const std::string& host,
+                                   int port);
+
+        const static size_t kDefaultMaxConnectionsPerHost;
+        const static int kDefaultIdleTimeoutSecs;
+
+    private:
+        struct IdleConnection
+        {
+            std::unique_ptr<Socket> socket;
+            std::chrono::steady_clock::time_point releasedAt;
+        };
+
+        struct HostConnections
+        {
+            HostConnections()
+                : activeCount(0)
+            {
+            }
+
+            // Most recently released last
+            std::deque<IdleConnection> idle;
+            size_t activeCount;
+        };
+
+        // Move the idle connections which timed out to expired, and forget hosts with no
+        // connections. Called with the mutex held, sockets are closed by the caller
+        // once the mutex is released.
+        void evictExpired(std::vector<std::unique_ptr<Socket>>& expired);
+
+        // Called with the mutex held. Reserve a slot, and take the most recently used
+        // idle connection if there is one.
+        bool reserve(const std::string& key, std::unique_ptr<Socket>& socket);
+
+        // Replace a reserved connection which was closed by the peer by another idle one,
+        // or by nullptr. The slot stays reserved.
+        void replaceStale(const std::string& key,
+                          std::unique_ptr<Socket>& socket,
+                          std::vector<std::unique_ptr<Socket>>& expired);
+
+        static bool isStale(Socket& socket);
+
+        std::map<std::string, HostConnections> _hosts;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+
+        size_t _maxConnectionsPerHost;
+        int _idleTimeoutSecs;
+
+        // Waiting for a free slot checks for cancellation that often
+        const static int kWaitIntervalMs;
+    };
+} // namespace ix
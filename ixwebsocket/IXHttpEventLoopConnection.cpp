@@ -0,0 +1,628 @@
+/*
+ *  IXHttpEventLoopConnection.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpEventLoopConnection.h"
+
+#include "IXGzipCodec.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpParser.h"
+#include "IXSocket.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+    bool isHeader(const ix::HttpHeaderView& header, const char* name)
+    {
+        if (header.name.size != strlen(name)) return false;
+
+        for (size_t i = 0; i < header.name.size; ++i)
+        {
+            if (tolower((unsigned char) header.name.data[i]) != tolower((unsigned char) name[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Find the line starting at pos. lineEnd is set to its end, CRLF or LF excluded, and
+    // next to the start of the next line. Returns false if it is not complete.
+    bool findLine(const char* data, size_t size, size_t pos, size_t& lineEnd, size_t& next)
+    {
+        if (pos >= size) return false;
+
+        auto p = (const char*) memchr(data + pos, '\n', size - pos);
+        if (p == nullptr) return false;
+
+        next = (size_t)(p - data) + 1;
+        lineEnd = next - 1;
+        if (lineEnd > pos && data[lineEnd - 1] == '\r') --lineEnd;
+        return true;
+    }
+
+    // Size of the chunked body at the start of data, trailers included. 0 if it is not
+    // all there yet, -1 if it is invalid. The chunk data is appended to body if it is set.
+    int64_t getChunkedBodySize(const char* data, size_t size, std::string* body = nullptr)
+    {
+        // Framing lines are bounded like header lines, trailers as a whole too
+        auto lineTooLong = [data, size](size_t pos) {
+            return size - pos >= ix::HttpParser::kMaxHeaderLineSize;
+        };
+
+        size_t pos = 0;
+        size_t lineEnd = 0;
+        size_t next = 0;
+        while (true)
+        {
+            if (!findLine(data, size, pos, lineEnd, next)) return lineTooLong(pos) ? -1 : 0;
+            if (next - pos > ix::HttpParser::kMaxHeaderLineSize) return -1;
+
+            // The chunk size, in hexadecimal, can be followed by extensions
+            uint64_t chunkSize = 0;
+            if (!ix::HttpParser::parseChunkSize(data + pos, lineEnd - pos, chunkSize)) return -1;
+
+            pos = next;
+
+            if (chunkSize == 0)
+            {
+                // Trailers, up to an empty line
+                size_t trailerStart = pos;
+                while (true)
+                {
+                    if (!findLine(data, size, pos, lineEnd, next))
+                    {
+                        return lineTooLong(pos) ? -1 : 0;
+                    }
+                    if (next - pos > ix::HttpParser::kMaxHeaderLineSize ||
+                        next - trailerStart > ix::HttpParser::kMaxTrailerSize)
+                    {
+                        return -1;
+                    }
+
+                    bool empty = lineEnd == pos;
+                    pos = next;
+                    if (empty) return (int64_t) pos;
+                }
+            }
+
+            // The chunk data is followed by a line end
+            if (size - pos < chunkSize + 1) return 0;
+            if (body) body->append(data + pos, (size_t) chunkSize);
+            pos += chunkSize;
+            if (data[pos] == '\r') ++pos;
+            if (pos == size) return 0;
+            if (data[pos] != '\n') return -1;
+            ++pos;
+        }
+    }
+
+    // tooLarge is set if the decompressed body would be larger than maxSize
+    bool decompressBody(const std::string& input,
+                        uint64_t maxSize,
+                        std::string& output,
+                        bool& tooLarge)
+    {
+        output.clear();
+        tooLarge = false;
+        if (input.empty()) return true;
+
+        ix::GzipDecompressor decompressor;
+        if (!decompressor.init()) return false;
+
+        auto onOutput = [&output, &tooLarge, maxSize](const char* data, size_t size) {
+            if (output.size() + size > maxSize)
+            {
+                tooLarge = true;
+                return false;
+            }
+            output.append(data, size);
+            return true;
+        };
+        bool success = decompressor.decompress(input.data(), input.size(), onOutput);
+        return success && decompressor.isDone();
+    }
+} // namespace
+
+namespace ix
+{
+    const size_t HttpEventLoopConnection::kMaxRequestSize(16 * 1024 * 1024);
+
+    HttpEventLoopConnection::HttpEventLoopConnection(EventLoopPtr eventLoop,
+                                                     const OnRequestCallback& onRequestCallback,
+                                                     const OnClosedCallback& onClosedCallback)
+        : _eventLoop(*eventLoop)
+        , _weakEventLoop(eventLoop)
+        , _onRequestCallback(onRequestCallback)
+        , _onClosedCallback(onClosedCallback)
+        , _state(State::ReadingRequest)
+        , _id(0)
+        , _timeoutSecs(0)
+        , _idleTimeoutSecs(0)
+        , _maxRequests(0)
+        , _maxBodySize(0)
+        , _requestCount(0)
+        , _keepAlive(false)
+        , _stopRequested(false)
+        , _inRequestCallback(false)
+        , _timerScheduled(false)
+        , _outputOffset(0)
+        , _bodyOffset(0)
+        , _sendBody(false)
+        , _fileSize(-1)
+        , _fileOffset(0)
+        , _bodyDone(true)
+    {
+        ;
+    }
+
+    HttpEventLoopConnection::~HttpEventLoopConnection()
+    {
+        ;
+    }
+
+    void HttpEventLoopConnection::start(std::unique_ptr<Socket> socket,
+                                        int timeoutSecs,
+                                        int idleTimeoutSecs,
+                                        int maxRequests,
+                                        uint64_t maxBodySize)
+    {
+        // Stopped before being started
+        if (_state == State::Closed) return;
+
+        _socket = std::move(socket);
+        _timeoutSecs = timeoutSecs;
+        _idleTimeoutSecs = idleTimeoutSecs;
+        _maxRequests = maxRequests;
+        _maxBodySize = maxBodySize;
+
+        auto self = shared_from_this();
+        std::string errorMsg;
+        _id = _eventLoop.add(
+            _socket->getFd(),
+            [self](bool readable, bool writable) { self->onEvent(readable, writable); },
+            errorMsg);
+
+        if (_id == 0)
+        {
+            finish();
+            return;
+        }
+
+        scheduleRequestTimeout(_timeoutSecs);
+
+        // The request might have been received already, and since sockets are
+        // watched in edge triggered mode we would not be notified about it.
+        readRequests();
+    }
+
+    void HttpEventLoopConnection::requestStop()
+    {
+        _stopRequested = true;
+
+        auto eventLoop = _weakEventLoop.lock();
+        if (!eventLoop) return;
+
+        auto self = shared_from_this();
+        eventLoop->post([self] { self->onStop(); });
+    }
+
+    void HttpEventLoopConnection::onStop()
+    {
+        // Requests which are being received are dropped, like in the thread per
+        // connection mode
+        if (_state == State::ReadingRequest) finish();
+    }
+
+    void HttpEventLoopConnection::onEvent(bool readable, bool writable)
+    {
+        if (_state == State::SendingResponse && writable)
+        {
+            sendResponse();
+
+            // The next request might be buffered already
+            readable = readable || _state == State::ReadingRequest;
+        }
+
+        // Pipelined requests are buffered while the current one is processed, and a
+        // closed connection is noticed
+        if (readable && _state != State::Closed)
+        {
+            readRequests();
+        }
+    }
+
+    void HttpEventLoopConnection::readRequests()
+    {
+        bool wouldBlock = false;
+        while (true)
+        {
+            // Once the limit is reached, the buffer is filled again after the request
+            // at its start is processed
+            if (!wouldBlock && _socket->getReadBufferSize() <= kMaxRequestSize &&
+                !_socket->fillReadBuffer(kMaxRequestSize + 1, wouldBlock))
+            {
+                finish();
+                return;
+            }
+
+            // Requests answered by the handler right away are followed by the next ones
+            if (_state != State::ReadingRequest || !processRequest()) return;
+        }
+    }
+
+    bool HttpEventLoopConnection::processRequest()
+    {
+        const char* data = _socket->getReadBufferData();
+        size_t size = _socket->getReadBufferSize();
+
+        HttpRequestHead head;
+        size_t headSize = 0;
+        auto parseResult = HttpParser::parseRequest(data, size, head, headSize);
+
+        if (parseResult == HttpParseResult::Incomplete)
+        {
+            if (size > kMaxRequestSize) reject("431 Request Header Fields Too Large");
+            return false;
+        }
+        else if (parseResult == HttpParseResult::TooLarge)
+        {
+            reject("431 Request Header Fields Too Large");
+            return false;
+        }
+        else if (parseResult != HttpParseResult::Complete)
+        {
+            reject("400 Bad Request");
+            return false;
+        }
+
+        // Wait for the whole body, delimited by a Content-Length or chunked. A request
+        // carrying both, or several lengths, could be framed differently by a proxy in
+        // front of us, it is rejected (RFC 7230 3.3.3).
+        uint64_t contentLength = 0;
+        bool hasContentLength = false;
+        bool hasTransferEncoding = false;
+        bool chunked = false;
+        for (auto&& header : head.headers)
+        {
+            if (isHeader(header, "Content-Length"))
+            {
+                if (hasContentLength ||
+                    !Http::parseContentLength(header.value.str(), contentLength))
+                {
+                    reject("400 Bad Request");
+                    return false;
+                }
+                hasContentLength = true;
+            }
+            else if (isHeader(header, "Transfer-Encoding"))
+            {
+                hasTransferEncoding = true;
+                chunked = header.value == "chunked";
+            }
+        }
+
+        if (hasContentLength && hasTransferEncoding)
+        {
+            reject("400 Bad Request");
+            return false;
+        }
+
+        uint64_t bodySize = contentLength;
+        uint64_t requestSize = headSize + contentLength;
+        if (chunked)
+        {
+            int64_t chunkedBodySize = getChunkedBodySize(data + headSize, size - headSize);
+            if (chunkedBodySize < 0)
+            {
+                reject("400 Bad Request");
+                return false;
+            }
+
+            // Until it is complete, its size is at least what was received
+            bodySize = chunkedBodySize == 0 ? size - headSize + 1 : (uint64_t) chunkedBodySize;
+            requestSize = headSize + bodySize;
+        }
+
+        if (requestSize > kMaxRequestSize || bodySize > _maxBodySize)
+        {
+            reject("413 Payload Too Large");
+            return false;
+        }
+        else if (size < requestSize)
+        {
+            return false;
+        }
+
+        // The request is built from the buffered bytes, with the framing found above. The
+        // socket is never read from here, that would block the event loop.
+        std::string body;
+        if (chunked)
+        {
+            getChunkedBodySize(data + headSize, size - headSize, &body);
+        }
+        else
+        {
+            body.assign(data + headSize, (size_t) bodySize);
+        }
+
+        auto headers = HttpParser::toHttpHeaders(head.headers);
+        auto it = headers.find("Content-Encoding");
+        if (it != headers.end() && it->second == "gzip")
+        {
+            std::string decompressed;
+            bool tooLarge = false;
+            if (!decompressBody(body, _maxBodySize, decompressed, tooLarge))
+            {
+                reject(tooLarge ? "413 Payload Too Large" : "400 Bad Request");
+                return false;
+            }
+            body.swap(decompressed);
+        }
+
+        auto request = std::make_shared<HttpRequest>(
+            head.uri.str(), head.method.str(), head.version.str(), std::string(), headers);
+        request->body.swap(body);
+        _socket->consumeReadBuffer((size_t) requestSize);
+
+        ++_requestCount;
+        _keepAlive = (int64_t) _requestCount < _maxRequests && Http::canKeepAlive(request);
+        _state = State::WaitingForResponse;
+
+        // Responses can come from any thread, they are sent from the event loop. The ones
+        // given by the handler before it returns are sent right away.
+        std::weak_ptr<EventLoop> weakEventLoop = _weakEventLoop;
+        std::weak_ptr<HttpEventLoopConnection> weakSelf = shared_from_this();
+        auto responder = std::make_shared<HttpResponder>(
+            [weakEventLoop, weakSelf, request](const HttpResponsePtr& response) {
+                auto eventLoop = weakEventLoop.lock();
+                if (!eventLoop) return;
+
+                if (eventLoop->isInLoopThread())
+                {
+                    auto self = weakSelf.lock();
+                    if (self && self->_inRequestCallback)
+                    {
+                        self->onResponse(request, response);
+                        return;
+                    }
+                }
+
+                eventLoop->post([weakSelf, request, response] {
+                    auto self = weakSelf.lock();
+                    if (!self) return;
+
+                    self->onResponse(request, response);
+                    if (self->_state == State::ReadingRequest) self->readRequests();
+                });
+            });
+        _responder = responder;
+
+        _inRequestCallback = true;
+        _onRequestCallback(request, responder);
+        _inRequestCallback = false;
+
+        return _state == State::ReadingRequest;
+    }
+
+    void HttpEventLoopConnection::onResponse(const HttpRequestPtr& request,
+                                             const HttpResponsePtr& response)
+    {
+        if (_state != State::WaitingForResponse) return;
+
+        _state = State::SendingResponse;
+        _responder.reset();
+
+        _keepAlive = _keepAlive && !_stopRequested;
+        auto connection = Http::getConnectionHeader(request, response, _keepAlive);
+        bool chunked = request->version != "HTTP/1.0";
+        bool headOnly = request->method == "HEAD";
+
+        bool bodyIncluded = false;
+        _output =
+            Http::serializeResponseHead(response, connection, chunked, headOnly, bodyIncluded);
+        _outputOffset = 0;
+        _response = response;
+        _bodyOffset = 0;
+        _sendBody = false;
+        _fileSize = -1;
+        _bodyDone = true;
+
+        auto& bodyProvider = response->bodyProvider;
+        if (bodyIncluded || Http::isBodyless(response->statusCode))
+        {
+            ;
+        }
+        else if (!bodyProvider)
+        {
+            _sendBody = true;
+        }
+        else if (bodyProvider->getFileDescriptor() >= 0 && bodyProvider->getSize() >= 0)
+        {
+            // Files of known size go straight from the page cache to the socket
+            _fileSize = bodyProvider->getSize();
+            _fileOffset = bodyProvider->getFileOffset();
+        }
+        else
+        {
+            // Without framing (HTTP/1.0 clients), the body is sent as is and the end of
+            // the body is marked by closing the connection
+            if (bodyProvider->getSize() >= 0 || chunked)
+            {
+                _bodyWriter.reset(new HttpBodyWriter(bodyProvider, false));
+            }
+            _bodyDone = false;
+        }
+
+        sendResponse();
+    }
+
+    void HttpEventLoopConnection::sendResponse()
+    {
+        while (true)
+        {
+            size_t outputSize = _output.size() - _outputOffset;
+            size_t bodySize = _sendBody ? _response->body.size() - _bodyOffset : 0;
+            ssize_t ret = 0;
+
+            if (outputSize != 0 || bodySize != 0)
+            {
+                // Large bodies are not copied, they are sent along with the head
+                SocketBuffer buffers[2];
+                size_t count = 0;
+                if (outputSize != 0) buffers[count++] = {&_output[_outputOffset], outputSize};
+                if (bodySize != 0)
+                {
+                    buffers[count++] = {_response->body.data() + _bodyOffset, bodySize};
+                }
+
+                ret = _socket->sendv(buffers, count);
+                if (ret > 0)
+                {
+                    size_t sentOutput = std::min((size_t) ret, outputSize);
+                    _outputOffset += sentOutput;
+                    _bodyOffset += (size_t) ret - sentOutput;
+                    continue;
+                }
+            }
+            else if (_fileSize >= 0 && _bodyOffset < (uint64_t) _fileSize)
+            {
+                ret = _socket->sendFile(_response->bodyProvider->getFileDescriptor(),
+                                        _fileOffset + _bodyOffset,
+                                        (size_t)((uint64_t) _fileSize - _bodyOffset));
+                if (ret > 0)
+                {
+                    _bodyOffset += (size_t) ret;
+                    continue;
+                }
+            }
+            else if (!_bodyDone)
+            {
+                if (!readBody())
+                {
+                    finish();
+                    return;
+                }
+                continue;
+            }
+            else
+            {
+                break;
+            }
+
+            // The rest is sent once the socket is writable again
+            if (ret < 0 && Socket::isWaitNeeded()) return;
+
+            finish();
+            return;
+        }
+
+        waitForNextRequest();
+    }
+
+    bool HttpEventLoopConnection::readBody()
+    {
+        _outputOffset = 0;
+
+        if (_bodyWriter)
+        {
+            if (!_bodyWriter->next(_output)) return false;
+            _bodyDone = _output.empty();
+            return true;
+        }
+
+        _output.resize(HttpBodyWriter::kReadSize);
+        int64_t ret = _response->bodyProvider->read(&_output[0], _output.size());
+        if (ret < 0 || ret > (int64_t) _output.size()) return false;
+
+        _output.resize((size_t) ret);
+        _bodyDone = ret == 0;
+        return true;
+    }
+
+    void HttpEventLoopConnection::waitForNextRequest()
+    {
+        _response.reset();
+        _bodyWriter.reset();
+        _output.clear();
+        _outputOffset = 0;
+
+        if (!_keepAlive || _stopRequested)
+        {
+            finish();
+            return;
+        }
+
+        _state = State::ReadingRequest;
+        scheduleRequestTimeout(_idleTimeoutSecs);
+    }
+
+    void HttpEventLoopConnection::scheduleRequestTimeout(int timeoutSecs)
+    {
+        _requestDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs);
+
+        // Only one timer is needed, it is scheduled again if the deadline moved
+        if (!_timerScheduled) scheduleTimer();
+    }
+
+    void HttpEventLoopConnection::scheduleTimer()
+    {
+        auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+            _requestDeadline - std::chrono::steady_clock::now());
+        _timerScheduled = true;
+
+        std::weak_ptr<HttpEventLoopConnection> weakSelf = shared_from_this();
+        _eventLoop.runAfter((int) std::max(delay.count(), (decltype(delay.count())) 0) + 1,
+                            [weakSelf] {
+                                if (auto self = weakSelf.lock()) self->onTimer();
+                            });
+    }
+
+    void HttpEventLoopConnection::onTimer()
+    {
+        _timerScheduled = false;
+        if (_state != State::ReadingRequest) return;
+
+        // The next request was not received in time
+        if (std::chrono::steady_clock::now() >= _requestDeadline)
+        {
+            finish();
+            return;
+        }
+
+        scheduleTimer();
+    }
+
+    void HttpEventLoopConnection::reject(const std::string& statusLine)
+    {
+        // The socket send buffer is empty at that point
+        _socket->send("HTTP/1.1 " + statusLine +
+                      "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        finish();
+    }
+
+    void HttpEventLoopConnection::finish()
+    {
+        if (_state == State::Closed) return;
+        _state = State::Closed;
+
+        if (auto responder = _responder.lock())
+        {
+            responder->setConnectionClosed();
+        }
+
+        // This releases the reference the event loop holds on us
+        _eventLoop.remove(_id);
+        _socket.reset();
+        _response.reset();
+
+        if (_onClosedCallback)
+        {
+            _onClosedCallback(shared_from_this());
+        }
+    }
+} // namespace ix
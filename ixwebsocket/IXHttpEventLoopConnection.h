@@ -0,0 +1,132 @@
+/*
+ *  IXHttpEventLoopConnection.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#pragma once
+
+#include "IXEventLoop.h"
+#include "IXHttp.h"
+#include "IXHttpResponder.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ix
+{
+    class HttpBodyWriter;
+    class Socket;
+
+    //
+    // Serve an HTTP server connection from an event loop thread, for asynchronous
+    // handlers. Requests are accumulated without blocking, bodies included, and passed
+    // to the handler with a responder. Responses can come from any thread, they are sent
+    // without blocking by the event loop, in the order of the requests.
+    //
+    // All methods but requestStop must be called from the event loop thread.
+    //
+    class HttpEventLoopConnection
+        : public std::enable_shared_from_this<HttpEventLoopConnection>
+    {
+    public:
+        // Invoked from the event loop thread, it should not block
+        using OnRequestCallback =
+            std::function<void(const HttpRequestPtr& request, const HttpResponderPtr& responder)>;
+        // Invoked once the connection is closed
+        using OnClosedCallback =
+            std::function<void(const std::shared_ptr<HttpEventLoopConnection>& connection)>;
+
+        HttpEventLoopConnection(EventLoopPtr eventLoop,
+                                const OnRequestCallback& onRequestCallback,
+                                const OnClosedCallback& onClosedCallback);
+        ~HttpEventLoopConnection();
+
+        // The first request must be received within timeoutSecs, the next ones within
+        // idleTimeoutSecs of the previous response. The connection is closed after
+        // maxRequests requests. Larger bodies than maxBodySize are rejected with a 413
+        // response.
+        void start(std::unique_ptr<Socket> socket,
+                   int timeoutSecs,
+                   int idleTimeoutSecs,
+                   int maxRequests,
+                   uint64_t maxBodySize);
+
+        // Thread safe. An idle connection is closed, otherwise it is closed once the
+        // response to the current request is sent.
+        void requestStop();
+
+        // Requests are buffered whole, larger ones are rejected with a 413 response
+        const static size_t kMaxRequestSize;
+
+    private:
+        enum class State
+        {
+            ReadingRequest,
+            WaitingForResponse,
+            SendingResponse,
+            Closed
+        };
+
+        void onEvent(bool readable, bool writable);
+        void onTimer();
+        void onResponse(const HttpRequestPtr& request, const HttpResponsePtr& response);
+        void onStop();
+
+        // Read what is available, and process the buffered requests
+        void readRequests();
+        // Returns true if a request was answered, and the next one can be processed
+        bool processRequest();
+        void sendResponse();
+        // Next piece of a response body, from its provider. Returns false on error.
+        bool readBody();
+        // Once a response is sent
+        void waitForNextRequest();
+
+        void scheduleRequestTimeout(int timeoutSecs);
+        void scheduleTimer();
+        // Best effort, for requests which are not answered by the handler
+        void reject(const std::string& statusLine);
+        void finish();
+
+        EventLoop& _eventLoop;
+        std::weak_ptr<EventLoop> _weakEventLoop;
+        OnRequestCallback _onRequestCallback;
+        OnClosedCallback _onClosedCallback;
+
+        State _state;
+        uint64_t _id;
+        std::unique_ptr<Socket> _socket;
+
+        int _timeoutSecs;
+        int _idleTimeoutSecs;
+        int _maxRequests;
+        uint64_t _maxBodySize;
+        uint64_t _requestCount;
+        bool _keepAlive;
+        std::atomic<bool> _stopRequested;
+
+        // Responder of the request waiting for its response
+        std::weak_ptr<HttpResponder> _responder;
+        bool _inRequestCallback;
+
+        // Deadline of the request being received
+        bool _timerScheduled;
+        std::chrono::steady_clock::time_point _requestDeadline;
+
+        // Response being sent: its head (and small body), then its body, from the
+        // response or piece by piece from its provider
+        HttpResponsePtr _response;
+        std::string _output;
+        size_t _outputOffset;
+        size_t _bodyOffset;
+        bool _sendBody;
+        std::unique_ptr<HttpBodyWriter> _bodyWriter;
+        int64_t _fileSize;
+        uint64_t _fileOffset;
+        bool _bodyDone;
+    };
+} // namespace ix
@@ -0,0 +1,529 @@
+/*
+ *  IXHttpParser.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpParser.h"
+
+#include "IXSocket.h"
+#include <algorithm>
+#include <cctype>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IXWEBSOCKET_HTTP_PARSER_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// The AVX2 kernel is compiled with a target attribute and only used when the
+// CPU supports it, so the library does not need to be built with -mavx2
+#if defined(IXWEBSOCKET_HTTP_PARSER_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define IXWEBSOCKET_HTTP_PARSER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    using ix::HttpHeaderView;
+    using ix::HttpParseResult;
+    using ix::HttpStringView;
+
+    // Characters allowed in methods and header names (tchar in RFC 7230)
+    struct TokenTable
+    {
+        bool allowed[256];
+
+        TokenTable()
+        {
+            memset(allowed, 0, sizeof(allowed));
+            for (int c = '0'; c <= '9'; ++c) allowed[c] = true;
+            for (int c = 'a'; c <= 'z'; ++c) allowed[c] = true;
+            for (int c = 'A'; c <= 'Z'; ++c) allowed[c] = true;
+            for (const char* c = "!#$%&'*+-.^_`|~"; *c; ++c) allowed[(unsigned char) *c] = true;
+        }
+    };
+
+    const TokenTable kTokenTable;
+
+    bool isTokenChar(char c)
+    {
+        return kTokenTable.allowed[(unsigned char) c];
+    }
+
+    // Control characters end a line (\r or \n) or are invalid, tab is allowed in values
+    bool isControlChar(char c)
+    {
+        unsigned char u = (unsigned char) c;
+        return (u < 0x20 && u != '\t') || u == 0x7f;
+    }
+
+    using ScanFunction = const char* (*) (const char* p, const char* end);
+
+    const char* findControlCharScalar(const char* p, const char* end)
+    {
+        while (p != end && !isControlChar(*p))
+        {
+            ++p;
+        }
+        return p;
+    }
+
+#ifdef IXWEBSOCKET_HTTP_PARSER_SSE2
+    int countTrailingZeros(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (int) index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    const char* findControlCharSSE2(const char* p, const char* end)
+    {
+        const __m128i limit = _mm_set1_epi8(0x1f);
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i del = _mm_set1_epi8(0x7f);
+
+        while (end - p >= 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*) p);
+
+            // Bytes <= 0x1f (unsigned) except tab, and DEL
+            __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(block, limit), block);
+            control = _mm_andnot_si128(_mm_cmpeq_epi8(block, tab), control);
+            control = _mm_or_si128(control, _mm_cmpeq_epi8(block, del));
+
+            uint32_t mask = (uint32_t) _mm_movemask_epi8(control);
+            if (mask != 0)
+            {
+                return p + countTrailingZeros(mask);
+            }
+            p += 16;
+        }
+
+        return findControlCharScalar(p, end);
+    }
+#endif
+
+#ifdef IXWEBSOCKET_HTTP_PARSER_AVX2
+    __attribute__((target("avx2"))) const char* findControlCharAVX2(const char* p,
+                                                                    const char* end)
+    {
+        const __m256i limit = _mm256_set1_epi8(0x1f);
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i del = _mm256_set1_epi8(0x7f);
+
+        while (end - p >= 32)
+        {
+            __m256i block = _mm256_loadu_si256((const __m256i*) p);
+
+            __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(block, limit), block);
+            control = _mm256_andnot_si256(_mm256_cmpeq_epi8(block, tab), control);
+            control = _mm256_or_si256(control, _mm256_cmpeq_epi8(block, del));
+
+            uint32_t mask = (uint32_t) _mm256_movemask_epi8(control);
+            if (mask != 0)
+            {
+                return p + countTrailingZeros(mask);
+            }
+            p += 32;
+        }
+
+        return findControlCharSSE2(p, end);
+    }
+#endif
+
+    struct ScanKernel
+    {
+        ScanFunction function;
+        const char* name;
+    };
+
+    ScanKernel selectScanKernel()
+    {
+#ifdef IXWEBSOCKET_HTTP_PARSER_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return ScanKernel {findControlCharAVX2, "avx2"};
+        }
+#endif
+
+#ifdef IXWEBSOCKET_HTTP_PARSER_SSE2
+        return ScanKernel {findControlCharSSE2, "sse2"};
+#else
+        return ScanKernel {findControlCharScalar, "scalar"};
+#endif
+    }
+
+    const ScanKernel& getScanKernel()
+    {
+        static const ScanKernel kernel = selectScanKernel();
+        return kernel;
+    }
+
+    const char* findControlChar(const char* p, const char* end)
+    {
+        return getScanKernel().function(p, end);
+    }
+
+    // Find the end of the line starting at p. On success lineEnd is the first control
+    // character (the end of the content) and next the start of the following line.
+    HttpParseResult findLineEnd(const char* p,
+                                const char* end,
+                                size_t maxLineSize,
+                                const char*& lineEnd,
+                                const char*& next)
+    {
+        lineEnd = findControlChar(p, end);
+
+        if (lineEnd == end)
+        {
+            return (size_t)(end - p) > maxLineSize ? HttpParseResult::TooLarge
+                                                    : HttpParseResult::Incomplete;
+        }
+
+        if (*lineEnd == '\r')
+        {
+            if (lineEnd + 1 == end)
+            {
+                return HttpParseResult::Incomplete;
+            }
+            if (lineEnd[1] != '\n')
+            {
+                return HttpParseResult::Invalid;
+            }
+            next = lineEnd + 2;
+        }
+        else if (*lineEnd == '\n')
+        {
+            next = lineEnd + 1;
+        }
+        else
+        {
+            return HttpParseResult::Invalid;
+        }
+
+        return (size_t)(next - p) > maxLineSize ? HttpParseResult::TooLarge
+                                                 : HttpParseResult::Complete;
+    }
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    HttpParseResult parseHeaderLines(const char* start,
+                                     const char* p,
+                                     const char* end,
+                                     std::vector<HttpHeaderView>& headers,
+                                     size_t& headSize)
+    {
+        headers.clear();
+
+        while (true)
+        {
+            if (p == end)
+            {
+                return HttpParseResult::Incomplete;
+            }
+
+            // Empty line, end of the head
+            if (*p == '\r' || *p == '\n')
+            {
+                const char* lineEnd = nullptr;
+                const char* next = nullptr;
+                auto result = findLineEnd(p, end, 2, lineEnd, next);
+                if (result != HttpParseResult::Complete) return result;
+                if (lineEnd != p) return HttpParseResult::Invalid;
+
+                headSize = next - start;
+                return HttpParseResult::Complete;
+            }
+
+            if (headers.size() == ix::HttpParser::kMaxHeaderCount)
+            {
+                return HttpParseResult::TooLarge;
+            }
+
+            const char* lineStart = p;
+            while (p != end && isTokenChar(*p))
+            {
+                ++p;
+            }
+
+            if (p == end)
+            {
+                return (size_t)(end - lineStart) > ix::HttpParser::kMaxHeaderLineSize
+                           ? HttpParseResult::TooLarge
+                           : HttpParseResult::Incomplete;
+            }
+
+            // Empty names, or continuation lines which are obsolete (RFC 7230 3.2.4)
+            if (*p != ':' || p == lineStart)
+            {
+                return HttpParseResult::Invalid;
+            }
+
+            HttpHeaderView header;
+            header.name = HttpStringView(lineStart, p - lineStart);
+
+            ++p;
+            while (p != end && isSpace(*p))
+            {
+                ++p;
+            }
+
+            const char* lineEnd = nullptr;
+            const char* next = nullptr;
+            auto result =
+                findLineEnd(lineStart, end, ix::HttpParser::kMaxHeaderLineSize, lineEnd, next);
+            if (result != HttpParseResult::Complete) return result;
+
+            // The value might be empty, and the search started from the line start
+            const char* valueStart = std::min(p, lineEnd);
+            const char* valueEnd = lineEnd;
+            while (valueEnd != valueStart && isSpace(valueEnd[-1]))
+            {
+                --valueEnd;
+            }
+
+            header.value = HttpStringView(valueStart, valueEnd - valueStart);
+            headers.push_back(header);
+
+            p = next;
+        }
+    }
+
+    bool parseVersion(const char* p, const char* end)
+    {
+        // HTTP/1.0 or HTTP/1.1
+        return end - p == 8 && memcmp(p, "HTTP/1.", 7) == 0 && (p[7] == '0' || p[7] == '1');
+    }
+
+    template<typename Parse>
+    HttpParseResult readHead(ix::Socket& socket,
+                             const ix::CancellationRequest& isCancellationRequested,
+                             Parse parse)
+    {
+        while (true)
+        {
+            size_t headSize = 0;
+            auto result =
+                parse(socket.getReadBufferData(), socket.getReadBufferSize(), headSize);
+
+            if (result == HttpParseResult::Complete)
+            {
+                socket.consumeReadBuffer(headSize);
+                return result;
+            }
+            else if (result != HttpParseResult::Incomplete)
+            {
+                return result;
+            }
+
+            if (!socket.recvIntoReadBuffer(isCancellationRequested))
+            {
+                return HttpParseResult::ReadError;
+            }
+        }
+    }
+} // namespace
+
+namespace ix
+{
+    const size_t HttpParser::kMaxHeaderLineSize(1024);
+    const size_t HttpParser::kMaxStartLineSize(8192);
+    const size_t HttpParser::kMaxHeaderCount(128);
+    const size_t HttpParser::kMaxTrailerSize(8192);
+
+    std::string HttpStringView::str() const
+    {
+        return std::string(data, size);
+    }
+
+    bool HttpStringView::operator==(const char* other) const
+    {
+        return strlen(other) == size && memcmp(data, other, size) == 0;
+    }
+
+    HttpParseResult HttpParser::parseRequest(const char* data,
+                                             size_t size,
+                                             HttpRequestHead& head,
+                                             size_t& headSize)
+    {
+        const char* p = data;
+        const char* end = data + size;
+
+        // Empty lines before the request line should be ignored (RFC 7230 3.5)
+        while (p != end && (*p == '\r' || *p == '\n'))
+        {
+            ++p;
+        }
+
+        // Request-Line = Method SP Request-URI SP HTTP-Version CRLF
+        const char* lineEnd = nullptr;
+        const char* next = nullptr;
+        auto result = findLineEnd(p, end, kMaxStartLineSize, lineEnd, next);
+        if (result != HttpParseResult::Complete) return result;
+
+        const char* method = p;
+        while (p != lineEnd && isTokenChar(*p))
+        {
+            ++p;
+        }
+        if (p == method || p == lineEnd || *p != ' ')
+        {
+            return HttpParseResult::Invalid;
+        }
+        head.method = HttpStringView(method, p - method);
+
+        const char* uri = ++p;
+        const char* version = lineEnd;
+        while (version != uri && version[-1] != ' ')
+        {
+            --version;
+        }
+        if (version == uri || version - 1 == uri || !parseVersion(version, lineEnd))
+        {
+            return HttpParseResult::Invalid;
+        }
+
+        head.uri = HttpStringView(uri, version - 1 - uri);
+        head.version = HttpStringView(version, lineEnd - version);
+
+        if (memchr(head.uri.data, ' ', head.uri.size) != nullptr)
+        {
+            return HttpParseResult::Invalid;
+        }
+
+        return parseHeaderLines(data, next, end, head.headers, headSize);
+    }
+
+    HttpParseResult HttpParser::parseResponse(const char* data,
+                                              size_t size,
+                                              HttpResponseHead& head,
+                                              size_t& headSize)
+    {
+        const char* p = data;
+        const char* end = data + size;
+
+        // Status-Line = HTTP-Version SP Status-Code SP Reason-Phrase CRLF
+        const char* lineEnd = nullptr;
+        const char* next = nullptr;
+        auto result = findLineEnd(p, end, kMaxStartLineSize, lineEnd, next);
+        if (result != HttpParseResult::Complete) return result;
+
+        const char* version = p;
+        while (p != lineEnd && *p != ' ')
+        {
+            ++p;
+        }
+        if (!parseVersion(version, p) || lineEnd - p < 4)
+        {
+            return HttpParseResult::Invalid;
+        }
+        head.version = HttpStringView(version, p - version);
+
+        ++p;
+        int statusCode = 0;
+        for (int i = 0; i < 3; ++i, ++p)
+        {
+            if (*p < '0' || *p > '9') return HttpParseResult::Invalid;
+            statusCode = statusCode * 10 + (*p - '0');
+        }
+        head.statusCode = statusCode;
+
+        // The reason phrase can be empty, some servers omit the space before it
+        if (p != lineEnd && *p++ != ' ')
+        {
+            return HttpParseResult::Invalid;
+        }
+        head.reason = HttpStringView(p, lineEnd - p);
+
+        return parseHeaderLines(data, next, end, head.headers, headSize);
+    }
+
+    HttpParseResult HttpParser::parseHeaders(const char* data,
+                                             size_t size,
+                                             std::vector<HttpHeaderView>& headers,
+                                             size_t& headSize)
+    {
+        return parseHeaderLines(data, data, data + size, headers, headSize);
+    }
+
+    HttpParseResult HttpParser::readRequest(Socket& socket,
+                                            const CancellationRequest& isCancellationRequested,
+                                            HttpRequestHead& head)
+    {
+        return readHead(socket,
+                        isCancellationRequested,
+                        [&head](const char* data, size_t size, size_t& headSize) {
+                            return parseRequest(data, size, head, headSize);
+                        });
+    }
+
+    HttpParseResult HttpParser::readResponse(Socket& socket,
+                                             const CancellationRequest& isCancellationRequested,
+                                             HttpResponseHead& head)
+    {
+        return readHead(socket,
+                        isCancellationRequested,
+                        [&head](const char* data, size_t size, size_t& headSize) {
+                            return parseResponse(data, size, head, headSize);
+                        });
+    }
+
+    HttpParseResult HttpParser::readHeaders(Socket& socket,
+                                            const CancellationRequest& isCancellationRequested,
+                                            std::vector<HttpHeaderView>& headers)
+    {
+        return readHead(socket,
+                        isCancellationRequested,
+                        [&headers](const char* data, size_t size, size_t& headSize) {
+                            return parseHeaders(data, size, headers, headSize);
+                        });
+    }
+
+    WebSocketHttpHeaders HttpParser::toHttpHeaders(const std::vector<HttpHeaderView>& headers)
+    {
+        WebSocketHttpHeaders httpHeaders;
+        for (auto&& header : headers)
+        {
+            // The last value wins for repeated headers
+            httpHeaders[header.name.str()] = header.value.str();
+        }
+        return httpHeaders;
+    }
+
+    bool HttpParser::parseChunkSize(const char* line, size_t size, uint64_t& chunkSize)
+    {
+        // At most 15 digits, so that it cannot overflow
+        chunkSize = 0;
+        size_t digits = 0;
+        for (; digits < size && isxdigit((unsigned char) line[digits]); ++digits)
+        {
+            if (digits == 15) return false;
+
+            int c = tolower((unsigned char) line[digits]);
+            chunkSize = chunkSize * 16 + (uint64_t) (isdigit(c) ? c - '0' : c - 'a' + 10);
+        }
+        if (digits == 0) return false;
+
+        // Extensions start with a ';', possibly after some whitespace
+        return digits == size || line[digits] == ';' || line[digits] == ' ' ||
+               line[digits] == '\t';
+    }
+
+    const char* HttpParser::getScanKernelName()
+    {
+        return getScanKernel().name;
+    }
+} // namespace ix
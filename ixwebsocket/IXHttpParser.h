@@ -0,0 +1,133 @@
+/*
+ *  IXHttpParser.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Incremental HTTP/1.x request and response head parser, in the spirit of
+ *  picohttpparser. It works on a contiguous buffer which may hold a partial
+ *  head, does not copy anything and returns views into that buffer.
+ *
+ *  Line ends and invalid control characters are searched 32 bytes at a time
+ *  with AVX2 (selected at runtime when the CPU supports it), 16 with SSE2 on
+ *  x86, and one by one otherwise.
+ */
+
+#pragma once
+
+#include "IXCancellationRequest.h"
+#include "IXWebSocketHttpHeaders.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace ix
+{
+    class Socket;
+
+    struct HttpStringView
+    {
+        const char* data;
+        size_t size;
+
+        HttpStringView()
+            : data(nullptr)
+            , size(0)
+        {
+        }
+
+        HttpStringView(const char* d, size_t s)
+            : data(d)
+            , size(s)
+        {
+        }
+
+        std::string str() const;
+        bool operator==(const char* other) const;
+    };
+
+    struct HttpHeaderView
+    {
+        HttpStringView name;
+        HttpStringView value;
+    };
+
+    struct HttpRequestHead
+    {
+        HttpStringView method;
+        HttpStringView uri;
+        HttpStringView version;
+        std::vector<HttpHeaderView> headers;
+    };
+
+    struct HttpResponseHead
+    {
+        HttpStringView version;
+        int statusCode;
+        HttpStringView reason;
+        std::vector<HttpHeaderView> headers;
+
+        HttpResponseHead()
+            : statusCode(0)
+        {
+        }
+    };
+
+    enum class HttpParseResult
+    {
+        Complete,
+        // More bytes are needed, parse again with the same buffer once they are appended
+        Incomplete,
+        Invalid,
+        // A header line, the request or status line or the number of headers is over the limit
+        TooLarge,
+        // Only returned when reading from a socket
+        ReadError
+    };
+
+    class HttpParser
+    {
+    public:
+        // On success headSize is the size of the head, including the empty line which ends it.
+        // Views point into data.
+        static HttpParseResult parseRequest(const char* data,
+                                            size_t size,
+                                            HttpRequestHead& head,
+                                            size_t& headSize);
+        static HttpParseResult parseResponse(const char* data,
+                                             size_t size,
+                                             HttpResponseHead& head,
+                                             size_t& headSize);
+        static HttpParseResult parseHeaders(const char* data,
+                                            size_t size,
+                                            std::vector<HttpHeaderView>& headers,
+                                            size_t& headSize);
+
+        // Receive from a socket until a complete head is buffered, and consume it. Views
+        // point into the socket read buffer, and are valid until the next read.
+        static HttpParseResult readRequest(Socket& socket,
+                                           const CancellationRequest& isCancellationRequested,
+                                           HttpRequestHead& head);
+        static HttpParseResult readResponse(Socket& socket,
+                                            const CancellationRequest& isCancellationRequested,
+                                            HttpResponseHead& head);
+        static HttpParseResult readHeaders(Socket& socket,
+                                           const CancellationRequest& isCancellationRequested,
+                                           std::vector<HttpHeaderView>& headers);
+
+        static WebSocketHttpHeaders toHttpHeaders(const std::vector<HttpHeaderView>& headers);
+
+        // The chunk size of a chunked body line (line end excluded), in hexadecimal,
+        // optionally followed by chunk extensions
+        static bool parseChunkSize(const char* line, size_t size, uint64_t& chunkSize);
+
+        // For logging and benchmarks: avx2, sse2 or scalar
+        static const char* getScanKernelName();
+
+        // Header lines (CRLF included) longer than this are rejected
+        static const size_t kMaxHeaderLineSize;
+        static const size_t kMaxStartLineSize;
+        static const size_t kMaxHeaderCount;
+        // For the trailers of chunked bodies, line ends included
+        static const size_t kMaxTrailerSize;
+    };
+} // namespace ix
@@ -0,0 +1,319 @@
+/*
+ *  IXHttpRequestBodyReader.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpRequestBodyReader.h"
+
+#include "IXHttpParser.h"
+#include "IXSocket.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const std::string kReadError("Error reading request body");
+    const std::string kChunkedReadError("Error reading chunked request body");
+    const std::string kChunkedFramingError("Invalid chunked request body");
+    const std::string kGzipError("Error during gzip decompression of the body");
+    const std::string kTooLargeError("Request body too large");
+
+    // Bodies are received that much at a time, the announced length is not trusted
+    const size_t kReadAllChunkSize(1024 * 1024);
+} // namespace
+
+namespace ix
+{
+    HttpRequestBodyReader::HttpRequestBodyReader(Socket& socket,
+                                                 int64_t contentLength,
+                                                 bool gzip,
+                                                 int timeoutSecs)
+        : _socket(socket)
+        , _timeoutSecs(timeoutSecs)
+        , _requestInitCancellation(false)
+        , _state(contentLength < 0 ? State::ChunkSize : State::ContentLength)
+        , _remaining(contentLength < 0 ? 0 : (uint64_t) contentLength)
+        , _receivedSize(0)
+        , _framingSize(0)
+        , _trailerSize(0)
+        , _tooLarge(false)
+        , _invalid(false)
+    {
+        if (gzip)
+        {
+            _decompressor.reset(new GzipDecompressor());
+            if (!_decompressor->init()) failInvalid(kGzipError);
+        }
+    }
+
+    bool HttpRequestBodyReader::read(std::string& chunk)
+    {
+        chunk.clear();
+        if (!_errorMsg.empty()) return false;
+
+        auto isCancellationRequested =
+            makeCancellationRequestWithTimeout(_timeoutSecs, _requestInitCancellation);
+
+        std::string data;
+        while (chunk.empty())
+        {
+            if (!readRaw(data, isCancellationRequested)) return false;
+
+            if (data.empty())
+            {
+                // The compressed content was cut short
+                if (_decompressor && _receivedSize != 0 && !_decompressor->isDone())
+                {
+                    return failInvalid(kGzipError);
+                }
+                return true;
+            }
+
+            if (!_decompressor)
+            {
+                chunk.swap(data);
+                return true;
+            }
+
+            // Compression can take several pieces to produce anything
+            bool success = _decompressor->decompress(
+                data.data(), data.size(), [&chunk](const char* output, size_t size) {
+                    chunk.append(output, size);
+                    return true;
+                });
+            if (!success) return failInvalid(kGzipError);
+        }
+
+        return true;
+    }
+
+    bool HttpRequestBodyReader::readAll(std::string& body, uint64_t maxSize)
+    {
+        uint64_t maxBodySize = (body.size() < maxSize) ? maxSize - body.size() : 0;
+        uint64_t bodySize = 0;
+
+        // Received in place when nothing has to be decoded
+        if (_state == State::ContentLength && !_decompressor && _errorMsg.empty())
+        {
+            if (_remaining > maxBodySize)
+            {
+                _tooLarge = true;
+                return fail(kTooLargeError);
+            }
+
+            auto isCancellationRequested =
+                makeCancellationRequestWithTimeout(_timeoutSecs, _requestInitCancellation);
+
+            while (_remaining != 0)
+            {
+                size_t size = (size_t) std::min(_remaining, (uint64_t) kReadAllChunkSize);
+                auto res = _socket.readBytes(size, nullptr, isCancellationRequested);
+                if (!res.first) return fail(kReadError + ": " + res.second);
+
+                _receivedSize += size;
+                _remaining -= size;
+                if (body.empty())
+                {
+                    body = std::move(res.second);
+                }
+                else
+                {
+                    body += res.second;
+                }
+            }
+
+            _state = State::Done;
+            return true;
+        }
+
+        uint64_t start = _receivedSize + _framingSize;
+        std::string chunk;
+        while (true)
+        {
+            if (!read(chunk)) return false;
+            if (chunk.empty()) return true;
+
+            // Chunked and compressed bodies are only known to be too large as they arrive
+            bodySize += chunk.size();
+            if (bodySize > maxBodySize || _receivedSize + _framingSize - start > maxBodySize)
+            {
+                _tooLarge = true;
+                return fail(kTooLargeError);
+            }
+
+            body += chunk;
+        }
+    }
+
+    bool HttpRequestBodyReader::discard(uint64_t maxSize)
+    {
+        if (!_errorMsg.empty()) return false;
+
+        if (_state == State::ContentLength && _remaining > maxSize)
+        {
+            return fail("Request body too large to be discarded");
+        }
+
+        auto isCancellationRequested =
+            makeCancellationRequestWithTimeout(_timeoutSecs, _requestInitCancellation);
+
+        uint64_t start = _receivedSize + _framingSize;
+        std::string data;
+        while (true)
+        {
+            if (!readRaw(data, isCancellationRequested)) return false;
+            if (data.empty()) break;
+
+            if (_receivedSize + _framingSize - start > maxSize)
+            {
+                return fail("Request body too large to be discarded");
+            }
+        }
+
+        return true;
+    }
+
+    bool HttpRequestBodyReader::readRaw(std::string& data,
+                                        const CancellationRequest& isCancellationRequested)
+    {
+        data.clear();
+
+        while (_state != State::Done)
+        {
+            if (_state == State::ChunkSize)
+            {
+                std::string line;
+                uint64_t chunkSize = 0;
+                if (!readLine(line, isCancellationRequested)) return fail(kChunkedReadError);
+                if (!HttpParser::parseChunkSize(line.data(), line.size(), chunkSize))
+                {
+                    return failInvalid(kChunkedFramingError);
+                }
+
+                _remaining = chunkSize;
+                _state = (chunkSize == 0) ? State::Trailer : State::Chunk;
+                continue;
+            }
+            else if (_state == State::ChunkEnd)
+            {
+                // The line that terminates the chunk (\r\n)
+                std::string line;
+                if (!readLine(line, isCancellationRequested)) return fail(kChunkedReadError);
+                if (!line.empty()) return failInvalid(kChunkedFramingError);
+
+                _state = State::ChunkSize;
+                continue;
+            }
+            else if (_state == State::Trailer)
+            {
+                // Trailer headers are ignored, up to the final empty line
+                std::string line;
+                if (!readLine(line, isCancellationRequested)) return fail(kChunkedReadError);
+                if (_trailerSize > HttpParser::kMaxTrailerSize)
+                {
+                    return failInvalid(kChunkedFramingError);
+                }
+
+                if (line.empty())
+                {
+                    _state = State::Done;
+                }
+                continue;
+            }
+
+            if (_remaining == 0)
+            {
+                _state = (_state == State::Chunk) ? State::ChunkEnd : State::Done;
+                continue;
+            }
+
+            if (_socket.getReadBufferSize() == 0 &&
+                !_socket.recvIntoReadBuffer(isCancellationRequested))
+            {
+                return fail(_state == State::Chunk ? kChunkedReadError : kReadError);
+            }
+
+            size_t size = (size_t) std::min((uint64_t) _socket.getReadBufferSize(), _remaining);
+            data.assign(_socket.getReadBufferData(), size);
+            _socket.consumeReadBuffer(size);
+
+            _remaining -= size;
+            _receivedSize += size;
+            return true;
+        }
+
+        return true;
+    }
+
+    bool HttpRequestBodyReader::readLine(std::string& line,
+                                         const CancellationRequest& isCancellationRequested)
+    {
+        size_t searchFrom = 0;
+        while (true)
+        {
+            const char* data = _socket.getReadBufferData();
+            size_t size = std::min(_socket.getReadBufferSize(), HttpParser::kMaxHeaderLineSize);
+
+            auto p = (const char*) memchr(data + searchFrom, '\n', size - searchFrom);
+            if (p != nullptr)
+            {
+                size_t lineSize = (size_t) (p - data) + 1;
+                size_t lineEnd = lineSize - 1;
+                if (lineEnd > 0 && data[lineEnd - 1] == '\r') --lineEnd;
+
+                line.assign(data, lineEnd);
+                _socket.consumeReadBuffer(lineSize);
+                _framingSize += lineSize;
+                if (_state == State::Trailer) _trailerSize += lineSize;
+                return true;
+            }
+
+            if (size == HttpParser::kMaxHeaderLineSize)
+            {
+                _invalid = true;
+                return false;
+            }
+
+            searchFrom = size;
+            if (!_socket.recvIntoReadBuffer(isCancellationRequested)) return false;
+        }
+    }
+
+    bool HttpRequestBodyReader::fail(const std::string& errorMsg)
+    {
+        _errorMsg = errorMsg;
+        return false;
+    }
+
+    bool HttpRequestBodyReader::failInvalid(const std::string& errorMsg)
+    {
+        _invalid = true;
+        return fail(errorMsg);
+    }
+
+    bool HttpRequestBodyReader::isDone() const
+    {
+        return _state == State::Done;
+    }
+
+    bool HttpRequestBodyReader::isTooLarge() const
+    {
+        return _tooLarge;
+    }
+
+    bool HttpRequestBodyReader::isInvalid() const
+    {
+        return _invalid;
+    }
+
+    uint64_t HttpRequestBodyReader::getReceivedSize() const
+    {
+        return _receivedSize;
+    }
+
+    const std::string& HttpRequestBodyReader::getErrorMsg() const
+    {
+        return _errorMsg;
+    }
+} // namespace ix
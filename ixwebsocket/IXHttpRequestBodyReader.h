@@ -0,0 +1,91 @@
+/*
+ *  IXHttpRequestBodyReader.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  The body of a request received by HttpServer, read piece by piece as it arrives
+ *  instead of being held in memory at once.
+ */
+
+#pragma once
+
+#include "IXCancellationRequest.h"
+#include "IXGzipCodec.h"
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+
+namespace ix
+{
+    class Socket;
+
+    class HttpRequestBodyReader
+    {
+    public:
+        // A contentLength of -1 means chunked transfer encoding. Each read waits up to
+        // timeoutSecs for the client.
+        HttpRequestBodyReader(Socket& socket, int64_t contentLength, bool gzip, int timeoutSecs);
+
+        // Set chunk to the next piece of the body, decompressed if needed, as soon as it
+        // is received. chunk is empty once the whole body was read. Returns false if the
+        // body cannot be read.
+        bool read(std::string& chunk);
+
+        // Read the whole body at once, appended to body. Fails without reading further
+        // once more than maxSize bytes would be appended, or were received with the
+        // chunked framing (see isTooLarge).
+        bool readAll(std::string& body,
+                     uint64_t maxSize = std::numeric_limits<uint64_t>::max());
+
+        // Read and drop what is left of the body, so that the next request on the
+        // connection can be read. Returns false if more than maxSize bytes are left,
+        // chunked framing included.
+        bool discard(uint64_t maxSize);
+
+        bool isDone() const;
+        // Whether readAll failed because of its maxSize
+        bool isTooLarge() const;
+        // Whether the body was malformed, rather than not received
+        bool isInvalid() const;
+        // Bytes received from the client, before decompression
+        uint64_t getReceivedSize() const;
+        const std::string& getErrorMsg() const;
+
+    private:
+        enum class State
+        {
+            ContentLength,
+            ChunkSize,
+            Chunk,
+            ChunkEnd,
+            Trailer,
+            Done
+        };
+
+        // Next piece of the body as sent by the client, empty at the end
+        bool readRaw(std::string& data, const CancellationRequest& isCancellationRequested);
+        // A line of the chunked framing, line end excluded. Longer lines than
+        // HttpParser::kMaxHeaderLineSize are not buffered, they fail the read.
+        bool readLine(std::string& line, const CancellationRequest& isCancellationRequested);
+        bool fail(const std::string& errorMsg);
+        bool failInvalid(const std::string& errorMsg);
+
+        Socket& _socket;
+        int _timeoutSecs;
+        std::atomic<bool> _requestInitCancellation;
+
+        State _state;
+        // Left to read in the body, or in the current chunk
+        uint64_t _remaining;
+        uint64_t _receivedSize;
+        // Chunk sizes, line ends and trailers
+        uint64_t _framingSize;
+        uint64_t _trailerSize;
+        std::unique_ptr<GzipDecompressor> _decompressor;
+        std::string _errorMsg;
+        bool _tooLarge;
+        bool _invalid;
+    };
+} // namespace ix
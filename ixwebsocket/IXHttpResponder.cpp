@@ -0,0 +1,89 @@
+/*
+ *  IXHttpResponder.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpResponder.h"
+
+namespace ix
+{
+    HttpResponder::HttpResponder(const OnResponseCallback& onResponseCallback)
+        : _onResponseCallback(onResponseCallback)
+        , _responded(false)
+        , _connectionClosed(false)
+    {
+        ;
+    }
+
+    HttpResponder::~HttpResponder()
+    {
+        respond(500, "Internal Server Error", "The handler did not respond");
+    }
+
+    bool HttpResponder::respond(const HttpResponsePtr& response)
+    {
+        if (_connectionClosed || _responded.exchange(true)) return false;
+
+        _onResponseCallback(response);
+        return true;
+    }
+
+    bool HttpResponder::respond(int statusCode,
+                                const std::string& description,
+                                const std::string& body,
+                                const WebSocketHttpHeaders& headers)
+    {
+        if (_connectionClosed || _responded) return false;
+
+        return respond(std::make_shared<HttpResponse>(
+            statusCode, description, HttpErrorCode::Ok, headers, body));
+    }
+
+    bool HttpResponder::forward(const HttpResponsePtr& response)
+    {
+        if (response->errorCode == HttpErrorCode::Timeout)
+        {
+            return respond(504, "Gateway Timeout", response->errorMsg);
+        }
+        else if (response->errorCode != HttpErrorCode::Ok)
+        {
+            return respond(502, "Bad Gateway", response->errorMsg);
+        }
+
+        auto forwarded = std::make_shared<HttpResponse>(response->statusCode,
+                                                        response->description,
+                                                        HttpErrorCode::Ok,
+                                                        response->headers,
+                                                        response->body);
+
+        for (auto name : {"Connection",
+                          "Content-Encoding",
+                          "Content-Length",
+                          "Keep-Alive",
+                          "Proxy-Connection",
+                          "Trailer",
+                          "Transfer-Encoding",
+                          "Upgrade"})
+        {
+            forwarded->headers.erase(name);
+        }
+
+        return respond(forwarded);
+    }
+
+    bool HttpResponder::hasResponded() const
+    {
+        return _responded;
+    }
+
+    bool HttpResponder::isConnectionClosed() const
+    {
+        return _connectionClosed;
+    }
+
+    void HttpResponder::setConnectionClosed()
+    {
+        _connectionClosed = true;
+    }
+} // namespace ix
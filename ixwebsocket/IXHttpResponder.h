@@ -0,0 +1,55 @@
+/*
+ *  IXHttpResponder.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Completes a request given to an asynchronous HttpServer handler, from any thread
+ *  and at any time after the handler returned.
+ */
+
+#pragma once
+
+#include "IXHttp.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+
+namespace ix
+{
+    class HttpResponder
+    {
+    public:
+        using OnResponseCallback = std::function<void(const HttpResponsePtr& response)>;
+
+        HttpResponder(const OnResponseCallback& onResponseCallback);
+        // A 500 response is sent if none was, so that the client is not left waiting
+        ~HttpResponder();
+
+        // Thread safe. Only the first response is sent, false is returned for the next ones
+        // and once the connection is closed.
+        bool respond(const HttpResponsePtr& response);
+        bool respond(int statusCode,
+                     const std::string& description,
+                     const std::string& body = std::string(),
+                     const WebSocketHttpHeaders& headers = WebSocketHttpHeaders());
+
+        // Respond with the response of an HttpClient request, for proxy handlers. Its
+        // Content-Length, Transfer-Encoding and hop-by-hop headers are dropped, and so is
+        // its Content-Encoding since HttpClient decompresses bodies. Requests which failed
+        // become a 502 Bad Gateway, or a 504 Gateway Timeout.
+        bool forward(const HttpResponsePtr& response);
+
+        bool hasResponded() const;
+
+        // Set once the client is gone, long running handlers can check it and give up
+        bool isConnectionClosed() const;
+        void setConnectionClosed();
+
+    private:
+        OnResponseCallback _onResponseCallback;
+        std::atomic<bool> _responded;
+        std::atomic<bool> _connectionClosed;
+    };
+
+    using HttpResponderPtr = std::shared_ptr<HttpResponder>;
+} // namespace ix
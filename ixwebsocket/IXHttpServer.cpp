@@ -6,45 +6,27 @@
 
 #include "IXHttpServer.h"
 
-#include "IXGzipCodec.h"
+#include "IXHttpBodyProvider.h"
+#include "IXHttpEventLoopConnection.h"
+#include "IXHttpRequestBodyReader.h"
+#include "IXHttpStaticFileHandler.h"
 #include "IXNetSystem.h"
 #include "IXSocketConnect.h"
+#include "IXUniquePtr.h"
 #include "IXUserAgent.h"
+#include <chrono>
 #include <cstring>
-#include <fstream>
+#include <future>
 #include <sstream>
-#include <vector>
-
-namespace
-{
-    std::pair<bool, std::vector<uint8_t>> load(const std::string& path)
-    {
-        std::vector<uint8_t> memblock;
-
-        std::ifstream file(path);
-        if (!file.is_open()) return std::make_pair(false, memblock);
-
-        file.seekg(0, file.end);
-        std::streamoff size = file.tellg();
-        file.seekg(0, file.beg);
-
-        memblock.resize((size_t) size);
-        file.read((char*) &memblock.front(), static_cast<std::streamsize>(size));
-
-        return std::make_pair(true, memblock);
-    }
-
-    std::pair<bool, std::string> readAsString(const std::string& path)
-    {
-        auto res = load(path);
-        auto vec = res.second;
-        return std::make_pair(res.first, std::string(vec.begin(), vec.end()));
-    }
-} // namespace
 
 namespace ix
 {
     const int HttpServer::kDefaultTimeoutSecs(30);
+    const int HttpServer::kDefaultIdleTimeoutSecs(5);
+    const int HttpServer::kDefaultMaxRequestsPerConnection(1000);
+    const int HttpServer::kIdlePollIntervalMs(100);
+    const uint64_t HttpServer::kMaxDiscardedBodySize(1024 * 1024);
+    const uint64_t HttpServer::kDefaultMaxRequestBodySize(16 * 1024 * 1024);
 
     HttpServer::HttpServer(int port,
                            const std::string& host,
@@ -53,8 +35,15 @@ namespace ix
                            int addressFamily,
                            int timeoutSecs)
         : SocketServer(port, host, backlog, maxConnections, addressFamily)
+        , _streamRequestBodies(false)
         , _connectedClientsCount(0)
         , _timeoutSecs(timeoutSecs)
+        , _idleTimeoutSecs(kDefaultIdleTimeoutSecs)
+        , _maxRequestsPerConnection(kDefaultMaxRequestsPerConnection)
+        , _maxRequestBodySize(kDefaultMaxRequestBodySize)
+        , _stopping(false)
+        , _useEventLoop(false)
+        , _eventLoopThreads(0)
     {
         setDefaultConnectionCallback();
     }
@@ -68,14 +57,94 @@ namespace ix
     {
         stopAcceptingConnections();
 
+        // Idle persistent connections are closed, the ones processing a request are
+        // closed after sending their response
+        _stopping = true;
+
         // FIXME: cancelling / closing active clients ...
 
         SocketServer::stop();
+        stopEventLoopConnections();
+
+        _stopping = false;
+    }
+
+    void HttpServer::stopEventLoopConnections()
+    {
+        if (!_eventLoopPool) return;
+
+        {
+            std::unique_lock<std::mutex> lock(_eventLoopConnectionsMutex);
+            for (auto&& connection : _eventLoopConnections)
+            {
+                connection->requestStop();
+            }
+
+            // Give the requests being processed a chance to be answered
+            _eventLoopConnectionsCondition.wait_for(
+                lock, std::chrono::seconds(_timeoutSecs), [this] {
+                    return _eventLoopConnections.empty();
+                });
+        }
+
+        // Stopping the loops releases the remaining connections
+        _eventLoopPool.reset();
+
+        std::lock_guard<std::mutex> lock(_eventLoopConnectionsMutex);
+        _connectedClientsCount -= (int) _eventLoopConnections.size();
+        _eventLoopConnections.clear();
     }
 
     void HttpServer::setOnConnectionCallback(const OnConnectionCallback& callback)
     {
         _onConnectionCallback = callback;
+        _streamRequestBodies = false;
+        _useEventLoop = false;
+    }
+
+    void HttpServer::setOnStreamingConnectionCallback(const OnConnectionCallback& callback)
+    {
+        _onConnectionCallback = callback;
+        _streamRequestBodies = true;
+        _useEventLoop = false;
+    }
+
+    void HttpServer::setOnAsyncConnectionCallback(const OnAsyncConnectionCallback& callback,
+                                                  size_t threads)
+    {
+        _onAsyncConnectionCallback = callback;
+        _streamRequestBodies = false;
+        _useEventLoop = true;
+        _eventLoopThreads = threads;
+
+        // Without event loops, the connection thread waits for the response
+        _onConnectionCallback =
+            [callback](HttpRequestPtr request,
+                       std::shared_ptr<ConnectionState> connectionState) -> HttpResponsePtr {
+            auto promise = std::make_shared<std::promise<HttpResponsePtr>>();
+            auto future = promise->get_future();
+            {
+                auto responder = std::make_shared<HttpResponder>(
+                    [promise](const HttpResponsePtr& response) { promise->set_value(response); });
+                callback(request, connectionState, responder);
+            }
+            return future.get();
+        };
+    }
+
+    void HttpServer::setIdleTimeoutSecs(int idleTimeoutSecs)
+    {
+        _idleTimeoutSecs = idleTimeoutSecs;
+    }
+
+    void HttpServer::setMaxRequestsPerConnection(int maxRequestsPerConnection)
+    {
+        _maxRequestsPerConnection = maxRequestsPerConnection;
+    }
+
+    void HttpServer::setMaxRequestBodySize(uint64_t maxRequestBodySize)
+    {
+        _maxRequestBodySize = maxRequestBodySize;
     }
 
     void HttpServer::handleConnection(std::unique_ptr<Socket> socket,
@@ -83,15 +152,55 @@ namespace ix
     {
         _connectedClientsCount++;
 
-        auto ret = Http::parseRequest(socket, _timeoutSecs);
-        // FIXME: handle errors in parseRequest
-
-        if (std::get<0>(ret))
+        int requestCount = 0;
+        while (true)
         {
-            auto response = _onConnectionCallback(std::get<2>(ret), connectionState);
-            if (!Http::sendResponse(response, socket))
+            // Pipelined requests are buffered already, and answered in order
+            if (requestCount != 0 && !waitForNextRequest(socket))
+            {
+                break;
+            }
+
+            // The body is read below, so that its size can be checked
+            int errorStatusCode = 0;
+            auto ret = Http::parseRequest(socket, _timeoutSecs, true, &errorStatusCode);
+            if (!std::get<0>(ret))
+            {
+                if (errorStatusCode != 0) rejectRequest(socket, errorStatusCode);
+                break;
+            }
+
+            auto request = std::get<2>(ret);
+            ++requestCount;
+
+            if (!_streamRequestBodies && !readRequestBody(request, socket))
+            {
+                break;
+            }
+
+            bool keepAlive = requestCount < _maxRequestsPerConnection && !_stopping &&
+                             Http::canKeepAlive(request);
+
+            auto response = _onConnectionCallback(request, connectionState);
+
+            if (request->bodyReader && !request->bodyReader->discard(kMaxDiscardedBodySize))
+            {
+                keepAlive = false;
+            }
+
+            auto connection = Http::getConnectionHeader(request, response, keepAlive);
+            bool chunked = request->version != "HTTP/1.0";
+            bool headOnly = request->method == "HEAD";
+
+            if (!Http::sendResponse(response, socket, connection, chunked, headOnly))
             {
                 logError("Cannot send response");
+                break;
+            }
+
+            if (!keepAlive)
+            {
+                break;
             }
         }
         connectionState->setTerminated();
@@ -99,6 +208,136 @@ namespace ix
         _connectedClientsCount--;
     }
 
+    bool HttpServer::readRequestBody(const HttpRequestPtr& request,
+                                     std::unique_ptr<Socket>& socket)
+    {
+        auto bodyReader = std::move(request->bodyReader);
+        if (bodyReader->readAll(request->body, _maxRequestBodySize)) return true;
+
+        if (bodyReader->isTooLarge())
+        {
+            rejectRequest(socket, 413);
+        }
+        else if (bodyReader->isInvalid())
+        {
+            rejectRequest(socket, 400);
+        }
+        return false;
+    }
+
+    void HttpServer::rejectRequest(std::unique_ptr<Socket>& socket, int statusCode)
+    {
+        std::string description("Bad Request");
+        if (statusCode == 413)
+        {
+            description = "Payload Too Large";
+        }
+        else if (statusCode == 431)
+        {
+            description = "Request Header Fields Too Large";
+        }
+
+        // Like the event loop connections, with an empty body
+        auto response = std::make_shared<HttpResponse>(statusCode, description);
+        Http::sendResponse(response, socket, "close");
+    }
+
+    bool HttpServer::waitForNextRequest(std::unique_ptr<Socket>& socket)
+    {
+        if (socket->getReadBufferSize() != 0)
+        {
+            return true;
+        }
+
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(_idleTimeoutSecs);
+
+        while (!_stopping)
+        {
+            auto pollResult = socket->isReadyToRead(kIdlePollIntervalMs);
+            if (pollResult == PollResultType::ReadyForRead)
+            {
+                return true;
+            }
+            else if (pollResult != PollResultType::Timeout)
+            {
+                return false;
+            }
+
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                return false;
+            }
+        }
+
+        return false;
+    }
+
+    bool HttpServer::handleConnectionWithEventLoop(
+        std::unique_ptr<Socket>& socket, std::shared_ptr<ConnectionState> connectionState)
+    {
+        if (!_useEventLoop) return false;
+
+        // Only called from the accept thread, the pool is created lazily so that
+        // the server can be restarted after being stopped.
+        if (!_eventLoopPool)
+        {
+            auto eventLoopPool = ix::make_unique<EventLoopPool>(_eventLoopThreads);
+
+            std::string errorMsg;
+            if (!eventLoopPool->start("HttpServer", errorMsg))
+            {
+                logError("HttpServer cannot start its event loops, falling back to one "
+                         "thread per connection: " +
+                         errorMsg);
+                _useEventLoop = false;
+                return false;
+            }
+            _eventLoopPool = std::move(eventLoopPool);
+        }
+
+        _connectedClientsCount++;
+
+        auto callback = _onAsyncConnectionCallback;
+        auto eventLoop = _eventLoopPool->getNextEventLoop();
+        auto connection = std::make_shared<HttpEventLoopConnection>(
+            eventLoop,
+            [callback, connectionState](const HttpRequestPtr& request,
+                                        const HttpResponderPtr& responder) {
+                callback(request, connectionState, responder);
+            },
+            [this, connectionState](const std::shared_ptr<HttpEventLoopConnection>& connection) {
+                connectionState->setTerminated();
+
+                std::lock_guard<std::mutex> lock(_eventLoopConnectionsMutex);
+                if (_eventLoopConnections.erase(connection) != 0) _connectedClientsCount--;
+                _eventLoopConnectionsCondition.notify_all();
+            });
+
+        {
+            std::lock_guard<std::mutex> lock(_eventLoopConnectionsMutex);
+            _eventLoopConnections.insert(connection);
+        }
+
+        // std::function needs a copyable object
+        auto sharedSocket = std::make_shared<std::unique_ptr<Socket>>(std::move(socket));
+        int timeoutSecs = _timeoutSecs;
+        int idleTimeoutSecs = _idleTimeoutSecs;
+        int maxRequests = _maxRequestsPerConnection;
+        uint64_t maxBodySize = _maxRequestBodySize;
+
+        eventLoop->post(
+            [connection, sharedSocket, timeoutSecs, idleTimeoutSecs, maxRequests, maxBodySize] {
+                connection->start(std::move(*sharedSocket),
+                                  timeoutSecs,
+                                  idleTimeoutSecs,
+                                  maxRequests,
+                                  maxBodySize);
+            });
+
+        return true;
+    }
+
     size_t HttpServer::getConnectedClientsCount()
     {
         return _connectedClientsCount;
@@ -106,56 +345,37 @@ namespace ix
 
     void HttpServer::setDefaultConnectionCallback()
     {
-        setOnConnectionCallback(
-            [this](HttpRequestPtr request,
-                   std::shared_ptr<ConnectionState> connectionState) -> HttpResponsePtr {
-                std::string uri(request->uri);
-                if (uri.empty() || uri == "/")
-                {
-                    uri = "/index.html";
-                }
+        auto staticFileHandler = std::make_shared<HttpStaticFileHandler>(".");
 
-                WebSocketHttpHeaders headers;
-                headers["Server"] = userAgent();
+        setOnConnectionCallback(
+            [this, staticFileHandler](
+                HttpRequestPtr request,
+                std::shared_ptr<ConnectionState> connectionState) -> HttpResponsePtr {
+                auto response = staticFileHandler->handleRequest(request);
+                response->headers["Server"] = userAgent();
 
-                std::string path("." + uri);
-                auto res = readAsString(path);
-                bool found = res.first;
-                if (!found)
+                if (response->statusCode == 404)
                 {
-                    return std::make_shared<HttpResponse>(
-                        404, "Not Found", HttpErrorCode::Ok, WebSocketHttpHeaders(), std::string());
+                    return response;
                 }
 
-                std::string content = res.second;
-
-#ifdef IXWEBSOCKET_USE_ZLIB
-                std::string acceptEncoding = request->headers["Accept-encoding"];
-                if (acceptEncoding == "*" || acceptEncoding.find("gzip") != std::string::npos)
-                {
-                    content = gzipCompress(content);
-                    headers["Content-Encoding"] = "gzip";
-                }
-#endif
+                int64_t size = (int64_t) response->body.size();
+                if (response->bodyProvider) size = response->bodyProvider->getSize();
 
                 // Log request
                 std::stringstream ss;
                 ss << connectionState->getRemoteIp() << ":" << connectionState->getRemotePort()
                    << " " << request->method << " " << request->headers["User-Agent"] << " "
-                   << request->uri << " " << content.size();
+                   << request->uri << " " << response->statusCode << " " << size;
                 logInfo(ss.str());
 
-                // FIXME: check extensions to set the content type
-                // headers["Content-Type"] = "application/octet-stream";
-                headers["Accept-Ranges"] = "none";
-
-                for (auto&& it : request->headers)
-                {
-                    headers[it.first] = it.second;
-                }
+                // The request headers are sent back, without overriding the response ones
+                WebSocketHttpHeaders requestHeaders = request->headers;
+                requestHeaders.erase("Content-Length");
+                requestHeaders.erase("Transfer-Encoding");
+                response->headers.insert(requestHeaders.begin(), requestHeaders.end());
 
-                return std::make_shared<HttpResponse>(
-                    200, "OK", HttpErrorCode::Ok, headers, content);
+                return response;
             });
     }
 
@@ -6,9 +6,12 @@
 
 #pragma once
 
+#include "IXEventLoop.h"
 #include "IXHttp.h"
+#include "IXHttpResponder.h"
 #include "IXSocketServer.h"
 #include "IXWebSocket.h"
+#include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -19,11 +22,15 @@
 
 namespace ix
 {
+    class HttpEventLoopConnection;
+
     class HttpServer final : public SocketServer
     {
     public:
         using OnConnectionCallback =
             std::function<HttpResponsePtr(HttpRequestPtr, std::shared_ptr<ConnectionState>)>;
+        using OnAsyncConnectionCallback = std::function<void(
+            HttpRequestPtr, std::shared_ptr<ConnectionState>, HttpResponderPtr)>;
 
         HttpServer(int port = SocketServer::kDefaultPort,
                    const std::string& host = SocketServer::kDefaultHost,
@@ -36,23 +43,91 @@ namespace ix
 
         void setOnConnectionCallback(const OnConnectionCallback& callback);
 
+        // Streaming variant: the callback is called once the request headers are read,
+        // and can read the body with request->bodyReader as it arrives. What it does not
+        // read is discarded before the response is sent.
+        void setOnStreamingConnectionCallback(const OnConnectionCallback& callback);
+
+        // Asynchronous variant: the callback answers with the responder, from any thread
+        // and after returning, so that waiting for a backend (such as with an async
+        // HttpClient) does not hold a thread. Connections are multiplexed on a fixed pool
+        // of event loop threads (epoll, Linux only), 0 means one thread per core. The
+        // callback is invoked from them and should not block. Request bodies are read
+        // whole before it is invoked. Must be called before start. Falls back to one
+        // thread per connection, waiting for the responses, if event loops are not
+        // supported.
+        void setOnAsyncConnectionCallback(const OnAsyncConnectionCallback& callback,
+                                          size_t threads = 0);
+
         void makeRedirectServer(const std::string& redirectUrl);
 
         void makeDebugServer();
 
+        // Connections are kept open between requests (HTTP/1.1 keep-alive, and HTTP/1.0
+        // clients which ask for it), until they are idle for too long or have served the
+        // maximum number of requests. A maximum of 1 disables keep-alive.
+        void setIdleTimeoutSecs(int idleTimeoutSecs);
+        void setMaxRequestsPerConnection(int maxRequestsPerConnection);
+
+        // Request bodies are read whole before the callback is invoked, except for
+        // streaming handlers. Larger ones are answered with 413 and the connection is
+        // closed, chunked bodies counting their framing. Whatever the mode, malformed
+        // requests are answered with 400, and headers which are too large with 431,
+        // before closing the connection as well.
+        void setMaxRequestBodySize(uint64_t maxRequestBodySize);
+
+        const static int kDefaultIdleTimeoutSecs;
+        const static int kDefaultMaxRequestsPerConnection;
+        const static uint64_t kDefaultMaxRequestBodySize;
+
     private:
         // Member variables
         OnConnectionCallback _onConnectionCallback;
+        bool _streamRequestBodies;
         std::atomic<int> _connectedClientsCount;
 
         const static int kDefaultTimeoutSecs;
         int _timeoutSecs;
 
+        std::atomic<int> _idleTimeoutSecs;
+        std::atomic<int> _maxRequestsPerConnection;
+        std::atomic<uint64_t> _maxRequestBodySize;
+        std::atomic<bool> _stopping;
+
+        // Event loop mode, for asynchronous callbacks
+        OnAsyncConnectionCallback _onAsyncConnectionCallback;
+        std::atomic<bool> _useEventLoop;
+        size_t _eventLoopThreads;
+        std::unique_ptr<EventLoopPool> _eventLoopPool;
+        std::mutex _eventLoopConnectionsMutex;
+        std::condition_variable _eventLoopConnectionsCondition;
+        std::set<std::shared_ptr<HttpEventLoopConnection>> _eventLoopConnections;
+
+        // Idle connections check for the server being stopped that often
+        const static int kIdlePollIntervalMs;
+
+        // Request bodies left unread by streaming handlers are read and dropped up to
+        // that size to keep the connection, it is closed for larger ones
+        const static uint64_t kMaxDiscardedBodySize;
+
         // Methods
         virtual void handleConnection(std::unique_ptr<Socket>,
                                       std::shared_ptr<ConnectionState> connectionState) final;
+        virtual bool handleConnectionWithEventLoop(
+            std::unique_ptr<Socket>& socket, std::shared_ptr<ConnectionState> connectionState);
         virtual size_t getConnectedClientsCount() final;
 
         void setDefaultConnectionCallback();
+        // Close the event loop connections, once their current request is answered
+        void stopEventLoopConnections();
+
+        // Returns false if the connection was closed or stayed idle for too long
+        bool waitForNextRequest(std::unique_ptr<Socket>& socket);
+        // Read the body of a request for a non streaming handler. Returns false, after
+        // answering with 413 if the body is too large, or 400 if it is malformed, when the
+        // connection must be closed.
+        bool readRequestBody(const HttpRequestPtr& request, std::unique_ptr<Socket>& socket);
+        // Answer a request which cannot be handled, before closing the connection
+        void rejectRequest(std::unique_ptr<Socket>& socket, int statusCode);
     };
 } // namespace ix
@@ -0,0 +1,566 @@
+/*
+ *  IXHttpStaticFileHandler.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXHttpStaticFileHandler.h"
+
+#include "IXGzipCodec.h"
+#include "IXHttpBodyProvider.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace
+{
+    std::string getContentType(const std::string& path)
+    {
+        static const std::unordered_map<std::string, std::string> contentTypes = {
+            {"css", "text/css"},
+            {"csv", "text/csv"},
+            {"gif", "image/gif"},
+            {"htm", "text/html"},
+            {"html", "text/html"},
+            {"ico", "image/x-icon"},
+            {"jpeg", "image/jpeg"},
+            {"jpg", "image/jpeg"},
+            {"js", "application/javascript"},
+            {"json", "application/json"},
+            {"map", "application/json"},
+            {"mjs", "application/javascript"},
+            {"mp4", "video/mp4"},
+            {"pdf", "application/pdf"},
+            {"png", "image/png"},
+            {"svg", "image/svg+xml"},
+            {"ttf", "font/ttf"},
+            {"txt", "text/plain"},
+            {"wasm", "application/wasm"},
+            {"webp", "image/webp"},
+            {"woff", "font/woff"},
+            {"woff2", "font/woff2"},
+            {"xml", "application/xml"},
+        };
+
+        auto dot = path.find_last_of('.');
+        auto slash = path.find_last_of('/');
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        {
+            std::string extension = path.substr(dot + 1);
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+            auto it = contentTypes.find(extension);
+            if (it != contentTypes.end()) return it->second;
+        }
+
+        return "application/octet-stream";
+    }
+
+    // The file requested by uri in rootDirectory, or an empty string if the uri is not
+    // valid or points outside of it
+    std::string getFilePath(const std::string& rootDirectory, const std::string& uri)
+    {
+        // The query string is not part of the path
+        std::string target = uri.substr(0, uri.find_first_of("?#"));
+        if (target.empty() || target[0] != '/') return std::string();
+
+        std::string path;
+        for (size_t i = 0; i < target.size(); ++i)
+        {
+            char c = target[i];
+            if (c == '%')
+            {
+                if (i + 2 >= target.size() || !isxdigit((unsigned char) target[i + 1]) ||
+                    !isxdigit((unsigned char) target[i + 2]))
+                {
+                    return std::string();
+                }
+
+                c = (char) std::strtol(target.substr(i + 1, 2).c_str(), nullptr, 16);
+                i += 2;
+            }
+
+            if (c == '\0' || c == '\\') return std::string();
+            path += c;
+        }
+
+        std::stringstream ss(path);
+        std::string segment;
+        while (std::getline(ss, segment, '/'))
+        {
+            if (segment == "..") return std::string();
+        }
+
+        if (path.back() == '/') path += "index.html";
+        return rootDirectory + path;
+    }
+
+    bool readFile(const std::string& path, uint64_t size, std::string& content)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr) return false;
+
+        content.resize((size_t) size);
+        size_t ret = (size == 0) ? 0 : fread(&content[0], 1, (size_t) size, file);
+        fclose(file);
+
+        // The file changed since it was checked
+        return ret == size;
+    }
+
+    // Changes of a file within the same second are only seen when its size changes
+    std::string makeETag(time_t mtime, uint64_t size, bool gzip)
+    {
+        std::stringstream ss;
+        ss << "\"" << std::hex << size << "-" << (uint64_t) mtime;
+        if (gzip) ss << "-gzip";
+        ss << "\"";
+        return ss.str();
+    }
+
+    bool matchesETag(const ix::WebSocketHttpHeaders& headers, const std::string& etag)
+    {
+        auto it = headers.find("If-None-Match");
+        if (it == headers.end()) return false;
+
+        // A list of ETags, weak ones are compared as strong ones
+        std::stringstream ss(it->second);
+        std::string tag;
+        while (std::getline(ss, tag, ','))
+        {
+            auto begin = tag.find_first_not_of(" \t");
+            auto end = tag.find_last_not_of(" \t");
+            if (begin == std::string::npos) continue;
+
+            tag = tag.substr(begin, end - begin + 1);
+            if (tag.compare(0, 2, "W/") == 0) tag = tag.substr(2);
+
+            if (tag == etag || tag == "*") return true;
+        }
+
+        return false;
+    }
+
+    // Inclusive byte ranges, first and last
+    using ByteRanges = std::vector<std::pair<uint64_t, uint64_t>>;
+
+    bool parseRangeNumber(const std::string& str, uint64_t& value)
+    {
+        // Larger values do not fit in 64 bits
+        if (str.empty() || str.size() > 18) return false;
+        for (auto c : str)
+        {
+            if (c < '0' || c > '9') return false;
+        }
+
+        value = std::strtoull(str.c_str(), nullptr, 10);
+        return true;
+    }
+
+    // The ranges of a Range header which are within a file of the given size, sorted,
+    // with the overlapping and adjacent ones merged. Returns false if the header is not
+    // a valid set of byte ranges, it is then ignored and the whole file is sent.
+    bool parseRanges(const std::string& value,
+                     uint64_t size,
+                     size_t maxRanges,
+                     ByteRanges& ranges)
+    {
+        if (value.compare(0, 6, "bytes=") != 0) return false;
+
+        std::stringstream ss(value.substr(6));
+        std::string spec;
+        size_t count = 0;
+        while (std::getline(ss, spec, ','))
+        {
+            auto begin = spec.find_first_not_of(" \t");
+            auto end = spec.find_last_not_of(" \t");
+            if (begin == std::string::npos) continue;
+
+            spec = spec.substr(begin, end - begin + 1);
+            if (++count > maxRanges) return false;
+
+            auto dash = spec.find('-');
+            if (dash == std::string::npos) return false;
+
+            uint64_t first = 0;
+            uint64_t last = 0;
+            if (dash == 0)
+            {
+                // The last bytes of the file: -suffixLength
+                uint64_t suffixLength;
+                if (!parseRangeNumber(spec.substr(1), suffixLength)) return false;
+                if (suffixLength == 0 || size == 0) continue;
+
+                first = size - std::min(suffixLength, size);
+                last = size - 1;
+            }
+            else
+            {
+                if (!parseRangeNumber(spec.substr(0, dash), first)) return false;
+
+                last = size - 1;
+                if (dash + 1 != spec.size())
+                {
+                    if (!parseRangeNumber(spec.substr(dash + 1), last)) return false;
+                    if (last < first) return false;
+                }
+
+                if (first >= size) continue;
+                last = std::min(last, size - 1);
+            }
+
+            ranges.push_back(std::make_pair(first, last));
+        }
+        if (count == 0) return false;
+
+        std::sort(ranges.begin(), ranges.end());
+        ByteRanges merged;
+        for (auto&& range : ranges)
+        {
+            if (!merged.empty() && range.first <= merged.back().second + 1)
+            {
+                merged.back().second = std::max(merged.back().second, range.second);
+            }
+            else
+            {
+                merged.push_back(range);
+            }
+        }
+        ranges.swap(merged);
+        return true;
+    }
+
+    std::string makeContentRange(uint64_t first, uint64_t last, uint64_t size)
+    {
+        std::stringstream ss;
+        ss << "bytes " << first << "-" << last << "/" << size;
+        return ss.str();
+    }
+
+    std::string makeBoundary()
+    {
+        std::random_device random;
+        std::stringstream ss;
+        ss << std::hex << std::setfill('0');
+        for (int i = 0; i < 4; ++i)
+        {
+            ss << std::setw(8) << (uint32_t) random();
+        }
+        return ss.str();
+    }
+
+    bool acceptsGzip(const ix::WebSocketHttpHeaders& headers)
+    {
+        auto it = headers.find("Accept-Encoding");
+        if (it == headers.end()) return false;
+
+        return it->second == "*" || it->second.find("gzip") != std::string::npos;
+    }
+
+    // 206 with the requested ranges of the file, from its cached content when there is
+    // one, or 416 when none of them is within the file
+    ix::HttpResponsePtr makeRangeResponse(const std::string& path,
+                                          const std::shared_ptr<const std::string>& content,
+                                          uint64_t size,
+                                          const ByteRanges& ranges,
+                                          const ix::WebSocketHttpHeaders& headers)
+    {
+        if (ranges.empty())
+        {
+            auto response = std::make_shared<ix::HttpResponse>(
+                416, "Range Not Satisfiable", ix::HttpErrorCode::Ok, headers);
+            response->headers["Content-Range"] = "bytes */" + std::to_string(size);
+            return response;
+        }
+
+        auto response = std::make_shared<ix::HttpResponse>(
+            206, "Partial Content", ix::HttpErrorCode::Ok, headers);
+
+        if (ranges.size() == 1)
+        {
+            uint64_t first = ranges[0].first;
+            uint64_t length = ranges[0].second - first + 1;
+            response->headers["Content-Range"] = makeContentRange(first, ranges[0].second, size);
+
+            if (content)
+            {
+                response->body = content->substr((size_t) first, (size_t) length);
+                return response;
+            }
+
+            // Sent from the file with sendfile
+            response->bodyProvider = ix::HttpBodyProvider::fromFile(path, first, (int64_t) length);
+            if (!response->bodyProvider)
+            {
+                return std::make_shared<ix::HttpResponse>(404, "Not Found");
+            }
+            return response;
+        }
+
+        // Several ranges are sent as a multipart/byteranges body, with a Content-Range
+        // header for each part
+        std::string boundary = makeBoundary();
+        std::string contentType = response->headers["Content-Type"];
+        response->headers["Content-Type"] = "multipart/byteranges; boundary=" + boundary;
+
+        std::string body;
+        std::vector<ix::HttpBodyProviderPtr> parts;
+        for (auto&& range : ranges)
+        {
+            uint64_t length = range.second - range.first + 1;
+
+            std::stringstream ss;
+            ss << "--" << boundary << "\r\n"
+               << "Content-Type: " << contentType << "\r\n"
+               << "Content-Range: " << makeContentRange(range.first, range.second, size)
+               << "\r\n"
+               << "\r\n";
+
+            if (content)
+            {
+                body += ss.str();
+                body.append(*content, (size_t) range.first, (size_t) length);
+                body += "\r\n";
+                continue;
+            }
+
+            auto part = ix::HttpBodyProvider::fromFile(path, range.first, (int64_t) length);
+            if (!part)
+            {
+                return std::make_shared<ix::HttpResponse>(404, "Not Found");
+            }
+
+            parts.push_back(ix::HttpBodyProvider::fromString(ss.str()));
+            parts.push_back(part);
+            parts.push_back(ix::HttpBodyProvider::fromString("\r\n"));
+        }
+
+        std::string closingBoundary = "--" + boundary + "--\r\n";
+        if (content)
+        {
+            response->body = body + closingBoundary;
+        }
+        else
+        {
+            parts.push_back(ix::HttpBodyProvider::fromString(closingBoundary));
+            response->bodyProvider = ix::HttpBodyProvider::fromParts(parts);
+        }
+        return response;
+    }
+} // namespace
+
+namespace ix
+{
+    const uint64_t HttpStaticFileHandler::kDefaultMaxCacheSize(64 * 1024 * 1024);
+    const uint64_t HttpStaticFileHandler::kMaxCachedFileSize(4 * 1024 * 1024);
+    const size_t HttpStaticFileHandler::kMaxRanges(16);
+
+    HttpStaticFileHandler::HttpStaticFileHandler(const std::string& rootDirectory,
+                                                 uint64_t maxCacheSize)
+        : _rootDirectory(rootDirectory)
+        , _maxCacheSize(maxCacheSize)
+        , _cacheSize(0)
+    {
+        ;
+    }
+
+    HttpResponsePtr HttpStaticFileHandler::handleRequest(const HttpRequestPtr& request)
+    {
+        std::string path = getFilePath(_rootDirectory, request->uri);
+
+        struct stat st;
+        if (path.empty() || stat(path.c_str(), &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG)
+        {
+            return std::make_shared<HttpResponse>(404, "Not Found");
+        }
+
+        uint64_t size = (uint64_t) st.st_size;
+        time_t mtime = st.st_mtime;
+
+        CachedFilePtr file;
+        if (size <= kMaxCachedFileSize && size <= _maxCacheSize)
+        {
+            file = getCachedFile(path, mtime, size);
+        }
+
+        // Ranges are counted on the file itself, never on its gzip version. A client
+        // resuming a download with If-Range gets the whole file if it changed.
+        std::string etag = makeETag(mtime, size, false);
+        ByteRanges ranges;
+        auto rangeIt = request->headers.find("Range");
+        auto ifRangeIt = request->headers.find("If-Range");
+        bool ranged = rangeIt != request->headers.end() &&
+                      (request->method == "GET" || request->method == "HEAD") &&
+                      (ifRangeIt == request->headers.end() || ifRangeIt->second == etag) &&
+                      parseRanges(rangeIt->second, size, kMaxRanges, ranges);
+
+        std::shared_ptr<const std::string> content;
+        bool gzip = false;
+        if (file)
+        {
+            content = file->content;
+
+            if (!ranged && acceptsGzip(request->headers))
+            {
+                auto gzipContent = getGzipContent(path, file);
+                if (gzipContent)
+                {
+                    content = gzipContent;
+                    gzip = true;
+                }
+            }
+        }
+
+        WebSocketHttpHeaders headers;
+        headers["ETag"] = gzip ? makeETag(mtime, size, true) : etag;
+        if (file) headers["Vary"] = "Accept-Encoding";
+
+        if (matchesETag(request->headers, headers["ETag"]))
+        {
+            return std::make_shared<HttpResponse>(304, "Not Modified", HttpErrorCode::Ok, headers);
+        }
+
+        headers["Content-Type"] = getContentType(path);
+        headers["Accept-Ranges"] = "bytes";
+        if (gzip) headers["Content-Encoding"] = "gzip";
+
+        if (ranged)
+        {
+            return makeRangeResponse(path, content, size, ranges, headers);
+        }
+
+        if (content)
+        {
+            return std::make_shared<HttpResponse>(200, "OK", HttpErrorCode::Ok, headers, *content);
+        }
+
+        // Sent from the file with sendfile, without being read here
+        auto response = std::make_shared<HttpResponse>(200, "OK", HttpErrorCode::Ok, headers);
+        response->bodyProvider = HttpBodyProvider::fromFile(path);
+        if (!response->bodyProvider)
+        {
+            return std::make_shared<HttpResponse>(404, "Not Found");
+        }
+        return response;
+    }
+
+    HttpStaticFileHandler::CachedFilePtr HttpStaticFileHandler::getCachedFile(
+        const std::string& path, time_t mtime, uint64_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            auto it = _cache.find(path);
+            if (it != _cache.end())
+            {
+                auto file = it->second.first;
+                if (file->mtime == mtime && file->size == size)
+                {
+                    _lru.splice(_lru.begin(), _lru, it->second.second);
+                    return file;
+                }
+
+                remove(path);
+            }
+        }
+
+        // Read without holding the lock, a file read by two requests at once is cached
+        // by the last one
+        std::string content;
+        if (!readFile(path, size, content)) return nullptr;
+
+        auto file = std::make_shared<CachedFile>();
+        file->mtime = mtime;
+        file->size = size;
+        file->content = std::make_shared<const std::string>(std::move(content));
+        file->gzipDone = false;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        insert(path, file);
+        evict();
+        return file;
+    }
+
+    std::shared_ptr<const std::string> HttpStaticFileHandler::getGzipContent(
+        const std::string& path, const CachedFilePtr& file)
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (file->gzipDone) return file->gzipContent;
+        }
+
+        std::shared_ptr<const std::string> gzipContent;
+        std::string compressed = gzipCompress(*file->content);
+        if (compressed.size() < file->content->size())
+        {
+            gzipContent = std::make_shared<const std::string>(std::move(compressed));
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!file->gzipDone)
+        {
+            file->gzipDone = true;
+            file->gzipContent = gzipContent;
+
+            // Counted if the file is still cached
+            auto it = _cache.find(path);
+            if (gzipContent && it != _cache.end() && it->second.first == file)
+            {
+                _cacheSize += gzipContent->size();
+                evict();
+            }
+        }
+        return file->gzipContent;
+#else
+        (void) path;
+        (void) file;
+        return nullptr;
+#endif
+    }
+
+    void HttpStaticFileHandler::insert(const std::string& path, const CachedFilePtr& file)
+    {
+        remove(path);
+
+        _lru.push_front(path);
+        _cache[path] = std::make_pair(file, _lru.begin());
+        _cacheSize += file->content->size();
+    }
+
+    void HttpStaticFileHandler::remove(const std::string& path)
+    {
+        auto it = _cache.find(path);
+        if (it == _cache.end()) return;
+
+        auto file = it->second.first;
+        _cacheSize -= file->content->size();
+        if (file->gzipContent) _cacheSize -= file->gzipContent->size();
+
+        auto lruIt = it->second.second;
+        _cache.erase(it);
+        _lru.erase(lruIt);
+    }
+
+    void HttpStaticFileHandler::evict()
+    {
+        while (_cacheSize > _maxCacheSize && !_lru.empty())
+        {
+            std::string path = _lru.back();
+            remove(path);
+        }
+    }
+
+    uint64_t HttpStaticFileHandler::getCacheSize() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _cacheSize;
+    }
+} // namespace ix
@@ -0,0 +1,78 @@
+/*
+ *  IXHttpStaticFileHandler.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Serves the files of a directory for HttpServer. Small files are kept in memory,
+ *  with their gzip version, larger ones are sent with sendfile. Range requests are
+ *  answered with the requested parts of the files.
+ */
+
+#pragma once
+
+#include "IXHttp.h"
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ix
+{
+    class HttpStaticFileHandler
+    {
+    public:
+        // Files are kept in a cache of up to maxCacheSize bytes, gzip versions included,
+        // and the least recently used ones are dropped first. 0 disables the cache.
+        HttpStaticFileHandler(const std::string& rootDirectory = ".",
+                              uint64_t maxCacheSize = kDefaultMaxCacheSize);
+
+        // 200 with the file content, 304 when the client If-None-Match header holds its
+        // ETag, 206 or 416 for Range requests, or 404. Thread safe.
+        HttpResponsePtr handleRequest(const HttpRequestPtr& request);
+
+        uint64_t getCacheSize() const;
+
+        const static uint64_t kDefaultMaxCacheSize;
+        // Larger files are never cached
+        const static uint64_t kMaxCachedFileSize;
+        // Range headers with more ranges are ignored
+        const static size_t kMaxRanges;
+
+    private:
+        struct CachedFile
+        {
+            time_t mtime;
+            uint64_t size;
+            std::shared_ptr<const std::string> content;
+            // Compressed the first time a client accepts it, and dropped if it is not
+            // smaller than the content
+            std::shared_ptr<const std::string> gzipContent;
+            bool gzipDone;
+        };
+
+        using CachedFilePtr = std::shared_ptr<CachedFile>;
+
+        // Cached content of a file, loaded if it is missing or out of date
+        CachedFilePtr getCachedFile(const std::string& path, time_t mtime, uint64_t size);
+        std::shared_ptr<const std::string> getGzipContent(const std::string& path,
+                                                          const CachedFilePtr& file);
+        void insert(const std::string& path, const CachedFilePtr& file);
+        void remove(const std::string& path);
+        // Drop the least recently used files until the cache is under its maximum size
+        void evict();
+
+        std::string _rootDirectory;
+        uint64_t _maxCacheSize;
+
+        mutable std::mutex _mutex;
+        // Most recently used paths first
+        std::list<std::string> _lru;
+        std::unordered_map<std::string,
+                           std::pair<CachedFilePtr, std::list<std::string>::iterator>>
+            _cache;
+        uint64_t _cacheSize;
+    };
+} // namespace ix
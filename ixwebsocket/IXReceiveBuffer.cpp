@@ -0,0 +1,116 @@
+/*
+ *  IXReceiveBuffer.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXReceiveBuffer.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace ix
+{
+    ReceiveBuffer::ReceiveBuffer()
+        : _readPos(0)
+        , _writePos(0)
+    {
+        ;
+    }
+
+    uint8_t* ReceiveBuffer::data()
+    {
+        return _buffer.data() + _readPos;
+    }
+
+    const uint8_t* ReceiveBuffer::data() const
+    {
+        return _buffer.data() + _readPos;
+    }
+
+    size_t ReceiveBuffer::size() const
+    {
+        return _writePos - _readPos;
+    }
+
+    bool ReceiveBuffer::empty() const
+    {
+        return _writePos == _readPos;
+    }
+
+    uint8_t& ReceiveBuffer::operator[](size_t i)
+    {
+        return _buffer[_readPos + i];
+    }
+
+    const uint8_t& ReceiveBuffer::operator[](size_t i) const
+    {
+        return _buffer[_readPos + i];
+    }
+
+    void ReceiveBuffer::consume(size_t n)
+    {
+        _readPos += std::min(n, size());
+
+        // Rewinding an empty buffer is free
+        if (_readPos == _writePos)
+        {
+            _readPos = 0;
+            _writePos = 0;
+        }
+    }
+
+    void ReceiveBuffer::clear()
+    {
+        _readPos = 0;
+        _writePos = 0;
+    }
+
+    uint8_t* ReceiveBuffer::prepare(size_t minSize)
+    {
+        if (_buffer.size() - _writePos >= minSize)
+        {
+            return _buffer.data() + _writePos;
+        }
+
+        // Moving the unread bytes back to the front is only worth it when they
+        // are few, otherwise the buffer grows so that moves stay amortized.
+        size_t unread = size();
+        if (_buffer.size() - unread < minSize || unread > _buffer.size() / 2)
+        {
+            _buffer.resize(std::max(2 * _buffer.size(), unread + minSize));
+        }
+
+        if (_readPos != 0)
+        {
+            memmove(_buffer.data(), _buffer.data() + _readPos, unread);
+            _readPos = 0;
+            _writePos = unread;
+        }
+
+        return _buffer.data() + _writePos;
+    }
+
+    void ReceiveBuffer::commit(size_t n)
+    {
+        _writePos = std::min(_writePos + n, _buffer.size());
+    }
+
+    void ReceiveBuffer::append(const uint8_t* bytes, size_t n)
+    {
+        if (n == 0) return;
+
+        memcpy(prepare(n), bytes, n);
+        commit(n);
+    }
+
+    void ReceiveBuffer::append(const std::string& str)
+    {
+        append((const uint8_t*) str.data(), str.size());
+    }
+
+    size_t ReceiveBuffer::capacity() const
+    {
+        return _buffer.size();
+    }
+} // namespace ix
@@ -0,0 +1,54 @@
+/*
+ *  IXReceiveBuffer.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  A contiguous byte buffer with read and write cursors. Data is received
+ *  straight into the free space at the end of the buffer, and consumed from
+ *  the front by moving the read cursor, without moving the remaining bytes.
+ *  The unread bytes are only moved back to the front of the buffer when more
+ *  space is needed at the end.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ix
+{
+    class ReceiveBuffer
+    {
+    public:
+        ReceiveBuffer();
+
+        // Unread bytes
+        uint8_t* data();
+        const uint8_t* data() const;
+        size_t size() const;
+        bool empty() const;
+        uint8_t& operator[](size_t i);
+        const uint8_t& operator[](size_t i) const;
+
+        // Mark the first n unread bytes as read
+        void consume(size_t n);
+        void clear();
+
+        // Return a pointer to at least minSize writable bytes at the end of the
+        // buffer. commit must be called with the number of bytes written.
+        uint8_t* prepare(size_t minSize);
+        void commit(size_t n);
+
+        void append(const uint8_t* bytes, size_t n);
+        void append(const std::string& str);
+
+        size_t capacity() const;
+
+    private:
+        std::vector<uint8_t> _buffer;
+        size_t _readPos;
+        size_t _writePos;
+    };
+} // namespace ix
@@ -14,6 +14,7 @@
 #include <array>
 #include <assert.h>
 #include <fcntl.h>
+#include <limits>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,17 @@
 #include <sys/types.h>
 #include <vector>
 
+#ifdef __linux__
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 #ifdef min
 #undef min
 #endif
@@ -29,10 +41,13 @@ namespace ix
 {
     const int Socket::kDefaultPollNoTimeout = -1; // No poll timeout by default
     const int Socket::kDefaultPollTimeout = kDefaultPollNoTimeout;
+    constexpr size_t Socket::kMaxSendBuffers;
+    constexpr size_t Socket::kReadBufferChunkSize;
 
     Socket::Socket(int fd)
         : _sockfd(fd)
         , _selectInterrupt(createSelectInterrupt())
+        , _readBufferOffset(0)
     {
         ;
     }
@@ -184,13 +199,15 @@ namespace ix
     bool Socket::connect(const std::string& host,
                          int port,
                          std::string& errMsg,
-                         const CancellationRequest& isCancellationRequested)
+                         const CancellationRequest& isCancellationRequested,
+                         int timeoutSecs)
     {
         std::lock_guard<std::mutex> lock(_socketMutex);
 
         if (!_selectInterrupt->clear()) return false;
 
-        _sockfd = SocketConnect::connect(host, port, errMsg, isCancellationRequested);
+        _sockfd = SocketConnect::connect(
+            host, port, errMsg, isCancellationRequested, _selectInterrupt, timeoutSecs);
         return _sockfd != -1;
     }
 
@@ -228,6 +245,108 @@ namespace ix
         return send((char*) &buffer[0], buffer.size());
     }
 
+    ssize_t Socket::sendv(const SocketBuffer* buffers, size_t count)
+    {
+#if defined(_WIN32)
+        return sendEach(buffers, count);
+#else
+        struct iovec iov[kMaxSendBuffers];
+        if (count > kMaxSendBuffers)
+        {
+            return sendEach(buffers, count);
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            iov[i].iov_base = (void*) buffers[i].data;
+            iov[i].iov_len = buffers[i].size;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;
+#endif
+
+        return ::sendmsg(_sockfd, &msg, flags);
+#endif
+    }
+
+    ssize_t Socket::sendEach(const SocketBuffer* buffers, size_t count)
+    {
+        ssize_t total = 0;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (buffers[i].size == 0) continue;
+
+            ssize_t ret = send((char*) buffers[i].data, buffers[i].size);
+            if (ret < 0)
+            {
+                // Report what was sent already, the error will show up on the next call
+                return (total > 0) ? total : ret;
+            }
+
+            total += ret;
+            if ((size_t) ret < buffers[i].size) break;
+        }
+
+        return total;
+    }
+
+    ssize_t Socket::sendFile(int fd, uint64_t offset, size_t length)
+    {
+#ifdef __linux__
+        // sendfile has no MSG_NOSIGNAL flag. SIGPIPE is blocked for this thread while it
+        // runs, and the one raised by a closed connection is discarded.
+        sigset_t sigpipeMask;
+        sigset_t previousMask;
+        sigemptyset(&sigpipeMask);
+        sigaddset(&sigpipeMask, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &sigpipeMask, &previousMask);
+
+        sigset_t pending;
+        sigpending(&pending);
+        bool wasPending = sigismember(&pending, SIGPIPE) == 1;
+
+        off_t fileOffset = (off_t) offset;
+        ssize_t ret = ::sendfile(_sockfd, fd, &fileOffset, length);
+        int err = errno;
+
+        if (ret < 0 && err == EPIPE && !wasPending)
+        {
+            struct timespec noWait = {0, 0};
+            sigtimedwait(&sigpipeMask, nullptr, &noWait);
+        }
+
+        pthread_sigmask(SIG_SETMASK, &previousMask, nullptr);
+        errno = err;
+        return ret;
+#else
+        return sendFileCopy(fd, offset, length);
+#endif
+    }
+
+    ssize_t Socket::sendFileCopy(int fd, uint64_t offset, size_t length)
+    {
+        std::array<char, kReadBufferChunkSize> buffer;
+        size_t size = std::min(length, buffer.size());
+
+#ifdef _WIN32
+        if (_lseeki64(fd, (__int64) offset, SEEK_SET) < 0) return -1;
+        ssize_t ret = _read(fd, buffer.data(), (unsigned int) size);
+#else
+        ssize_t ret = ::pread(fd, buffer.data(), size, (off_t) offset);
+#endif
+        if (ret <= 0) return ret;
+
+        return send(buffer.data(), (size_t) ret);
+    }
+
     ssize_t Socket::recv(void* buffer, size_t length)
     {
         int flags = 0;
@@ -278,10 +397,12 @@ namespace ix
     }
 
     bool Socket::writeBytes(const std::string& str,
-                            const CancellationRequest& isCancellationRequested)
+                            const CancellationRequest& isCancellationRequested,
+                            size_t* sentSize)
     {
         int offset = 0;
         int len = (int) str.size();
+        if (sentSize) *sentSize = 0;
 
         while (true)
         {
@@ -292,6 +413,8 @@ namespace ix
             // We wrote some bytes, as needed, all good.
             if (ret > 0)
             {
+                if (sentSize) *sentSize += (size_t) ret;
+
                 if (ret == len)
                 {
                     return true;
@@ -303,10 +426,13 @@ namespace ix
                     continue;
                 }
             }
-            // There is possibly something to be writen, try again
+            // The socket send buffer is full, wait until there is room in it
             else if (ret < 0 && Socket::isWaitNeeded())
             {
-                continue;
+                if (isReadyToWrite(kWritePollTimeoutMs) == PollResultType::Error)
+                {
+                    return false;
+                }
             }
             // There was an error during the write, abort
             else
@@ -316,57 +442,136 @@ namespace ix
         }
     }
 
-    bool Socket::readByte(void* buffer, const CancellationRequest& isCancellationRequested)
+    bool Socket::writeBuffers(const SocketBuffer* buffers,
+                              size_t count,
+                              const CancellationRequest& isCancellationRequested)
     {
-        while (true)
+        // What is left to send, the first buffer can be partially sent
+        std::array<SocketBuffer, kMaxSendBuffers> pending;
+        size_t pendingCount = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (buffers[i].size == 0) continue;
+
+            // Too many buffers for a single system call, the rest is sent on its own
+            if (pendingCount == pending.size())
+            {
+                return writeBuffers(pending.data(), pendingCount, isCancellationRequested) &&
+                       writeBuffers(buffers + i, count - i, isCancellationRequested);
+            }
+            pending[pendingCount++] = buffers[i];
+        }
+
+        size_t index = 0;
+        while (index != pendingCount)
         {
             if (isCancellationRequested && isCancellationRequested()) return false;
 
-            ssize_t ret;
-            ret = recv(buffer, 1);
+            ssize_t ret = sendv(&pending[index], pendingCount - index);
 
-            // We read one byte, as needed, all good.
-            if (ret == 1)
+            if (ret > 0)
             {
-                return true;
+                size_t sent = (size_t) ret;
+                while (index != pendingCount && sent >= pending[index].size)
+                {
+                    sent -= pending[index].size;
+                    index++;
+                }
+                if (sent != 0)
+                {
+                    pending[index].data += sent;
+                    pending[index].size -= sent;
+                }
             }
-            // There is possibly something to be read, try again
             else if (ret < 0 && Socket::isWaitNeeded())
             {
-                // Wait with a 1ms timeout until the socket is ready to read.
-                // This way we are not busy looping
-                if (isReadyToRead(1) == PollResultType::Error)
+                if (isReadyToWrite(kWritePollTimeoutMs) == PollResultType::Error)
                 {
                     return false;
                 }
             }
-            // There was an error during the read, abort
             else
             {
                 return false;
             }
         }
+
+        return true;
+    }
+
+    bool Socket::writeFile(int fd,
+                           uint64_t offset,
+                           uint64_t length,
+                           const CancellationRequest& isCancellationRequested)
+    {
+        while (length != 0)
+        {
+            if (isCancellationRequested && isCancellationRequested()) return false;
+
+            size_t size = (size_t) std::min(length, (uint64_t) kSendFileChunkSize);
+            ssize_t ret = sendFile(fd, offset, size);
+
+            if (ret > 0)
+            {
+                offset += (uint64_t) ret;
+                length -= (uint64_t) ret;
+            }
+            else if (ret < 0 && Socket::isWaitNeeded())
+            {
+                if (isReadyToWrite(kWritePollTimeoutMs) == PollResultType::Error)
+                {
+                    return false;
+                }
+            }
+            // Error, or a file shorter than expected
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Socket::readByte(void* buffer, const CancellationRequest& isCancellationRequested)
+    {
+        if (_readBufferOffset == _readBuffer.size() && !recvIntoReadBuffer(isCancellationRequested))
+        {
+            return false;
+        }
+
+        *(char*) buffer = _readBuffer[_readBufferOffset++];
+        return true;
     }
 
     std::pair<bool, std::string> Socket::readLine(
         const CancellationRequest& isCancellationRequested)
     {
-        char c;
-        std::string line;
-        line.reserve(64);
+        // Lines are at least 2 characters long (\r\n), the terminating \n is searched
+        // in the buffered bytes, and more bytes are received until it shows up
+        size_t searchFrom = _readBufferOffset + 1;
 
-        for (int i = 0; i < 2 || (line[i - 2] != '\r' && line[i - 1] != '\n'); ++i)
+        while (true)
         {
-            if (!readByte(&c, isCancellationRequested))
+            size_t pos = _readBuffer.find('\n', searchFrom);
+            if (pos != std::string::npos)
+            {
+                std::string line(_readBuffer, _readBufferOffset, pos + 1 - _readBufferOffset);
+                _readBufferOffset = pos + 1;
+                return std::make_pair(true, line);
+            }
+
+            size_t lineSize = _readBuffer.size() - _readBufferOffset;
+            if (!recvIntoReadBuffer(isCancellationRequested))
             {
                 // Return what we were able to read
+                std::string line(takeReadBuffer());
                 return std::make_pair(false, line);
             }
 
-            line += c;
+            // The buffer might have been compacted
+            searchFrom = _readBufferOffset + std::max(lineSize, (size_t) 1);
         }
-
-        return std::make_pair(true, line);
     }
 
 #if defined( _MSC_VER)
@@ -378,9 +583,14 @@ namespace ix
         const OnProgressCallback& onProgressCallback,
         const CancellationRequest& isCancellationRequested)
     {
-        std::array<uint8_t, 1 << 14> readBuffer;
+        // Start with what was already buffered, then receive the rest in place. The output
+        // grows as data arrives, since the length usually comes from the peer.
+        size_t buffered = std::min(_readBuffer.size() - _readBufferOffset, length);
+        std::string output;
+        output.reserve(std::min(length, std::max(buffered, kReadBufferChunkSize)));
+        output.append(_readBuffer, _readBufferOffset, buffered);
+        _readBufferOffset += buffered;
 
-        std::vector<uint8_t> output;
         while (output.size() != length)
         {
             if (isCancellationRequested && isCancellationRequested())
@@ -389,30 +599,151 @@ namespace ix
                 return std::make_pair(false, errorMsg);
             }
 
-            size_t size = std::min(readBuffer.size(), length - output.size());
-            ssize_t ret = recv((char*) &readBuffer[0], size);
+            size_t received = output.size();
+            size_t size = std::min(length - received, kReadBufferChunkSize);
+            output.resize(received + size);
+            ssize_t ret = recv(&output[received], size);
+            output.resize(received + (ret > 0 ? (size_t) ret : 0));
 
             if (ret > 0)
             {
-                output.insert(output.end(), readBuffer.begin(), readBuffer.begin() + ret);
+                if (onProgressCallback) onProgressCallback((int) output.size(), (int) length);
+            }
+            else if (ret < 0 && Socket::isWaitNeeded())
+            {
+                // Wait with a 1ms timeout until the socket is ready to read.
+                // This way we are not busy looping
+                if (isReadyToRead(1) == PollResultType::Error)
+                {
+                    const std::string errorMsg("Poll Error");
+                    return std::make_pair(false, errorMsg);
+                }
             }
-            else if (ret <= 0 && !Socket::isWaitNeeded())
+            else
             {
                 const std::string errorMsg("Recv Error");
                 return std::make_pair(false, errorMsg);
             }
+        }
 
-            if (onProgressCallback) onProgressCallback((int) output.size(), (int) length);
+        return std::make_pair(true, std::move(output));
+    }
 
-            // Wait with a 1ms timeout until the socket is ready to read.
-            // This way we are not busy looping
-            if (isReadyToRead(1) == PollResultType::Error)
+    ssize_t Socket::recvIntoReadBuffer()
+    {
+        // Compact the buffer when everything has been consumed, or when the consumed bytes
+        // would make it grow forever while it is read and consumed incrementally
+        if (_readBufferOffset == _readBuffer.size())
+        {
+            _readBuffer.clear();
+            _readBufferOffset = 0;
+        }
+        else if (_readBufferOffset >= kReadBufferChunkSize)
+        {
+            _readBuffer.erase(0, _readBufferOffset);
+            _readBufferOffset = 0;
+        }
+
+        size_t size = _readBuffer.size();
+        _readBuffer.resize(size + kReadBufferChunkSize);
+        ssize_t ret = recv(&_readBuffer[size], kReadBufferChunkSize);
+        _readBuffer.resize(size + (ret > 0 ? (size_t) ret : 0));
+
+        return ret;
+    }
+
+    bool Socket::recvIntoReadBuffer(const CancellationRequest& isCancellationRequested)
+    {
+        while (true)
+        {
+            if (isCancellationRequested && isCancellationRequested()) return false;
+
+            ssize_t ret = recvIntoReadBuffer();
+
+            if (ret > 0)
             {
-                const std::string errorMsg("Poll Error");
-                return std::make_pair(false, errorMsg);
+                return true;
+            }
+            // There is possibly something to be read, try again
+            else if (ret < 0 && Socket::isWaitNeeded())
+            {
+                // Wait with a 1ms timeout until the socket is ready to read.
+                // This way we are not busy looping
+                if (isReadyToRead(1) == PollResultType::Error)
+                {
+                    return false;
+                }
+            }
+            // There was an error during the read, or the connection was closed
+            else
+            {
+                return false;
             }
         }
+    }
+
+    bool Socket::fillReadBuffer()
+    {
+        bool wouldBlock;
+        return fillReadBuffer(std::numeric_limits<size_t>::max(), wouldBlock);
+    }
 
-        return std::make_pair(true, std::string(output.begin(), output.end()));
+    bool Socket::fillReadBuffer(size_t maxSize, bool& wouldBlock)
+    {
+        wouldBlock = false;
+
+        while (getReadBufferSize() < maxSize)
+        {
+            ssize_t ret = recvIntoReadBuffer();
+
+            if (ret > 0)
+            {
+                continue;
+            }
+            else if (ret < 0 && Socket::isWaitNeeded())
+            {
+                wouldBlock = true;
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Socket::readBufferContains(const std::string& pattern) const
+    {
+        return _readBuffer.find(pattern, _readBufferOffset) != std::string::npos;
+    }
+
+    size_t Socket::getReadBufferSize() const
+    {
+        return _readBuffer.size() - _readBufferOffset;
+    }
+
+    const char* Socket::getReadBufferData() const
+    {
+        return _readBuffer.data() + _readBufferOffset;
+    }
+
+    void Socket::consumeReadBuffer(size_t size)
+    {
+        _readBufferOffset = std::min(_readBufferOffset + size, _readBuffer.size());
+    }
+
+    std::string Socket::takeReadBuffer()
+    {
+        std::string buffer(_readBuffer.substr(_readBufferOffset));
+        _readBuffer.clear();
+        _readBufferOffset = 0;
+        return buffer;
+    }
+
+    int Socket::getFd() const
+    {
+        return _sockfd;
     }
 } // namespace ix
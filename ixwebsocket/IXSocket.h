@@ -33,6 +33,13 @@ namespace ix
         CloseRequest = 5
     };
 
+    // A buffer to be sent with Socket::sendv
+    struct SocketBuffer
+    {
+        const char* data;
+        size_t size;
+    };
+
     class Socket
     {
     public:
@@ -50,26 +57,73 @@ namespace ix
         // Virtual methods
         virtual bool accept(std::string& errMsg);
 
+        // With a timeout, the connection waits on the select interrupt of this socket and
+        // is cancelled with wakeUpFromPoll(SelectInterrupt::kCloseRequest), instead of
+        // polling isCancellationRequested. See SocketConnect::connect.
         virtual bool connect(const std::string& host,
                              int port,
                              std::string& errMsg,
-                             const CancellationRequest& isCancellationRequested);
+                             const CancellationRequest& isCancellationRequested,
+                             int timeoutSecs = -1);
         virtual void close();
 
         virtual ssize_t send(char* buffer, size_t length);
         ssize_t send(const std::string& buffer);
         virtual ssize_t recv(void* buffer, size_t length);
 
+        // Send several buffers with a single system call (writev) when possible.
+        // Returns the number of bytes sent, which can stop in the middle of a buffer.
+        virtual ssize_t sendv(const SocketBuffer* buffers, size_t count);
+
+        // Send up to length bytes of a file from offset, with sendfile when possible.
+        // Returns the number of bytes sent, like send.
+        virtual ssize_t sendFile(int fd, uint64_t offset, size_t length);
+
         // Blocking and cancellable versions, working with socket that can be set
-        // to non blocking mode. Used during HTTP upgrade.
+        // to non blocking mode. Used during HTTP upgrade. They consume the read
+        // buffer, which is filled with as many bytes as available at once.
         bool readByte(void* buffer, const CancellationRequest& isCancellationRequested);
-        bool writeBytes(const std::string& str, const CancellationRequest& isCancellationRequested);
+        // sentSize, if set, is the number of bytes sent, even when the write fails
+        bool writeBytes(const std::string& str,
+                        const CancellationRequest& isCancellationRequested,
+                        size_t* sentSize = nullptr);
+        // The buffers one after the other, with as few system calls as possible
+        bool writeBuffers(const SocketBuffer* buffers,
+                          size_t count,
+                          const CancellationRequest& isCancellationRequested);
+        bool writeFile(int fd,
+                       uint64_t offset,
+                       uint64_t length,
+                       const CancellationRequest& isCancellationRequested);
 
         std::pair<bool, std::string> readLine(const CancellationRequest& isCancellationRequested);
         std::pair<bool, std::string> readBytes(size_t length,
                                                const OnProgressCallback& onProgressCallback,
                                                const CancellationRequest& isCancellationRequested);
 
+        // Read everything that is available without blocking into the read buffer, which
+        // is consumed before the socket by readByte, readLine and readBytes. Event loops
+        // use it to wait for a complete HTTP request before parsing it.
+        // Returns false if the connection was closed or on error.
+        bool fillReadBuffer();
+        // Same as fillReadBuffer, stopping once at least maxSize bytes are buffered, so
+        // that they can be consumed before more is read. wouldBlock tells whether
+        // everything available was read.
+        bool fillReadBuffer(size_t maxSize, bool& wouldBlock);
+        bool readBufferContains(const std::string& pattern) const;
+        size_t getReadBufferSize() const;
+
+        // Give away the bytes which were buffered but not consumed yet
+        std::string takeReadBuffer();
+
+        // For parsers working on the buffered bytes in place. recvIntoReadBuffer waits
+        // until some bytes are received, the buffer data might move.
+        bool recvIntoReadBuffer(const CancellationRequest& isCancellationRequested);
+        const char* getReadBufferData() const;
+        void consumeReadBuffer(size_t size);
+
+        int getFd() const;
+
         static int getErrno();
         static bool isWaitNeeded();
         static void closeSocket(int fd);
@@ -80,13 +134,27 @@ namespace ix
                                    const SelectInterruptPtr& selectInterrupt);
 
     protected:
+        // Send the buffers one after the other, for sockets which cannot use writev
+        ssize_t sendEach(const SocketBuffer* buffers, size_t count);
+        // Read the file and send it, for sockets which cannot use sendfile
+        ssize_t sendFileCopy(int fd, uint64_t offset, size_t length);
+
         std::atomic<int> _sockfd;
         std::mutex _socketMutex;
+        SelectInterruptPtr _selectInterrupt;
 
     private:
+        // Receive up to kReadBufferChunkSize bytes at the end of the read buffer
+        ssize_t recvIntoReadBuffer();
+
         static const int kDefaultPollTimeout;
         static const int kDefaultPollNoTimeout;
+        static constexpr size_t kMaxSendBuffers = 16;
+        static constexpr size_t kReadBufferChunkSize = 16 * 1024;
+        static constexpr size_t kSendFileChunkSize = 1024 * 1024 * 1024;
+        static constexpr int kWritePollTimeoutMs = 100;
 
-        SelectInterruptPtr _selectInterrupt;
+        std::string _readBuffer;
+        size_t _readBufferOffset;
     };
 } // namespace ix
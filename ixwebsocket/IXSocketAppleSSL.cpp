@@ -190,13 +190,15 @@ namespace ix
     bool SocketAppleSSL::connect(const std::string& host,
                                  int port,
                                  std::string& errMsg,
-                                 const CancellationRequest& isCancellationRequested)
+                                 const CancellationRequest& isCancellationRequested,
+                                 int timeoutSecs)
     {
         OSStatus status;
         {
             std::lock_guard<std::mutex> lock(_mutex);
 
-            _sockfd = SocketConnect::connect(host, port, errMsg, isCancellationRequested);
+            _sockfd = SocketConnect::connect(
+                host, port, errMsg, isCancellationRequested, _selectInterrupt, timeoutSecs);
             if (_sockfd == -1) return false;
 
             _sslContext = SSLCreateContext(kCFAllocatorDefault, kSSLClientSide, kSSLStreamType);
@@ -279,6 +281,16 @@ namespace ix
     }
 
     // No wait support
+    ssize_t SocketAppleSSL::sendv(const SocketBuffer* buffers, size_t count)
+    {
+        return sendEach(buffers, count);
+    }
+
+    ssize_t SocketAppleSSL::sendFile(int fd, uint64_t offset, size_t length)
+    {
+        return sendFileCopy(fd, offset, length);
+    }
+
     ssize_t SocketAppleSSL::recv(void* buf, size_t nbyte)
     {
         OSStatus status = errSSLWouldBlock;
@@ -6,14 +6,15 @@
 
 #include "IXSocketConnect.h"
 
-#include "IXDNSLookup.h"
+#include "IXDNSCache.h"
 #include "IXNetSystem.h"
-#include "IXSelectInterrupt.h"
 #include "IXSocket.h"
-#include "IXUniquePtr.h"
+#include <algorithm>
+#include <chrono>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/types.h>
+#include <vector>
 
 // Android needs extra headers for TCP_NODELAY and IPPROTO_TCP
 #ifdef ANDROID
@@ -21,19 +22,51 @@
 #include <linux/tcp.h>
 #endif
 
+namespace
+{
+    // RFC 8305 section 4: alternate between address families, starting with the
+    // family of the first address, which getaddrinfo sorted by preference
+    std::vector<const struct addrinfo*> interleaveAddressFamilies(const struct addrinfo* res)
+    {
+        std::vector<const struct addrinfo*> primary;
+        std::vector<const struct addrinfo*> secondary;
+        for (auto address = res; address != nullptr; address = address->ai_next)
+        {
+            if (address->ai_family == res->ai_family)
+            {
+                primary.push_back(address);
+            }
+            else
+            {
+                secondary.push_back(address);
+            }
+        }
+
+        std::vector<const struct addrinfo*> addresses;
+        for (size_t i = 0; i < primary.size() || i < secondary.size(); ++i)
+        {
+            if (i < primary.size()) addresses.push_back(primary[i]);
+            if (i < secondary.size()) addresses.push_back(secondary[i]);
+        }
+        return addresses;
+    }
+} // namespace
+
 namespace ix
 {
+    // Recommended value of the Connection Attempt Delay in RFC 8305
+    const int SocketConnect::kDefaultConnectionAttemptDelayMs(250);
+    const int SocketConnect::kCancellationCheckIntervalMs(10);
+
     //
-    // This function can be cancelled every 50 ms
-    // This is important so that we don't block the main UI thread when shutting down a
-    // connection which is already trying to reconnect, and can be blocked waiting for
-    // ::connect to respond.
+    // Start a non blocking connect. Returns -1 if it failed right away, connected is set
+    // if it succeeded right away.
     //
-    int SocketConnect::connectToAddress(const struct addrinfo* address,
-                                        std::string& errMsg,
-                                        const CancellationRequest& isCancellationRequested)
+    int SocketConnect::startConnect(const struct addrinfo* address,
+                                    bool& connected,
+                                    std::string& errMsg)
     {
-        errMsg = "no error";
+        connected = false;
 
         socket_t fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
         if (fd < 0)
@@ -50,85 +83,208 @@ namespace ix
 
         if (res == -1 && !Socket::isWaitNeeded())
         {
-            errMsg = strerror(Socket::getErrno());
+            errMsg = std::string("Connect error: ") + strerror(Socket::getErrno());
             Socket::closeSocket( static_cast< int >( fd ) );
             return -1;
         }
 
+        connected = (res == 0);
+        return static_cast< int >( fd );
+    }
+
+    //
+    // This function can be cancelled through the select interrupt, or every 10 ms
+    // This is important so that we don't block the main UI thread when shutting down a
+    // connection which is already trying to reconnect, and can be blocked waiting for
+    // ::connect to respond.
+    //
+    int SocketConnect::connectToAddresses(const struct addrinfo* res,
+                                          std::string& errMsg,
+                                          const CancellationRequest& isCancellationRequested,
+                                          const SelectInterruptPtr& selectInterrupt,
+                                          std::chrono::steady_clock::time_point deadline,
+                                          int connectionAttemptDelayMs)
+    {
+        errMsg = "no error";
+
+        auto addresses = interleaveAddressFamilies(res);
+        size_t next = 0;
+
+        // Connections in progress, the first one to complete wins
+        std::vector<int> attempts;
+        auto closeAttempts = [&attempts](int winner) {
+            for (auto&& fd : attempts)
+            {
+                if (fd != winner) Socket::closeSocket(fd);
+            }
+        };
+
+        // Without a deadline, the timeout is only known by isCancellationRequested
+        bool hasDeadline = deadline != std::chrono::steady_clock::time_point::max();
+        int interruptFd = (selectInterrupt && hasDeadline) ? selectInterrupt->getFd() : -1;
+
+        auto nextAttemptTime = std::chrono::steady_clock::now();
+        std::vector<struct pollfd> fds;
+
         for (;;)
         {
-            if (isCancellationRequested && isCancellationRequested()) // Must handle timeout as well
+            if (isCancellationRequested && isCancellationRequested())
             {
-                Socket::closeSocket( static_cast< int >( fd ) );
+                closeAttempts(-1);
                 errMsg = "Cancelled";
                 return -1;
             }
 
-            int timeoutMs = 10;
-            bool readyToRead = false;
-            auto selectInterrupt = ix::make_unique<SelectInterrupt>();
-            PollResultType pollResult = Socket::poll(readyToRead, timeoutMs, static_cast< int >( fd ), selectInterrupt);
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                closeAttempts(-1);
+                errMsg = "Connect timed out";
+                return -1;
+            }
+
+            // The next address is tried when the previous attempts are taking too long,
+            // or right away when they all failed
+            if (next < addresses.size() && (attempts.empty() || now >= nextAttemptTime))
+            {
+                bool connected = false;
+                int fd = startConnect(addresses[next++], connected, errMsg);
+                if (fd == -1)
+                {
+                    continue;
+                }
+                else if (connected)
+                {
+                    closeAttempts(fd);
+                    return fd;
+                }
 
-            if (pollResult == PollResultType::Timeout)
+                attempts.push_back(fd);
+                nextAttemptTime = now + std::chrono::milliseconds(connectionAttemptDelayMs);
+            }
+
+            if (attempts.empty())
             {
-                continue;
+                return -1; // every address failed, errMsg tells why the last one did
             }
-            else if (pollResult == PollResultType::Error)
+
+            // Sleep until an attempt completes, the next one is due, the deadline passes
+            // or the interrupt is notified
+            auto wakeUpTime = deadline;
+            if (next < addresses.size()) wakeUpTime = std::min(wakeUpTime, nextAttemptTime);
+
+            int timeoutMs = -1;
+            if (wakeUpTime != std::chrono::steady_clock::time_point::max())
             {
-                Socket::closeSocket( static_cast< int >( fd ) );
-                errMsg = std::string("Connect error: ") + strerror(Socket::getErrno());
-                return -1;
+                auto delay =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(wakeUpTime - now);
+                timeoutMs = std::max(0, (int) delay.count() + 1);
             }
-            else if (pollResult == PollResultType::ReadyForWrite)
+            if (interruptFd == -1 && (timeoutMs < 0 || timeoutMs > kCancellationCheckIntervalMs))
             {
-                return static_cast< int >( fd );
+                timeoutMs = kCancellationCheckIntervalMs;
             }
-            else
+
+            fds.resize(attempts.size());
+            for (size_t i = 0; i < attempts.size(); ++i)
+            {
+                fds[i].fd = attempts[i];
+                // POLLERR is ignored by poll, but our select based poll wrapper on Windows
+                // needs it
+                fds[i].events = POLLOUT | POLLERR;
+                fds[i].revents = 0;
+            }
+            if (interruptFd != -1)
+            {
+                struct pollfd interruptPollFd;
+                interruptPollFd.fd = interruptFd;
+                interruptPollFd.events = POLLIN;
+                interruptPollFd.revents = 0;
+                fds.push_back(interruptPollFd);
+            }
+
+            int ret = ix::poll(&fds[0], (nfds_t) fds.size(), timeoutMs);
+            if (ret < 0)
             {
-                Socket::closeSocket( static_cast< int >( fd ) );
                 errMsg = std::string("Connect error: ") + strerror(Socket::getErrno());
+                closeAttempts(-1);
                 return -1;
             }
-        }
 
-     /* Socket::closeSocket(fd);
-        errMsg = "connect timed out after 60 seconds";
-        return -1; Unreachable code - CS */
+            if (interruptFd != -1 && (fds.back().revents & POLLIN) &&
+                selectInterrupt->read() == SelectInterrupt::kCloseRequest)
+            {
+                closeAttempts(-1);
+                errMsg = "Cancelled";
+                return -1;
+            }
+
+            std::vector<int> pending;
+            bool failed = false;
+            for (size_t i = 0; i < attempts.size(); ++i)
+            {
+                int fd = fds[i].fd;
+                if (fds[i].revents == 0)
+                {
+                    pending.push_back(fd);
+                    continue;
+                }
+
+                // getsockopt() puts the errno value for connect into optval so 0
+                // means no-error.
+                int optval = -1;
+                socklen_t optlen = sizeof(optval);
+                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char*) &optval, &optlen) == -1)
+                {
+                    optval = Socket::getErrno();
+                }
+                // On connect error, in async mode, windows will write to the exceptions fds
+                if (optval == 0 && (fds[i].revents & POLLOUT) && !(fds[i].revents & POLLERR))
+                {
+                    closeAttempts(fd);
+                    return fd;
+                }
+
+                errMsg = std::string("Connect error: ") + strerror(optval);
+                Socket::closeSocket(fd);
+                failed = true;
+            }
+            attempts.swap(pending);
+
+            // A failed attempt lets the next address be tried without waiting
+            if (failed) nextAttemptTime = std::chrono::steady_clock::now();
+        }
     }
 
     int SocketConnect::connect(const std::string& hostname,
                                int port,
                                std::string& errMsg,
-                               const CancellationRequest& isCancellationRequested)
+                               const CancellationRequest& isCancellationRequested,
+                               const SelectInterruptPtr& selectInterrupt,
+                               int timeoutSecs)
     {
+        // The deadline covers the DNS resolution as well
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        if (timeoutSecs > 0)
+        {
+            deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeoutSecs);
+        }
+
         //
-        // First do DNS resolution
+        // First do DNS resolution, shared with the other connections to the same host
         //
-        auto dnsLookup = std::make_shared<DNSLookup>(hostname, port);
-        struct addrinfo* res = dnsLookup->resolve(errMsg, isCancellationRequested);
+        auto dnsCache = DNSCache::getInstance();
+        auto res = dnsCache->resolve(hostname, port, errMsg, isCancellationRequested);
         if (res == nullptr)
         {
             return -1;
         }
 
-        int sockfd = -1;
-
-        // iterate through the records to find a working peer
-        struct addrinfo* address;
-        for (address = res; address != nullptr; address = address->ai_next)
-        {
-            //
-            // Second try to connect to the remote host
-            //
-            sockfd = connectToAddress(address, errMsg, isCancellationRequested);
-            if (sockfd != -1)
-            {
-                break;
-            }
-        }
-
-        freeaddrinfo(res);
-        return sockfd;
+        //
+        // Second race connections to the addresses of the remote host
+        //
+        return connectToAddresses(
+            res.get(), errMsg, isCancellationRequested, selectInterrupt, deadline);
     }
 
     // FIXME: configure is a terrible name
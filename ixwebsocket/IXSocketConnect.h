@@ -7,6 +7,8 @@
 #pragma once
 
 #include "IXCancellationRequest.h"
+#include "IXSelectInterrupt.h"
+#include <chrono>
 #include <string>
 
 struct addrinfo;
@@ -16,16 +18,42 @@ namespace ix
     class SocketConnect
     {
     public:
+        // The connection fails after timeoutSecs when it is positive. When selectInterrupt
+        // has a file descriptor and a timeout is given, the connection waits on the sockets
+        // and on the interrupt without polling: isCancellationRequested is only checked when
+        // woken up, and notifying SelectInterrupt::kCloseRequest cancels the connection.
+        // Otherwise isCancellationRequested is checked every 10ms.
         static int connect(const std::string& hostname,
                            int port,
                            std::string& errMsg,
-                           const CancellationRequest& isCancellationRequested);
+                           const CancellationRequest& isCancellationRequested,
+                           const SelectInterruptPtr& selectInterrupt = nullptr,
+                           int timeoutSecs = -1);
+
+        // Happy Eyeballs (RFC 8305): connections to the addresses are raced, alternating
+        // address families. The next address is tried every connectionAttemptDelayMs
+        // while no connection completed, or as soon as an attempt failed. The first
+        // connected socket is returned, the other attempts are closed. The race waits for
+        // selectInterrupt and fails at the deadline, as described for connect.
+        static int connectToAddresses(
+            const struct addrinfo* addresses,
+            std::string& errMsg,
+            const CancellationRequest& isCancellationRequested,
+            const SelectInterruptPtr& selectInterrupt = nullptr,
+            std::chrono::steady_clock::time_point deadline =
+                std::chrono::steady_clock::time_point::max(),
+            int connectionAttemptDelayMs = SocketConnect::kDefaultConnectionAttemptDelayMs);
 
         static void configure(int sockfd);
 
+        const static int kDefaultConnectionAttemptDelayMs;
+
     private:
-        static int connectToAddress(const struct addrinfo* address,
-                                    std::string& errMsg,
-                                    const CancellationRequest& isCancellationRequested);
+        // How often cancellation requests are checked, when they cannot be waited for
+        const static int kCancellationCheckIntervalMs;
+
+        static int startConnect(const struct addrinfo* address,
+                                bool& connected,
+                                std::string& errMsg);
     };
 } // namespace ix
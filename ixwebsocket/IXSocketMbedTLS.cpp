@@ -252,11 +252,13 @@ namespace ix
     bool SocketMbedTLS::connect(const std::string& host,
                                 int port,
                                 std::string& errMsg,
-                                const CancellationRequest& isCancellationRequested)
+                                const CancellationRequest& isCancellationRequested,
+                                int timeoutSecs)
     {
         {
             std::lock_guard<std::mutex> lock(_mutex);
-            _sockfd = SocketConnect::connect(host, port, errMsg, isCancellationRequested);
+            _sockfd = SocketConnect::connect(
+                host, port, errMsg, isCancellationRequested, _selectInterrupt, timeoutSecs);
             if (_sockfd == -1) return false;
         }
 
@@ -336,6 +338,16 @@ namespace ix
         }
     }
 
+    ssize_t SocketMbedTLS::sendv(const SocketBuffer* buffers, size_t count)
+    {
+        return sendEach(buffers, count);
+    }
+
+    ssize_t SocketMbedTLS::sendFile(int fd, uint64_t offset, size_t length)
+    {
+        return sendFileCopy(fd, offset, length);
+    }
+
     ssize_t SocketMbedTLS::recv(void* buf, size_t nbyte)
     {
         while (true)
@@ -32,11 +32,14 @@ namespace ix
         virtual bool connect(const std::string& host,
                              int port,
                              std::string& errMsg,
-                             const CancellationRequest& isCancellationRequested) final;
+                             const CancellationRequest& isCancellationRequested,
+                             int timeoutSecs = -1) final;
         virtual void close() final;
 
         virtual ssize_t send(char* buffer, size_t length) final;
         virtual ssize_t recv(void* buffer, size_t length) final;
+        virtual ssize_t sendv(const SocketBuffer* buffers, size_t count) final;
+        virtual ssize_t sendFile(int fd, uint64_t offset, size_t length) final;
 
     private:
         mbedtls_ssl_context _ssl;
@@ -12,7 +12,12 @@
 #include "IXSocketConnect.h"
 #include "IXUniquePtr.h"
 #include <cassert>
+#include <chrono>
 #include <errno.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unordered_map>
 #include <vector>
 #ifdef _WIN32
 #include <Shlwapi.h>
@@ -80,6 +85,66 @@ namespace
 } // namespace
 #endif
 
+namespace
+{
+    struct ServerContext
+    {
+        std::shared_ptr<SSL_CTX> context;
+        // Modification times and sizes of the files the context was built from
+        std::string filesSignature;
+        std::chrono::steady_clock::time_point checkedAt;
+    };
+
+    struct ServerContexts
+    {
+        ServerContexts()
+            : buildCount(0)
+        {
+        }
+
+        std::unordered_map<std::string, ServerContext> contexts;
+        std::mutex mutex;
+        std::atomic<uint64_t> buildCount;
+    };
+
+    // Never destroyed, OpenSSL can be cleaned up before the static objects at exit
+    ServerContexts& getServerContexts()
+    {
+        static auto serverContexts = new ServerContexts();
+        return *serverContexts;
+    }
+
+    std::string getFilesSignature(const ix::SocketTLSOptions& tlsOptions)
+    {
+        std::vector<std::string> paths;
+        if (tlsOptions.hasCertAndKey())
+        {
+            paths.push_back(tlsOptions.certFile);
+            paths.push_back(tlsOptions.keyFile);
+        }
+        if (!tlsOptions.isPeerVerifyDisabled() && !tlsOptions.isUsingSystemDefaults() &&
+            !tlsOptions.isUsingInMemoryCAs())
+        {
+            paths.push_back(tlsOptions.caFile);
+        }
+
+        std::stringstream ss;
+        for (auto&& path : paths)
+        {
+            struct stat st;
+            if (stat(path.c_str(), &st) == 0)
+            {
+                ss << st.st_mtime << ":" << st.st_size << ";";
+            }
+            else
+            {
+                ss << "-;";
+            }
+        }
+        return ss.str();
+    }
+} // namespace
+
 namespace ix
 {
     const std::string kDefaultCiphers =
@@ -94,6 +159,12 @@ namespace ix
     std::once_flag SocketOpenSSL::_openSSLInitFlag;
     std::vector<std::unique_ptr<std::mutex>> openSSLMutexes;
 
+    // Certificates renewed on disk are picked up without checking their files on
+    // every accept
+    const int SocketOpenSSL::kServerContextCheckIntervalSecs(1);
+    // Cancellation requests are checked that often during client handshakes
+    const int SocketOpenSSL::kHandshakePollTimeoutMs(10);
+
     SocketOpenSSL::SocketOpenSSL(const SocketTLSOptions& tlsOptions, int fd)
         : Socket(fd)
         , _ssl_connection(nullptr)
@@ -228,10 +299,10 @@ namespace ix
         return ctx;
     }
 
-    bool SocketOpenSSL::openSSLAddCARootsFromString(const std::string roots)
+    bool SocketOpenSSL::openSSLAddCARootsFromString(SSL_CTX* ctx, const std::string roots)
     {
         // Create certificate store
-        X509_STORE* certificate_store = SSL_CTX_get_cert_store(_ssl_context);
+        X509_STORE* certificate_store = SSL_CTX_get_cert_store(ctx);
         if (certificate_store == nullptr) return false;
 
         // Configure to allow intermediate certs
@@ -369,6 +440,21 @@ namespace ix
         return true;
     }
 
+    bool SocketOpenSSL::waitForHandshake(int reason, std::string& errMsg)
+    {
+        // Sockets are non blocking, wait for the peer instead of calling SSL_connect
+        // or SSL_accept again right away
+        bool readyToRead = (reason == SSL_ERROR_WANT_READ);
+        auto pollResult =
+            Socket::poll(readyToRead, kHandshakePollTimeoutMs, _sockfd, _selectInterrupt);
+        if (pollResult == PollResultType::CloseRequest)
+        {
+            errMsg = "Cancellation requested";
+            return false;
+        }
+        return true;
+    }
+
     bool SocketOpenSSL::openSSLClientHandshake(const std::string& host,
                                                std::string& errMsg,
                                                const CancellationRequest& isCancellationRequested)
@@ -397,7 +483,7 @@ namespace ix
             bool rc = false;
             if (reason == SSL_ERROR_WANT_READ || reason == SSL_ERROR_WANT_WRITE)
             {
-                rc = true;
+                rc = waitForHandshake(reason, errMsg);
             }
             else
             {
@@ -432,7 +518,7 @@ namespace ix
             bool rc = false;
             if (reason == SSL_ERROR_WANT_READ || reason == SSL_ERROR_WANT_WRITE)
             {
-                rc = true;
+                rc = waitForHandshake(reason, errMsg);
             }
             else
             {
@@ -501,7 +587,7 @@ namespace ix
                 if (_tlsOptions.isUsingInMemoryCAs())
                 {
                     // Load from memory
-                    openSSLAddCARootsFromString(_tlsOptions.caFile);
+                    openSSLAddCARootsFromString(_ssl_context, _tlsOptions.caFile);
                 }
                 else
                 {
@@ -550,143 +636,225 @@ namespace ix
         return true;
     }
 
-    bool SocketOpenSSL::accept(std::string& errMsg)
+    std::shared_ptr<SSL_CTX> SocketOpenSSL::openSSLCreateServerContext(
+        const SocketTLSOptions& tlsOptions, std::string& errMsg)
     {
-        bool handshakeSuccessful = false;
+        const SSL_METHOD* method = SSLv23_server_method();
+        if (method == nullptr)
         {
-            std::lock_guard<std::mutex> lock(_mutex);
+            errMsg = "SSLv23_server_method failure";
+            return nullptr;
+        }
 
-            if (!_openSSLInitializationSuccessful)
-            {
-                errMsg = "OPENSSL_init_ssl failure";
-                return false;
-            }
+        std::shared_ptr<SSL_CTX> context(SSL_CTX_new(method), SSL_CTX_free);
+        if (!context)
+        {
+            errMsg = "OpenSSL failed - SSL_CTX_new failed";
+            return nullptr;
+        }
+        SSL_CTX* ctx = context.get();
 
-            if (_sockfd == -1)
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+        SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        SSL_CTX_set_options(ctx, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+
+        // Sessions are cached by the shared context, resuming them requires a context id
+        // when clients are verified
+        const unsigned char sessionIdContext[] = "ixwebsocket";
+        SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+
+        ERR_clear_error();
+        if (tlsOptions.hasCertAndKey())
+        {
+            if (SSL_CTX_use_certificate_chain_file(ctx, tlsOptions.certFile.c_str()) != 1)
             {
-                return false;
+                auto sslErr = ERR_get_error();
+                errMsg = "OpenSSL failed - SSL_CTX_use_certificate_chain_file(\"" +
+                         tlsOptions.certFile + "\") failed: ";
+                errMsg += ERR_error_string(sslErr, nullptr);
+                return nullptr;
             }
-
+            else if (SSL_CTX_use_PrivateKey_file(
+                         ctx, tlsOptions.keyFile.c_str(), SSL_FILETYPE_PEM) != 1)
             {
-                const SSL_METHOD* method = SSLv23_server_method();
-                if (method == nullptr)
-                {
-                    errMsg = "SSLv23_server_method failure";
-                    _ssl_context = nullptr;
-                }
-                else
-                {
-                    _ssl_method = method;
-
-                    _ssl_context = SSL_CTX_new(_ssl_method);
-                    if (_ssl_context)
-                    {
-                        SSL_CTX_set_mode(_ssl_context, SSL_MODE_ENABLE_PARTIAL_WRITE);
-                        SSL_CTX_set_mode(_ssl_context, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
-                        SSL_CTX_set_options(_ssl_context,
-                                            SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
-                    }
-                }
+                auto sslErr = ERR_get_error();
+                errMsg = "OpenSSL failed - SSL_CTX_use_PrivateKey_file(\"" + tlsOptions.keyFile +
+                         "\") failed: ";
+                errMsg += ERR_error_string(sslErr, nullptr);
+                return nullptr;
             }
-
-            if (_ssl_context == nullptr)
+            else if (!SSL_CTX_check_private_key(ctx))
             {
-                return false;
+                auto sslErr = ERR_get_error();
+                errMsg = "OpenSSL failed - cert/key mismatch(\"" + tlsOptions.certFile + ", " +
+                         tlsOptions.keyFile + "\")";
+                errMsg += ERR_error_string(sslErr, nullptr);
+                return nullptr;
             }
+        }
 
-            ERR_clear_error();
-            if (_tlsOptions.hasCertAndKey())
+        ERR_clear_error();
+        if (!tlsOptions.isPeerVerifyDisabled())
+        {
+            if (tlsOptions.isUsingSystemDefaults())
             {
-                if (SSL_CTX_use_certificate_chain_file(_ssl_context,
-                                                       _tlsOptions.certFile.c_str()) != 1)
+                if (SSL_CTX_set_default_verify_paths(ctx) == 0)
                 {
                     auto sslErr = ERR_get_error();
-                    errMsg = "OpenSSL failed - SSL_CTX_use_certificate_chain_file(\"" +
-                             _tlsOptions.certFile + "\") failed: ";
-                    errMsg += ERR_error_string(sslErr, nullptr);
-                }
-                else if (SSL_CTX_use_PrivateKey_file(
-                             _ssl_context, _tlsOptions.keyFile.c_str(), SSL_FILETYPE_PEM) != 1)
-                {
-                    auto sslErr = ERR_get_error();
-                    errMsg = "OpenSSL failed - SSL_CTX_use_PrivateKey_file(\"" +
-                             _tlsOptions.keyFile + "\") failed: ";
+                    errMsg = "OpenSSL failed - SSL_CTX_default_verify_paths loading failed: ";
                     errMsg += ERR_error_string(sslErr, nullptr);
+                    return nullptr;
                 }
             }
-
-
-            ERR_clear_error();
-            if (!_tlsOptions.isPeerVerifyDisabled())
+            else
             {
-                if (_tlsOptions.isUsingSystemDefaults())
+                if (tlsOptions.isUsingInMemoryCAs())
                 {
-                    if (SSL_CTX_set_default_verify_paths(_ssl_context) == 0)
-                    {
-                        auto sslErr = ERR_get_error();
-                        errMsg = "OpenSSL failed - SSL_CTX_default_verify_paths loading failed: ";
-                        errMsg += ERR_error_string(sslErr, nullptr);
-                    }
+                    // Load from memory
+                    openSSLAddCARootsFromString(ctx, tlsOptions.caFile);
                 }
                 else
                 {
-                    if (_tlsOptions.isUsingInMemoryCAs())
+                    const char* root_ca_file = tlsOptions.caFile.c_str();
+                    STACK_OF(X509_NAME) * rootCAs;
+                    rootCAs = SSL_load_client_CA_file(root_ca_file);
+                    if (rootCAs == NULL)
                     {
-                        // Load from memory
-                        openSSLAddCARootsFromString(_tlsOptions.caFile);
+                        auto sslErr = ERR_get_error();
+                        errMsg = "OpenSSL failed - SSL_load_client_CA_file('" +
+                                 tlsOptions.caFile + "') failed: ";
+                        errMsg += ERR_error_string(sslErr, nullptr);
+                        return nullptr;
                     }
-                    else
+
+                    SSL_CTX_set_client_CA_list(ctx, rootCAs);
+                    if (SSL_CTX_load_verify_locations(ctx, root_ca_file, nullptr) != 1)
                     {
-                        const char* root_ca_file = _tlsOptions.caFile.c_str();
-                        STACK_OF(X509_NAME) * rootCAs;
-                        rootCAs = SSL_load_client_CA_file(root_ca_file);
-                        if (rootCAs == NULL)
-                        {
-                            auto sslErr = ERR_get_error();
-                            errMsg = "OpenSSL failed - SSL_load_client_CA_file('" +
-                                     _tlsOptions.caFile + "') failed: ";
-                            errMsg += ERR_error_string(sslErr, nullptr);
-                        }
-                        else
-                        {
-                            SSL_CTX_set_client_CA_list(_ssl_context, rootCAs);
-                            if (SSL_CTX_load_verify_locations(
-                                    _ssl_context, root_ca_file, nullptr) != 1)
-                            {
-                                auto sslErr = ERR_get_error();
-                                errMsg = "OpenSSL failed - SSL_CTX_load_verify_locations(\"" +
-                                         _tlsOptions.caFile + "\") failed: ";
-                                errMsg += ERR_error_string(sslErr, nullptr);
-                            }
-                        }
+                        auto sslErr = ERR_get_error();
+                        errMsg = "OpenSSL failed - SSL_CTX_load_verify_locations(\"" +
+                                 tlsOptions.caFile + "\") failed: ";
+                        errMsg += ERR_error_string(sslErr, nullptr);
+                        return nullptr;
                     }
                 }
+            }
 
-                SSL_CTX_set_verify(
-                    _ssl_context, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
-                SSL_CTX_set_verify_depth(_ssl_context, 4);
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, nullptr);
+            SSL_CTX_set_verify_depth(ctx, 4);
+        }
+        else
+        {
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+        }
+
+        const std::string& ciphers =
+            tlsOptions.isUsingDefaultCiphers() ? kDefaultCiphers : tlsOptions.ciphers;
+        if (SSL_CTX_set_cipher_list(ctx, ciphers.c_str()) != 1)
+        {
+            auto sslErr = ERR_get_error();
+            errMsg = "OpenSSL failed - SSL_CTX_set_cipher_list(\"" + ciphers + "\") failed: ";
+            errMsg += ERR_error_string(sslErr, nullptr);
+            return nullptr;
+        }
+
+        return context;
+    }
+
+    std::shared_ptr<SSL_CTX> SocketOpenSSL::getServerContext(const SocketTLSOptions& tlsOptions,
+                                                             std::string& errMsg)
+    {
+        auto& serverContexts = getServerContexts();
+        auto key = tlsOptions.getDescription();
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(serverContexts.mutex);
+
+        auto& entry = serverContexts.contexts[key];
+        if (entry.context &&
+            now < entry.checkedAt + std::chrono::seconds(kServerContextCheckIntervalSecs))
+        {
+            return entry.context;
+        }
+
+        auto filesSignature = getFilesSignature(tlsOptions);
+        if (entry.context && filesSignature == entry.filesSignature)
+        {
+            entry.checkedAt = now;
+            return entry.context;
+        }
+
+        auto context = openSSLCreateServerContext(tlsOptions, errMsg);
+        if (!context)
+        {
+            if (!entry.context)
+            {
+                serverContexts.contexts.erase(key);
+                return nullptr;
             }
-            else
+
+            // Files being replaced can be inconsistent for a moment, the previous
+            // context is used until the next check
+            entry.checkedAt = now;
+            return entry.context;
+        }
+
+        // Sockets using the previous context keep it until they are closed
+        entry.context = context;
+        entry.filesSignature = filesSignature;
+        entry.checkedAt = now;
+        serverContexts.buildCount++;
+
+        return context;
+    }
+
+    size_t SocketOpenSSL::getServerContextsCount()
+    {
+        auto& serverContexts = getServerContexts();
+        std::lock_guard<std::mutex> lock(serverContexts.mutex);
+        return serverContexts.contexts.size();
+    }
+
+    uint64_t SocketOpenSSL::getServerContextsBuildCount()
+    {
+        return getServerContexts().buildCount;
+    }
+
+    void SocketOpenSSL::clearServerContexts()
+    {
+        auto& serverContexts = getServerContexts();
+        std::lock_guard<std::mutex> lock(serverContexts.mutex);
+        serverContexts.contexts.clear();
+    }
+
+    bool SocketOpenSSL::accept(std::string& errMsg)
+    {
+        bool handshakeSuccessful = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (!_openSSLInitializationSuccessful)
             {
-                SSL_CTX_set_verify(_ssl_context, SSL_VERIFY_NONE, nullptr);
+                errMsg = "OPENSSL_init_ssl failure";
+                return false;
             }
-            if (_tlsOptions.isUsingDefaultCiphers())
+
+            if (_sockfd == -1)
             {
-                if (SSL_CTX_set_cipher_list(_ssl_context, kDefaultCiphers.c_str()) != 1)
-                {
-                    return false;
-                }
+                return false;
             }
-            else if (SSL_CTX_set_cipher_list(_ssl_context, _tlsOptions.ciphers.c_str()) != 1)
+
+            _ssl_server_context = getServerContext(_tlsOptions, errMsg);
+            if (!_ssl_server_context)
             {
                 return false;
             }
+            _ssl_context = _ssl_server_context.get();
 
             _ssl_connection = SSL_new(_ssl_context);
             if (_ssl_connection == nullptr)
             {
                 errMsg = "OpenSSL failed to connect";
-                SSL_CTX_free(_ssl_context);
+                _ssl_server_context.reset();
                 _ssl_context = nullptr;
                 return false;
             }
@@ -710,7 +878,8 @@ namespace ix
     bool SocketOpenSSL::connect(const std::string& host,
                                 int port,
                                 std::string& errMsg,
-                                const CancellationRequest& isCancellationRequested)
+                                const CancellationRequest& isCancellationRequested,
+                                int timeoutSecs)
     {
         bool handshakeSuccessful = false;
         {
@@ -722,7 +891,8 @@ namespace ix
                 return false;
             }
 
-            _sockfd = SocketConnect::connect(host, port, errMsg, isCancellationRequested);
+            _sockfd = SocketConnect::connect(
+                host, port, errMsg, isCancellationRequested, _selectInterrupt, timeoutSecs);
             if (_sockfd == -1) return false;
 
             _ssl_context = openSSLCreateContext(errMsg);
@@ -780,7 +950,15 @@ namespace ix
         }
         if (_ssl_context != nullptr)
         {
-            SSL_CTX_free(_ssl_context);
+            // The context of accepted sockets is shared with the other ones
+            if (_ssl_server_context)
+            {
+                _ssl_server_context.reset();
+            }
+            else
+            {
+                SSL_CTX_free(_ssl_context);
+            }
             _ssl_context = nullptr;
         }
 
@@ -815,6 +993,16 @@ namespace ix
         }
     }
 
+    ssize_t SocketOpenSSL::sendv(const SocketBuffer* buffers, size_t count)
+    {
+        return sendEach(buffers, count);
+    }
+
+    ssize_t SocketOpenSSL::sendFile(int fd, uint64_t offset, size_t length)
+    {
+        return sendFileCopy(fd, offset, length);
+    }
+
     ssize_t SocketOpenSSL::recv(void* buf, size_t nbyte)
     {
         while (true)
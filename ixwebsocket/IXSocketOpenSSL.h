@@ -10,6 +10,8 @@
 #include "IXCancellationRequest.h"
 #include "IXSocket.h"
 #include "IXSocketTLSOptions.h"
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <openssl/bio.h>
 #include <openssl/conf.h>
@@ -30,17 +32,32 @@ namespace ix
         virtual bool connect(const std::string& host,
                              int port,
                              std::string& errMsg,
-                             const CancellationRequest& isCancellationRequested) final;
+                             const CancellationRequest& isCancellationRequested,
+                             int timeoutSecs = -1) final;
         virtual void close() final;
 
         virtual ssize_t send(char* buffer, size_t length) final;
         virtual ssize_t recv(void* buffer, size_t length) final;
+        virtual ssize_t sendv(const SocketBuffer* buffers, size_t count) final;
+        virtual ssize_t sendFile(int fd, uint64_t offset, size_t length) final;
+
+        // Accepted sockets share a server context per set of TLS options, built by the
+        // first accept. It is built again when the certificate, key or CA file changes,
+        // which is checked at most every second. The connections accepted afterwards use
+        // the new context, and the previous one is kept if it cannot be built.
+        static size_t getServerContextsCount();
+        static uint64_t getServerContextsBuildCount();
+        static void clearServerContexts();
 
     private:
         void openSSLInitialize();
         std::string getSSLError(int ret);
         SSL_CTX* openSSLCreateContext(std::string& errMsg);
-        bool openSSLAddCARootsFromString(const std::string roots);
+        static bool openSSLAddCARootsFromString(SSL_CTX* ctx, const std::string roots);
+        static std::shared_ptr<SSL_CTX> openSSLCreateServerContext(
+            const SocketTLSOptions& tlsOptions, std::string& errMsg);
+        static std::shared_ptr<SSL_CTX> getServerContext(const SocketTLSOptions& tlsOptions,
+                                                         std::string& errMsg);
         bool openSSLClientHandshake(const std::string& hostname,
                                     std::string& errMsg,
                                     const CancellationRequest& isCancellationRequested);
@@ -48,12 +65,15 @@ namespace ix
         bool checkHost(const std::string& host, const char* pattern);
         bool handleTLSOptions(std::string& errMsg);
         bool openSSLServerHandshake(std::string& errMsg);
+        bool waitForHandshake(int reason, std::string& errMsg);
 
         // Required for OpenSSL < 1.1
         static void openSSLLockingCallback(int mode, int type, const char* /*file*/, int /*line*/);
 
         SSL* _ssl_connection;
         SSL_CTX* _ssl_context;
+        // Holds _ssl_context for accepted sockets, instead of freeing it on close
+        std::shared_ptr<SSL_CTX> _ssl_server_context;
         const SSL_METHOD* _ssl_method;
         SocketTLSOptions _tlsOptions;
 
@@ -61,6 +81,9 @@ namespace ix
 
         static std::once_flag _openSSLInitFlag;
         static std::atomic<bool> _openSSLInitializationSuccessful;
+
+        const static int kServerContextCheckIntervalSecs;
+        const static int kHandshakePollTimeoutMs;
     };
 
 } // namespace ix
@@ -427,6 +427,11 @@ namespace ix
                 continue;
             }
 
+            if (handleConnectionWithEventLoop(socket, connectionState))
+            {
+                continue;
+            }
+
             // Launch the handleConnection work asynchronously in its own thread.
             std::lock_guard<std::mutex> lock(_connectionsThreadsMutex);
             _connectionsThreads.push_back(std::make_pair(
@@ -436,6 +441,12 @@ namespace ix
         }
     }
 
+    bool SocketServer::handleConnectionWithEventLoop(
+        std::unique_ptr<Socket>& /*socket*/, std::shared_ptr<ConnectionState> /*connectionState*/)
+    {
+        return false;
+    }
+
     size_t SocketServer::getConnectionsThreadsCount()
     {
         std::lock_guard<std::mutex> lock(_connectionsThreadsMutex);
@@ -108,6 +108,11 @@ namespace ix
                                       std::shared_ptr<ConnectionState> connectionState) = 0;
         virtual size_t getConnectedClientsCount() = 0;
 
+        // Servers multiplexing their connections on event loops take ownership of the
+        // socket and return true, in which case no worker thread is started.
+        virtual bool handleConnectionWithEventLoop(std::unique_ptr<Socket>& socket,
+                                                   std::shared_ptr<ConnectionState> connectionState);
+
         // Returns true if all connection threads are joined
         void closeTerminatedThreads();
         size_t getConnectionsThreadsCount();
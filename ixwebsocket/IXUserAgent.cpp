@@ -54,9 +54,9 @@
 #include <openssl/opensslv.h>
 #endif
 
-namespace ix
+namespace
 {
-    std::string userAgent()
+    std::string makeUserAgent()
     {
         std::stringstream ss;
 
@@ -86,4 +86,14 @@ namespace ix
 
         return ss.str();
     }
+} // namespace
+
+namespace ix
+{
+    std::string userAgent()
+    {
+        // Sent with every request and response, it is only formatted once
+        static const std::string agent = makeUserAgent();
+        return agent;
+    }
 } // namespace ix
@@ -175,4 +175,14 @@ namespace ix
         return v.complete();
     }
 
+    inline bool validateUtf8(const char* data, size_t size)
+    {
+        Utf8Validator v;
+        if (!v.decode(data, data + size))
+        {
+            return false;
+        }
+        return v.complete();
+    }
+
 } // namespace ix
@@ -10,9 +10,12 @@
 #include "IXSetThreadName.h"
 #include "IXUniquePtr.h"
 #include "IXUtf8Validator.h"
+#include "IXWebSocketClientLoop.h"
+#include "IXWebSocketEventLoopConnection.h"
 #include "IXWebSocketHandshake.h"
 #include <cassert>
 #include <cmath>
+#include <new>
 
 
 namespace
@@ -33,12 +36,15 @@ namespace ix
     WebSocket::WebSocket()
         : _onMessageCallback(OnMessageCallback())
         , _stop(false)
+        , _deferredMessagesSize(0)
         , _automaticReconnection(true)
         , _maxWaitBetweenReconnectionRetries(kDefaultMaxWaitBetweenReconnectionRetries)
         , _minWaitBetweenReconnectionRetries(kDefaultMinWaitBetweenReconnectionRetries)
         , _handshakeTimeoutSecs(kDefaultHandShakeTimeoutSecs)
         , _enablePong(kDefaultEnablePong)
+        , _enableZeroCopyMessages(false)
         , _pingIntervalSecs(kDefaultPingIntervalSecs)
+        , _connectionClosed(true)
     {
         _ws.setOnCloseCallback(
             [this](uint16_t code, const std::string& reason, size_t wireSize, bool remote) {
@@ -138,6 +144,18 @@ namespace ix
         _perMessageDeflateOptions = perMessageDeflateOptions;
     }
 
+    void WebSocket::enableZeroCopyMessages()
+    {
+        std::lock_guard<std::mutex> lock(_configMutex);
+        _enableZeroCopyMessages = true;
+    }
+
+    void WebSocket::disableZeroCopyMessages()
+    {
+        std::lock_guard<std::mutex> lock(_configMutex);
+        _enableZeroCopyMessages = false;
+    }
+
     void WebSocket::setMaxWaitBetweenReconnectionRetries(uint32_t maxWaitBetweenReconnectionRetries)
     {
         std::lock_guard<std::mutex> lock(_configMutex);
@@ -162,15 +180,61 @@ namespace ix
         return _minWaitBetweenReconnectionRetries;
     }
 
+    void WebSocket::setClientLoop(const std::shared_ptr<WebSocketClientLoop>& clientLoop)
+    {
+        _clientLoop = clientLoop;
+    }
+
     void WebSocket::start()
     {
-        if (_thread.joinable()) return; // we've already been started
+        if (_thread.joinable() || _connection) return; // we've already been started
+
+        auto eventLoop = (_clientLoop) ? _clientLoop->getNextEventLoop() : nullptr;
+        if (eventLoop)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_connectionMutex);
+                _connectionClosed = false;
+            }
+
+            _connection = std::make_shared<WebSocketEventLoopConnection>(
+                eventLoop, *this, [this](const std::string& /*errorMsg*/) {
+                    std::lock_guard<std::mutex> lock(_connectionMutex);
+                    _connectionClosed = true;
+                    _connectionCondition.notify_all();
+                });
+
+            _clientLoop->addConnection(_connection);
+
+            // Do not keep the client loop alive from its own threads, it would join
+            // them when destroyed by one of them. The client loop stops its threads
+            // before going away, so they can use it without holding a reference.
+            WebSocketClientLoop* clientLoop = _clientLoop.get();
+            auto connection = _connection;
+            eventLoop->post([connection, clientLoop] {
+                connection->connect(
+                    [clientLoop](const EventLoop::Task& task) { clientLoop->runConnect(task); });
+            });
+            return;
+        }
+
+        // A previous run might have been driven by a client loop
+        _ws.setOnWakeUpCallback(nullptr);
 
         _thread = std::thread(&WebSocket::run, this);
     }
 
     void WebSocket::stop(uint16_t code, const std::string& reason)
     {
+        if (_connection)
+        {
+            _stop = true;
+            close(code, reason);
+            stopClientLoopConnection();
+            _stop = false;
+            return;
+        }
+
         close(code, reason);
 
         if (_thread.joinable())
@@ -184,12 +248,40 @@ namespace ix
         }
     }
 
+    void WebSocket::stopClientLoopConnection()
+    {
+        // The connection stops once the close handshake is over, or right
+        // away if it is waiting before reconnecting
+        _connection->requestStop();
+
+        std::unique_lock<std::mutex> lock(_connectionMutex);
+        _connectionCondition.wait(lock, [this] { return _connectionClosed; });
+        lock.unlock();
+
+        _connection.reset();
+    }
+
     WebSocketInitResult WebSocket::connect(int timeoutSecs)
+    {
+        WebSocketInitResult status = connectToUrl(timeoutSecs);
+        if (!status.success)
+        {
+            return status;
+        }
+
+        notifyOpen(status);
+        return status;
+    }
+
+    WebSocketInitResult WebSocket::connectToUrl(int timeoutSecs)
     {
         {
             std::lock_guard<std::mutex> lock(_configMutex);
-            _ws.configure(
-                _perMessageDeflateOptions, _socketTLSOptions, _enablePong, _pingIntervalSecs);
+            _ws.configure(_perMessageDeflateOptions,
+                          _socketTLSOptions,
+                          _enablePong,
+                          _pingIntervalSecs,
+                          _enableZeroCopyMessages);
         }
 
         WebSocketHttpHeaders headers(_extraHeaders);
@@ -215,12 +307,11 @@ namespace ix
             headers["Sec-WebSocket-Protocol"] = subProtocolsHeader;
         }
 
-        WebSocketInitResult status = _ws.connectToUrl(_url, headers, timeoutSecs);
-        if (!status.success)
-        {
-            return status;
-        }
+        return _ws.connectToUrl(_url, headers, timeoutSecs);
+    }
 
+    void WebSocket::notifyOpen(const WebSocketInitResult& status)
+    {
         _onMessageCallback(ix::make_unique<WebSocketMessage>(
             WebSocketMessageType::Open,
             emptyMsg,
@@ -234,8 +325,6 @@ namespace ix
             // Send a heart beat right away
             _ws.sendHeartBeat();
         }
-
-        return status;
     }
 
     WebSocketInitResult WebSocket::connectToSocket(std::unique_ptr<Socket> socket,
@@ -244,8 +333,11 @@ namespace ix
     {
         {
             std::lock_guard<std::mutex> lock(_configMutex);
-            _ws.configure(
-                _perMessageDeflateOptions, _socketTLSOptions, _enablePong, _pingIntervalSecs);
+            _ws.configure(_perMessageDeflateOptions,
+                          _socketTLSOptions,
+                          _enablePong,
+                          _pingIntervalSecs,
+                          _enableZeroCopyMessages);
         }
 
         WebSocketInitResult status =
@@ -327,32 +419,42 @@ namespace ix
 
             if (!status.success)
             {
-                WebSocketErrorInfo connectErr;
-
                 if (_automaticReconnection)
                 {
                     duration =
                         millis(calculateRetryWaitMilliseconds(retries++,
                                                               _maxWaitBetweenReconnectionRetries,
                                                               _minWaitBetweenReconnectionRetries));
-
-                    connectErr.wait_time = duration.count();
-                    connectErr.retries = retries;
                 }
 
-                connectErr.reason = status.errorStr;
-                connectErr.http_status = status.http_status;
-
-                _onMessageCallback(ix::make_unique<WebSocketMessage>(WebSocketMessageType::Error,
-                                                                     emptyMsg,
-                                                                     0,
-                                                                     connectErr,
-                                                                     WebSocketOpenInfo(),
-                                                                     WebSocketCloseInfo()));
+                notifyConnectionError(status, retries, duration.count());
             }
         }
     }
 
+    void WebSocket::notifyConnectionError(const WebSocketInitResult& status,
+                                          uint32_t retries,
+                                          double waitTime)
+    {
+        WebSocketErrorInfo connectErr;
+
+        if (_automaticReconnection)
+        {
+            connectErr.wait_time = waitTime;
+            connectErr.retries = retries;
+        }
+
+        connectErr.reason = status.errorStr;
+        connectErr.http_status = status.http_status;
+
+        _onMessageCallback(ix::make_unique<WebSocketMessage>(WebSocketMessageType::Error,
+                                                             emptyMsg,
+                                                             0,
+                                                             connectErr,
+                                                             WebSocketOpenInfo(),
+                                                             WebSocketCloseInfo()));
+    }
+
     void WebSocket::run()
     {
         setThreadName(getUrl());
@@ -379,57 +481,90 @@ namespace ix
             WebSocketTransport::PollResult pollResult = _ws.poll();
 
             // 3. Dispatch the incoming messages
-            _ws.dispatch(
-                pollResult,
-                [this](const std::string& msg,
-                       size_t wireSize,
-                       bool decompressionError,
-                       WebSocketTransport::MessageKind messageKind) {
-                    WebSocketMessageType webSocketMessageType;
-                    switch (messageKind)
+            dispatch(pollResult);
+        }
+    }
+
+    void WebSocket::dispatch(WebSocketTransport::PollResult pollResult)
+    {
+        _ws.dispatch(
+            pollResult,
+            [this](const std::string& msg,
+                   const char* data,
+                   size_t size,
+                   size_t wireSize,
+                   bool decompressionError,
+                   WebSocketTransport::MessageKind messageKind) {
+                WebSocketMessageType webSocketMessageType;
+                switch (messageKind)
+                {
+                    case WebSocketTransport::MessageKind::MSG_TEXT:
+                    case WebSocketTransport::MessageKind::MSG_BINARY:
                     {
-                        case WebSocketTransport::MessageKind::MSG_TEXT:
-                        case WebSocketTransport::MessageKind::MSG_BINARY:
-                        {
-                            webSocketMessageType = WebSocketMessageType::Message;
-                        }
-                        break;
-
-                        case WebSocketTransport::MessageKind::PING:
-                        {
-                            webSocketMessageType = WebSocketMessageType::Ping;
-                        }
-                        break;
-
-                        case WebSocketTransport::MessageKind::PONG:
-                        {
-                            webSocketMessageType = WebSocketMessageType::Pong;
-                        }
-                        break;
-
-                        case WebSocketTransport::MessageKind::FRAGMENT:
-                        {
-                            webSocketMessageType = WebSocketMessageType::Fragment;
-                        }
-                        break;
+                        webSocketMessageType = WebSocketMessageType::Message;
                     }
+                    break;
 
-                    WebSocketErrorInfo webSocketErrorInfo;
-                    webSocketErrorInfo.decompressionError = decompressionError;
+                    case WebSocketTransport::MessageKind::PING:
+                    {
+                        webSocketMessageType = WebSocketMessageType::Ping;
+                    }
+                    break;
 
-                    bool binary = messageKind == WebSocketTransport::MessageKind::MSG_BINARY;
+                    case WebSocketTransport::MessageKind::PONG:
+                    {
+                        webSocketMessageType = WebSocketMessageType::Pong;
+                    }
+                    break;
 
-                    _onMessageCallback(ix::make_unique<WebSocketMessage>(webSocketMessageType,
-                                                                         msg,
-                                                                         wireSize,
-                                                                         webSocketErrorInfo,
-                                                                         WebSocketOpenInfo(),
-                                                                         WebSocketCloseInfo(),
-                                                                         binary));
+                    case WebSocketTransport::MessageKind::FRAGMENT:
+                    {
+                        webSocketMessageType = WebSocketMessageType::Fragment;
+                    }
+                    break;
+                }
 
-                    WebSocket::invokeTrafficTrackerCallback(wireSize, true);
-                });
+                WebSocketErrorInfo webSocketErrorInfo;
+                webSocketErrorInfo.decompressionError = decompressionError;
+
+                bool binary = messageKind == WebSocketTransport::MessageKind::MSG_BINARY;
+
+                _onMessageCallback(makeReceivedMessage(webSocketMessageType,
+                                                       msg,
+                                                       data,
+                                                       size,
+                                                       wireSize,
+                                                       webSocketErrorInfo,
+                                                       binary));
+
+                WebSocket::invokeTrafficTrackerCallback(wireSize, true);
+            });
+    }
+
+    const WebSocketMessagePtr& WebSocket::makeReceivedMessage(WebSocketMessageType type,
+                                                              const std::string& str,
+                                                              const char* data,
+                                                              size_t size,
+                                                              size_t wireSize,
+                                                              const WebSocketErrorInfo& errorInfo,
+                                                              bool binary)
+    {
+        if (!_receivedMessage)
+        {
+            _receivedMessage = ix::make_unique<WebSocketMessage>(
+                type, str, data, size, wireSize, errorInfo, binary);
+            return _receivedMessage;
         }
+
+        // The callback only gets a reference to the message, which is not valid once it
+        // returns, so the previous message can be destroyed and its storage reused.
+        WebSocketMessage* message = _receivedMessage.release();
+        message->~WebSocketMessage();
+        message = new (message)
+            WebSocketMessage(type, str, data, size, wireSize, errorInfo, binary);
+        _receivedMessage.reset(message);
+
+        return _receivedMessage;
     }
 
     void WebSocket::setOnMessageCallback(const OnMessageCallback& callback)
@@ -494,6 +629,134 @@ namespace ix
         return sendMessage(text, SendMessageKind::Ping);
     }
 
+    WebSocketSendInfo WebSocket::sendPrepared(const WebSocketPreparedMessage& message)
+    {
+        if (!message.isValid() || !isConnected()) return WebSocketSendInfo(false);
+
+        std::unique_lock<std::mutex> lock(_writeMutex);
+        WebSocketSendInfo webSocketSendInfo = _ws.sendPreparedMessage(message);
+        releaseWriteLock(lock);
+
+        WebSocket::invokeTrafficTrackerCallback(webSocketSendInfo.wireSize, false);
+
+        return webSocketSendInfo;
+    }
+
+    QueueMessageResult WebSocket::queuePrepared(const WebSocketPreparedMessage& message,
+                                                size_t highWaterMark,
+                                                SendQueueOverflowPolicy policy)
+    {
+        if (!message.isValid()) return QueueMessageResult::Dropped;
+        if (!isConnected()) return QueueMessageResult::NotConnected;
+
+        // A message cannot be queued in the middle of the fragments of another one
+        std::unique_lock<std::mutex> lock(_writeMutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            auto result = queuePreparedLocked(message, highWaterMark, policy);
+            releaseWriteLock(lock);
+
+            if (result == QueueMessageResult::Dropped &&
+                policy == SendQueueOverflowPolicy::Disconnect)
+            {
+                close(WebSocketCloseConstants::kPolicyViolationCode,
+                      WebSocketCloseConstants::kSendQueueOverflowMessage);
+                return QueueMessageResult::Disconnected;
+            }
+            return result;
+        }
+
+        // The thread sending a message queues this one once it is done. The deferred
+        // messages count toward the high-water mark too.
+        auto result = QueueMessageResult::Deferred;
+        {
+            std::lock_guard<std::mutex> deferredLock(_deferredMessagesMutex);
+
+            size_t size = message.getPayload().size();
+            if (_deferredMessagesSize + size > highWaterMark)
+            {
+                if (policy == SendQueueOverflowPolicy::Drop)
+                {
+                    return QueueMessageResult::Dropped;
+                }
+                else if (policy == SendQueueOverflowPolicy::Coalesce)
+                {
+                    _deferredMessages.clear();
+                    _deferredMessagesSize = 0;
+                    result = QueueMessageResult::Coalesced;
+                }
+                else
+                {
+                    result = QueueMessageResult::Disconnected;
+                }
+            }
+
+            if (result != QueueMessageResult::Disconnected)
+            {
+                _deferredMessages.push_back({message, highWaterMark, policy});
+                _deferredMessagesSize += size;
+            }
+        }
+
+        if (result == QueueMessageResult::Disconnected)
+        {
+            close(WebSocketCloseConstants::kPolicyViolationCode,
+                  WebSocketCloseConstants::kSendQueueOverflowMessage);
+            return result;
+        }
+
+        // The lock might have been released in the meantime
+        if (lock.try_lock()) releaseWriteLock(lock);
+
+        return result;
+    }
+
+    QueueMessageResult WebSocket::queuePreparedLocked(const WebSocketPreparedMessage& message,
+                                                      size_t highWaterMark,
+                                                      SendQueueOverflowPolicy policy)
+    {
+        bool coalesce = policy == SendQueueOverflowPolicy::Coalesce;
+        return _ws.queuePreparedMessage(message, highWaterMark, coalesce);
+    }
+
+    void WebSocket::releaseWriteLock(std::unique_lock<std::mutex>& lock)
+    {
+        bool disconnect = false;
+        while (true)
+        {
+            std::deque<DeferredPreparedMessage> deferredMessages;
+            {
+                std::lock_guard<std::mutex> deferredLock(_deferredMessagesMutex);
+                deferredMessages.swap(_deferredMessages);
+                _deferredMessagesSize = 0;
+            }
+
+            for (auto&& deferred : deferredMessages)
+            {
+                auto result =
+                    queuePreparedLocked(deferred.message, deferred.highWaterMark, deferred.policy);
+                disconnect = disconnect || (result == QueueMessageResult::Dropped &&
+                                            deferred.policy == SendQueueOverflowPolicy::Disconnect);
+            }
+
+            lock.unlock();
+
+            // Messages deferred after the swap, and before the unlock, are queued by
+            // whoever gets the lock next, possibly us
+            {
+                std::lock_guard<std::mutex> deferredLock(_deferredMessagesMutex);
+                if (_deferredMessages.empty()) break;
+            }
+            if (!lock.try_lock()) break;
+        }
+
+        if (disconnect)
+        {
+            close(WebSocketCloseConstants::kPolicyViolationCode,
+                  WebSocketCloseConstants::kSendQueueOverflowMessage);
+        }
+    }
+
     WebSocketSendInfo WebSocket::sendMessage(const std::string& text,
                                              SendMessageKind sendMessageKind,
                                              const OnProgressCallback& onProgressCallback)
@@ -509,7 +772,7 @@ namespace ix
         // with battery life), and use the system select call to notify us when
         // incoming messages are arriving / there's data to be received.
         //
-        std::lock_guard<std::mutex> lock(_writeMutex);
+        std::unique_lock<std::mutex> lock(_writeMutex);
         WebSocketSendInfo webSocketSendInfo;
 
         switch (sendMessageKind)
@@ -532,6 +795,7 @@ namespace ix
             }
             break;
         }
+        releaseWriteLock(lock);
 
         WebSocket::invokeTrafficTrackerCallback(webSocketSendInfo.wireSize, false);
 
@@ -16,10 +16,13 @@
 #include "IXWebSocketHttpHeaders.h"
 #include "IXWebSocketMessage.h"
 #include "IXWebSocketPerMessageDeflateOptions.h"
+#include "IXWebSocketPreparedMessage.h"
 #include "IXWebSocketSendInfo.h"
 #include "IXWebSocketTransport.h"
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -39,6 +42,9 @@ namespace ix
 
     using OnTrafficTrackerCallback = std::function<void(size_t size, bool incoming)>;
 
+    class WebSocketClientLoop;
+    class WebSocketEventLoopConnection;
+
     class WebSocket
     {
     public:
@@ -60,6 +66,17 @@ namespace ix
         void addSubProtocol(const std::string& subProtocol);
         void setHandshakeTimeout(int handshakeTimeoutSecs);
 
+        // Deliver unfragmented and uncompressed messages as a view into the receive
+        // buffer, available with the data and size message fields (str is empty).
+        // The view is only valid for the duration of the message callback.
+        void enableZeroCopyMessages();
+        void disableZeroCopyMessages();
+
+        // Run from the threads of a shared client loop instead of a dedicated thread.
+        // Must be called before start. The message callback is then invoked from the
+        // client loop threads and should not block, and stop must not be called from it.
+        void setClientLoop(const std::shared_ptr<WebSocketClientLoop>& clientLoop);
+
         // Run asynchronously, by calling start and stop.
         void start();
 
@@ -81,6 +98,17 @@ namespace ix
                                    const OnProgressCallback& onProgressCallback = nullptr);
         WebSocketSendInfo ping(const std::string& text);
 
+        // Send a message encoded once for many connections, without copying its frame
+        WebSocketSendInfo sendPrepared(const WebSocketPreparedMessage& message);
+
+        // Queue a prepared message without blocking, it is sent from the thread (or the
+        // event loop) of the connection. The policy applies when more than highWaterMark
+        // bytes are waiting to be sent already. If the connection is busy with a blocking
+        // send from another thread, the message is deferred until that send is done.
+        QueueMessageResult queuePrepared(const WebSocketPreparedMessage& message,
+                                         size_t highWaterMark,
+                                         SendQueueOverflowPolicy policy);
+
         void close(uint16_t code = WebSocketCloseConstants::kNormalClosureCode,
                    const std::string& reason = WebSocketCloseConstants::kNormalClosureMessage);
 
@@ -111,11 +139,36 @@ namespace ix
                                       SendMessageKind sendMessageKind,
                                       const OnProgressCallback& callback = nullptr);
 
+        // With _writeMutex held
+        QueueMessageResult queuePreparedLocked(const WebSocketPreparedMessage& message,
+                                               size_t highWaterMark,
+                                               SendQueueOverflowPolicy policy);
+        // Queue the messages deferred while the lock was held, then release it
+        void releaseWriteLock(std::unique_lock<std::mutex>& lock);
+
         bool isConnected() const;
         bool isClosing() const;
         void checkConnection(bool firstConnectionAttempt);
+        void notifyConnectionError(const WebSocketInitResult& status,
+                                   uint32_t retries,
+                                   double waitTime);
+        void stopClientLoopConnection();
+
+        // Client connection, split in a blocking part and a notification
+        WebSocketInitResult connectToUrl(int timeoutSecs);
+        void notifyOpen(const WebSocketInitResult& status);
         static void invokeTrafficTrackerCallback(size_t size, bool incoming);
 
+        // Process the received data and invoke the message callback
+        void dispatch(WebSocketTransport::PollResult pollResult);
+        const WebSocketMessagePtr& makeReceivedMessage(WebSocketMessageType type,
+                                                       const std::string& str,
+                                                       const char* data,
+                                                       size_t size,
+                                                       size_t wireSize,
+                                                       const WebSocketErrorInfo& errorInfo,
+                                                       bool binary);
+
         // Server
         WebSocketInitResult connectToSocket(std::unique_ptr<Socket>,
                                             int timeoutSecs,
@@ -135,10 +188,24 @@ namespace ix
         OnMessageCallback _onMessageCallback;
         static OnTrafficTrackerCallback _onTrafficTrackerCallback;
 
+        // Reused for all the received messages, to avoid an allocation per message
+        WebSocketMessagePtr _receivedMessage;
+
         std::atomic<bool> _stop;
         std::thread _thread;
         std::mutex _writeMutex;
 
+        // Prepared messages queued while another thread held _writeMutex
+        struct DeferredPreparedMessage
+        {
+            WebSocketPreparedMessage message;
+            size_t highWaterMark;
+            SendQueueOverflowPolicy policy;
+        };
+        std::mutex _deferredMessagesMutex;
+        std::deque<DeferredPreparedMessage> _deferredMessages;
+        size_t _deferredMessagesSize;
+
         // Automatic reconnection
         std::atomic<bool> _automaticReconnection;
         static const uint32_t kDefaultMaxWaitBetweenReconnectionRetries;
@@ -157,6 +224,8 @@ namespace ix
         bool _enablePong;
         static const bool kDefaultEnablePong;
 
+        bool _enableZeroCopyMessages;
+
         // Optional ping and pong timeout
         int _pingIntervalSecs;
         int _pingTimeoutSecs;
@@ -166,6 +235,14 @@ namespace ix
         // Subprotocols
         std::vector<std::string> _subProtocols;
 
+        // Client loop mode
+        std::shared_ptr<WebSocketClientLoop> _clientLoop;
+        std::shared_ptr<WebSocketEventLoopConnection> _connection;
+        std::mutex _connectionMutex;
+        std::condition_variable _connectionCondition;
+        bool _connectionClosed;
+
         friend class WebSocketServer;
+        friend class WebSocketEventLoopConnection;
     };
 } // namespace ix
@@ -0,0 +1,146 @@
+/*
+ *  IXWebSocketClientLoop.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXWebSocketClientLoop.h"
+
+#include "IXSetThreadName.h"
+#include "IXWebSocketEventLoopConnection.h"
+#include <algorithm>
+#include <sstream>
+
+namespace ix
+{
+    const size_t WebSocketClientLoop::kDefaultConnectThreads(4);
+
+    WebSocketClientLoop::WebSocketClientLoop(size_t threads, size_t connectThreads)
+        : _eventLoopPool(threads)
+        , _started(false)
+        , _connectThreadsCount(connectThreads == 0 ? 1 : connectThreads)
+        , _stop(false)
+    {
+        ;
+    }
+
+    WebSocketClientLoop::~WebSocketClientLoop()
+    {
+        stop();
+    }
+
+    bool WebSocketClientLoop::start(std::string& errorMsg)
+    {
+        if (_started) return true;
+
+        if (!_eventLoopPool.start("WebSocketClientLoop", errorMsg))
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < _connectThreadsCount; ++i)
+        {
+            _connectThreads.push_back(std::thread([this, i] {
+                std::stringstream ss;
+                ss << "WebSocketClientLoop::connect::" << i;
+                setThreadName(ss.str());
+
+                runConnectTasks();
+            }));
+        }
+
+        _started = true;
+        return true;
+    }
+
+    void WebSocketClientLoop::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_connectTasksMutex);
+            _stop = true;
+        }
+        _connectTasksCondition.notify_all();
+
+        // Connections being established are finished, queued ones are dropped
+        for (auto&& thread : _connectThreads)
+        {
+            thread.join();
+        }
+        _connectThreads.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(_connectTasksMutex);
+            _connectTasks.clear();
+        }
+
+        for (auto&& eventLoop : _eventLoopPool.getEventLoops())
+        {
+            eventLoop->stop();
+        }
+
+        // The loop threads are gone, the connections can be closed from this one
+        std::vector<std::weak_ptr<WebSocketEventLoopConnection>> connections;
+        {
+            std::lock_guard<std::mutex> lock(_connectionsMutex);
+            connections.swap(_connections);
+        }
+
+        for (auto&& weakConnection : connections)
+        {
+            if (auto connection = weakConnection.lock()) connection->abort();
+        }
+
+        _eventLoopPool.stop();
+        _started = false;
+    }
+
+    EventLoopPtr WebSocketClientLoop::getNextEventLoop()
+    {
+        if (!_started) return nullptr;
+
+        return _eventLoopPool.getNextEventLoop();
+    }
+
+    void WebSocketClientLoop::runConnect(const EventLoop::Task& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_connectTasksMutex);
+            _connectTasks.push_back(task);
+        }
+        _connectTasksCondition.notify_one();
+    }
+
+    void WebSocketClientLoop::addConnection(
+        const std::shared_ptr<WebSocketEventLoopConnection>& connection)
+    {
+        std::lock_guard<std::mutex> lock(_connectionsMutex);
+
+        _connections.erase(std::remove_if(_connections.begin(),
+                                          _connections.end(),
+                                          [](const std::weak_ptr<WebSocketEventLoopConnection>& c) {
+                                              return c.expired();
+                                          }),
+                           _connections.end());
+        _connections.push_back(connection);
+    }
+
+    void WebSocketClientLoop::runConnectTasks()
+    {
+        while (true)
+        {
+            EventLoop::Task task;
+            {
+                std::unique_lock<std::mutex> lock(_connectTasksMutex);
+                _connectTasksCondition.wait(lock,
+                                            [this] { return _stop || !_connectTasks.empty(); });
+
+                if (_stop) return;
+
+                task = std::move(_connectTasks.front());
+                _connectTasks.pop_front();
+            }
+
+            task();
+        }
+    }
+} // namespace ix
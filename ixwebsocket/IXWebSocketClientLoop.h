@@ -0,0 +1,78 @@
+/*
+ *  IXWebSocketClientLoop.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#pragma once
+
+#include "IXEventLoop.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ix
+{
+    class WebSocketEventLoopConnection;
+
+    //
+    // Run many client WebSockets from a fixed number of threads, instead of one
+    // thread per WebSocket. Usage:
+    //
+    //   auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(4);
+    //   std::string errorMsg;
+    //   if (!clientLoop->start(errorMsg)) ...
+    //
+    //   webSocket.setClientLoop(clientLoop);
+    //   webSocket.start();
+    //
+    // Connected WebSockets are served by a set of event loops (reads, sends, pings,
+    // close handshake and reconnection backoff). Establishing a connection still
+    // requires blocking calls (DNS lookup, TCP connect, TLS and HTTP upgrade
+    // handshakes) which run on a separate, small set of connect threads.
+    //
+    // Only available on Linux. WebSockets fall back to their own thread if the
+    // client loop is not started.
+    //
+    // Async HttpClient instances use their own client loop in the same way.
+    //
+    class WebSocketClientLoop
+    {
+    public:
+        // 0 event loop threads means one per core
+        WebSocketClientLoop(size_t threads = 0, size_t connectThreads = kDefaultConnectThreads);
+        ~WebSocketClientLoop();
+
+        bool start(std::string& errorMsg);
+
+        // internal
+        EventLoopPtr getNextEventLoop();
+        void runConnect(const EventLoop::Task& task);
+        // Connections still running when the client loop stops are closed, so that
+        // their WebSockets do not wait for tasks which will not run anymore
+        void addConnection(const std::shared_ptr<WebSocketEventLoopConnection>& connection);
+
+        const static size_t kDefaultConnectThreads;
+
+    private:
+        void stop();
+        void runConnectTasks();
+
+        EventLoopPool _eventLoopPool;
+        bool _started;
+
+        size_t _connectThreadsCount;
+        std::vector<std::thread> _connectThreads;
+        std::mutex _connectTasksMutex;
+        std::condition_variable _connectTasksCondition;
+        std::deque<EventLoop::Task> _connectTasks;
+        bool _stop;
+
+        std::mutex _connectionsMutex;
+        std::vector<std::weak_ptr<WebSocketEventLoopConnection>> _connections;
+    };
+} // namespace ix
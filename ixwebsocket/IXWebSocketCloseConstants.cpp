@@ -14,6 +14,7 @@ namespace ix
     const uint16_t WebSocketCloseConstants::kInvalidFramePayloadData(1007);
     const uint16_t WebSocketCloseConstants::kProtocolErrorCode(1002);
     const uint16_t WebSocketCloseConstants::kNoStatusCodeErrorCode(1005);
+    const uint16_t WebSocketCloseConstants::kPolicyViolationCode(1008);
 
     const std::string WebSocketCloseConstants::kNormalClosureMessage("Normal closure");
     const std::string WebSocketCloseConstants::kInternalErrorMessage("Internal error");
@@ -33,4 +34,5 @@ namespace ix
     const std::string WebSocketCloseConstants::kInvalidFramePayloadDataMessage(
         "Invalid frame payload data");
     const std::string WebSocketCloseConstants::kInvalidCloseCodeMessage("Invalid close code");
+    const std::string WebSocketCloseConstants::kSendQueueOverflowMessage("Send queue overflow");
 } // namespace ix
@@ -0,0 +1,378 @@
+/*
+ *  IXWebSocketEventLoopConnection.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXWebSocketEventLoopConnection.h"
+
+#include "IXExponentialBackoff.h"
+#include "IXHttpParser.h"
+#include "IXSocket.h"
+#include "IXUserAgent.h"
+#include "IXWebSocket.h"
+#include <sstream>
+
+namespace ix
+{
+    const size_t WebSocketEventLoopConnection::kMaxHandshakeRequestSize(1 << 16);
+
+    WebSocketEventLoopConnection::WebSocketEventLoopConnection(
+        EventLoopPtr eventLoop,
+        WebSocket& webSocket,
+        const OnClosedCallback& onClosedCallback)
+        : _eventLoop(*eventLoop)
+        , _weakEventLoop(eventLoop)
+        , _webSocket(webSocket)
+        , _onClosedCallback(onClosedCallback)
+        , _state(State::Handshake)
+        , _id(0)
+        , _handshakeTimeoutSecs(0)
+        , _enablePerMessageDeflate(false)
+        , _retries(0)
+        , _stopRequested(false)
+        , _timerScheduled(false)
+    {
+        ;
+    }
+
+    WebSocketEventLoopConnection::~WebSocketEventLoopConnection()
+    {
+        ;
+    }
+
+    void WebSocketEventLoopConnection::accept(std::unique_ptr<Socket> socket,
+                                              int handshakeTimeoutSecs,
+                                              bool enablePerMessageDeflate)
+    {
+        _socket = std::move(socket);
+        _handshakeTimeoutSecs = handshakeTimeoutSecs;
+        _enablePerMessageDeflate = enablePerMessageDeflate;
+
+        std::string errorMsg;
+        if (!registerSocket(_socket->getFd(), errorMsg))
+        {
+            finish(errorMsg);
+            return;
+        }
+
+        std::weak_ptr<WebSocketEventLoopConnection> weakSelf = shared_from_this();
+        _eventLoop.runAfter(1000 * _handshakeTimeoutSecs, [weakSelf] {
+            if (auto self = weakSelf.lock()) self->onHandshakeTimeout();
+        });
+
+        // The request might have been received already, and since sockets are
+        // watched in edge triggered mode we would not be notified about it.
+        onHandshakeEvent();
+    }
+
+    void WebSocketEventLoopConnection::connect(const BlockingTaskRunner& blockingTaskRunner)
+    {
+        _blockingTaskRunner = blockingTaskRunner;
+
+        installWakeUpCallback();
+        startConnect();
+    }
+
+    void WebSocketEventLoopConnection::startConnect()
+    {
+        _state = State::Connecting;
+
+        auto self = shared_from_this();
+        std::weak_ptr<EventLoop> weakEventLoop = _weakEventLoop;
+        int timeoutSecs = _webSocket._handshakeTimeoutSecs;
+
+        _blockingTaskRunner([self, weakEventLoop, timeoutSecs] {
+            WebSocketInitResult status(false, 0, "WebSocketEventLoopConnection: stopped");
+            if (!self->isStopRequested())
+            {
+                status = self->_webSocket.connectToUrl(timeoutSecs);
+            }
+
+            if (auto eventLoop = weakEventLoop.lock())
+            {
+                eventLoop->post([self, status] { self->onConnected(status); });
+            }
+        });
+    }
+
+    void WebSocketEventLoopConnection::onConnected(const WebSocketInitResult& status)
+    {
+        if (!status.success)
+        {
+            bool automaticReconnection = _webSocket.isAutomaticReconnectionEnabled();
+            uint32_t delayMs = 0;
+
+            if (automaticReconnection)
+            {
+                delayMs = calculateRetryWaitMilliseconds(
+                    _retries++,
+                    _webSocket.getMaxWaitBetweenReconnectionRetries(),
+                    _webSocket.getMinWaitBetweenReconnectionRetries());
+            }
+
+            _webSocket.notifyConnectionError(status, _retries, delayMs);
+
+            if (!automaticReconnection || isStopRequested())
+            {
+                finish(status.errorStr);
+                return;
+            }
+
+            _state = State::WaitingToReconnect;
+
+            std::weak_ptr<WebSocketEventLoopConnection> weakSelf = shared_from_this();
+            _eventLoop.runAfter(delayMs, [weakSelf] {
+                if (auto self = weakSelf.lock()) self->onReconnectTimer();
+            });
+            return;
+        }
+
+        std::string errorMsg;
+        if (isStopRequested())
+        {
+            errorMsg = "WebSocketEventLoopConnection: stopped while connecting";
+        }
+        else if (registerSocket(_webSocket._ws.getSocketFd(), errorMsg))
+        {
+            _state = State::Open;
+            _retries = 0;
+
+            _webSocket.notifyOpen(status);
+
+            // Data might be buffered already by the TLS layer, which would not
+            // trigger a notification from the event loop
+            process(true, true);
+            return;
+        }
+
+        _webSocket._ws.closeSocket();
+        _webSocket._ws.setReadyState(WebSocketTransport::ReadyState::CLOSED);
+        finish(errorMsg);
+    }
+
+    void WebSocketEventLoopConnection::onReconnectTimer()
+    {
+        if (_state != State::WaitingToReconnect) return;
+
+        startConnect();
+    }
+
+    void WebSocketEventLoopConnection::requestStop()
+    {
+        _stopRequested = true;
+
+        auto eventLoop = _weakEventLoop.lock();
+        if (!eventLoop) return;
+
+        auto self = shared_from_this();
+        eventLoop->post([self] { self->onStop(); });
+    }
+
+    void WebSocketEventLoopConnection::onStop()
+    {
+        if (_state == State::WaitingToReconnect)
+        {
+            finish();
+        }
+        else if (_state == State::Open)
+        {
+            // The WebSocket might be closed already
+            process(false, false);
+        }
+    }
+
+    void WebSocketEventLoopConnection::abort()
+    {
+        if (_state == State::Closed) return;
+
+        _stopRequested = true;
+
+        // A connection might have been established without its completion being processed
+        if (_webSocket.getReadyState() != ReadyState::Closed)
+        {
+            _webSocket._ws.closeSocket();
+            _webSocket._ws.setReadyState(WebSocketTransport::ReadyState::CLOSED);
+        }
+
+        finish("WebSocketEventLoopConnection: event loop stopped");
+    }
+
+    bool WebSocketEventLoopConnection::isStopRequested() const
+    {
+        return _stopRequested;
+    }
+
+    bool WebSocketEventLoopConnection::registerSocket(int fd, std::string& errorMsg)
+    {
+        auto self = shared_from_this();
+
+        _id = _eventLoop.add(
+            fd, [self](bool readable, bool writable) { self->onEvent(readable, writable); }, errorMsg);
+
+        return _id != 0;
+    }
+
+    void WebSocketEventLoopConnection::installWakeUpCallback()
+    {
+        // Sends and close requests can come from any thread. The event loop
+        // is asked to flush the send buffer and to re-arm the timers.
+        std::weak_ptr<EventLoop> weakEventLoop = _weakEventLoop;
+        std::weak_ptr<WebSocketEventLoopConnection> weakSelf = shared_from_this();
+
+        _webSocket._ws.setOnWakeUpCallback([weakEventLoop, weakSelf](uint64_t /*wakeUpCode*/) {
+            auto eventLoop = weakEventLoop.lock();
+            if (!eventLoop) return;
+
+            eventLoop->post([weakSelf] {
+                if (auto self = weakSelf.lock()) self->onWakeUp();
+            });
+        });
+    }
+
+    void WebSocketEventLoopConnection::onEvent(bool readable, bool writable)
+    {
+        if (_state == State::Handshake)
+        {
+            if (readable) onHandshakeEvent();
+        }
+        else if (_state == State::Open)
+        {
+            process(readable, writable);
+        }
+    }
+
+    void WebSocketEventLoopConnection::onHandshakeEvent()
+    {
+        if (!_socket->fillReadBuffer())
+        {
+            finish("WebSocketEventLoopConnection: connection closed during the handshake");
+            return;
+        }
+
+        // Parse what was received so far. Invalid requests are rejected by the handshake.
+        HttpRequestHead head;
+        size_t headSize = 0;
+        auto parseResult = HttpParser::parseRequest(
+            _socket->getReadBufferData(), _socket->getReadBufferSize(), head, headSize);
+
+        if (parseResult == HttpParseResult::Incomplete)
+        {
+            if (_socket->getReadBufferSize() > kMaxHandshakeRequestSize)
+            {
+                rejectHandshake("HTTP request too large");
+            }
+            return;
+        }
+
+        // The whole request is buffered, so the handshake will not block on reads
+        auto status = _webSocket.connectToSocket(
+            std::move(_socket), _handshakeTimeoutSecs, _enablePerMessageDeflate);
+
+        if (!status.success)
+        {
+            std::stringstream ss;
+            ss << "WebSocketEventLoopConnection: HTTP status: " << status.http_status
+               << " error: " << status.errorStr;
+            finish(ss.str());
+            return;
+        }
+
+        _state = State::Open;
+
+        // Process the frames which were received along with the request
+        process(false, false);
+    }
+
+    void WebSocketEventLoopConnection::onHandshakeTimeout()
+    {
+        if (_state != State::Handshake) return;
+
+        rejectHandshake("Error reading HTTP request line");
+    }
+
+    void WebSocketEventLoopConnection::rejectHandshake(const std::string& reason)
+    {
+        // Best effort, the socket send buffer is empty at that point
+        std::stringstream ss;
+        ss << "HTTP/1.1 400 " << reason << "\r\n";
+        ss << "Server: " << userAgent() << "\r\n";
+        _socket->send(ss.str());
+
+        finish("WebSocketEventLoopConnection: HTTP status: 400 error: " + reason);
+    }
+
+    void WebSocketEventLoopConnection::onWakeUp()
+    {
+        if (_state != State::Open) return;
+
+        process(false, true);
+    }
+
+    void WebSocketEventLoopConnection::onTimer()
+    {
+        if (_state != State::Open) return;
+
+        _timerScheduled = false;
+        process(false, false);
+    }
+
+    void WebSocketEventLoopConnection::process(bool readable, bool writable)
+    {
+        auto pollResult = _webSocket._ws.processEvents(readable, writable);
+        _webSocket.dispatch(pollResult);
+
+        scheduleTimer();
+        checkClosed();
+    }
+
+    void WebSocketEventLoopConnection::scheduleTimer()
+    {
+        int delayMs = _webSocket._ws.processTimers();
+        if (delayMs < 0) return;
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs);
+        if (_timerScheduled && _timerDeadline <= deadline) return;
+
+        _timerScheduled = true;
+        _timerDeadline = deadline;
+
+        std::weak_ptr<WebSocketEventLoopConnection> weakSelf = shared_from_this();
+        _eventLoop.runAfter(delayMs, [weakSelf] {
+            if (auto self = weakSelf.lock()) self->onTimer();
+        });
+    }
+
+    void WebSocketEventLoopConnection::checkClosed()
+    {
+        if (_webSocket.getReadyState() != ReadyState::Closed) return;
+
+        // Clients reconnect right away, and then with a backoff
+        if (_blockingTaskRunner && _webSocket.isAutomaticReconnectionEnabled() &&
+            !isStopRequested())
+        {
+            _eventLoop.remove(_id);
+            _id = 0;
+            startConnect();
+            return;
+        }
+
+        finish();
+    }
+
+    void WebSocketEventLoopConnection::finish(const std::string& errorMsg)
+    {
+        if (_state == State::Closed) return;
+        _state = State::Closed;
+
+        // This releases the reference the event loop holds on us
+        _eventLoop.remove(_id);
+        _socket.reset();
+
+        // The WebSocket can be destroyed by the callback, it must come last
+        if (_onClosedCallback)
+        {
+            _onClosedCallback(errorMsg);
+        }
+    }
+} // namespace ix
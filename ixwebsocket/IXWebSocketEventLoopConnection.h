@@ -0,0 +1,125 @@
+/*
+ *  IXWebSocketEventLoopConnection.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#pragma once
+
+#include "IXEventLoop.h"
+#include "IXWebSocketHandshake.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace ix
+{
+    class Socket;
+    class WebSocket;
+
+    //
+    // Drive a WebSocket from an event loop thread, instead of running it in its own
+    // thread: socket readiness, wake up requests coming from other threads (sends,
+    // close) and ping / closing timers are all processed by the event loop.
+    // Callbacks of the WebSocket are invoked from the event loop thread, and should
+    // not block.
+    //
+    // All methods but requestStop must be called from the event loop thread.
+    //
+    class WebSocketEventLoopConnection
+        : public std::enable_shared_from_this<WebSocketEventLoopConnection>
+    {
+    public:
+        // Invoked once the connection is closed, with an error message if
+        // it failed before being established.
+        using OnClosedCallback = std::function<void(const std::string& errorMsg)>;
+
+        // Run a task outside of the event loop, used for blocking operations
+        using BlockingTaskRunner = std::function<void(const EventLoop::Task& task)>;
+
+        // The WebSocket must outlive the connection, or at least the call
+        // to the closed callback.
+        WebSocketEventLoopConnection(EventLoopPtr eventLoop,
+                                     WebSocket& webSocket,
+                                     const OnClosedCallback& onClosedCallback);
+        ~WebSocketEventLoopConnection();
+
+        // Server. Route the sends of the WebSocket through the event loop, to be called
+        // before the WebSocket can be reached from other threads.
+        void installWakeUpCallback();
+
+        // Server. Accumulate the HTTP upgrade request without blocking and perform the
+        // handshake once it is complete.
+        void accept(std::unique_ptr<Socket> socket,
+                    int handshakeTimeoutSecs,
+                    bool enablePerMessageDeflate);
+
+        // Client. Connect with the given runner, as connecting blocks, and reconnect
+        // with an exponential backoff if automatic reconnection is enabled.
+        void connect(const BlockingTaskRunner& blockingTaskRunner);
+
+        // Thread safe. Stop reconnecting, the connection is closed (and the closed
+        // callback invoked) once the WebSocket is closed.
+        void requestStop();
+
+        // Close the WebSocket without a close handshake and invoke the closed callback.
+        // Called once the event loop thread is stopped, instead of from it.
+        void abort();
+
+    private:
+        enum class State
+        {
+            Handshake,
+            Connecting,
+            WaitingToReconnect,
+            Open,
+            Closed
+        };
+
+        void onEvent(bool readable, bool writable);
+        void onHandshakeEvent();
+        void onHandshakeTimeout();
+        void onConnected(const WebSocketInitResult& status);
+        void onReconnectTimer();
+        void onWakeUp();
+        void onTimer();
+        void onStop();
+
+        void startConnect();
+        void process(bool readable, bool writable);
+        void scheduleTimer();
+        void checkClosed();
+        void finish(const std::string& errorMsg = std::string());
+
+        bool registerSocket(int fd, std::string& errorMsg);
+        void rejectHandshake(const std::string& reason);
+        bool isStopRequested() const;
+
+        EventLoop& _eventLoop;
+        std::weak_ptr<EventLoop> _weakEventLoop;
+        WebSocket& _webSocket;
+        OnClosedCallback _onClosedCallback;
+
+        State _state;
+        uint64_t _id;
+
+        // Server handshake
+        std::unique_ptr<Socket> _socket;
+        int _handshakeTimeoutSecs;
+        bool _enablePerMessageDeflate;
+
+        // Client connection and reconnection
+        BlockingTaskRunner _blockingTaskRunner;
+        uint32_t _retries;
+        std::atomic<bool> _stopRequested;
+
+        // Only one timer is needed, the earliest one
+        bool _timerScheduled;
+        std::chrono::steady_clock::time_point _timerDeadline;
+
+        // Upper bound for the size of an HTTP upgrade request
+        static const size_t kMaxHandshakeRequestSize;
+    };
+} // namespace ix
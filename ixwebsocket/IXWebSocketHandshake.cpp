@@ -7,6 +7,7 @@
 #include "IXWebSocketHandshake.h"
 
 #include "IXHttp.h"
+#include "IXHttpParser.h"
 #include "IXSocketConnect.h"
 #include "IXStrCaseCompare.h"
 #include "IXUrlParser.h"
@@ -98,7 +99,7 @@ namespace ix
             makeCancellationRequestWithTimeout(timeoutSecs, _requestInitCancellation);
 
         std::string errMsg;
-        bool success = _socket->connect(host, port, errMsg, isCancellationRequested);
+        bool success = _socket->connect(host, port, errMsg, isCancellationRequested, timeoutSecs);
         if (!success)
         {
             std::stringstream ss;
@@ -148,21 +149,25 @@ namespace ix
                 false, 0, std::string("Failed sending GET request to ") + url);
         }
 
-        // Read HTTP status line
-        auto lineResult = _socket->readLine(isCancellationRequested);
-        auto lineValid = lineResult.first;
-        auto line = lineResult.second;
+        // Read HTTP status line and headers
+        HttpResponseHead head;
+        auto parseResult = HttpParser::readResponse(*_socket, isCancellationRequested, head);
 
-        if (!lineValid)
+        if (parseResult == HttpParseResult::ReadError)
         {
             return WebSocketInitResult(
                 false, 0, std::string("Failed reading HTTP status line from ") + url);
         }
+        else if (parseResult != HttpParseResult::Complete)
+        {
+            return WebSocketInitResult(
+                false, 0, std::string("Error parsing HTTP response from ") + url);
+        }
 
         // Validate status
-        auto statusLine = Http::parseStatusLine(line);
-        std::string httpVersion = statusLine.first;
-        int status = statusLine.second;
+        std::string httpVersion = head.version.str();
+        int status = head.statusCode;
+        std::string line = httpVersion + " " + std::to_string(status) + " " + head.reason.str();
 
         // HTTP/1.0 is too old.
         if (httpVersion != "HTTP/1.1")
@@ -174,14 +179,7 @@ namespace ix
             return WebSocketInitResult(false, status, ss2.str());
         }
 
-        auto result = parseHttpHeaders(_socket, isCancellationRequested);
-        auto headersValid = result.first;
-        auto headers = result.second;
-
-        if (!headersValid)
-        {
-            return WebSocketInitResult(false, status, "Error parsing HTTP headers");
-        }
+        auto headers = HttpParser::toHttpHeaders(head.headers);
 
         // We want an 101 HTTP status for websocket, otherwise it could be
         // a redirection (like 301)
@@ -252,21 +250,27 @@ namespace ix
         auto isCancellationRequested =
             makeCancellationRequestWithTimeout(timeoutSecs, _requestInitCancellation);
 
-        // Read first line
-        auto lineResult = _socket->readLine(isCancellationRequested);
-        auto lineValid = lineResult.first;
-        auto line = lineResult.second;
+        // Read the request line and the headers
+        HttpRequestHead head;
+        auto parseResult = HttpParser::readRequest(*_socket, isCancellationRequested, head);
 
-        if (!lineValid)
+        if (parseResult == HttpParseResult::ReadError)
         {
-            return sendErrorResponse(400, "Error reading HTTP request line");
+            return sendErrorResponse(400, "Error reading HTTP request");
+        }
+        else if (parseResult == HttpParseResult::TooLarge)
+        {
+            return sendErrorResponse(431, "Request Header Fields Too Large");
+        }
+        else if (parseResult != HttpParseResult::Complete)
+        {
+            return sendErrorResponse(400, "Error parsing HTTP request");
         }
 
         // Validate request line (GET /foo HTTP/1.1\r\n)
-        auto requestLine = Http::parseRequestLine(line);
-        auto method = std::get<0>(requestLine);
-        auto uri = std::get<1>(requestLine);
-        auto httpVersion = std::get<2>(requestLine);
+        auto method = head.method.str();
+        auto uri = head.uri.str();
+        auto httpVersion = head.version.str();
 
         if (method != "GET")
         {
@@ -279,15 +283,7 @@ namespace ix
                                      "Invalid HTTP version, need HTTP/1.1, got: " + httpVersion);
         }
 
-        // Retrieve and validate HTTP headers
-        auto result = parseHttpHeaders(_socket, isCancellationRequested);
-        auto headersValid = result.first;
-        auto headers = result.second;
-
-        if (!headersValid)
-        {
-            return sendErrorResponse(400, "Error parsing HTTP headers");
-        }
+        auto headers = HttpParser::toHttpHeaders(head.headers);
 
         if (headers.find("sec-websocket-key") == headers.end())
         {
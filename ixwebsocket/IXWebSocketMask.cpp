@@ -0,0 +1,190 @@
+/*
+ *  IXWebSocketMask.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXWebSocketMask.h"
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IXWEBSOCKET_MASK_SSE2
+#include <emmintrin.h>
+#endif
+
+// The AVX2 kernel is compiled with a target attribute and only used when the
+// CPU supports it, so the library does not need to be built with -mavx2
+#if defined(IXWEBSOCKET_MASK_SSE2) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define IXWEBSOCKET_MASK_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    using MaskFunction = void (*)(uint8_t* dst,
+                                  const uint8_t* src,
+                                  size_t size,
+                                  const uint8_t maskingKey[4]);
+
+    // Key repeated to fill a register, in memory order so that it does not
+    // depend on endianness. size must be a multiple of 4.
+    void fillKey(uint8_t* pattern, size_t size, const uint8_t maskingKey[4])
+    {
+        for (size_t i = 0; i < size; i += 4)
+        {
+            memcpy(pattern + i, maskingKey, 4);
+        }
+    }
+
+    // Process the bytes left from i, which must be a multiple of 4, 8 at a time
+    // then one by one. memcpy compiles to plain (unaligned) loads and stores.
+    void maskTail(
+        uint8_t* dst, const uint8_t* src, size_t i, size_t size, const uint8_t maskingKey[4])
+    {
+        if (i + 8 <= size)
+        {
+            uint8_t pattern[8];
+            fillKey(pattern, sizeof(pattern), maskingKey);
+
+            uint64_t key;
+            memcpy(&key, pattern, sizeof(key));
+
+            for (; i + 8 <= size; i += 8)
+            {
+                uint64_t word;
+                memcpy(&word, src + i, sizeof(word));
+                word ^= key;
+                memcpy(dst + i, &word, sizeof(word));
+            }
+        }
+
+        for (; i < size; ++i)
+        {
+            dst[i] = src[i] ^ maskingKey[i & 0x3];
+        }
+    }
+
+#ifndef IXWEBSOCKET_MASK_SSE2
+    void maskScalar(uint8_t* dst, const uint8_t* src, size_t size, const uint8_t maskingKey[4])
+    {
+        maskTail(dst, src, 0, size, maskingKey);
+    }
+#endif
+
+#ifdef IXWEBSOCKET_MASK_SSE2
+    void maskSSE2(uint8_t* dst, const uint8_t* src, size_t size, const uint8_t maskingKey[4])
+    {
+        uint8_t pattern[16];
+        fillKey(pattern, sizeof(pattern), maskingKey);
+        const __m128i key = _mm_loadu_si128((const __m128i*) pattern);
+
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*) (src + i));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(block, key));
+        }
+
+        maskTail(dst, src, i, size, maskingKey);
+    }
+#endif
+
+#ifdef IXWEBSOCKET_MASK_AVX2
+    __attribute__((target("avx2"))) void maskAVX2(uint8_t* dst,
+                                                  const uint8_t* src,
+                                                  size_t size,
+                                                  const uint8_t maskingKey[4])
+    {
+        uint8_t pattern[32];
+        fillKey(pattern, sizeof(pattern), maskingKey);
+        const __m256i key = _mm256_loadu_si256((const __m256i*) pattern);
+
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64)
+        {
+            __m256i block0 = _mm256_loadu_si256((const __m256i*) (src + i));
+            __m256i block1 = _mm256_loadu_si256((const __m256i*) (src + i + 32));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(block0, key));
+            _mm256_storeu_si256((__m256i*) (dst + i + 32), _mm256_xor_si256(block1, key));
+        }
+
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256((const __m256i*) (src + i));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(block, key));
+        }
+
+        if (i + 16 <= size)
+        {
+            __m128i block = _mm_loadu_si128((const __m128i*) (src + i));
+            _mm_storeu_si128((__m128i*) (dst + i),
+                             _mm_xor_si128(block, _mm256_castsi256_si128(key)));
+            i += 16;
+        }
+
+        maskTail(dst, src, i, size, maskingKey);
+    }
+#endif
+
+    struct MaskingKernel
+    {
+        MaskFunction function;
+        const char* name;
+    };
+
+    MaskingKernel selectMaskingKernel()
+    {
+#ifdef IXWEBSOCKET_MASK_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return MaskingKernel {maskAVX2, "avx2"};
+        }
+#endif
+
+#ifdef IXWEBSOCKET_MASK_SSE2
+        return MaskingKernel {maskSSE2, "sse2"};
+#else
+        return MaskingKernel {maskScalar, "scalar"};
+#endif
+    }
+
+    const MaskingKernel& getMaskingKernel()
+    {
+        static const MaskingKernel kernel = selectMaskingKernel();
+        return kernel;
+    }
+} // namespace
+
+namespace ix
+{
+    void maskInPlace(uint8_t* data, size_t size, const uint8_t maskingKey[4])
+    {
+        // Small payloads are common, skip the dispatch
+        if (size < 16)
+        {
+            maskTail(data, data, 0, size, maskingKey);
+            return;
+        }
+
+        getMaskingKernel().function(data, data, size, maskingKey);
+    }
+
+    void maskCopy(uint8_t* dst, const uint8_t* src, size_t size, const uint8_t maskingKey[4])
+    {
+        if (size < 16)
+        {
+            maskTail(dst, src, 0, size, maskingKey);
+            return;
+        }
+
+        getMaskingKernel().function(dst, src, size, maskingKey);
+    }
+
+    const char* getMaskingKernelName()
+    {
+        return getMaskingKernel().name;
+    }
+} // namespace ix
@@ -0,0 +1,28 @@
+/*
+ *  IXWebSocketMask.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  Apply a WebSocket masking key to a payload (masking and unmasking are the
+ *  same operation), see https://tools.ietf.org/html/rfc6455#section-5.3
+ *
+ *  Several bytes are processed per iteration: 32 with AVX2 (selected at
+ *  runtime when the CPU supports it), 16 with SSE2 on x86, and 8 otherwise.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ix
+{
+    void maskInPlace(uint8_t* data, size_t size, const uint8_t maskingKey[4]);
+
+    // Mask while copying, so that the payload is only read once.
+    // dst and src must not overlap.
+    void maskCopy(uint8_t* dst, const uint8_t* src, size_t size, const uint8_t maskingKey[4]);
+
+    // For logging and benchmarks: avx2, sse2 or scalar
+    const char* getMaskingKernelName();
+} // namespace ix
@@ -25,6 +25,11 @@ namespace ix
         WebSocketCloseInfo closeInfo;
         bool binary;
 
+        // The payload, always valid. When zero copy messages are enabled, unfragmented and
+        // uncompressed messages point into the receive buffer and str is empty.
+        const char* data;
+        size_t size;
+
         WebSocketMessage(WebSocketMessageType t,
                          const std::string& s,
                          size_t w,
@@ -39,6 +44,26 @@ namespace ix
             , openInfo(o)
             , closeInfo(c)
             , binary(b)
+            , data(s.data())
+            , size(s.size())
+        {
+            ;
+        }
+
+        WebSocketMessage(WebSocketMessageType t,
+                         const std::string& s,
+                         const char* d,
+                         size_t n,
+                         size_t w,
+                         WebSocketErrorInfo e,
+                         bool b)
+            : type(t)
+            , str(s)
+            , wireSize(w)
+            , errorInfo(e)
+            , binary(b)
+            , data(d)
+            , size(n)
         {
             ;
         }
@@ -88,4 +88,9 @@ namespace ix
         return _decompressor->decompress(in, out);
     }
 
+    bool WebSocketPerMessageDeflate::canSendPrecompressed(uint8_t windowBits) const
+    {
+        return _compressor->canSendPrecompressed(windowBits);
+    }
+
 } // namespace ix
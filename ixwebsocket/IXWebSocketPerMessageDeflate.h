@@ -34,6 +34,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
@@ -52,6 +53,7 @@ namespace ix
         bool init(const WebSocketPerMessageDeflateOptions& perMessageDeflateOptions);
         bool compress(const std::string& in, std::string& out);
         bool decompress(const std::string& in, std::string& out);
+        bool canSendPrecompressed(uint8_t windowBits) const;
 
     private:
         std::unique_ptr<WebSocketPerMessageDeflateCompressor> _compressor;
@@ -24,6 +24,8 @@ namespace ix
     // Compressor
     //
     WebSocketPerMessageDeflateCompressor::WebSocketPerMessageDeflateCompressor()
+        : _flush(0)
+        , _deflateBits(0)
     {
 #ifdef IXWEBSOCKET_USE_ZLIB
         memset(&_deflateState, 0, sizeof(_deflateState));
@@ -56,6 +58,7 @@ namespace ix
         if (ret != Z_OK) return false;
 
         _flush = (clientNoContextTakeOver) ? Z_FULL_FLUSH : Z_SYNC_FLUSH;
+        _deflateBits = deflateBits;
 
         return true;
 #else
@@ -66,6 +69,17 @@ namespace ix
 #endif
     }
 
+    bool WebSocketPerMessageDeflateCompressor::canSendPrecompressed(uint8_t windowBits) const
+    {
+#ifdef IXWEBSOCKET_USE_ZLIB
+        return _flush == Z_FULL_FLUSH && windowBits <= _deflateBits;
+#else
+        windowBits;
+
+        return false;
+#endif
+    }
+
     template<typename T>
     bool WebSocketPerMessageDeflateCompressor::endsWithEmptyUnCompressedBlock(const T& value)
     {
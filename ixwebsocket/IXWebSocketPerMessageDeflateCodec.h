@@ -27,6 +27,11 @@ namespace ix
         bool compress(const std::vector<uint8_t>& in, std::string& out);
         bool compress(const std::vector<uint8_t>& in, std::vector<uint8_t>& out);
 
+        // Whether a message compressed on its own, with a window of at most windowBits,
+        // can be sent in between the messages of this compressor. They must not refer
+        // to previous messages (no context takeover).
+        bool canSendPrecompressed(uint8_t windowBits) const;
+
     private:
         template<typename T, typename S>
         bool compressData(const T& in, S& out);
@@ -34,6 +39,7 @@ namespace ix
         bool endsWithEmptyUnCompressedBlock(const T& value);
 
         int _flush;
+        uint8_t _deflateBits;
         std::array<unsigned char, 1 << 14> _compressBuffer;
 
 #ifdef IXWEBSOCKET_USE_ZLIB
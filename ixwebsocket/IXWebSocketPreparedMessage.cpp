@@ -0,0 +1,75 @@
+/*
+ *  IXWebSocketPreparedMessage.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ */
+
+#include "IXWebSocketPreparedMessage.h"
+
+#include "IXUtf8Validator.h"
+#include "IXWebSocketPerMessageDeflateCodec.h"
+#include "IXWebSocketTransport.h"
+
+namespace ix
+{
+    // Largest window, which every peer negotiating per message deflate accepts by default
+    const uint8_t WebSocketPreparedMessage::kCompressionWindowBits(15);
+
+    WebSocketPreparedMessage::WebSocketPreparedMessage(const std::string& payload,
+                                                       bool binary,
+                                                       bool compress)
+        : _payload(payload)
+        , _binary(binary)
+        , _valid(binary || validateUtf8(payload))
+        , _compressedSize(0)
+    {
+        if (!_valid) return;
+
+        _frame = std::make_shared<const std::string>(
+            WebSocketTransport::encodeFrame(_binary, false, _payload));
+
+        if (!compress) return;
+
+        // A fresh compressor without context takeover, so that the compressed
+        // message does not depend on anything sent before it on a connection
+        WebSocketPerMessageDeflateCompressor compressor;
+        std::string compressed;
+        if (compressor.init(kCompressionWindowBits, true) &&
+            compressor.compress(_payload, compressed) && compressed.size() < _payload.size())
+        {
+            _compressedSize = compressed.size();
+            _compressedFrame = std::make_shared<const std::string>(
+                WebSocketTransport::encodeFrame(_binary, true, compressed));
+        }
+    }
+
+    bool WebSocketPreparedMessage::isValid() const
+    {
+        return _valid;
+    }
+
+    bool WebSocketPreparedMessage::isBinary() const
+    {
+        return _binary;
+    }
+
+    const std::string& WebSocketPreparedMessage::getPayload() const
+    {
+        return _payload;
+    }
+
+    const std::shared_ptr<const std::string>& WebSocketPreparedMessage::getFrame() const
+    {
+        return _frame;
+    }
+
+    const std::shared_ptr<const std::string>& WebSocketPreparedMessage::getCompressedFrame() const
+    {
+        return _compressedFrame;
+    }
+
+    size_t WebSocketPreparedMessage::getCompressedSize() const
+    {
+        return _compressedSize;
+    }
+} // namespace ix
@@ -0,0 +1,78 @@
+/*
+ *  IXWebSocketPreparedMessage.h
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone, Inc. All rights reserved.
+ *
+ *  A message encoded once in its wire form, to be sent to many connections.
+ *  Text is validated once, and the frame (header + payload) is built once, along
+ *  with a compressed variant for peers which negotiated per message deflate
+ *  without context takeover. Connections queue a reference to the same immutable
+ *  frame instead of copying it.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace ix
+{
+    // What happens to a prepared message queued for a connection which has more than its
+    // high-water mark of data waiting to be sent already
+    enum class SendQueueOverflowPolicy
+    {
+        // The message is not queued
+        Drop,
+        // The connection is closed
+        Disconnect,
+        // The message replaces the queued prepared messages which did not start to be sent
+        Coalesce
+    };
+
+    enum class QueueMessageResult
+    {
+        Queued,
+        Coalesced,
+        Dropped,
+        Disconnected,
+        NotConnected,
+        // Another thread is sending a message on the connection, this one is queued once
+        // it is done, and the policy applies then
+        Deferred
+    };
+
+    class WebSocketPreparedMessage
+    {
+    public:
+        WebSocketPreparedMessage(const std::string& payload,
+                                 bool binary = false,
+                                 bool compress = true);
+
+        // False for a text message which is not valid UTF-8, it cannot be sent
+        bool isValid() const;
+        bool isBinary() const;
+        const std::string& getPayload() const;
+
+        // Single unmasked frame, as sent by servers. Clients mask each frame with
+        // their own key and send the payload instead.
+        const std::shared_ptr<const std::string>& getFrame() const;
+
+        // Same frame, compressed with per message deflate, or nullptr when the message
+        // was not compressed (compression disabled, unavailable or not smaller)
+        const std::shared_ptr<const std::string>& getCompressedFrame() const;
+        size_t getCompressedSize() const;
+
+        static const uint8_t kCompressionWindowBits;
+
+    private:
+        std::string _payload;
+        bool _binary;
+        bool _valid;
+        std::shared_ptr<const std::string> _frame;
+        std::shared_ptr<const std::string> _compressedFrame;
+        size_t _compressedSize;
+    };
+
+    using WebSocketPreparedMessagePtr = std::shared_ptr<const WebSocketPreparedMessage>;
+} // namespace ix
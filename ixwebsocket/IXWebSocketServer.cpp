@@ -9,7 +9,9 @@
 #include "IXNetSystem.h"
 #include "IXSetThreadName.h"
 #include "IXSocketConnect.h"
+#include "IXUniquePtr.h"
 #include "IXWebSocket.h"
+#include "IXWebSocketEventLoopConnection.h"
 #include "IXWebSocketTransport.h"
 #include <future>
 #include <sstream>
@@ -19,6 +21,7 @@ namespace ix
 {
     const int WebSocketServer::kDefaultHandShakeTimeoutSecs(3); // 3 seconds
     const bool WebSocketServer::kDefaultEnablePong(true);
+    const size_t WebSocketServer::kDefaultBroadcastHighWaterMark(1 << 20); // 1MB
 
     WebSocketServer::WebSocketServer(int port,
                                      const std::string& host,
@@ -30,6 +33,11 @@ namespace ix
         , _handshakeTimeoutSecs(handshakeTimeoutSecs)
         , _enablePong(kDefaultEnablePong)
         , _enablePerMessageDeflate(true)
+        , _enableZeroCopyMessages(false)
+        , _broadcastHighWaterMark(kDefaultBroadcastHighWaterMark)
+        , _broadcastOverflowPolicy(SendQueueOverflowPolicy::Drop)
+        , _useEventLoop(false)
+        , _eventLoopThreads(0)
     {
     }
 
@@ -49,6 +57,23 @@ namespace ix
         }
 
         SocketServer::stop();
+
+        if (_eventLoopPool)
+        {
+            // Give the clients a chance to complete the closing handshake
+            {
+                std::unique_lock<std::mutex> lock(_clientsMutex);
+                _clientsCondition.wait_for(lock,
+                                           std::chrono::seconds(_handshakeTimeoutSecs),
+                                           [this] { return _clients.empty(); });
+            }
+
+            // Stopping the loops releases the remaining connections
+            _eventLoopPool.reset();
+
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            _clients.clear();
+        }
     }
 
     void WebSocketServer::enablePong()
@@ -66,6 +91,17 @@ namespace ix
         _enablePerMessageDeflate = false;
     }
 
+    void WebSocketServer::enableZeroCopyMessages()
+    {
+        _enableZeroCopyMessages = true;
+    }
+
+    void WebSocketServer::enableEventLoop(size_t threads)
+    {
+        _useEventLoop = true;
+        _eventLoopThreads = threads;
+    }
+
     void WebSocketServer::setOnConnectionCallback(const OnConnectionCallback& callback)
     {
         _onConnectionCallback = callback;
@@ -76,11 +112,9 @@ namespace ix
         _onClientMessageCallback = callback;
     }
 
-    void WebSocketServer::handleConnection(std::unique_ptr<Socket> socket,
-                                           std::shared_ptr<ConnectionState> connectionState)
+    std::shared_ptr<WebSocket> WebSocketServer::createWebSocket(
+        std::shared_ptr<ConnectionState> connectionState)
     {
-        setThreadName("WebSocketServer::" + connectionState->getId());
-
         auto webSocket = std::make_shared<WebSocket>();
         if (_onConnectionCallback)
         {
@@ -92,7 +126,7 @@ namespace ix
                          "registerered.");
                 logError("Missing call to setOnMessageCallback inside setOnConnectionCallback.");
                 connectionState->setTerminated();
-                return;
+                return nullptr;
             }
         }
         else if (_onClientMessageCallback)
@@ -109,7 +143,7 @@ namespace ix
                 "WebSocketServer Application developer error: No server callback is registerered.");
             logError("Missing call to setOnConnectionCallback or setOnClientMessageCallback.");
             connectionState->setTerminated();
-            return;
+            return nullptr;
         }
 
         webSocket->disableAutomaticReconnection();
@@ -123,12 +157,47 @@ namespace ix
             webSocket->disablePong();
         }
 
+        if (_enableZeroCopyMessages)
+        {
+            webSocket->enableZeroCopyMessages();
+        }
+
+        return webSocket;
+    }
+
+    void WebSocketServer::addClient(std::shared_ptr<WebSocket> webSocket)
+    {
         // Add this client to our client set
+        std::lock_guard<std::mutex> lock(_clientsMutex);
+        _clients.insert(webSocket);
+    }
+
+    void WebSocketServer::removeClient(std::shared_ptr<WebSocket> webSocket)
+    {
+        webSocket->setOnMessageCallback(nullptr);
+
+        // Remove this client from our client set
         {
             std::lock_guard<std::mutex> lock(_clientsMutex);
-            _clients.insert(webSocket);
+            if (_clients.erase(webSocket) != 1)
+            {
+                logError("Cannot delete client");
+            }
         }
 
+        _clientsCondition.notify_all();
+    }
+
+    void WebSocketServer::handleConnection(std::unique_ptr<Socket> socket,
+                                           std::shared_ptr<ConnectionState> connectionState)
+    {
+        setThreadName("WebSocketServer::" + connectionState->getId());
+
+        auto webSocket = createWebSocket(connectionState);
+        if (!webSocket) return;
+
+        addClient(webSocket);
+
         auto status = webSocket->connectToSocket(
             std::move(socket), _handshakeTimeoutSecs, _enablePerMessageDeflate);
         if (status.success)
@@ -145,18 +214,64 @@ namespace ix
             logError(ss.str());
         }
 
-        webSocket->setOnMessageCallback(nullptr);
+        removeClient(webSocket);
+        connectionState->setTerminated();
+    }
 
-        // Remove this client from our client set
+    bool WebSocketServer::handleConnectionWithEventLoop(
+        std::unique_ptr<Socket>& socket, std::shared_ptr<ConnectionState> connectionState)
+    {
+        if (!_useEventLoop) return false;
+
+        // Only called from the accept thread, the pool is created lazily so that
+        // the server can be restarted after being stopped.
+        if (!_eventLoopPool)
         {
-            std::lock_guard<std::mutex> lock(_clientsMutex);
-            if (_clients.erase(webSocket) != 1)
+            auto eventLoopPool = ix::make_unique<EventLoopPool>(_eventLoopThreads);
+
+            std::string errorMsg;
+            if (!eventLoopPool->start("WebSocketServer", errorMsg))
             {
-                logError("Cannot delete client");
+                logError("WebSocketServer cannot start its event loops, falling back to one "
+                         "thread per connection: " +
+                         errorMsg);
+                _useEventLoop = false;
+                return false;
             }
+            _eventLoopPool = std::move(eventLoopPool);
         }
 
-        connectionState->setTerminated();
+        // std::function needs a copyable object
+        auto sharedSocket = std::make_shared<std::unique_ptr<Socket>>(std::move(socket));
+        auto eventLoop = _eventLoopPool->getNextEventLoop();
+
+        eventLoop->post([this, eventLoop, sharedSocket, connectionState] {
+            auto webSocket = createWebSocket(connectionState);
+            if (!webSocket) return;
+
+            // The closed callback keeps the WebSocket alive as long as the connection
+            auto connection = std::make_shared<WebSocketEventLoopConnection>(
+                eventLoop,
+                *webSocket,
+                [this, webSocket, connectionState](const std::string& errorMsg) {
+                    if (!errorMsg.empty())
+                    {
+                        logError("WebSocketServer::handleConnectionWithEventLoop() " + errorMsg);
+                    }
+
+                    removeClient(webSocket);
+                    connectionState->setTerminated();
+                });
+
+            // Broadcasts can reach the client as soon as it is added
+            connection->installWakeUpCallback();
+            addClient(webSocket);
+
+            connection->accept(
+                std::move(*sharedSocket), _handshakeTimeoutSecs, _enablePerMessageDeflate);
+        });
+
+        return true;
     }
 
     std::set<std::shared_ptr<WebSocket>> WebSocketServer::getClients()
@@ -165,6 +280,48 @@ namespace ix
         return _clients;
     }
 
+    BroadcastResult WebSocketServer::broadcast(const WebSocketPreparedMessage& message,
+                                               const WebSocket* except)
+    {
+        // Closing a client runs callbacks, which must not be invoked with the lock held
+        std::vector<std::shared_ptr<WebSocket>> clients;
+        {
+            std::lock_guard<std::mutex> lock(_clientsMutex);
+            clients.assign(_clients.begin(), _clients.end());
+        }
+
+        size_t highWaterMark = _broadcastHighWaterMark;
+        SendQueueOverflowPolicy policy = _broadcastOverflowPolicy;
+
+        BroadcastResult result;
+        for (auto&& client : clients)
+        {
+            if (client.get() == except) continue;
+
+            switch (client->queuePrepared(message, highWaterMark, policy))
+            {
+                case QueueMessageResult::Queued: result.queued++; break;
+                case QueueMessageResult::Coalesced: result.coalesced++; break;
+                case QueueMessageResult::Dropped: result.dropped++; break;
+                case QueueMessageResult::Disconnected: result.disconnected++; break;
+                case QueueMessageResult::NotConnected: break;
+                case QueueMessageResult::Deferred: result.deferred++; break;
+            }
+        }
+
+        return result;
+    }
+
+    void WebSocketServer::setBroadcastHighWaterMark(size_t highWaterMark)
+    {
+        _broadcastHighWaterMark = highWaterMark;
+    }
+
+    void WebSocketServer::setBroadcastOverflowPolicy(SendQueueOverflowPolicy policy)
+    {
+        _broadcastOverflowPolicy = policy;
+    }
+
     size_t WebSocketServer::getConnectedClientsCount()
     {
         std::lock_guard<std::mutex> lock(_clientsMutex);
@@ -176,26 +333,14 @@ namespace ix
     //
     void WebSocketServer::makeBroadcastServer()
     {
-        setOnClientMessageCallback([this](std::shared_ptr<ConnectionState> connectionState,
+        setOnClientMessageCallback([this](std::shared_ptr<ConnectionState> /*connectionState*/,
                                           WebSocket& webSocket,
                                           const WebSocketMessagePtr& msg) {
-            auto remoteIp = connectionState->getRemoteIp();
             if (msg->type == ix::WebSocketMessageType::Message)
             {
-                for (auto&& client : getClients())
-                {
-                    if (client.get() != &webSocket)
-                    {
-                        client->send(msg->str, msg->binary);
-
-                        // Make sure the OS send buffer is flushed before moving on
-                        do
-                        {
-                            std::chrono::duration<double, std::milli> duration(500);
-                            std::this_thread::sleep_for(duration);
-                        } while (client->bufferedAmount() != 0);
-                    }
-                }
+                // The message is encoded once for all the clients
+                WebSocketPreparedMessage message(std::string(msg->data, msg->size), msg->binary);
+                broadcast(message, &webSocket);
             }
         });
     }
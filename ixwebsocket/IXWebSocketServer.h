@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "IXEventLoop.h"
 #include "IXSocketServer.h"
 #include "IXWebSocket.h"
 #include <condition_variable>
@@ -16,9 +17,32 @@
 #include <string>
 #include <thread>
 #include <utility> // pair
+#include <vector>
 
 namespace ix
 {
+    // Number of clients for which a broadcast message was queued, coalesced with the
+    // messages queued before, dropped, or which were disconnected
+    struct BroadcastResult
+    {
+        size_t queued;
+        size_t coalesced;
+        size_t dropped;
+        size_t disconnected;
+        // Clients busy with a send from another thread, see QueueMessageResult::Deferred
+        size_t deferred;
+
+        BroadcastResult()
+            : queued(0)
+            , coalesced(0)
+            , dropped(0)
+            , disconnected(0)
+            , deferred(0)
+        {
+            ;
+        }
+    };
+
     class WebSocketServer : public SocketServer
     {
     public:
@@ -41,34 +65,72 @@ namespace ix
         void disablePong();
         void disablePerMessageDeflate();
 
+        // See WebSocket::enableZeroCopyMessages
+        void enableZeroCopyMessages();
+
+        // Multiplex all the connections on a fixed pool of event loop threads (epoll, Linux
+        // only) instead of running one thread per connection. 0 means one thread per core.
+        // Callbacks are invoked from the event loop threads and should not block.
+        // Must be called before start. Falls back to one thread per connection if event
+        // loops are not supported.
+        void enableEventLoop(size_t threads = 0);
+
         void setOnConnectionCallback(const OnConnectionCallback& callback);
         void setOnClientMessageCallback(const OnClientMessageCallback& callback);
 
         // Get all the connected clients
         std::set<std::shared_ptr<WebSocket>> getClients();
 
+        // Queue a message for all the clients but one (if set), without blocking. Each
+        // client sends it from its own thread or event loop, so that slow clients do
+        // not delay the others. When more than the high-water mark is waiting to be
+        // sent to a client already, the overflow policy applies.
+        BroadcastResult broadcast(const WebSocketPreparedMessage& message,
+                                  const WebSocket* except = nullptr);
+        void setBroadcastHighWaterMark(size_t highWaterMark);
+        void setBroadcastOverflowPolicy(SendQueueOverflowPolicy policy);
+
+        // Forward the messages received from each client to all the other clients
         void makeBroadcastServer();
         bool listenAndStart();
 
         const static int kDefaultHandShakeTimeoutSecs;
+        const static size_t kDefaultBroadcastHighWaterMark;
 
     private:
         // Member variables
         int _handshakeTimeoutSecs;
         bool _enablePong;
         bool _enablePerMessageDeflate;
+        bool _enableZeroCopyMessages;
 
         OnConnectionCallback _onConnectionCallback;
         OnClientMessageCallback _onClientMessageCallback;
 
         std::mutex _clientsMutex;
+        std::condition_variable _clientsCondition;
         std::set<std::shared_ptr<WebSocket>> _clients;
 
+        std::atomic<size_t> _broadcastHighWaterMark;
+        std::atomic<SendQueueOverflowPolicy> _broadcastOverflowPolicy;
+
+        // Event loop mode
+        std::atomic<bool> _useEventLoop;
+        size_t _eventLoopThreads;
+        std::unique_ptr<EventLoopPool> _eventLoopPool;
+
         const static bool kDefaultEnablePong;
 
         // Methods
         virtual void handleConnection(std::unique_ptr<Socket> socket,
                                       std::shared_ptr<ConnectionState> connectionState);
+        virtual bool handleConnectionWithEventLoop(
+            std::unique_ptr<Socket>& socket, std::shared_ptr<ConnectionState> connectionState);
         virtual size_t getConnectedClientsCount() final;
+
+        std::shared_ptr<WebSocket> createWebSocket(
+            std::shared_ptr<ConnectionState> connectionState);
+        void addClient(std::shared_ptr<WebSocket> webSocket);
+        void removeClient(std::shared_ptr<WebSocket> webSocket);
     };
 } // namespace ix
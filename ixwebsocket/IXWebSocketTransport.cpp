@@ -41,6 +41,9 @@
 #include "IXUtf8Validator.h"
 #include "IXWebSocketHandshake.h"
 #include "IXWebSocketHttpHeaders.h"
+#include "IXWebSocketMask.h"
+#include "IXWebSocketPreparedMessage.h"
+#include <algorithm>
 #include <chrono>
 #include <cstdarg>
 #include <cstdlib>
@@ -55,20 +58,26 @@
 namespace ix
 {
     const std::string WebSocketTransport::kPingMessage("ixwebsocket::heartbeat");
+    const std::string WebSocketTransport::kEmptyMessage;
     const int WebSocketTransport::kDefaultPingIntervalSecs(-1);
     const bool WebSocketTransport::kDefaultEnablePong(true);
     const int WebSocketTransport::kClosingMaximumWaitingDelayInMs(300);
     constexpr size_t WebSocketTransport::kChunkSize;
+    constexpr size_t WebSocketTransport::kDirectSendMinSize;
+    constexpr size_t WebSocketTransport::kMaxSendSegments;
 
     WebSocketTransport::WebSocketTransport()
         : _useMask(true)
         , _blockingSend(false)
+        , _sharedFramesSize(0)
         , _receivedMessageCompressed(false)
+        , _connectingSocket(nullptr)
         , _readyState(ReadyState::CLOSED)
         , _closeCode(WebSocketCloseConstants::kInternalErrorCode)
         , _closeWireSize(0)
         , _closeRemote(false)
         , _enablePerMessageDeflate(false)
+        , _enableZeroCopyMessages(false)
         , _requestInitCancellation(false)
         , _closingTimePoint(std::chrono::steady_clock::now())
         , _enablePong(kDefaultEnablePong)
@@ -78,7 +87,6 @@ namespace ix
         , _lastSendPingTimePoint(std::chrono::steady_clock::now())
     {
         setCloseReason(WebSocketCloseConstants::kInternalErrorMessage);
-        _readbuf.resize(kChunkSize);
     }
 
     WebSocketTransport::~WebSocketTransport()
@@ -90,13 +98,15 @@ namespace ix
         const WebSocketPerMessageDeflateOptions& perMessageDeflateOptions,
         const SocketTLSOptions& socketTLSOptions,
         bool enablePong,
-        int pingIntervalSecs)
+        int pingIntervalSecs,
+        bool enableZeroCopyMessages)
     {
         _perMessageDeflateOptions = perMessageDeflateOptions;
         _enablePerMessageDeflate = _perMessageDeflateOptions.enabled();
         _socketTLSOptions = socketTLSOptions;
         _enablePong = enablePong;
         _pingIntervalSecs = pingIntervalSecs;
+        _enableZeroCopyMessages = enableZeroCopyMessages;
     }
 
     // Client
@@ -138,8 +148,10 @@ namespace ix
                                                   _perMessageDeflateOptions,
                                                   _enablePerMessageDeflate);
 
+            setConnectingSocket(_socket.get());
             result = webSocketHandshake.clientHandshake(
                 remoteUrl, headers, host, path, port, timeoutSecs);
+            setConnectingSocket(nullptr);
 
             if (result.http_status >= 300 && result.http_status < 400)
             {
@@ -159,6 +171,9 @@ namespace ix
 
             if (result.success)
             {
+                // Frames sent by the server right after its response were buffered
+                _rxbuf.append(_socket->takeReadBuffer());
+
                 setReadyState(ReadyState::OPEN);
             }
             return result;
@@ -167,6 +182,12 @@ namespace ix
         return result;
     }
 
+    void WebSocketTransport::setConnectingSocket(Socket* socket)
+    {
+        std::lock_guard<std::mutex> lock(_connectingSocketMutex);
+        _connectingSocket = socket;
+    }
+
     // Server
     WebSocketInitResult WebSocketTransport::connectToSocket(std::unique_ptr<Socket> socket,
                                                             int timeoutSecs,
@@ -190,6 +211,9 @@ namespace ix
         auto result = webSocketHandshake.serverHandshake(timeoutSecs, enablePerMessageDeflate);
         if (result.success)
         {
+            // Frames received along with the HTTP request still need to be processed
+            _rxbuf.append(_socket->takeReadBuffer());
+
             setReadyState(ReadyState::OPEN);
         }
         return result;
@@ -264,7 +288,7 @@ namespace ix
         return now - _closingTimePoint > std::chrono::milliseconds(kClosingMaximumWaitingDelayInMs);
     }
 
-    WebSocketTransport::PollResult WebSocketTransport::poll()
+    void WebSocketTransport::checkHeartBeat()
     {
         if (_readyState == ReadyState::OPEN)
         {
@@ -282,6 +306,44 @@ namespace ix
                 }
             }
         }
+    }
+
+    int WebSocketTransport::getPingDelayInMs()
+    {
+        // compute lasting delay to wait for next ping / timeout
+        std::lock_guard<std::mutex> lock(_lastSendPingTimePointMutex);
+        auto now = std::chrono::steady_clock::now();
+        int timeSinceLastPingMs =
+            (int) std::chrono::duration_cast<std::chrono::milliseconds>(now -
+                                                                        _lastSendPingTimePoint)
+                .count();
+        return (1000 * _pingIntervalSecs) - timeSinceLastPingMs;
+    }
+
+    void WebSocketTransport::closeIfClosingDelayExceeded()
+    {
+        if (_readyState == ReadyState::CLOSING && closingDelayExceeded())
+        {
+            _rxbuf.clear();
+            // close code and reason were set when calling close()
+            closeSocket();
+            setReadyState(ReadyState::CLOSED);
+        }
+    }
+
+    int WebSocketTransport::getClosingDelayInMs()
+    {
+        std::lock_guard<std::mutex> lock(_closingTimePointMutex);
+        auto now = std::chrono::steady_clock::now();
+        int timeSinceClosingMs =
+            (int) std::chrono::duration_cast<std::chrono::milliseconds>(now - _closingTimePoint)
+                .count();
+        return kClosingMaximumWaitingDelayInMs - timeSinceClosingMs;
+    }
+
+    WebSocketTransport::PollResult WebSocketTransport::poll()
+    {
+        checkHeartBeat();
 
         // No timeout if state is not OPEN, otherwise computed
         // pingIntervalOrTimeoutGCD (equals to -1 if no ping and no ping timeout are set)
@@ -290,11 +352,7 @@ namespace ix
         if (_pingIntervalSecs > 0)
         {
             // compute lasting delay to wait for next ping / timeout, if at least one set
-            auto now = std::chrono::steady_clock::now();
-            int timeSinceLastPingMs = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
-                                          now - _lastSendPingTimePoint)
-                                          .count();
-            lastingTimeoutDelayInMs = (1000 * _pingIntervalSecs) - timeSinceLastPingMs;
+            lastingTimeoutDelayInMs = getPingDelayInMs();
         }
 
 #ifdef _WIN32
@@ -340,25 +398,79 @@ namespace ix
             closeSocket();
         }
 
-        if (_readyState == ReadyState::CLOSING && closingDelayExceeded())
+        closeIfClosingDelayExceeded();
+
+        return PollResult::Succeeded;
+    }
+
+    WebSocketTransport::PollResult WebSocketTransport::processEvents(bool readable, bool writable)
+    {
+        if (writable)
         {
-            _rxbuf.clear();
-            // close code and reason were set when calling close()
-            closeSocket();
-            setReadyState(ReadyState::CLOSED);
+            if (!sendOnSocket())
+            {
+                return PollResult::CannotFlushSendBuffer;
+            }
+        }
+
+        if (readable)
+        {
+            if (!receiveFromSocket())
+            {
+                return PollResult::AbnormalClose;
+            }
         }
 
         return PollResult::Succeeded;
     }
 
+    int WebSocketTransport::processTimers()
+    {
+        checkHeartBeat();
+        closeIfClosingDelayExceeded();
+
+        if (_readyState == ReadyState::CLOSING)
+        {
+            return std::max(0, getClosingDelayInMs());
+        }
+        else if (_readyState == ReadyState::OPEN && _pingIntervalSecs > 0)
+        {
+            return std::max(0, getPingDelayInMs());
+        }
+
+        return -1;
+    }
+
+    void WebSocketTransport::setOnWakeUpCallback(const OnWakeUpCallback& onWakeUpCallback)
+    {
+        auto callback =
+            (onWakeUpCallback) ? std::make_shared<OnWakeUpCallback>(onWakeUpCallback) : nullptr;
+
+        std::lock_guard<std::mutex> lock(_onWakeUpCallbackMutex);
+        _onWakeUpCallback = std::move(callback);
+    }
+
+    bool WebSocketTransport::hasWakeUpCallback() const
+    {
+        std::lock_guard<std::mutex> lock(_onWakeUpCallbackMutex);
+        return _onWakeUpCallback != nullptr;
+    }
+
+    int WebSocketTransport::getSocketFd()
+    {
+        std::lock_guard<std::mutex> lock(_socketMutex);
+        return (_socket) ? _socket->getFd() : -1;
+    }
+
     bool WebSocketTransport::isSendBufferEmpty() const
     {
         std::lock_guard<std::mutex> lock(_txbufMutex);
-        return _txbuf.empty();
+        return _txbuf.empty() && _sharedFrames.empty();
     }
 
     template<class Iterator>
-    void WebSocketTransport::appendToSendBuffer(const std::vector<uint8_t>& header,
+    void WebSocketTransport::appendToSendBuffer(const uint8_t* header,
+                                                size_t headerSize,
                                                 Iterator begin,
                                                 Iterator end,
                                                 uint64_t message_size,
@@ -366,15 +478,19 @@ namespace ix
     {
         std::lock_guard<std::mutex> lock(_txbufMutex);
 
-        _txbuf.insert(_txbuf.end(), header.begin(), header.end());
-        _txbuf.insert(_txbuf.end(), begin, end);
+        _txbuf.insert(_txbuf.end(), header, header + headerSize);
 
-        if (_useMask)
+        if (_useMask && message_size > 0)
         {
-            for (size_t i = 0; i != (size_t) message_size; ++i)
-            {
-                *(_txbuf.end() - (size_t) message_size + i) ^= masking_key[i & 0x3];
-            }
+            // Mask while copying, the payload is only touched once. The iterators
+            // come from a std::string, which is contiguous.
+            size_t offset = _txbuf.size();
+            _txbuf.resize(offset + (size_t) message_size);
+            maskCopy(&_txbuf[offset], (const uint8_t*) &*begin, (size_t) message_size, masking_key);
+        }
+        else
+        {
+            _txbuf.insert(_txbuf.end(), begin, end);
         }
     }
 
@@ -382,10 +498,7 @@ namespace ix
     {
         if (ws.mask)
         {
-            for (size_t j = 0; j != ws.N; ++j)
-            {
-                _rxbuf[j + ws.header_size] ^= ws.masking_key[j & 0x3];
-            }
+            maskInPlace(_rxbuf.data() + ws.header_size, (size_t) ws.N, ws.masking_key);
         }
     }
 
@@ -418,7 +531,7 @@ namespace ix
         {
             wsheader_type ws;
             if (_rxbuf.size() < 2) break;                /* Need at least 2 */
-            const uint8_t* data = (uint8_t*) &_rxbuf[0]; // peek, but don't consume
+            const uint8_t* data = _rxbuf.data(); // peek, but don't consume
             ws.fin = (data[0] & 0x80) == 0x80;
             ws.rsv1 = (data[0] & 0x40) == 0x40;
             ws.rsv2 = (data[0] & 0x20) == 0x20;
@@ -513,8 +626,20 @@ namespace ix
             }
 
             unmaskReceiveBuffer(ws);
-            std::string frameData(_rxbuf.begin() + ws.header_size,
-                                  _rxbuf.begin() + ws.header_size + (size_t) ws.N);
+            const char* payload = (const char*) _rxbuf.data() + ws.header_size;
+
+            // In zero copy mode, unfragmented and uncompressed messages are handed to
+            // the callback as a view into the receive buffer
+            bool deliverView = _enableZeroCopyMessages && ws.fin && _chunks.empty() &&
+                               (ws.opcode == wsheader_type::TEXT_FRAME ||
+                                ws.opcode == wsheader_type::BINARY_FRAME) &&
+                               !(_enablePerMessageDeflate && ws.rsv1);
+
+            std::string frameData;
+            if (!deliverView)
+            {
+                frameData.assign(payload, (size_t) ws.N);
+            }
 
             // We got a whole message, now do something with it:
             if (ws.opcode == wsheader_type::TEXT_FRAME ||
@@ -547,7 +672,12 @@ namespace ix
                 //
                 // Usual case. Small unfragmented messages
                 //
-                if (ws.fin && _chunks.empty())
+                if (deliverView)
+                {
+                    emitMessageView(
+                        _fragmentedMessageKind, payload, (size_t) ws.N, onMessageCallback);
+                }
+                else if (ws.fin && _chunks.empty())
                 {
                     emitMessage(_fragmentedMessageKind,
                                 frameData,
@@ -687,8 +817,8 @@ namespace ix
                       _rxbuf.size());
             }
 
-            // Erase the message that has been processed from the input/read buffer
-            _rxbuf.erase(_rxbuf.begin(), _rxbuf.begin() + ws.header_size + (size_t) ws.N);
+            // Consume the message that has been processed from the input/read buffer
+            _rxbuf.consume(ws.header_size + (size_t) ws.N);
         }
 
         // if an abnormal closure was raised in poll, and nothing else triggered a CLOSED state in
@@ -753,7 +883,12 @@ namespace ix
             }
             else
             {
-                onMessageCallback(_decompressedMessage, wireSize, !success, messageKind);
+                onMessageCallback(_decompressedMessage,
+                                  _decompressedMessage.data(),
+                                  _decompressedMessage.size(),
+                                  wireSize,
+                                  !success,
+                                  messageKind);
             }
         }
         else
@@ -765,11 +900,28 @@ namespace ix
             }
             else
             {
-                onMessageCallback(message, wireSize, false, messageKind);
+                onMessageCallback(
+                    message, message.data(), message.size(), wireSize, false, messageKind);
             }
         }
     }
 
+    void WebSocketTransport::emitMessageView(MessageKind messageKind,
+                                             const char* data,
+                                             size_t size,
+                                             const OnMessageCallback& onMessageCallback)
+    {
+        if (messageKind == MessageKind::MSG_TEXT && !validateUtf8(data, size))
+        {
+            close(WebSocketCloseConstants::kInvalidFramePayloadData,
+                  WebSocketCloseConstants::kInvalidFramePayloadDataMessage);
+        }
+        else
+        {
+            onMessageCallback(kEmptyMessage, data, size, size, false, messageKind);
+        }
+    }
+
     unsigned WebSocketTransport::getRandomUnsigned()
     {
         auto now = std::chrono::system_clock::now();
@@ -869,6 +1021,14 @@ namespace ix
                     return WebSocketSendInfo(false);
                 }
 
+                // In blocking mode, wait for the socket to take the pending data before
+                // sending the next fragment, instead of queueing the whole message
+                if (_blockingSend && !hasWakeUpCallback() && !isSendBufferEmpty() &&
+                    !flushSendBuffer())
+                {
+                    return WebSocketSendInfo(false);
+                }
+
                 if (onProgressCallback && !onProgressCallback((int) i, (int) steps))
                 {
                     break;
@@ -884,7 +1044,7 @@ namespace ix
             wakeUpFromPoll(SelectInterrupt::kSendRequest);
 
             // FIXME: we should have a timeout when sending large messages: see #131
-            if (_blockingSend && !flushSendBuffer())
+            if (_blockingSend && !hasWakeUpCallback() && !flushSendBuffer())
             {
                 success = false;
             }
@@ -893,26 +1053,16 @@ namespace ix
         return WebSocketSendInfo(success, compressionError, payloadSize, wireSize);
     }
 
-    template<class Iterator>
-    bool WebSocketTransport::sendFragment(wsheader_type::opcode_type type,
-                                          bool fin,
-                                          Iterator message_begin,
-                                          Iterator message_end,
-                                          bool compress)
+    size_t WebSocketTransport::writeFrameHeader(uint8_t* header,
+                                                wsheader_type::opcode_type type,
+                                                bool fin,
+                                                bool compress,
+                                                uint64_t message_size,
+                                                const uint8_t* masking_key)
     {
-        uint64_t message_size = static_cast<uint64_t>(message_end - message_begin);
-
-        unsigned x = getRandomUnsigned();
-        uint8_t masking_key[4] = {};
-        masking_key[0] = (x >> 24);
-        masking_key[1] = (x >> 16) & 0xff;
-        masking_key[2] = (x >> 8) & 0xff;
-        masking_key[3] = (x) &0xff;
-
-        std::vector<uint8_t> header;
-        header.assign(static_cast< size_t >( 2 + (message_size >= 126 ? 2 : 0) + (message_size >= 65536 ? 6 : 0) +
-                          (_useMask ? 4 : 0) ),
-                      uint8_t( 0 ));
+        bool mask = masking_key != nullptr;
+        size_t headerSize = 2 + (message_size >= 126 ? 2 : 0) +
+                            (message_size >= 65536 ? 6 : 0) + (mask ? 4 : 0);
         header[0] = static_cast< uint8_t >( type );
 
         // The fin bit indicate that this is the last fragment. Fin is French for end.
@@ -930,9 +1080,9 @@ namespace ix
 
         if (message_size < 126)
         {
-            header[1] = (message_size & 0xff) | (_useMask ? 0x80 : 0);
+            header[1] = (message_size & 0xff) | (mask ? 0x80 : 0);
 
-            if (_useMask)
+            if (mask)
             {
                 header[2] = masking_key[0];
                 header[3] = masking_key[1];
@@ -942,11 +1092,11 @@ namespace ix
         }
         else if (message_size < 65536)
         {
-            header[1] = 126 | (_useMask ? 0x80 : 0);
+            header[1] = 126 | (mask ? 0x80 : 0);
             header[2] = (message_size >> 8) & 0xff;
             header[3] = (message_size >> 0) & 0xff;
 
-            if (_useMask)
+            if (mask)
             {
                 header[4] = masking_key[0];
                 header[5] = masking_key[1];
@@ -956,7 +1106,7 @@ namespace ix
         }
         else
         { // TODO: run coverage testing here
-            header[1] = 127 | (_useMask ? 0x80 : 0);
+            header[1] = 127 | (mask ? 0x80 : 0);
             header[2] = (message_size >> 56) & 0xff;
             header[3] = (message_size >> 48) & 0xff;
             header[4] = (message_size >> 40) & 0xff;
@@ -966,7 +1116,7 @@ namespace ix
             header[8] = (message_size >> 8) & 0xff;
             header[9] = (message_size >> 0) & 0xff;
 
-            if (_useMask)
+            if (mask)
             {
                 header[10] = masking_key[0];
                 header[11] = masking_key[1];
@@ -975,8 +1125,40 @@ namespace ix
             }
         }
 
+        return headerSize;
+    }
+
+    template<class Iterator>
+    bool WebSocketTransport::sendFragment(wsheader_type::opcode_type type,
+                                          bool fin,
+                                          Iterator message_begin,
+                                          Iterator message_end,
+                                          bool compress)
+    {
+        uint64_t message_size = static_cast<uint64_t>(message_end - message_begin);
+
+        unsigned x = getRandomUnsigned();
+        uint8_t masking_key[4] = {};
+        masking_key[0] = (x >> 24);
+        masking_key[1] = (x >> 16) & 0xff;
+        masking_key[2] = (x >> 8) & 0xff;
+        masking_key[3] = (x) &0xff;
+
+        uint8_t header[14] = {};
+        size_t headerSize = writeFrameHeader(
+            header, type, fin, compress, message_size, _useMask ? masking_key : nullptr);
+
+        // Large unmasked payloads (sent by servers) are not copied to _txbuf, unless
+        // the socket cannot take them right away. The iterators come from a std::string.
+        if (!_useMask && message_size >= kDirectSendMinSize)
+        {
+            return sendFrameDirectly(
+                header, headerSize, (const char*) &*message_begin, (size_t) message_size);
+        }
+
         // _txbuf will keep growing until it can be transmitted over the socket:
-        appendToSendBuffer(header, message_begin, message_end, message_size, masking_key);
+        appendToSendBuffer(
+            header, headerSize, message_begin, message_end, message_size, masking_key);
 
         // Now actually send this data
         return sendOnSocket();
@@ -1012,16 +1194,246 @@ namespace ix
             wsheader_type::TEXT_FRAME, message, _enablePerMessageDeflate, onProgressCallback);
     }
 
+    WebSocketSendInfo WebSocketTransport::sendPreparedMessage(
+        const WebSocketPreparedMessage& message)
+    {
+        auto type = message.isBinary() ? wsheader_type::BINARY_FRAME : wsheader_type::TEXT_FRAME;
+
+        // Clients mask every frame with a new key, the frame cannot be shared
+        if (_useMask)
+        {
+            return sendData(type, message.getPayload(), _enablePerMessageDeflate);
+        }
+
+        if (_readyState != ReadyState::OPEN && _readyState != ReadyState::CLOSING)
+        {
+            return WebSocketSendInfo(false);
+        }
+
+        size_t wireSize = 0;
+        auto frame = getPreparedFrame(message, wireSize);
+
+        {
+            std::lock_guard<std::mutex> lock(_txbufMutex);
+            _sharedFrames.push_back(SharedFrame {frame, 0, _txbuf.size()});
+            _sharedFramesSize += frame->size();
+        }
+
+        bool success = sendOnSocket();
+
+        // Request to flush the send buffer on the background thread if it isn't empty
+        if (success && !isSendBufferEmpty())
+        {
+            wakeUpFromPoll(SelectInterrupt::kSendRequest);
+
+            if (_blockingSend && !hasWakeUpCallback() && !flushSendBuffer())
+            {
+                success = false;
+            }
+        }
+
+        bool compressionError = false;
+        return WebSocketSendInfo(success, compressionError, message.getPayload().size(), wireSize);
+    }
+
+    QueueMessageResult WebSocketTransport::queuePreparedMessage(
+        const WebSocketPreparedMessage& message, size_t highWaterMark, bool coalesce)
+    {
+        if (_readyState != ReadyState::OPEN)
+        {
+            return QueueMessageResult::NotConnected;
+        }
+
+        // Clients mask their frames, which are sent right away as they do not block
+        if (_useMask)
+        {
+            if (bufferedAmount() > highWaterMark)
+            {
+                return QueueMessageResult::Dropped;
+            }
+
+            auto type =
+                message.isBinary() ? wsheader_type::BINARY_FRAME : wsheader_type::TEXT_FRAME;
+            return sendData(type, message.getPayload(), _enablePerMessageDeflate).success
+                       ? QueueMessageResult::Queued
+                       : QueueMessageResult::NotConnected;
+        }
+
+        size_t wireSize = 0;
+        auto frame = getPreparedFrame(message, wireSize);
+        auto result = QueueMessageResult::Queued;
+        bool wasEmpty = false;
+
+        {
+            std::lock_guard<std::mutex> lock(_txbufMutex);
+
+            if (_txbuf.size() + _sharedFramesSize > highWaterMark)
+            {
+                if (!coalesce)
+                {
+                    return QueueMessageResult::Dropped;
+                }
+
+                // The frames which started to be sent must be completed
+                auto it = std::remove_if(
+                    _sharedFrames.begin(), _sharedFrames.end(), [this](const SharedFrame& f) {
+                        if (f.offset != 0) return false;
+                        _sharedFramesSize -= f.frame->size();
+                        return true;
+                    });
+                _sharedFrames.erase(it, _sharedFrames.end());
+                result = QueueMessageResult::Coalesced;
+            }
+
+            wasEmpty = _txbuf.empty() && _sharedFrames.empty();
+            _sharedFrames.push_back(SharedFrame {frame, 0, _txbuf.size()});
+            _sharedFramesSize += frame->size();
+        }
+
+        // Otherwise a flush is pending already, or the connection waits for the
+        // socket to be writable. The socket does not block, most small frames are
+        // written right away without waking up the connection thread.
+        if (wasEmpty)
+        {
+            if (!sendOnSocket())
+            {
+                return QueueMessageResult::NotConnected;
+            }
+
+            if (!isSendBufferEmpty())
+            {
+                wakeUpFromPoll(SelectInterrupt::kSendRequest);
+            }
+        }
+
+        return result;
+    }
+
+    std::shared_ptr<const std::string> WebSocketTransport::getPreparedFrame(
+        const WebSocketPreparedMessage& message, size_t& wireSize)
+    {
+        // The compressed variant was compressed on its own, which only works with peers
+        // that do not expect the messages to share a compression context
+        if (_enablePerMessageDeflate && message.getCompressedFrame() &&
+            _perMessageDeflate->canSendPrecompressed(
+                WebSocketPreparedMessage::kCompressionWindowBits))
+        {
+            wireSize = message.getCompressedSize();
+            return message.getCompressedFrame();
+        }
+
+        wireSize = message.getPayload().size();
+        return message.getFrame();
+    }
+
+    std::string WebSocketTransport::encodeFrame(bool binary,
+                                                bool compressed,
+                                                const std::string& payload)
+    {
+        auto type = binary ? wsheader_type::BINARY_FRAME : wsheader_type::TEXT_FRAME;
+
+        uint8_t header[14] = {};
+        size_t headerSize =
+            writeFrameHeader(header, type, true, compressed, payload.size(), nullptr);
+
+        std::string frame;
+        frame.reserve(headerSize + payload.size());
+        frame.append((const char*) header, headerSize);
+        frame.append(payload);
+        return frame;
+    }
+
+    bool WebSocketTransport::sendFrameDirectly(const uint8_t* header,
+                                               size_t headerSize,
+                                               const char* payload,
+                                               size_t payloadSize)
+    {
+        {
+            std::lock_guard<std::mutex> lockTransaction(_txbufMutex);
+
+            // Data queued earlier has to go first
+            if (_txbuf.empty() && _sharedFrames.empty())
+            {
+                SocketBuffer buffers[2] = {{(const char*) header, headerSize},
+                                           {payload, payloadSize}};
+
+                ssize_t ret = 0;
+                {
+                    std::lock_guard<std::mutex> lockSocket(_socketMutex);
+                    ret = _socket->sendv(buffers, 2);
+                }
+
+                if (ret < 0 && Socket::isWaitNeeded())
+                {
+                    ret = 0;
+                }
+                else if (ret <= 0)
+                {
+                    if (!hasWakeUpCallback())
+                    {
+                        closeSocket();
+                        setReadyState(ReadyState::CLOSED);
+                    }
+                    return false;
+                }
+
+                size_t sent = (size_t) ret;
+                if (sent < headerSize)
+                {
+                    _txbuf.insert(_txbuf.end(), header + sent, header + headerSize);
+                    sent = headerSize;
+                }
+                _txbuf.insert(_txbuf.end(), payload + (sent - headerSize), payload + payloadSize);
+
+                return true;
+            }
+        }
+
+        uint8_t maskingKey[4] = {};
+        appendToSendBuffer(
+            header, headerSize, payload, payload + payloadSize, payloadSize, maskingKey);
+        return sendOnSocket();
+    }
+
     bool WebSocketTransport::sendOnSocket()
     {
         std::lock_guard<std::mutex> lockTransaction(_txbufMutex);
 
-        while (_txbuf.size())
+        // Sent bytes are removed from the front of the buffer once, at the end
+        size_t sent = 0;
+
+        while (sent < _txbuf.size() || !_sharedFrames.empty())
         {
+            // Gather the pending bytes of _txbuf and of the shared frames, in order
+            SocketBuffer buffers[kMaxSendSegments];
+            size_t count = 0;
+            size_t position = sent;
+
+            for (auto&& sharedFrame : _sharedFrames)
+            {
+                if (sharedFrame.txbufPosition > position)
+                {
+                    buffers[count++] = {(const char*) &_txbuf[position],
+                                        sharedFrame.txbufPosition - position};
+                    position = sharedFrame.txbufPosition;
+                    if (count == kMaxSendSegments) break;
+                }
+
+                buffers[count++] = {sharedFrame.frame->data() + sharedFrame.offset,
+                                    sharedFrame.frame->size() - sharedFrame.offset};
+                if (count == kMaxSendSegments) break;
+            }
+
+            if (count < kMaxSendSegments && position < _txbuf.size())
+            {
+                buffers[count++] = {(const char*) &_txbuf[position], _txbuf.size() - position};
+            }
+
             ssize_t ret = 0;
             {
                 std::lock_guard<std::mutex> lockSocket(_socketMutex);
-                ret = _socket->send((char*) &_txbuf[0], _txbuf.size());
+                ret = (count == 1) ? _socket->send((char*) buffers[0].data, buffers[0].size)
+                                   : _socket->sendv(buffers, count);
             }
 
             if (ret < 0 && Socket::isWaitNeeded())
@@ -1030,16 +1442,51 @@ namespace ix
             }
             else if (ret <= 0)
             {
-                closeSocket();
-                setReadyState(ReadyState::CLOSED);
+                // In event loop mode the socket is only closed from the loop thread,
+                // which is notified of the error as well
+                if (!hasWakeUpCallback())
+                {
+                    closeSocket();
+                    setReadyState(ReadyState::CLOSED);
+                }
                 return false;
             }
-            else
+
+            // Consume the sent bytes, in the order they were gathered
+            size_t remaining = (size_t) ret;
+            while (remaining > 0)
             {
-                _txbuf.erase(_txbuf.begin(), _txbuf.begin() + ret);
+                if (!_sharedFrames.empty() && _sharedFrames.front().txbufPosition == sent)
+                {
+                    SharedFrame& sharedFrame = _sharedFrames.front();
+                    size_t n =
+                        std::min(remaining, sharedFrame.frame->size() - sharedFrame.offset);
+                    sharedFrame.offset += n;
+                    _sharedFramesSize -= n;
+                    remaining -= n;
+
+                    if (sharedFrame.offset == sharedFrame.frame->size())
+                    {
+                        _sharedFrames.pop_front();
+                    }
+                }
+                else
+                {
+                    size_t end =
+                        _sharedFrames.empty() ? _txbuf.size() : _sharedFrames.front().txbufPosition;
+                    size_t n = std::min(remaining, end - sent);
+                    sent += n;
+                    remaining -= n;
+                }
             }
         }
 
+        _txbuf.erase(_txbuf.begin(), _txbuf.begin() + sent);
+        for (auto&& sharedFrame : _sharedFrames)
+        {
+            sharedFrame.txbufPosition -= sent;
+        }
+
         return true;
     }
 
@@ -1047,7 +1494,9 @@ namespace ix
     {
         while (true)
         {
-            ssize_t ret = _socket->recv((char*) &_readbuf[0], _readbuf.size());
+            // Receive straight into the free space at the end of the buffer
+            uint8_t* buffer = _rxbuf.prepare(kChunkSize);
+            ssize_t ret = _socket->recv((char*) buffer, kChunkSize);
 
             if (ret < 0 && Socket::isWaitNeeded())
             {
@@ -1064,7 +1513,7 @@ namespace ix
             }
             else
             {
-                _rxbuf.insert(_rxbuf.end(), _readbuf.begin(), _readbuf.begin() + ret);
+                _rxbuf.commit(ret);
             }
         }
 
@@ -1102,6 +1551,18 @@ namespace ix
 
     bool WebSocketTransport::wakeUpFromPoll(uint64_t wakeUpCode)
     {
+        std::shared_ptr<OnWakeUpCallback> onWakeUpCallback;
+        {
+            std::lock_guard<std::mutex> lock(_onWakeUpCallbackMutex);
+            onWakeUpCallback = _onWakeUpCallback;
+        }
+
+        if (onWakeUpCallback)
+        {
+            (*onWakeUpCallback)(wakeUpCode);
+            return true;
+        }
+
         std::lock_guard<std::mutex> lock(_socketMutex);
         return _socket->wakeUpFromPoll(wakeUpCode);
     }
@@ -1129,6 +1590,15 @@ namespace ix
     {
         _requestInitCancellation = true;
 
+        // A connection in progress waits for this rather than polling for cancellation
+        {
+            std::lock_guard<std::mutex> lock(_connectingSocketMutex);
+            if (_connectingSocket)
+            {
+                _connectingSocket->wakeUpFromPoll(SelectInterrupt::kCloseRequest);
+            }
+        }
+
         if (_readyState == ReadyState::CLOSING || _readyState == ReadyState::CLOSED) return;
 
         if (closeWireSize == 0)
@@ -1156,7 +1626,7 @@ namespace ix
     size_t WebSocketTransport::bufferedAmount() const
     {
         std::lock_guard<std::mutex> lock(_txbufMutex);
-        return _txbuf.size();
+        return _txbuf.size() + _sharedFramesSize;
     }
 
     bool WebSocketTransport::flushSendBuffer()
@@ -12,14 +12,17 @@
 
 #include "IXCancellationRequest.h"
 #include "IXProgressCallback.h"
+#include "IXReceiveBuffer.h"
 #include "IXSocketTLSOptions.h"
 #include "IXWebSocketCloseConstants.h"
 #include "IXWebSocketHandshake.h"
 #include "IXWebSocketHttpHeaders.h"
 #include "IXWebSocketPerMessageDeflate.h"
 #include "IXWebSocketPerMessageDeflateOptions.h"
+#include "IXWebSocketPreparedMessage.h"
 #include "IXWebSocketSendInfo.h"
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <list>
 #include <memory>
@@ -65,9 +68,13 @@ namespace ix
             CannotFlushSendBuffer
         };
 
-        using OnMessageCallback =
-            std::function<void(const std::string&, size_t, bool, MessageKind)>;
+        // The payload is passed both as a string and as a data pointer and size. In zero
+        // copy mode the string is empty for messages delivered as a view into the
+        // receive buffer, which is only valid for the duration of the callback.
+        using OnMessageCallback = std::function<void(
+            const std::string&, const char*, size_t, size_t, bool, MessageKind)>;
         using OnCloseCallback = std::function<void(uint16_t, const std::string&, size_t, bool)>;
+        using OnWakeUpCallback = std::function<void(uint64_t)>;
 
         WebSocketTransport();
         ~WebSocketTransport();
@@ -75,7 +82,8 @@ namespace ix
         void configure(const WebSocketPerMessageDeflateOptions& perMessageDeflateOptions,
                        const SocketTLSOptions& socketTLSOptions,
                        bool enablePong,
-                       int pingIntervalSecs);
+                       int pingIntervalSecs,
+                       bool enableZeroCopyMessages = false);
 
         // Client
         WebSocketInitResult connectToUrl(const std::string& url,
@@ -94,6 +102,21 @@ namespace ix
                                    const OnProgressCallback& onProgressCallback);
         WebSocketSendInfo sendPing(const std::string& message);
 
+        // Queue the shared frame of a prepared message, without copying it when
+        // the connection does not mask its frames (servers)
+        WebSocketSendInfo sendPreparedMessage(const WebSocketPreparedMessage& message);
+
+        // Queue a prepared message without sending it nor blocking, it is sent from the
+        // thread or the event loop of the connection. When more than highWaterMark bytes
+        // are waiting to be sent already, the message is dropped, or replaces the prepared
+        // messages which did not start to be sent if coalesce is set.
+        QueueMessageResult queuePreparedMessage(const WebSocketPreparedMessage& message,
+                                                size_t highWaterMark,
+                                                bool coalesce);
+
+        // Single unmasked frame holding a whole message
+        static std::string encodeFrame(bool binary, bool compressed, const std::string& payload);
+
         void close(uint16_t code = WebSocketCloseConstants::kNormalClosureCode,
                    const std::string& reason = WebSocketCloseConstants::kNormalClosureMessage,
                    size_t closeWireSize = 0,
@@ -107,6 +130,20 @@ namespace ix
         void dispatch(PollResult pollResult, const OnMessageCallback& onMessageCallback);
         size_t bufferedAmount() const;
 
+        // Event loop mode. Instead of blocking in poll(), the socket readiness is reported
+        // by an event loop through processEvents, and the wake up requests (pending data
+        // to send, close) are forwarded to the wake up callback. Sends never block.
+        void setOnWakeUpCallback(const OnWakeUpCallback& onWakeUpCallback);
+        bool hasWakeUpCallback() const;
+        PollResult processEvents(bool readable, bool writable);
+
+        // File descriptor of the connected socket, to be watched by the event loop
+        int getSocketFd();
+
+        // Send pings and enforce the closing delay. Returns the delay in ms before
+        // it needs to be called again, or -1 if there is nothing to wait for.
+        int processTimers();
+
         // internal
         WebSocketSendInfo sendHeartBeat();
 
@@ -143,18 +180,31 @@ namespace ix
         // saying that a send is complete. This is the mode for server code.
         std::atomic<bool> _blockingSend;
 
-        // Buffer for reading from our socket. That buffer is never resized.
-        std::vector<uint8_t> _readbuf;
-
         // Contains all messages that were fetched in the last socket read.
         // This could be a mix of control messages (Close, Ping, etc...) and
-        // data messages. That buffer is resized
-        std::vector<uint8_t> _rxbuf;
+        // data messages. Data is received straight into that buffer, and
+        // processed messages are consumed without moving the remaining bytes.
+        ReceiveBuffer _rxbuf;
 
         // Contains all messages that are waiting to be sent
         std::vector<uint8_t> _txbuf;
         mutable std::mutex _txbufMutex;
 
+        // Frames of prepared messages waiting to be sent. They are shared with other
+        // connections and sent from where they are, after the first txbufPosition
+        // bytes of _txbuf, so that the order of the messages is preserved.
+        struct SharedFrame
+        {
+            std::shared_ptr<const std::string> frame;
+            size_t offset;
+            size_t txbufPosition;
+        };
+        std::deque<SharedFrame> _sharedFrames;
+        size_t _sharedFramesSize;
+
+        // Most buffers given to a single sendv call
+        static constexpr size_t kMaxSendSegments = 16;
+
         // Hold fragments for multi-fragments messages in a list. We support receiving very large
         // messages (tested messages up to 700M) and we cannot put them in a single
         // buffer that is resized, as this operation can be slow when a buffer has its
@@ -172,14 +222,28 @@ namespace ix
         // Fragments are 32K long
         static constexpr size_t kChunkSize = 1 << 15;
 
+        // Smaller unmasked frames are still copied to the send buffer, which lets
+        // several of them go out with a single send call
+        static constexpr size_t kDirectSendMinSize = 1 << 13;
+
         // Underlying TCP socket
         std::unique_ptr<Socket> _socket;
         std::mutex _socketMutex;
 
+        // The socket being connected by connectToUrl, which close() wakes up to cancel
+        // the connection. _socketMutex is held during the connection.
+        Socket* _connectingSocket;
+        std::mutex _connectingSocketMutex;
+
         // Hold the state of the connection (OPEN, CLOSED, etc...)
         std::atomic<ReadyState> _readyState;
 
         OnCloseCallback _onCloseCallback;
+
+        // Set from the event loop thread while other threads send. Shared so that it can be
+        // invoked without holding the mutex.
+        std::shared_ptr<OnWakeUpCallback> _onWakeUpCallback;
+        mutable std::mutex _onWakeUpCallbackMutex;
         std::string _closeReason;
         mutable std::mutex _closeReasonMutex;
         std::atomic<uint16_t> _closeCode;
@@ -194,6 +258,10 @@ namespace ix
         std::string _decompressedMessage;
         std::string _compressedMessage;
 
+        // Deliver unfragmented and uncompressed messages without copying them
+        bool _enableZeroCopyMessages;
+        static const std::string kEmptyMessage;
+
         // Used to control TLS connection behavior
         SocketTLSOptions _socketTLSOptions;
 
@@ -223,13 +291,19 @@ namespace ix
         // If this function returns true, it is time to send a new ping
         bool pingIntervalExceeded();
         void initTimePointsAfterConnect();
+        void checkHeartBeat();
+        int getPingDelayInMs();
 
         // after calling close(), if no CLOSE frame answer is received back from the remote, we
         // should close the connexion
         bool closingDelayExceeded();
+        void closeIfClosingDelayExceeded();
+        int getClosingDelayInMs();
 
         void sendCloseFrame(uint16_t code, const std::string& reason);
 
+        void setConnectingSocket(Socket* socket);
+
         void closeSocketAndSwitchToClosedState(uint16_t code,
                                                const std::string& reason,
                                                size_t closeWireSize,
@@ -247,6 +321,17 @@ namespace ix
                                    bool compress,
                                    const OnProgressCallback& onProgressCallback = nullptr);
 
+        // Frame to send for a prepared message, and its payload size on the wire
+        std::shared_ptr<const std::string> getPreparedFrame(
+            const WebSocketPreparedMessage& message, size_t& wireSize);
+
+        static size_t writeFrameHeader(uint8_t* header,
+                                       wsheader_type::opcode_type type,
+                                       bool fin,
+                                       bool compress,
+                                       uint64_t message_size,
+                                       const uint8_t* masking_key);
+
         template<class Iterator>
         bool sendFragment(
             wsheader_type::opcode_type type, bool fin, Iterator begin, Iterator end, bool compress);
@@ -255,16 +340,28 @@ namespace ix
                          const std::string& message,
                          bool compressedMessage,
                          const OnMessageCallback& onMessageCallback);
+        void emitMessageView(MessageKind messageKind,
+                             const char* data,
+                             size_t size,
+                             const OnMessageCallback& onMessageCallback);
 
         bool isSendBufferEmpty() const;
 
         template<class Iterator>
-        void appendToSendBuffer(const std::vector<uint8_t>& header,
+        void appendToSendBuffer(const uint8_t* header,
+                                size_t headerSize,
                                 Iterator begin,
                                 Iterator end,
                                 uint64_t message_size,
                                 uint8_t masking_key[4]);
 
+        // Send an unmasked frame straight from the caller's payload with writev,
+        // only queueing the bytes which could not be sent
+        bool sendFrameDirectly(const uint8_t* header,
+                               size_t headerSize,
+                               const char* payload,
+                               size_t payloadSize);
+
         unsigned getRandomUnsigned();
         void unmaskReceiveBuffer(const wsheader_type& ws);
 
@@ -6,8 +6,16 @@
 
 #include "IXTest.h"
 #include "catch.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <ixwebsocket/IXDNSCache.h>
 #include <ixwebsocket/IXDNSLookup.h>
+#include <ixwebsocket/IXDNSResolverPool.h>
+#include <ixwebsocket/IXNetSystem.h>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 using namespace ix;
 
@@ -49,3 +57,175 @@ TEST_CASE("dns", "[net]")
         REQUIRE(res == nullptr);
     }
 }
+
+TEST_CASE("dns cache", "[net]")
+{
+    SECTION("Lookups are answered from the cache until they expire")
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+
+        std::string errMsg;
+        auto res = dnsCache->resolve("localhost", 80, errMsg, [] { return false; });
+        REQUIRE(res != nullptr);
+        REQUIRE(dnsCache->getMissCount() == 1);
+
+        auto cached = dnsCache->resolve("localhost", 80, errMsg, [] { return false; });
+        REQUIRE(cached == res);
+        REQUIRE(dnsCache->getHitCount() == 1);
+
+        // Entries are keyed by port too
+        auto other = dnsCache->resolve("localhost", 8080, errMsg, [] { return false; });
+        REQUIRE(other != nullptr);
+        REQUIRE(other != res);
+        REQUIRE(dnsCache->getMissCount() == 2);
+        REQUIRE(dnsCache->getEntriesCount() == 2);
+
+        dnsCache->clear();
+        REQUIRE(dnsCache->resolve("localhost", 80, errMsg, [] { return false; }) != nullptr);
+        REQUIRE(dnsCache->getMissCount() == 3);
+    }
+
+    SECTION("Concurrent lookups of the same name share a single query")
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+
+        std::atomic<int> resolved(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 32; ++i)
+        {
+            threads.emplace_back([dnsCache, &resolved] {
+                std::string errMsg;
+                if (dnsCache->resolve("localhost", 80, errMsg, [] { return false; }))
+                {
+                    resolved++;
+                }
+            });
+        }
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+
+        REQUIRE(resolved == 32);
+        REQUIRE(dnsCache->getHitCount() + dnsCache->getMissCount() == 32);
+        // Only one miss started a query, the others joined it or found its result
+        REQUIRE(dnsCache->getMissCount() - dnsCache->getCoalescedCount() == 1);
+    }
+
+    SECTION("Failures are cached for a short time")
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+        dnsCache->setNegativeTTLSecs(1);
+
+        std::string errMsg;
+        auto res = dnsCache->resolve("nonexistent.invalid", 80, errMsg, [] { return false; });
+        REQUIRE(res == nullptr);
+        auto firstErrMsg = errMsg;
+
+        res = dnsCache->resolve("nonexistent.invalid", 80, errMsg, [] { return false; });
+        REQUIRE(res == nullptr);
+        REQUIRE(errMsg == firstErrMsg);
+        REQUIRE(dnsCache->getHitCount() == 1);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        dnsCache->resolve("nonexistent.invalid", 80, errMsg, [] { return false; });
+        REQUIRE(dnsCache->getMissCount() == 2);
+    }
+
+    SECTION("Entries used before they expire are refreshed in the background")
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+        dnsCache->setTTLSecs(2);
+        dnsCache->setRefreshAheadSecs(1);
+
+        std::string errMsg;
+        auto res = dnsCache->resolve("localhost", 80, errMsg, [] { return false; });
+        REQUIRE(res != nullptr);
+
+        // Within a second of expiring, a hit starts a refresh
+        std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+        REQUIRE(dnsCache->resolve("localhost", 80, errMsg, [] { return false; }) == res);
+        REQUIRE(dnsCache->getRefreshCount() == 1);
+
+        // The refreshed entry is used after the first one expired
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        REQUIRE(dnsCache->resolve("localhost", 80, errMsg, [] { return false; }) != nullptr);
+        REQUIRE(dnsCache->getMissCount() == 1);
+        REQUIRE(dnsCache->getHitCount() == 2);
+    }
+
+    SECTION("A cancelled caller does not wait for the lookup")
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+
+        std::string errMsg;
+        auto res = dnsCache->resolve("localhost", 80, errMsg, [] { return true; });
+        REQUIRE(res == nullptr);
+        REQUIRE(errMsg == "cancellation requested");
+    }
+}
+
+TEST_CASE("dns resolver pool", "[net]")
+{
+    SECTION("Lookups are run by a bounded number of threads")
+    {
+        DNSResolverPool pool(2);
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        int resolved = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            pool.resolve("localhost", 80, [&](struct addrinfo* res, const std::string&) {
+                if (res != nullptr) freeaddrinfo(res);
+
+                std::lock_guard<std::mutex> lock(mutex);
+                resolved++;
+                condition.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        REQUIRE(condition.wait_for(lock, std::chrono::seconds(10), [&] { return resolved == 16; }));
+        REQUIRE(pool.getThreadsCount() <= 2);
+        REQUIRE(pool.getQueuedCount() == 0);
+    }
+
+    SECTION("Cancelled lookups are not performed")
+    {
+        DNSResolverPool pool(1);
+
+        std::atomic<bool> done(false);
+        std::string errMsg;
+        pool.resolve(
+            "localhost",
+            80,
+            [&](struct addrinfo* res, const std::string& msg) {
+                errMsg = msg;
+                done = res == nullptr;
+            },
+            [] { return true; });
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!done && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(done);
+        REQUIRE(errMsg == "cancellation requested");
+    }
+
+    SECTION("DNSLookup wakes up as soon as the lookup completes")
+    {
+        // A wait interval longer than the lookup, which only bounds cancellation checks
+        auto dnsLookup = std::make_shared<DNSLookup>("localhost", 80, 5000);
+
+        auto start = std::chrono::steady_clock::now();
+        std::string errMsg;
+        struct addrinfo* res = dnsLookup->resolve(errMsg, [] { return false; });
+        REQUIRE(res != nullptr);
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        dnsLookup->release(res);
+    }
+}
@@ -4,12 +4,312 @@
  *  Copyright (c) 2019 Machine Zone. All rights reserved.
  */
 
+#include "IXTest.h"
 #include "catch.hpp"
 #include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <ixwebsocket/IXGzipCodec.h>
+#include <ixwebsocket/IXHttpBodyProvider.h>
 #include <ixwebsocket/IXHttpClient.h>
+#include <ixwebsocket/IXHttpServer.h>
+#include <ixwebsocket/IXHttpStaticFileHandler.h>
+#include <ixwebsocket/IXSocketServer.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
 
 using namespace ix;
 
+namespace
+{
+    // Each response body is the id of the server connection which handled the request
+    void startConnectionIdServer(HttpServer& server, int delayMs = 0)
+    {
+        server.setOnConnectionCallback(
+            [delayMs](HttpRequestPtr request,
+                      std::shared_ptr<ConnectionState> connectionState) -> HttpResponsePtr {
+                if (delayMs > 0) ix::msleep(delayMs);
+
+                WebSocketHttpHeaders headers;
+                if (request->uri == "/close")
+                {
+                    headers["Connection"] = "close";
+                }
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, headers, connectionState->getId());
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+    }
+
+    std::string getConnectionId(HttpClient& httpClient, int port, const std::string& path = "/")
+    {
+        std::string url("http://127.0.0.1:" + std::to_string(port) + path);
+        auto args = httpClient.createRequest(url);
+        auto response = httpClient.get(url, args);
+
+        INFO(response->errorMsg);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 200);
+        return response->body;
+    }
+
+    // Collect the responses of async requests, which are delivered on another thread
+    struct AsyncResponses
+    {
+        OnResponseCallback add(const std::string& name)
+        {
+            return [this, name](const HttpResponsePtr& response) {
+                std::lock_guard<std::mutex> lock(mutex);
+                responses[name] = response;
+            };
+        }
+
+        bool waitFor(size_t count, int timeoutMs = 10000)
+        {
+            for (int i = 0; i < timeoutMs / 10; ++i)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (responses.size() >= count) return true;
+                }
+                ix::msleep(10);
+            }
+            return false;
+        }
+
+        HttpResponsePtr get(const std::string& name)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return responses[name];
+        }
+
+        std::mutex mutex;
+        std::map<std::string, HttpResponsePtr> responses;
+    };
+
+    // Requests to /sleep/<ms> are answered after that delay. The server keeps track of the
+    // maximum number of requests handled at the same time.
+    void startSleepServer(HttpServer& server, std::atomic<int>& current, std::atomic<int>& max)
+    {
+        server.setOnConnectionCallback(
+            [&current, &max](HttpRequestPtr request,
+                             std::shared_ptr<ConnectionState> /*connectionState*/)
+                -> HttpResponsePtr {
+                int count = ++current;
+                int previous = max;
+                while (count > previous && !max.compare_exchange_weak(previous, count))
+                {
+                    ;
+                }
+
+                int delayMs = 0;
+                if (request->uri.find("/sleep/") == 0)
+                {
+                    delayMs = std::stoi(request->uri.substr(7));
+                }
+                ix::msleep(delayMs);
+
+                current--;
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), request->uri);
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+    }
+
+    // A large body which compresses well, but not into nothing
+    std::string makeLargeBody()
+    {
+        std::string body;
+        for (int i = 0; body.size() < 1024 * 1024; ++i)
+        {
+            body += "line " + std::to_string(i) + "\n";
+        }
+        return body;
+    }
+
+    // Serves the large body, gzip compressed for requests to /gzip
+    void startLargeBodyServer(HttpServer& server, const std::string& body)
+    {
+        server.setOnConnectionCallback(
+            [body](HttpRequestPtr request,
+                   std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                WebSocketHttpHeaders headers;
+                if (request->uri == "/gzip")
+                {
+                    headers["Content-Encoding"] = "gzip";
+                    return std::make_shared<HttpResponse>(
+                        200, "OK", HttpErrorCode::Ok, headers, gzipCompress(body));
+                }
+                return std::make_shared<HttpResponse>(200, "OK", HttpErrorCode::Ok, headers, body);
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+    }
+
+    // Echo the request body, and tell how it was sent in the response headers
+    void startEchoServer(HttpServer& server)
+    {
+        server.setOnConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                WebSocketHttpHeaders headers;
+                headers["X-Transfer-Encoding"] = request->headers["Transfer-Encoding"];
+                headers["X-Content-Length"] = request->headers["Content-Length"];
+                headers["X-Content-Type"] = request->headers["Content-Type"];
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, headers, request->body);
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+    }
+
+    // Body pieces received by an onChunkCallback
+    struct Chunks
+    {
+        Chunks()
+            : count(0)
+            , maxSize(0)
+            , limit(0)
+        {
+        }
+
+        OnChunkCallback callback()
+        {
+            return [this](const char* data, size_t size) {
+                std::lock_guard<std::mutex> lock(mutex);
+                body.append(data, size);
+                count++;
+                maxSize = std::max(maxSize, size);
+                return limit == 0 || body.size() < limit;
+            };
+        }
+
+        std::mutex mutex;
+        std::string body;
+        size_t count;
+        size_t maxSize;
+        // The transfer is stopped once that many bytes are received, if not 0
+        size_t limit;
+    };
+
+    // Answers every request with the same raw response, one that HttpServer would not send
+    class RawResponseServer : public SocketServer
+    {
+    public:
+        RawResponseServer(int port, const std::string& response)
+            : SocketServer(port, "127.0.0.1")
+            , _response(response)
+        {
+            ;
+        }
+
+        ~RawResponseServer()
+        {
+            stop();
+        }
+
+    private:
+        void handleConnection(std::unique_ptr<Socket> socket,
+                              std::shared_ptr<ConnectionState> connectionState) final
+        {
+            auto ret = Http::parseRequest(socket, 5);
+            if (std::get<0>(ret))
+            {
+                socket->writeBytes(_response, nullptr);
+            }
+            connectionState->setTerminated();
+        }
+
+        size_t getConnectedClientsCount() final
+        {
+            return 0;
+        }
+
+        std::string _response;
+    };
+
+    // Keeps connections alive, except after requests to /drop, which are read and left
+    // unanswered, as if the server went away after processing them
+    class DroppingServer : public SocketServer
+    {
+    public:
+        DroppingServer(int port)
+            : SocketServer(port, "127.0.0.1")
+        {
+            ;
+        }
+
+        ~DroppingServer()
+        {
+            stop();
+        }
+
+        // Requests received, such as "POST /drop"
+        int getCount(const std::string& request)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _counts[request];
+        }
+
+    private:
+        void handleConnection(std::unique_ptr<Socket> socket,
+                              std::shared_ptr<ConnectionState> connectionState) final
+        {
+            while (true)
+            {
+                auto ret = Http::parseRequest(socket, 5);
+                if (!std::get<0>(ret)) break;
+
+                auto request = std::get<2>(ret);
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _counts[request->method + " " + request->uri]++;
+                }
+
+                if (request->uri == "/drop" ||
+                    !socket->writeBytes("HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+                                        nullptr))
+                {
+                    break;
+                }
+            }
+            connectionState->setTerminated();
+        }
+
+        size_t getConnectedClientsCount() final
+        {
+            return 0;
+        }
+
+        std::mutex _mutex;
+        std::map<std::string, int> _counts;
+    };
+
+    std::string makeResponse(const std::string& contentLength)
+    {
+        return "HTTP/1.1 200 OK\r\n"
+               "Content-Length: " +
+               contentLength +
+               "\r\n"
+               "Connection: close\r\n"
+               "\r\n"
+               "hello";
+    }
+} // namespace
+
 TEST_CASE("http_client", "[http]")
 {
     SECTION("Connect to a remote HTTP server")
@@ -222,3 +522,778 @@ TEST_CASE("http_client", "[http]")
         REQUIRE(statusCode2 == 200);
     }
 }
+
+TEST_CASE("http_client_keep_alive", "[http_keep_alive]")
+{
+    SECTION("Sequential requests reuse the same connection")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        startConnectionIdServer(server);
+
+        HttpClient httpClient;
+        std::string connectionId = getConnectionId(httpClient, port);
+        for (int i = 0; i < 10; ++i)
+        {
+            REQUIRE(getConnectionId(httpClient, port) == connectionId);
+        }
+
+        server.stop();
+    }
+
+    SECTION("Connections closed by the server while idle are not reused")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        server.setIdleTimeoutSecs(1);
+        startConnectionIdServer(server);
+
+        HttpClient httpClient;
+        std::string connectionId = getConnectionId(httpClient, port);
+        ix::msleep(1500);
+        REQUIRE(getConnectionId(httpClient, port) != connectionId);
+
+        // Connection: close in a response
+        connectionId = getConnectionId(httpClient, port, "/close");
+        REQUIRE(getConnectionId(httpClient, port) != connectionId);
+
+        server.stop();
+    }
+
+    SECTION("Idle connections time out on the client side, or are not kept at all")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        startConnectionIdServer(server);
+
+        HttpClient httpClient;
+        httpClient.setIdleConnectionTimeoutSecs(1);
+        std::string connectionId = getConnectionId(httpClient, port);
+        ix::msleep(1100);
+        REQUIRE(getConnectionId(httpClient, port) != connectionId);
+
+        httpClient.setIdleConnectionTimeoutSecs(0);
+        connectionId = getConnectionId(httpClient, port);
+        REQUIRE(getConnectionId(httpClient, port) != connectionId);
+
+        server.stop();
+    }
+
+    SECTION("Concurrent requests are capped per host")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        startConnectionIdServer(server, 50);
+
+        HttpClient httpClient;
+        httpClient.setMaxConnectionsPerHost(2);
+
+        std::mutex mutex;
+        std::set<std::string> connectionIds;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 6; ++i)
+        {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 3; ++j)
+                {
+                    std::string url("http://127.0.0.1:" + std::to_string(port) + "/");
+                    auto response = httpClient.get(url, httpClient.createRequest(url));
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (response->errorCode == HttpErrorCode::Ok)
+                    {
+                        connectionIds.insert(response->body);
+                    }
+                    else
+                    {
+                        connectionIds.insert("error: " + response->errorMsg);
+                    }
+                }
+            });
+        }
+
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+
+        REQUIRE(connectionIds.size() == 2);
+        for (auto&& connectionId : connectionIds)
+        {
+            REQUIRE(connectionId.find("error") == std::string::npos);
+        }
+
+        server.stop();
+    }
+
+    SECTION("Waiting for a connection slot can be cancelled")
+    {
+        HttpConnectionPool pool;
+        pool.setMaxConnectionsPerHost(1);
+        std::string key = HttpConnectionPool::makeKey("http", "127.0.0.1", 8080);
+
+        std::unique_ptr<Socket> socket;
+        REQUIRE(pool.acquire(key, nullptr, socket));
+        REQUIRE(!socket);
+
+        std::atomic<bool> cancelled(false);
+        REQUIRE(!pool.acquire(key, makeCancellationRequestWithTimeout(1, cancelled), socket));
+
+        pool.release(key, nullptr);
+        REQUIRE(pool.acquire(key, nullptr, socket));
+        REQUIRE(pool.getIdleConnectionsCount() == 0);
+    }
+}
+
+TEST_CASE("http_client_retries", "[http_keep_alive]")
+{
+    int port = getFreePort();
+    DroppingServer server(port);
+    REQUIRE(server.listen().first);
+    server.start();
+
+    std::string url("http://127.0.0.1:" + std::to_string(port));
+
+    SECTION("Only idempotent requests are sent again when a kept alive connection is lost")
+    {
+        HttpClient httpClient;
+        auto args = httpClient.createRequest();
+
+        // The POST might have been processed, it fails instead of being sent twice
+        REQUIRE(httpClient.get(url + "/", args)->errorCode == HttpErrorCode::Ok);
+        auto response = httpClient.post(url + "/drop", std::string("data"), args);
+        REQUIRE(response->errorCode == HttpErrorCode::CannotReadStatusLine);
+        REQUIRE(server.getCount("POST /drop") == 1);
+
+        REQUIRE(httpClient.get(url + "/", args)->errorCode == HttpErrorCode::Ok);
+        response = httpClient.get(url + "/drop", args);
+        REQUIRE(response->errorCode == HttpErrorCode::CannotReadStatusLine);
+        REQUIRE(server.getCount("GET /drop") == 2);
+    }
+
+    SECTION("Async requests are only sent again when they are idempotent")
+    {
+        HttpClient httpClient(true);
+        AsyncResponses responses;
+
+        auto args = httpClient.createRequest(url + "/", HttpClient::kGet);
+        REQUIRE(httpClient.performRequest(args, responses.add("first")));
+        REQUIRE(responses.waitFor(1));
+        REQUIRE(responses.get("first")->errorCode == HttpErrorCode::Ok);
+
+        args = httpClient.createRequest(url + "/drop", HttpClient::kPost);
+        args->body = "data";
+        REQUIRE(httpClient.performRequest(args, responses.add("post")));
+        REQUIRE(responses.waitFor(2));
+        REQUIRE(responses.get("post")->errorCode == HttpErrorCode::CannotReadStatusLine);
+        REQUIRE(server.getCount("POST /drop") == 1);
+
+        args = httpClient.createRequest(url + "/", HttpClient::kGet);
+        REQUIRE(httpClient.performRequest(args, responses.add("second")));
+        REQUIRE(responses.waitFor(3));
+
+        args = httpClient.createRequest(url + "/drop", HttpClient::kGet);
+        REQUIRE(httpClient.performRequest(args, responses.add("get")));
+        REQUIRE(responses.waitFor(4));
+        REQUIRE(responses.get("get")->errorCode == HttpErrorCode::CannotReadStatusLine);
+        REQUIRE(server.getCount("GET /drop") == 2);
+    }
+}
+
+TEST_CASE("http_client_async", "[http_async]")
+{
+    SECTION("Requests to slow endpoints are in flight at the same time")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        std::atomic<int> current(0);
+        std::atomic<int> max(0);
+        startSleepServer(server, current, max);
+
+        HttpClient httpClient(true);
+        httpClient.setMaxConnectionsPerHost(16);
+
+        AsyncResponses responses;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 16; ++i)
+        {
+            std::string url("http://127.0.0.1:" + std::to_string(port) + "/sleep/500");
+            auto args = httpClient.createRequest(url);
+            REQUIRE(httpClient.performRequest(args, responses.add(std::to_string(i))));
+        }
+
+        REQUIRE(responses.waitFor(16));
+        auto duration = std::chrono::steady_clock::now() - start;
+
+        for (auto&& it : responses.responses)
+        {
+            INFO(it.second->errorMsg);
+            REQUIRE(it.second->errorCode == HttpErrorCode::Ok);
+            REQUIRE(it.second->body == "/sleep/500");
+        }
+
+        // One after the other, it would take 8 seconds
+        REQUIRE(duration < std::chrono::seconds(4));
+        REQUIRE(max > 1);
+
+        server.stop();
+    }
+
+    SECTION("The number of requests in flight is capped")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        std::atomic<int> current(0);
+        std::atomic<int> max(0);
+        startSleepServer(server, current, max);
+
+        HttpClient httpClient(true);
+        httpClient.setMaxConnectionsPerHost(16);
+        httpClient.setMaxInFlightRequests(2);
+
+        AsyncResponses responses;
+        for (int i = 0; i < 8; ++i)
+        {
+            std::string url("http://127.0.0.1:" + std::to_string(port) + "/sleep/100");
+            auto args = httpClient.createRequest(url);
+            REQUIRE(httpClient.performRequest(args, responses.add(std::to_string(i))));
+        }
+
+        REQUIRE(responses.waitFor(8));
+        for (auto&& it : responses.responses)
+        {
+            REQUIRE(it.second->errorCode == HttpErrorCode::Ok);
+        }
+        REQUIRE(max == 2);
+
+        server.stop();
+    }
+
+    SECTION("Queued requests can be cancelled, and requests time out")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        std::atomic<int> current(0);
+        std::atomic<int> max(0);
+        startSleepServer(server, current, max);
+
+        HttpClient httpClient(true);
+        httpClient.setMaxInFlightRequests(1);
+
+        std::string url("http://127.0.0.1:" + std::to_string(port) + "/sleep/300");
+        AsyncResponses responses;
+
+        auto first = httpClient.createRequest(url);
+        REQUIRE(httpClient.performRequest(first, responses.add("first")));
+
+        auto cancelled = httpClient.createRequest(url);
+        REQUIRE(httpClient.performRequest(cancelled, responses.add("cancelled")));
+
+        auto timedOut = httpClient.createRequest(
+            "http://127.0.0.1:" + std::to_string(port) + "/sleep/3000");
+        timedOut->requestTimeout = 1;
+        REQUIRE(httpClient.performRequest(timedOut, responses.add("timedOut")));
+
+        REQUIRE(httpClient.cancelRequest(cancelled));
+        REQUIRE(responses.waitFor(3));
+
+        REQUIRE(responses.get("first")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(responses.get("cancelled")->errorCode == HttpErrorCode::Cancelled);
+        REQUIRE(responses.get("timedOut")->errorCode == HttpErrorCode::Timeout);
+        REQUIRE(!httpClient.cancelRequest(first));
+
+        server.stop();
+    }
+
+    SECTION("Redirections are followed")
+    {
+        int port = getFreePort();
+        HttpServer server(port, "127.0.0.1");
+        std::atomic<int> current(0);
+        std::atomic<int> max(0);
+        startSleepServer(server, current, max);
+
+        int redirectPort = getFreePort();
+        HttpServer redirectServer(redirectPort, "127.0.0.1");
+        redirectServer.makeRedirectServer("http://127.0.0.1:" + std::to_string(port) +
+                                          "/sleep/0");
+        REQUIRE(redirectServer.listen().first);
+        redirectServer.start();
+
+        HttpClient httpClient(true);
+        AsyncResponses responses;
+
+        std::string url("http://127.0.0.1:" + std::to_string(redirectPort) + "/");
+        auto args = httpClient.createRequest(url);
+        REQUIRE(httpClient.performRequest(args, responses.add("redirected")));
+
+        auto malformed = httpClient.createRequest("not a url");
+        REQUIRE(httpClient.performRequest(malformed, responses.add("malformed")));
+
+        REQUIRE(responses.waitFor(2));
+        REQUIRE(responses.get("redirected")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(responses.get("redirected")->body == "/sleep/0");
+        REQUIRE(responses.get("malformed")->errorCode == HttpErrorCode::UrlMalformed);
+
+        redirectServer.stop();
+        server.stop();
+    }
+}
+
+TEST_CASE("http_client_content_length", "[http]")
+{
+    SECTION("Invalid Content-Length values fail the request")
+    {
+        for (auto&& contentLength : {"-1", "12abc", "", "99999999999999999999"})
+        {
+            int port = getFreePort();
+            RawResponseServer server(port, makeResponse(contentLength));
+            REQUIRE(server.listen().first);
+            server.start();
+
+            std::string url("http://127.0.0.1:" + std::to_string(port) + "/");
+
+            HttpClient httpClient;
+            auto response = httpClient.get(url, httpClient.createRequest(url));
+            INFO(contentLength);
+            REQUIRE(response->errorCode == HttpErrorCode::HeaderParsingError);
+
+            HttpClient asyncHttpClient(true);
+            AsyncResponses responses;
+            auto args = asyncHttpClient.createRequest(url);
+            REQUIRE(asyncHttpClient.performRequest(args, responses.add("invalid")));
+            REQUIRE(responses.waitFor(1));
+            REQUIRE(responses.get("invalid")->errorCode == HttpErrorCode::HeaderParsingError);
+        }
+    }
+
+    SECTION("A huge Content-Length is not reserved upfront")
+    {
+        int port = getFreePort();
+        RawResponseServer server(port, makeResponse("9223372036854775807"));
+        REQUIRE(server.listen().first);
+        server.start();
+
+        std::string url("http://127.0.0.1:" + std::to_string(port) + "/");
+
+        HttpClient httpClient;
+        auto response = httpClient.get(url, httpClient.createRequest(url));
+        REQUIRE(response->errorCode == HttpErrorCode::ChunkReadError);
+
+        HttpClient asyncHttpClient(true);
+        AsyncResponses responses;
+        auto args = asyncHttpClient.createRequest(url);
+        REQUIRE(asyncHttpClient.performRequest(args, responses.add("huge")));
+        REQUIRE(responses.waitFor(1));
+        REQUIRE(responses.get("huge")->errorCode != HttpErrorCode::Ok);
+    }
+}
+
+TEST_CASE("http_client_streaming", "[http_streaming]")
+{
+    std::string body = makeLargeBody();
+    int port = getFreePort();
+    HttpServer server(port, "127.0.0.1");
+    startLargeBodyServer(server, body);
+    std::string url("http://127.0.0.1:" + std::to_string(port) + "/");
+
+    SECTION("Bodies are passed to the chunk callback instead of being stored")
+    {
+        HttpClient httpClient;
+        Chunks chunks;
+        auto args = httpClient.createRequest(url);
+        args->onChunkCallback = chunks.callback();
+
+        auto response = httpClient.get(url, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->body.empty());
+        REQUIRE(response->downloadSize == body.size());
+        REQUIRE(chunks.body == body);
+        REQUIRE(chunks.count > 1);
+        REQUIRE(chunks.maxSize < body.size());
+
+        // The connection is kept alive as usual
+        response = httpClient.get(url, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+    }
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+    SECTION("Gzip bodies are decompressed on the fly")
+    {
+        HttpClient httpClient;
+        Chunks chunks;
+        auto args = httpClient.createRequest(url + "gzip");
+        args->onChunkCallback = chunks.callback();
+
+        auto response = httpClient.get(url + "gzip", args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->headers["Content-Encoding"] == "gzip");
+        REQUIRE(response->body.empty());
+        REQUIRE(response->downloadSize < body.size());
+        REQUIRE(chunks.body == body);
+        REQUIRE(chunks.count > 1);
+    }
+#endif
+
+    SECTION("The chunk callback can stop the transfer")
+    {
+        HttpClient httpClient;
+        Chunks chunks;
+        chunks.limit = 1;
+        auto args = httpClient.createRequest(url);
+        args->onChunkCallback = chunks.callback();
+
+        auto response = httpClient.get(url, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Cancelled);
+        REQUIRE(chunks.count == 1);
+
+        // The interrupted connection is not reused
+        args->onChunkCallback = nullptr;
+        response = httpClient.get(url, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->body == body);
+    }
+
+    SECTION("Async requests stream their body too")
+    {
+        HttpClient httpClient(true);
+        AsyncResponses responses;
+
+        Chunks chunks;
+        auto args = httpClient.createRequest(url);
+        args->onChunkCallback = chunks.callback();
+        REQUIRE(httpClient.performRequest(args, responses.add("plain")));
+
+        Chunks stopped;
+        stopped.limit = 1;
+        auto stoppedArgs = httpClient.createRequest(url);
+        stoppedArgs->onChunkCallback = stopped.callback();
+        REQUIRE(httpClient.performRequest(stoppedArgs, responses.add("stopped")));
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        Chunks gzipChunks;
+        auto gzipArgs = httpClient.createRequest(url + "gzip");
+        gzipArgs->onChunkCallback = gzipChunks.callback();
+        REQUIRE(httpClient.performRequest(gzipArgs, responses.add("gzip")));
+        REQUIRE(responses.waitFor(3));
+        REQUIRE(responses.get("gzip")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(gzipChunks.body == body);
+#else
+        REQUIRE(responses.waitFor(2));
+#endif
+
+        REQUIRE(responses.get("plain")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(responses.get("plain")->body.empty());
+        REQUIRE(chunks.body == body);
+        REQUIRE(chunks.count > 1);
+        REQUIRE(responses.get("stopped")->errorCode == HttpErrorCode::Cancelled);
+        REQUIRE(stopped.count == 1);
+    }
+
+    server.stop();
+}
+
+TEST_CASE("http_client_upload", "[http_upload]")
+{
+    std::string body = makeLargeBody();
+    const std::string path("http_client_upload.txt");
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << body;
+    }
+
+    int port = getFreePort();
+    HttpServer server(port, "127.0.0.1");
+    startEchoServer(server);
+    std::string url("http://127.0.0.1:" + std::to_string(port) + "/");
+
+    SECTION("Files are streamed with their size, and can be sent again")
+    {
+        HttpClient httpClient;
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+        args->bodyProvider = HttpBodyProvider::fromFile(path);
+        REQUIRE(args->bodyProvider);
+
+        std::vector<std::pair<uint64_t, int64_t>> progress;
+        args->onUploadProgressCallback = [&progress](uint64_t current, int64_t total) {
+            progress.push_back(std::make_pair(current, total));
+            return true;
+        };
+
+        for (int i = 0; i < 2; ++i)
+        {
+            progress.clear();
+            auto response = httpClient.request(url, HttpClient::kPost, std::string(), args);
+            INFO(response->errorMsg);
+            REQUIRE(response->errorCode == HttpErrorCode::Ok);
+            REQUIRE(response->body == body);
+            REQUIRE(response->headers["X-Content-Length"] == std::to_string(body.size()));
+            REQUIRE(response->headers["X-Transfer-Encoding"].empty());
+            REQUIRE(response->uploadSize > body.size());
+
+            REQUIRE(progress.size() > 1);
+            REQUIRE(progress.back().first == body.size());
+            REQUIRE(progress.back().second == (int64_t) body.size());
+        }
+
+        REQUIRE(HttpBodyProvider::fromFile("no/such/file") == nullptr);
+    }
+
+    SECTION("Bodies of unknown size are sent with chunked transfer encoding")
+    {
+        size_t offset = 0;
+        HttpClient httpClient;
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+        args->bodyProvider =
+            HttpBodyProvider::fromCallback([&body, &offset](char* buffer, size_t size) {
+                // Small pieces, to produce many chunks
+                size_t length = std::min(std::min(size, (size_t) 1000), body.size() - offset);
+                memcpy(buffer, body.data() + offset, length);
+                offset += length;
+                return (int64_t) length;
+            });
+
+        auto response = httpClient.request(url, HttpClient::kPost, std::string(), args);
+        INFO(response->errorMsg);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->headers["X-Transfer-Encoding"] == "chunked");
+        REQUIRE(response->body == body);
+
+        // A callback body cannot be sent again
+        response = httpClient.request(url, HttpClient::kPost, std::string(), args);
+        REQUIRE(response->errorCode == HttpErrorCode::SendError);
+    }
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+    SECTION("Bodies are compressed on the fly")
+    {
+        HttpClient httpClient;
+        auto args = httpClient.createRequest(url, HttpClient::kPut);
+        args->bodyProvider = HttpBodyProvider::fromFile(path);
+        args->compressRequest = true;
+
+        auto response = httpClient.request(url, HttpClient::kPut, std::string(), args);
+        INFO(response->errorMsg);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->headers["X-Transfer-Encoding"] == "chunked");
+        REQUIRE(response->body == body);
+        REQUIRE(response->uploadSize < body.size());
+    }
+#endif
+
+    SECTION("Multipart forms stream their files")
+    {
+        HttpClient httpClient;
+        auto multipart =
+            std::make_shared<HttpMultipartBodyProvider>(httpClient.generateMultipartBoundary());
+        multipart->addField("name", "value");
+        multipart->addFile("logs", "logs.txt", HttpBodyProvider::fromFile(path), "text/plain");
+
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+        args->bodyProvider = multipart;
+
+        auto response = httpClient.request(url, HttpClient::kPost, std::string(), args);
+        INFO(response->errorMsg);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->headers["X-Content-Type"] == multipart->getContentType());
+        REQUIRE(response->headers["X-Content-Length"] == std::to_string(multipart->getSize()));
+        REQUIRE(response->body.size() == (size_t) multipart->getSize());
+        REQUIRE(response->body.find("name=\"name\";\r\n\r\nvalue\r\n") != std::string::npos);
+        REQUIRE(response->body.find("filename=\"logs.txt\"\r\nContent-Type: text/plain\r\n\r\n" +
+                                    body + "\r\n") != std::string::npos);
+    }
+
+    SECTION("The upload progress callback can stop the transfer")
+    {
+        HttpClient httpClient;
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+        args->bodyProvider = HttpBodyProvider::fromFile(path);
+        args->onUploadProgressCallback = [](uint64_t /*current*/, int64_t /*total*/) {
+            return false;
+        };
+
+        auto response = httpClient.request(url, HttpClient::kPost, std::string(), args);
+        REQUIRE(response->errorCode == HttpErrorCode::Cancelled);
+    }
+
+    SECTION("Async requests stream their body too")
+    {
+        HttpClient httpClient(true);
+        AsyncResponses responses;
+
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+        args->bodyProvider = HttpBodyProvider::fromFile(path);
+        uint64_t uploaded = 0;
+        args->onUploadProgressCallback = [&uploaded](uint64_t current, int64_t /*total*/) {
+            uploaded = current;
+            return true;
+        };
+        REQUIRE(httpClient.performRequest(args, responses.add("file")));
+
+        auto chunkedArgs = httpClient.createRequest(url, HttpClient::kPost);
+        auto sent = std::make_shared<bool>(false);
+        chunkedArgs->bodyProvider = HttpBodyProvider::fromCallback(
+            [sent](char* buffer, size_t size) -> int64_t {
+                if (*sent || size < 5) return 0;
+                *sent = true;
+                memcpy(buffer, "hello", 5);
+                return 5;
+            });
+        REQUIRE(httpClient.performRequest(chunkedArgs, responses.add("chunked")));
+
+        REQUIRE(responses.waitFor(2));
+        INFO(responses.get("file")->errorMsg);
+        REQUIRE(responses.get("file")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(responses.get("file")->body == body);
+        REQUIRE(uploaded == body.size());
+        REQUIRE(responses.get("chunked")->errorCode == HttpErrorCode::Ok);
+        REQUIRE(responses.get("chunked")->headers["X-Transfer-Encoding"] == "chunked");
+        REQUIRE(responses.get("chunked")->body == "hello");
+    }
+
+    server.stop();
+    std::remove(path.c_str());
+}
+
+namespace
+{
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream ss;
+        ss << file.rdbuf();
+        return ss.str();
+    }
+
+    void writeFile(const std::string& path, const std::string& content)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << content;
+    }
+} // namespace
+
+TEST_CASE("http_client_download", "[http_download]")
+{
+    // Not cached by the server, ranges are sent with sendfile
+    std::string content(5 * 1024 * 1024, '\0');
+    uint32_t state = 42;
+    for (auto&& c : content)
+    {
+        state = state * 1664525 + 1013904223;
+        c = (char) (state >> 24);
+    }
+    REQUIRE(content.size() > HttpStaticFileHandler::kMaxCachedFileSize);
+
+    const std::string source("http_client_download_source.bin");
+    const std::string output("http_client_download_output.bin");
+    writeFile(source, content);
+    std::remove(output.c_str());
+
+    std::atomic<int> rangeRequests(0);
+    std::atomic<bool> ignoreRanges(false);
+    // Ranges from that offset fail, if not 0
+    std::atomic<uint64_t> failedRangesOffset(0);
+
+    int port = getFreePort();
+    HttpServer server(port, "127.0.0.1");
+    auto handler = std::make_shared<HttpStaticFileHandler>(".");
+    server.setOnConnectionCallback(
+        [&](HttpRequestPtr request,
+            std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+            auto it = request->headers.find("Range");
+            if (it != request->headers.end())
+            {
+                rangeRequests++;
+
+                uint64_t first = std::strtoull(it->second.c_str() + 6, nullptr, 10);
+                if (ignoreRanges)
+                {
+                    request->headers.erase(it);
+                }
+                else if (failedRangesOffset != 0 && first >= failedRangesOffset)
+                {
+                    return std::make_shared<HttpResponse>(500, "Internal Server Error");
+                }
+            }
+            return handler->handleRequest(request);
+        });
+    REQUIRE(server.listen().first);
+    server.start();
+
+    HttpClient httpClient;
+    std::string url("http://127.0.0.1:" + std::to_string(port) + "/" + source);
+    auto args = httpClient.createRequest(url);
+
+    SECTION("Files are downloaded with one request, or with parallel range requests")
+    {
+        auto response = httpClient.download(url, output, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->downloadSize == content.size());
+        REQUIRE(readFile(output) == content);
+        REQUIRE(rangeRequests == 0);
+
+        // The first megabyte, then four ranges for the rest of the file
+        std::remove(output.c_str());
+        response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->downloadSize == content.size());
+        REQUIRE(readFile(output) == content);
+        REQUIRE(rangeRequests == 5);
+    }
+
+    SECTION("Interrupted downloads are resumed")
+    {
+        writeFile(output, content.substr(0, 1000));
+        auto response = httpClient.download(url, output, args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->downloadSize == content.size() - 999);
+        REQUIRE(readFile(output) == content);
+
+        // Complete files only get their last byte again
+        response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->downloadSize == 1);
+        REQUIRE(readFile(output) == content);
+
+        // Files larger than the one on the server are downloaded again
+        writeFile(output, content + "more");
+        response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(readFile(output) == content);
+
+        // Servers which do not support ranges send the whole file
+        ignoreRanges = true;
+        writeFile(output, content.substr(0, 1000));
+        response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->downloadSize == content.size());
+        REQUIRE(readFile(output) == content);
+    }
+
+    SECTION("Failed downloads keep the beginning of the file, to be resumed")
+    {
+        failedRangesOffset = 3 * 1024 * 1024;
+        auto response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 500);
+        REQUIRE(readFile(output) == content.substr(0, 3 * 1024 * 1024));
+
+        failedRangesOffset = 0;
+        response = httpClient.download(url, output, args, 4);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(readFile(output) == content);
+
+        // Nothing is left behind by errors
+        const std::string missing("http_client_download_missing.bin");
+        response = httpClient.download(url + ".missing", missing, args);
+        REQUIRE(response->statusCode == 404);
+        REQUIRE(!std::ifstream(missing));
+    }
+
+    server.stop();
+    std::remove(source.c_str());
+    std::remove(output.c_str());
+}
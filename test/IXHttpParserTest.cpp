@@ -0,0 +1,193 @@
+/*
+ *  IXHttpParserTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <ixwebsocket/IXHttpParser.h>
+
+using namespace ix;
+
+namespace
+{
+    HttpParseResult parseRequest(const std::string& data, HttpRequestHead& head, size_t& headSize)
+    {
+        return HttpParser::parseRequest(data.data(), data.size(), head, headSize);
+    }
+} // namespace
+
+TEST_CASE("http_parser", "[http_parser]")
+{
+    TLogger() << "Scan kernel: " << HttpParser::getScanKernelName();
+
+    const std::string request("GET /chat?room=1 HTTP/1.1\r\n"
+                              "Host: server.example.com\r\n"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                              "Sec-WebSocket-Extensions: permessage-deflate; "
+                              "client_max_window_bits\r\n"
+                              "X-Empty:\r\n"
+                              "X-Spaces: \t padded value \t \r\n"
+                              "\r\n");
+
+    SECTION("A request is split into views")
+    {
+        HttpRequestHead head;
+        size_t headSize = 0;
+        // Views point into the parsed buffer
+        std::string data(request + "body");
+        REQUIRE(parseRequest(data, head, headSize) == HttpParseResult::Complete);
+        REQUIRE(headSize == request.size());
+
+        REQUIRE(head.method == "GET");
+        REQUIRE(head.uri == "/chat?room=1");
+        REQUIRE(head.version == "HTTP/1.1");
+        REQUIRE(head.headers.size() == 7);
+        REQUIRE(head.headers[0].name == "Host");
+        REQUIRE(head.headers[0].value == "server.example.com");
+        REQUIRE(head.headers[4].value == "permessage-deflate; client_max_window_bits");
+        REQUIRE(head.headers[5].name == "X-Empty");
+        REQUIRE(head.headers[5].value.size == 0);
+        REQUIRE(head.headers[6].value == "padded value");
+
+        auto headers = HttpParser::toHttpHeaders(head.headers);
+        REQUIRE(headers["upgrade"] == "websocket");
+    }
+
+    SECTION("Partial requests are incomplete, whatever the split")
+    {
+        for (size_t size = 0; size < request.size(); ++size)
+        {
+            HttpRequestHead head;
+            size_t headSize = 0;
+            REQUIRE(HttpParser::parseRequest(request.data(), size, head, headSize) ==
+                    HttpParseResult::Incomplete);
+        }
+    }
+
+    SECTION("Bare line feeds and leading empty lines are accepted")
+    {
+        HttpRequestHead head;
+        size_t headSize = 0;
+        std::string data("\r\nPOST / HTTP/1.0\nContent-Length: 5\n\n");
+        REQUIRE(parseRequest(data, head, headSize) == HttpParseResult::Complete);
+        REQUIRE(headSize == data.size());
+        REQUIRE(head.method == "POST");
+        REQUIRE(head.version == "HTTP/1.0");
+        REQUIRE(head.headers[0].value == "5");
+    }
+
+    SECTION("Malformed requests are invalid")
+    {
+        std::vector<std::string> requests = {
+            "GET /\r\n\r\n",
+            "GET  HTTP/1.1\r\n\r\n",
+            "GET / HTTP/2.0\r\n\r\n",
+            "G(T / HTTP/1.1\r\n\r\n",
+            "GET /a b HTTP/1.1\r\n\r\n",
+            "GET / HTTP/1.1\r\nHost : x\r\n\r\n",
+            "GET / HTTP/1.1\r\n: x\r\n\r\n",
+            "GET / HTTP/1.1\r\nHost: x\r\n folded\r\n\r\n",
+            "GET / HTTP/1.1\r\nHost: a\x01z\r\n\r\n",
+            "GET / HTTP/1.1\r\nHost: x\rz\r\n\r\n",
+            // Control characters are found past the first vector too
+            "GET / HTTP/1.1\r\nX: 0123456789012345678901234567890123456789\x7f\r\n\r\n",
+        };
+
+        for (auto&& data : requests)
+        {
+            HttpRequestHead head;
+            size_t headSize = 0;
+            INFO(data);
+            REQUIRE(parseRequest(data, head, headSize) == HttpParseResult::Invalid);
+        }
+    }
+
+    SECTION("Header lines over the limit are rejected, even before they end")
+    {
+        std::string line("X-Long: ");
+        line += std::string(HttpParser::kMaxHeaderLineSize - line.size() - 2, 'a');
+        line += "\r\n";
+        REQUIRE(line.size() == HttpParser::kMaxHeaderLineSize);
+
+        HttpRequestHead head;
+        size_t headSize = 0;
+        REQUIRE(parseRequest("GET / HTTP/1.1\r\n" + line + "\r\n", head, headSize) ==
+                HttpParseResult::Complete);
+
+        std::string longLine("X-Long: " + std::string(HttpParser::kMaxHeaderLineSize, 'a'));
+        REQUIRE(parseRequest("GET / HTTP/1.1\r\n" + longLine + "\r\n\r\n", head, headSize) ==
+                HttpParseResult::TooLarge);
+        REQUIRE(parseRequest("GET / HTTP/1.1\r\n" + longLine, head, headSize) ==
+                HttpParseResult::TooLarge);
+    }
+
+    SECTION("Too many headers are rejected")
+    {
+        std::string data("GET / HTTP/1.1\r\n");
+        for (size_t i = 0; i <= HttpParser::kMaxHeaderCount; ++i)
+        {
+            data += "X-" + std::to_string(i) + ": value\r\n";
+        }
+
+        HttpRequestHead head;
+        size_t headSize = 0;
+        REQUIRE(parseRequest(data + "\r\n", head, headSize) == HttpParseResult::TooLarge);
+    }
+
+    SECTION("Chunk sizes are hexadecimal, optionally followed by extensions")
+    {
+        auto parseChunkSize = [](const std::string& line, uint64_t& chunkSize) {
+            return HttpParser::parseChunkSize(line.data(), line.size(), chunkSize);
+        };
+
+        uint64_t chunkSize = 0;
+        REQUIRE(parseChunkSize("1aF", chunkSize));
+        REQUIRE(chunkSize == 0x1af);
+        REQUIRE(parseChunkSize("10;name=value", chunkSize));
+        REQUIRE(chunkSize == 16);
+        REQUIRE(parseChunkSize("0 ;name", chunkSize));
+        REQUIRE(chunkSize == 0);
+        REQUIRE(parseChunkSize("fffffffffffffff", chunkSize));
+
+        for (auto&& line : {"", "0x5", "-1", "5z", " 5", "1000000000000000"})
+        {
+            INFO(line);
+            REQUIRE(!parseChunkSize(line, chunkSize));
+        }
+    }
+
+    SECTION("Responses are parsed")
+    {
+        std::string data("HTTP/1.1 101 Switching Protocols\r\n"
+                         "Upgrade: websocket\r\n"
+                         "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+                         "\r\n");
+
+        HttpResponseHead head;
+        size_t headSize = 0;
+        REQUIRE(HttpParser::parseResponse(data.data(), data.size(), head, headSize) ==
+                HttpParseResult::Complete);
+        REQUIRE(headSize == data.size());
+        REQUIRE(head.version == "HTTP/1.1");
+        REQUIRE(head.statusCode == 101);
+        REQUIRE(head.reason == "Switching Protocols");
+        REQUIRE(head.headers[1].value == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+        data = "HTTP/1.1 204\r\n\r\n";
+        REQUIRE(HttpParser::parseResponse(data.data(), data.size(), head, headSize) ==
+                HttpParseResult::Complete);
+        REQUIRE(head.statusCode == 204);
+        REQUIRE(head.reason.size == 0);
+
+        for (std::string invalid :
+             {"HTTP/1.1 20\r\n\r\n", "HTTP/1.1 2x0 OK\r\n\r\n", "ICY 200 OK\r\n\r\n"})
+        {
+            REQUIRE(HttpParser::parseResponse(invalid.data(), invalid.size(), head, headSize) ==
+                    HttpParseResult::Invalid);
+        }
+    }
+}
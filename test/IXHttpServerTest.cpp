@@ -5,13 +5,124 @@
  */
 
 #include "catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <ixwebsocket/IXGetFreePort.h>
+#include <ixwebsocket/IXGzipCodec.h>
+#include <ixwebsocket/IXHttpBodyProvider.h>
 #include <ixwebsocket/IXHttpClient.h>
+#include <ixwebsocket/IXHttpParser.h>
+#include <ixwebsocket/IXHttpRequestBodyReader.h>
+#include <ixwebsocket/IXHttpResponder.h>
 #include <ixwebsocket/IXHttpServer.h>
+#include <ixwebsocket/IXHttpStaticFileHandler.h>
+#include <ixwebsocket/IXSocketFactory.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace ix;
 
+namespace
+{
+    std::unique_ptr<Socket> connectToServer(int port)
+    {
+        std::string errMsg;
+        SocketTLSOptions tlsOptions;
+        auto socket = createSocket(false, -1, errMsg, tlsOptions);
+        auto isCancellationRequested = []() -> bool { return false; };
+
+        if (!socket || !socket->connect("127.0.0.1", port, errMsg, isCancellationRequested))
+        {
+            return nullptr;
+        }
+        return socket;
+    }
+
+    struct RawResponse
+    {
+        int statusCode = 0;
+        WebSocketHttpHeaders headers;
+        std::string body;
+    };
+
+    // Answers to HEAD requests are headOnly
+    bool readResponse(std::unique_ptr<Socket>& socket,
+                      RawResponse& response,
+                      bool headOnly = false)
+    {
+        std::atomic<bool> cancelled(false);
+        auto isCancellationRequested = makeCancellationRequestWithTimeout(5, cancelled);
+
+        HttpResponseHead head;
+        if (HttpParser::readResponse(*socket, isCancellationRequested, head) !=
+            HttpParseResult::Complete)
+        {
+            return false;
+        }
+
+        response.statusCode = head.statusCode;
+        response.headers = HttpParser::toHttpHeaders(head.headers);
+        response.body.clear();
+        if (headOnly) return true;
+
+        auto size = std::stoi(response.headers["Content-Length"]);
+        auto body = socket->readBytes(size, nullptr, isCancellationRequested);
+        response.body = body.second;
+        return body.first;
+    }
+
+    // The server closed the connection, rather than the read timing out
+    bool isClosedByServer(std::unique_ptr<Socket>& socket, int timeoutSecs)
+    {
+        std::atomic<bool> cancelled(false);
+        auto timedOut = makeCancellationRequestWithTimeout(timeoutSecs, cancelled);
+        bool didTimeout = false;
+        auto isCancellationRequested = [&]() -> bool {
+            didTimeout = timedOut();
+            return didTimeout;
+        };
+
+        char c;
+        return !socket->readByte(&c, isCancellationRequested) && !didTimeout;
+    }
+
+    // A chunked request with count chunks of a single byte
+    std::string makeTinyChunks(int count)
+    {
+        std::string request("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+        for (int i = 0; i < count; ++i)
+        {
+            request += "1\r\na\r\n";
+        }
+        return request + "0\r\n\r\n";
+    }
+
+    void startEchoUriServer(ix::HttpServer& server)
+    {
+        server.setOnConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), request->uri);
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+    }
+} // namespace
+
 TEST_CASE("http server", "[httpd]")
 {
     SECTION("Connect to a local HTTP server")
@@ -113,6 +224,242 @@ TEST_CASE("http server", "[httpd]")
     }
 }
 
+TEST_CASE("http server request body limit", "[httpd]")
+{
+    int port = getFreePort();
+    ix::HttpServer server(port, "127.0.0.1");
+    server.setMaxRequestBodySize(1024);
+
+    SECTION("Larger bodies are answered with 413 before being read")
+    {
+        server.setOnConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), request->body);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        std::string body(1024, 'a');
+        REQUIRE(socket->writeBytes("POST / HTTP/1.1\r\nContent-Length: 1024\r\n\r\n" + body,
+                                   nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.body == body);
+
+        REQUIRE(socket->writeBytes(
+            "POST / HTTP/1.1\r\nContent-Length: 9223372036854775807\r\n\r\n", nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+
+        // Chunked bodies are only known to be too large as they arrive
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                   "400\r\n" +
+                                       body + "\r\n1\r\na\r\n0\r\n\r\n",
+                                   nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+
+        // The chunked framing counts too
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes(makeTinyChunks(1000), nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+    }
+
+    SECTION("Async handlers have the same limit")
+    {
+        server.setOnAsyncConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/,
+               HttpResponderPtr responder) { responder->respond(200, "OK", request->body); });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("POST / HTTP/1.1\r\nContent-Length: 1025\r\n\r\n",
+                                   nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes(makeTinyChunks(1000), nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+    }
+
+    server.stop();
+}
+
+TEST_CASE("http server request framing", "[httpd]")
+{
+    int port = getFreePort();
+    int timeoutSecs = 10;
+    ix::HttpServer server(port,
+                          "127.0.0.1",
+                          SocketServer::kDefaultTcpBacklog,
+                          SocketServer::kDefaultMaxConnections,
+                          SocketServer::kDefaultAddressFamily,
+                          timeoutSecs);
+
+    // The Content-Length announces more than the chunked body
+    std::string ambiguousRequest("POST / HTTP/1.1\r\nContent-Length: 100\r\n"
+                                 "Transfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\n");
+
+    // Both modes answer the same, and close the connection
+    auto checkRejectedRequests = [port, &ambiguousRequest]() {
+        std::string longHeader("X-Long: " + std::string(HttpParser::kMaxHeaderLineSize, 'a'));
+        std::vector<std::pair<std::string, int>> requests = {
+            {ambiguousRequest, 400},
+            {"POST / HTTP/1.1\r\nContent-Length: 12abc\r\n\r\n", 400},
+            {"POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd", 400},
+            {"GET / HTTP/1.1\r\nNo colon\r\n\r\n", 400},
+            {"GET / HTTP/1.1\r\n" + longHeader + "\r\n\r\n", 431}};
+
+        for (auto&& request : requests)
+        {
+            INFO(request.first.substr(0, 64));
+            auto socket = connectToServer(port);
+            REQUIRE(socket);
+            REQUIRE(socket->writeBytes(request.first, nullptr));
+            RawResponse response;
+            REQUIRE(readResponse(socket, response));
+            REQUIRE(response.statusCode == request.second);
+            REQUIRE(response.headers["Connection"] == "close");
+            REQUIRE(isClosedByServer(socket, 5));
+        }
+    };
+
+    SECTION("Malformed requests are answered with 400, or 431, and the connection closed")
+    {
+        server.setOnConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), request->body);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+        checkRejectedRequests();
+    }
+
+    SECTION("Async handlers reject them without blocking the event loop")
+    {
+        server.setOnAsyncConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/,
+               HttpResponderPtr responder) { responder->respond(200, "OK", request->body); },
+            1);
+        REQUIRE(server.listen().first);
+        server.start();
+        checkRejectedRequests();
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes(ambiguousRequest, nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 400);
+        REQUIRE(isClosedByServer(socket, 5));
+
+        // The only event loop thread is still available to other clients
+        auto start = std::chrono::steady_clock::now();
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                   "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n",
+                                   nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.body == "abcde");
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(timeoutSecs / 2));
+    }
+
+    server.stop();
+}
+
+TEST_CASE("http server chunked framing", "[httpd]")
+{
+    int port = getFreePort();
+    ix::HttpServer server(port, "127.0.0.1");
+
+    std::string head("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    std::string trailers;
+    while (trailers.size() <= HttpParser::kMaxTrailerSize)
+    {
+        trailers += "X-Trailer: value\r\n";
+    }
+
+    // Endless chunk size lines and trailers are not buffered until the request times out
+    auto checkInvalidFraming = [port, &head, &trailers]() {
+        for (auto&& body : {std::string(2 * HttpParser::kMaxHeaderLineSize, '1'),
+                            std::string("0x5\r\nhello\r\n0\r\n\r\n"),
+                            std::string("5\r\nhelloX\r\n0\r\n\r\n"),
+                            "0\r\n" + trailers})
+        {
+            INFO(body.substr(0, 32));
+            auto socket = connectToServer(port);
+            REQUIRE(socket);
+            REQUIRE(socket->writeBytes(head + body, nullptr));
+            RawResponse response;
+            REQUIRE(readResponse(socket, response));
+            REQUIRE(response.statusCode == 400);
+            REQUIRE(isClosedByServer(socket, 5));
+        }
+
+        // Extensions and trailers are accepted
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes(head + "5;name=value\r\nhello\r\n0\r\nX-Trailer: 1\r\n\r\n",
+                                   nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.body == "hello");
+    };
+
+    SECTION("Invalid chunked bodies are answered with 400")
+    {
+        server.setOnConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), request->body);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+        checkInvalidFraming();
+    }
+
+    SECTION("Async handlers answer them with 400 too")
+    {
+        server.setOnAsyncConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/,
+               HttpResponderPtr responder) { responder->respond(200, "OK", request->body); });
+        REQUIRE(server.listen().first);
+        server.start();
+        checkInvalidFraming();
+    }
+
+    server.stop();
+}
+
 TEST_CASE("http server redirection", "[httpd_redirect]")
 {
     SECTION(
@@ -217,3 +564,943 @@ TEST_CASE("http server redirection", "[httpd_redirect]")
         server.stop();
     }
 }
+
+TEST_CASE("http server keep-alive", "[httpd_keep_alive]")
+{
+    SECTION("Pipelined requests are answered in order on the same connection")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        startEchoUriServer(server);
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+
+        REQUIRE(socket->writeBytes("GET /1 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+                                   "POST /2 HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+                                   "GET /3 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n",
+                                   nullptr));
+
+        for (auto uri : {"/1", "/2", "/3"})
+        {
+            RawResponse response;
+            REQUIRE(readResponse(socket, response));
+            REQUIRE(response.statusCode == 200);
+            REQUIRE(response.body == uri);
+            REQUIRE(response.headers.find("Connection") == response.headers.end());
+        }
+
+        // Still open, a request sent later is served too
+        REQUIRE(socket->writeBytes("GET /4 HTTP/1.1\r\n\r\n", nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == "/4");
+
+        server.stop();
+    }
+
+    SECTION("Connection: close and HTTP/1.0 requests close the connection")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        startEchoUriServer(server);
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /close HTTP/1.1\r\nConnection: Close\r\n\r\n",
+                                   nullptr));
+
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == "/close");
+        REQUIRE(response.headers["Connection"] == "close");
+        REQUIRE(isClosedByServer(socket, 5));
+
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /old HTTP/1.0\r\n\r\n", nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.headers["Connection"] == "close");
+        REQUIRE(isClosedByServer(socket, 5));
+
+        // Unless they ask for keep-alive
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes(
+            "GET /old HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.headers["Connection"] == "keep-alive");
+        REQUIRE(!isClosedByServer(socket, 1));
+
+        server.stop();
+    }
+
+    SECTION("Connections are closed after the maximum number of requests, or when idle")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        server.setMaxRequestsPerConnection(2);
+        server.setIdleTimeoutSecs(1);
+        startEchoUriServer(server);
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\n"
+                                   "GET /3 HTTP/1.1\r\n\r\n",
+                                   nullptr));
+
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.headers.find("Connection") == response.headers.end());
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == "/2");
+        REQUIRE(response.headers["Connection"] == "close");
+        REQUIRE(isClosedByServer(socket, 5));
+
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /1 HTTP/1.1\r\n\r\n", nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(isClosedByServer(socket, 5));
+
+        server.stop();
+    }
+
+    SECTION("Stopping the server closes idle connections")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        startEchoUriServer(server);
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET / HTTP/1.1\r\n\r\n", nullptr));
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+
+        auto start = std::chrono::steady_clock::now();
+        server.stop();
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+        REQUIRE(isClosedByServer(socket, 1));
+    }
+
+    SECTION("Responses have a Date header, and small and large bodies are sent whole")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        std::string largeBody(Http::kMaxCopiedResponseBodySize * 4 + 1, 'x');
+        server.setOnConnectionCallback(
+            [&largeBody](HttpRequestPtr request,
+                         std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                WebSocketHttpHeaders headers;
+                if (request->uri == "/dated")
+                {
+                    headers["Date"] = "Sun, 06 Nov 1994 08:49:37 GMT";
+                }
+                std::string body = request->uri == "/large" ? largeBody : request->uri;
+                return std::make_shared<HttpResponse>(
+                    200, "OK", HttpErrorCode::Ok, headers, body);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /small HTTP/1.1\r\n\r\nGET /large HTTP/1.1\r\n\r\n"
+                                   "GET /dated HTTP/1.1\r\n\r\n",
+                                   nullptr));
+
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == "/small");
+        auto date = response.headers["Date"];
+        REQUIRE(date.size() == 29);
+        REQUIRE(date.substr(date.size() - 4) == " GMT");
+
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == largeBody);
+        REQUIRE(!response.headers["Date"].empty());
+
+        // Handlers can set their own
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.body == "/dated");
+        REQUIRE(response.headers["Date"] == "Sun, 06 Nov 1994 08:49:37 GMT");
+
+        server.stop();
+    }
+}
+
+TEST_CASE("http server head requests", "[httpd_keep_alive]")
+{
+    int port = getFreePort();
+    ix::HttpServer server(port, "127.0.0.1");
+    std::string largeBody(Http::kMaxCopiedResponseBodySize * 4 + 1, 'x');
+    std::ofstream("head_test.txt") << largeBody;
+
+    auto makeResponse = [&largeBody](const HttpRequestPtr& request) -> HttpResponsePtr {
+        auto response = std::make_shared<HttpResponse>(200, "OK");
+        if (request->uri == "/large")
+        {
+            response->body = largeBody;
+        }
+        else if (request->uri == "/stream")
+        {
+            response->bodyProvider = HttpBodyProvider::fromCallback(
+                [](char* /*buffer*/, size_t /*size*/) -> int64_t { return 0; });
+        }
+        else if (request->uri == "/file")
+        {
+            // Sent with sendfile by the event loops
+            response->bodyProvider = HttpBodyProvider::fromFile("head_test.txt");
+        }
+        else
+        {
+            response->body = "0123456789abcdef\n";
+        }
+        return response;
+    };
+
+    // The headers describe the body, which is not sent. The connection stays usable.
+    auto checkHeadRequests = [port, &largeBody]() {
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("HEAD /a.txt HTTP/1.1\r\n\r\nHEAD /large HTTP/1.1\r\n\r\n"
+                                   "HEAD /stream HTTP/1.1\r\n\r\nHEAD /file HTTP/1.1\r\n\r\n"
+                                   "GET /a.txt HTTP/1.1\r\n\r\n",
+                                   nullptr));
+
+        RawResponse response;
+        REQUIRE(readResponse(socket, response, true));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.headers["Content-Length"] == "17");
+
+        REQUIRE(readResponse(socket, response, true));
+        REQUIRE(response.headers["Content-Length"] == std::to_string(largeBody.size()));
+
+        REQUIRE(readResponse(socket, response, true));
+        REQUIRE(response.headers["Transfer-Encoding"] == "chunked");
+
+        REQUIRE(readResponse(socket, response, true));
+        REQUIRE(response.headers["Content-Length"] == std::to_string(largeBody.size()));
+
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.body == "0123456789abcdef\n");
+        REQUIRE(!isClosedByServer(socket, 1));
+    };
+
+    SECTION("Answers to HEAD requests have no body")
+    {
+        server.setOnConnectionCallback(
+            [&makeResponse](HttpRequestPtr request,
+                            std::shared_ptr<ConnectionState> /*connectionState*/) {
+                return makeResponse(request);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+        checkHeadRequests();
+    }
+
+    SECTION("Async handlers answer HEAD requests without a body too")
+    {
+        server.setOnAsyncConnectionCallback(
+            [&makeResponse](HttpRequestPtr request,
+                            std::shared_ptr<ConnectionState> /*connectionState*/,
+                            HttpResponderPtr responder) { responder->respond(makeResponse(request)); });
+        REQUIRE(server.listen().first);
+        server.start();
+        checkHeadRequests();
+    }
+
+    server.stop();
+    std::remove("head_test.txt");
+}
+
+TEST_CASE("http server streaming", "[httpd_streaming]")
+{
+    int port = getFreePort();
+    ix::HttpServer server(port, "127.0.0.1");
+
+    // Events are only produced once the client received the previous ones, which
+    // cannot happen if the response is buffered
+    auto eventsReceived = std::make_shared<std::atomic<int>>(0);
+    const int eventCount = 5;
+
+    server.setOnStreamingConnectionCallback(
+        [eventsReceived](HttpRequestPtr request,
+                         std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+            auto response = std::make_shared<HttpResponse>(200, "OK");
+
+            if (request->uri == "/count")
+            {
+                std::string chunk;
+                size_t size = 0;
+                while (request->bodyReader->read(chunk) && !chunk.empty())
+                {
+                    size += chunk.size();
+                }
+
+                response->body = std::to_string(size);
+                if (!request->body.empty() || !request->bodyReader->isDone())
+                {
+                    response->statusCode = 400;
+                }
+            }
+            else if (request->uri == "/events")
+            {
+                auto index = std::make_shared<int>(0);
+                response->bodyProvider = HttpBodyProvider::fromCallback(
+                    [eventsReceived, index, eventCount](char* buffer, size_t size) -> int64_t {
+                        if (*index == eventCount) return 0;
+
+                        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+                        while (*eventsReceived < *index &&
+                               std::chrono::steady_clock::now() < deadline)
+                        {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+
+                        std::string event = "event " + std::to_string((*index)++) + "\n";
+                        if (size < event.size()) return -1;
+                        memcpy(buffer, event.data(), event.size());
+                        return (int64_t) event.size();
+                    });
+            }
+
+            // Other request bodies are not read by the handler
+            return response;
+        });
+
+    auto res = server.listen();
+    REQUIRE(res.first);
+    server.start();
+
+    std::string baseUrl("http://127.0.0.1:" + std::to_string(port));
+
+    SECTION("Request bodies are read by the handler as they arrive")
+    {
+        HttpClient httpClient;
+        std::string body(1024 * 1024, 'a');
+
+        auto args = httpClient.createRequest();
+        auto response = httpClient.post(baseUrl + "/count", body, args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == std::to_string(body.size()));
+
+        // Chunked, and compressed
+        size_t offset = 0;
+        args->bodyProvider = HttpBodyProvider::fromCallback(
+            [&body, &offset](char* buffer, size_t size) -> int64_t {
+                size = std::min(size, body.size() - offset);
+                memcpy(buffer, body.data() + offset, size);
+                offset += size;
+                return (int64_t) size;
+            });
+        args->compressRequest = true;
+        response = httpClient.post(baseUrl + "/count", std::string(), args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == std::to_string(body.size()));
+    }
+
+    SECTION("Unread request bodies are discarded, large ones close the connection")
+    {
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+
+        REQUIRE(socket->writeBytes("POST /1 HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+                                   "POST /2 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                   "4\r\nbody\r\n0\r\n\r\n"
+                                   "POST /count HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc",
+                                   nullptr));
+
+        RawResponse response;
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.statusCode == 200);
+        REQUIRE(response.body == "3");
+
+        std::string header("POST /3 HTTP/1.1\r\nContent-Length: 2000000\r\n\r\n");
+        REQUIRE(socket->writeBytes(header, nullptr));
+        REQUIRE(readResponse(socket, response));
+        REQUIRE(response.headers["Connection"] == "close");
+        REQUIRE(isClosedByServer(socket, 5));
+    }
+
+    SECTION("Responses of unknown size are sent as they are produced")
+    {
+        std::string expected;
+        for (int i = 0; i < eventCount; ++i)
+        {
+            expected += "event " + std::to_string(i) + "\n";
+        }
+
+        HttpClient httpClient;
+        auto args = httpClient.createRequest();
+        std::string received;
+        args->onChunkCallback = [&received, eventsReceived](const char* data, size_t size) {
+            received.append(data, size);
+            *eventsReceived = (int) std::count(received.begin(), received.end(), '\n');
+            return true;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        auto response = httpClient.get(baseUrl + "/events", args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->headers["Transfer-Encoding"] == "chunked");
+        REQUIRE(received == expected);
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+        // Without a callback, the body is collected
+        *eventsReceived = eventCount;
+        response = httpClient.get(baseUrl + "/events", httpClient.createRequest());
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == expected);
+    }
+
+    SECTION("HTTP/1.0 responses of unknown size end when the connection is closed")
+    {
+        *eventsReceived = eventCount;
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /events HTTP/1.0\r\nConnection: keep-alive\r\n\r\n",
+                                   nullptr));
+
+        std::atomic<bool> cancelled(false);
+        auto isCancellationRequested = makeCancellationRequestWithTimeout(5, cancelled);
+
+        HttpResponseHead head;
+        REQUIRE(HttpParser::readResponse(*socket, isCancellationRequested, head) ==
+                HttpParseResult::Complete);
+
+        auto headers = HttpParser::toHttpHeaders(head.headers);
+        REQUIRE(headers.find("Content-Length") == headers.end());
+        REQUIRE(headers.find("Transfer-Encoding") == headers.end());
+        REQUIRE(headers["Connection"] == "close");
+
+        std::string body;
+        char c;
+        while (socket->readByte(&c, isCancellationRequested))
+        {
+            body += c;
+        }
+        REQUIRE(body.find("event 4\n") != std::string::npos);
+        REQUIRE(!isCancellationRequested());
+    }
+
+    server.stop();
+}
+
+TEST_CASE("http server async handlers", "[httpd_async]")
+{
+    SECTION("Slow requests do not hold a thread, they are answered from another one")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+
+        std::mutex mutex;
+        std::vector<std::pair<std::string, HttpResponderPtr>> pending;
+        server.setOnAsyncConnectionCallback(
+            [&mutex, &pending](HttpRequestPtr request,
+                               std::shared_ptr<ConnectionState> /*connectionState*/,
+                               HttpResponderPtr responder) {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.push_back(std::make_pair(request->uri, responder));
+            },
+            1);
+        REQUIRE(server.listen().first);
+        server.start();
+
+        // More requests in flight than the server has threads
+        const int requestCount = 50;
+        std::vector<std::unique_ptr<Socket>> sockets;
+        for (int i = 0; i < requestCount; ++i)
+        {
+            auto socket = connectToServer(port);
+            REQUIRE(socket);
+            REQUIRE(socket->writeBytes(
+                "GET /" + std::to_string(i) + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", nullptr));
+            sockets.push_back(std::move(socket));
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.size() == requestCount) break;
+        }
+
+        std::thread responderThread([&mutex, &pending] {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto&& it : pending)
+            {
+                REQUIRE(it.second->respond(200, "OK", it.first));
+                REQUIRE(!it.second->respond(500, "Too late"));
+            }
+        });
+        responderThread.join();
+        REQUIRE(pending.size() == requestCount);
+
+        for (int i = 0; i < requestCount; ++i)
+        {
+            RawResponse response;
+            REQUIRE(readResponse(sockets[i], response));
+            REQUIRE(response.statusCode == 200);
+            REQUIRE(response.body == "/" + std::to_string(i));
+        }
+
+        // Kept alive, the next request on a connection goes to the handler too
+        REQUIRE(sockets[0]->writeBytes("GET /again HTTP/1.1\r\n\r\n", nullptr));
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending.size() == requestCount + 1) break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(pending.size() == requestCount + 1);
+            REQUIRE(pending.back().second->respond(200, "OK", pending.back().first));
+        }
+        RawResponse response;
+        REQUIRE(readResponse(sockets[0], response));
+        REQUIRE(response.body == "/again");
+
+        // Idle connections are closed
+        server.stop();
+        REQUIRE(isClosedByServer(sockets[1], 1));
+    }
+
+    SECTION("Request bodies are buffered, and all kinds of responses are sent")
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        server.setOnAsyncConnectionCallback(
+            [](HttpRequestPtr request,
+               std::shared_ptr<ConnectionState> /*connectionState*/,
+               HttpResponderPtr responder) {
+                if (request->uri == "/stream")
+                {
+                    // Of unknown size, sent with chunked transfer encoding
+                    auto response = std::make_shared<HttpResponse>(200, "OK");
+                    auto index = std::make_shared<int>(0);
+                    response->bodyProvider = HttpBodyProvider::fromCallback(
+                        [index](char* buffer, size_t size) -> int64_t {
+                            if (*index == 100) return 0;
+                            size = std::min(size, (size_t) 1000);
+                            memset(buffer, '0' + (*index)++ % 10, size);
+                            return (int64_t) size;
+                        });
+                    responder->respond(response);
+                }
+                else if (request->uri == "/drop")
+                {
+                    // Dropped without a response
+                }
+                else
+                {
+                    responder->respond(200, "OK", request->body);
+                }
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        std::string baseUrl("http://127.0.0.1:" + std::to_string(port));
+        HttpClient httpClient;
+        auto args = httpClient.createRequest();
+
+        std::string body(2 * 1024 * 1024 + 7, 'a');
+        auto response = httpClient.post(baseUrl + "/echo", body, args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == body);
+
+        // Chunked, and compressed
+        size_t offset = 0;
+        args->bodyProvider = HttpBodyProvider::fromCallback(
+            [&body, &offset](char* buffer, size_t size) -> int64_t {
+                size = std::min(size, body.size() - offset);
+                memcpy(buffer, body.data() + offset, size);
+                offset += size;
+                return (int64_t) size;
+            });
+        args->compressRequest = true;
+        response = httpClient.post(baseUrl + "/echo", std::string(), args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == body);
+
+        args = httpClient.createRequest();
+        response = httpClient.get(baseUrl + "/stream", args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body.size() == 100 * 1000);
+        REQUIRE(response->body.substr(99 * 1000) == std::string(1000, '9'));
+
+        response = httpClient.get(baseUrl + "/drop", args);
+        REQUIRE(response->statusCode == 500);
+
+        // Pipelined, answered in order. HTTP/1.0 requests close the connection.
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("POST /1 HTTP/1.1\r\nContent-Length: 3\r\n\r\none"
+                                   "POST /2 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                                   "3\r\ntwo\r\n0\r\n\r\n"
+                                   "POST /3 HTTP/1.0\r\nContent-Length: 5\r\n\r\nthree",
+                                   nullptr));
+        for (auto expected : {"one", "two", "three"})
+        {
+            RawResponse rawResponse;
+            REQUIRE(readResponse(socket, rawResponse));
+            REQUIRE(rawResponse.body == expected);
+        }
+        REQUIRE(isClosedByServer(socket, 5));
+
+        // Requests which cannot be buffered are rejected
+        socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("POST / HTTP/1.1\r\nContent-Length: 100000000\r\n\r\n",
+                                   nullptr));
+        RawResponse rawResponse;
+        REQUIRE(readResponse(socket, rawResponse));
+        REQUIRE(rawResponse.statusCode == 413);
+        REQUIRE(isClosedByServer(socket, 5));
+
+        server.stop();
+    }
+
+    SECTION("Proxy handlers forward the responses of an async HttpClient")
+    {
+        int backendPort = getFreePort();
+        ix::HttpServer backend(backendPort, "127.0.0.1");
+        startEchoUriServer(backend);
+
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        HttpClient httpClient(true);
+
+        std::string backendUrl("http://127.0.0.1:" + std::to_string(backendPort));
+        auto closed = std::make_shared<std::atomic<bool>>(false);
+        server.setOnAsyncConnectionCallback(
+            [&httpClient, backendUrl, closed](HttpRequestPtr request,
+                                              std::shared_ptr<ConnectionState> /*connectionState*/,
+                                              HttpResponderPtr responder) {
+                if (request->uri == "/slow")
+                {
+                    // Kept until the client is gone
+                    std::thread([responder, closed] {
+                        while (!responder->isConnectionClosed())
+                        {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                        }
+                        *closed = true;
+                    }).detach();
+                    return;
+                }
+
+                std::string url =
+                    request->uri == "/down" ? "http://127.0.0.1:1/" : backendUrl + request->uri;
+                auto args = httpClient.createRequest(url);
+                httpClient.performRequest(
+                    args, [responder](const HttpResponsePtr& response) {
+                        responder->forward(response);
+                    });
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        std::string baseUrl("http://127.0.0.1:" + std::to_string(port));
+        HttpClient client;
+        auto args = client.createRequest();
+
+        for (int i = 0; i < 10; ++i)
+        {
+            auto response = client.get(baseUrl + "/proxied/" + std::to_string(i), args);
+            REQUIRE(response->statusCode == 200);
+            REQUIRE(response->body == "/proxied/" + std::to_string(i));
+        }
+
+        auto response = client.get(baseUrl + "/down", args);
+        REQUIRE(response->statusCode == 502);
+
+        auto socket = connectToServer(port);
+        REQUIRE(socket);
+        REQUIRE(socket->writeBytes("GET /slow HTTP/1.1\r\n\r\n", nullptr));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        socket.reset();
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!*closed && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(*closed);
+
+        server.stop();
+        backend.stop();
+    }
+}
+
+namespace
+{
+    const std::string kStaticRoot("http_static_files");
+
+    void writeStaticFile(const std::string& name, const std::string& content)
+    {
+        std::ofstream file(kStaticRoot + "/" + name, std::ios::binary | std::ios::trunc);
+        file << content;
+    }
+
+    // Not compressible
+    std::string makeRandomContent(size_t size)
+    {
+        std::string content(size, '\0');
+        uint32_t state = 42;
+        for (auto&& c : content)
+        {
+            state = state * 1664525 + 1013904223;
+            c = (char) (state >> 24);
+        }
+        return content;
+    }
+
+    HttpRequestPtr makeGetRequest(const std::string& uri,
+                                  const WebSocketHttpHeaders& headers = WebSocketHttpHeaders())
+    {
+        return std::make_shared<HttpRequest>(uri, "GET", "HTTP/1.1", std::string(), headers);
+    }
+
+    // The body of a response, read from its body provider if it has one
+    std::string getResponseBody(const HttpResponsePtr& response)
+    {
+        if (!response->bodyProvider) return response->body;
+
+        std::string body;
+        char buffer[4096];
+        int64_t ret;
+        while ((ret = response->bodyProvider->read(buffer, sizeof(buffer))) > 0)
+        {
+            body.append(buffer, (size_t) ret);
+        }
+        REQUIRE(ret == 0);
+        REQUIRE(body.size() == (size_t) response->bodyProvider->getSize());
+        return body;
+    }
+} // namespace
+
+TEST_CASE("http server static files", "[httpd_static]")
+{
+#ifdef _WIN32
+    _mkdir(kStaticRoot.c_str());
+#else
+    mkdir(kStaticRoot.c_str(), 0755);
+#endif
+    std::string html = "<html>" + std::string(4000, 'a') + "</html>";
+    writeStaticFile("index.html", html);
+    writeStaticFile("small.bin", makeRandomContent(1000));
+
+    SECTION("Files are cached, with their gzip version and an ETag")
+    {
+        HttpStaticFileHandler handler(kStaticRoot);
+
+        auto response = handler.handleRequest(makeGetRequest("/"));
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == html);
+        REQUIRE(response->headers["Content-Type"] == "text/html");
+        REQUIRE(handler.getCacheSize() == html.size());
+
+        auto etag = response->headers["ETag"];
+        REQUIRE(!etag.empty());
+
+        WebSocketHttpHeaders headers;
+        headers["Accept-Encoding"] = "gzip, deflate";
+        auto gzipResponse = handler.handleRequest(makeGetRequest("/index.html?v=2", headers));
+        REQUIRE(gzipResponse->statusCode == 200);
+        REQUIRE(gzipResponse->body.size() < html.size());
+        REQUIRE(gzipResponse->headers["ETag"] != etag);
+#ifdef IXWEBSOCKET_USE_ZLIB
+        REQUIRE(gzipResponse->headers["Content-Encoding"] == "gzip");
+        REQUIRE(handler.getCacheSize() == html.size() + gzipResponse->body.size());
+
+        std::string decompressed;
+        REQUIRE(gzipDecompress(gzipResponse->body, decompressed));
+        REQUIRE(decompressed == html);
+#endif
+
+        // Random bytes are not worth compressing
+        response = handler.handleRequest(makeGetRequest("/small.bin", headers));
+        REQUIRE(response->headers.find("Content-Encoding") == response->headers.end());
+        REQUIRE(response->headers["Content-Type"] == "application/octet-stream");
+
+        headers["If-None-Match"] = "\"other\", W/" + gzipResponse->headers["ETag"];
+        response = handler.handleRequest(makeGetRequest("/index.html", headers));
+        REQUIRE(response->statusCode == 304);
+        REQUIRE(response->body.empty());
+
+        // A modified file is read again
+        writeStaticFile("index.html", "<html></html>");
+        response = handler.handleRequest(makeGetRequest("/index.html", headers));
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == "<html></html>");
+        REQUIRE(handler.getCacheSize() == 1000 + response->body.size());
+    }
+
+    SECTION("The cache is bounded, and drops the least recently used files")
+    {
+        HttpStaticFileHandler handler(kStaticRoot, 2500);
+        for (auto name : {"a.bin", "b.bin", "c.bin"})
+        {
+            writeStaticFile(name, makeRandomContent(1000));
+        }
+
+        REQUIRE(handler.handleRequest(makeGetRequest("/a.bin"))->statusCode == 200);
+        REQUIRE(handler.handleRequest(makeGetRequest("/b.bin"))->statusCode == 200);
+        REQUIRE(handler.getCacheSize() == 2000);
+        REQUIRE(handler.handleRequest(makeGetRequest("/c.bin"))->statusCode == 200);
+        REQUIRE(handler.getCacheSize() == 2000);
+
+        // Too large to be cached
+        HttpStaticFileHandler noCache(kStaticRoot, 0);
+        auto response = noCache.handleRequest(makeGetRequest("/a.bin"));
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->bodyProvider);
+        REQUIRE(response->bodyProvider->getFileDescriptor() >= 0);
+        REQUIRE(noCache.getCacheSize() == 0);
+    }
+
+    SECTION("Paths outside of the root directory are not served")
+    {
+        HttpStaticFileHandler handler(kStaticRoot);
+        for (auto uri : {"/../IXHttpServerTest.cpp",
+                         "/%2e%2e/IXHttpServerTest.cpp",
+                         "/missing.html",
+                         "/%zz",
+                         "index.html",
+                         "/"})
+        {
+            auto response = handler.handleRequest(makeGetRequest(uri));
+            REQUIRE(response->statusCode == (std::string(uri) == "/" ? 200 : 404));
+        }
+    }
+
+    SECTION("Range requests get parts of the files, cached or not")
+    {
+        std::string content = makeRandomContent(1000);
+        writeStaticFile("small.bin", content);
+
+        HttpStaticFileHandler cached(kStaticRoot);
+        HttpStaticFileHandler uncached(kStaticRoot, 0);
+        for (auto handler : {&cached, &uncached})
+        {
+            WebSocketHttpHeaders headers;
+            headers["Accept-Encoding"] = "gzip";
+            headers["Range"] = "bytes=100-199";
+            auto response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->statusCode == 206);
+            REQUIRE(response->headers["Accept-Ranges"] == "bytes");
+            REQUIRE(response->headers["Content-Range"] == "bytes 100-199/1000");
+            REQUIRE(response->headers.find("Content-Encoding") == response->headers.end());
+            REQUIRE(getResponseBody(response) == content.substr(100, 100));
+            REQUIRE((bool) response->bodyProvider == (handler == &uncached));
+
+            // Open and suffix ranges are cut at the end of the file
+            headers["Range"] = "bytes=900-5000";
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->headers["Content-Range"] == "bytes 900-999/1000");
+            REQUIRE(getResponseBody(response) == content.substr(900));
+
+            headers["Range"] = "bytes=-10";
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->headers["Content-Range"] == "bytes 990-999/1000");
+
+            // Several ranges, overlapping ones merged, are sent as a multipart body
+            headers["Range"] = "bytes=500-509, 0-4,2-9";
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->statusCode == 206);
+            std::string contentType = response->headers["Content-Type"];
+            REQUIRE(contentType.find("multipart/byteranges; boundary=") == 0);
+            std::string boundary = contentType.substr(contentType.find('=') + 1);
+            std::string expected = "--" + boundary +
+                                   "\r\nContent-Type: application/octet-stream\r\n"
+                                   "Content-Range: bytes 0-9/1000\r\n\r\n" +
+                                   content.substr(0, 10) + "\r\n--" + boundary +
+                                   "\r\nContent-Type: application/octet-stream\r\n"
+                                   "Content-Range: bytes 500-509/1000\r\n\r\n" +
+                                   content.substr(500, 10) + "\r\n--" + boundary + "--\r\n";
+            REQUIRE(getResponseBody(response) == expected);
+
+            headers["Range"] = "bytes=1000-";
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->statusCode == 416);
+            REQUIRE(response->headers["Content-Range"] == "bytes */1000");
+
+            // Invalid ranges, and ranges of another version of the file, are ignored
+            for (auto range : {"bytes=20-10", "lines=1-2", "bytes=a-b"})
+            {
+                headers["Range"] = range;
+                response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+                REQUIRE(response->statusCode == 200);
+            }
+
+            headers["Range"] = "bytes=0-9";
+            headers["If-Range"] = "\"other\"";
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->statusCode == 200);
+            REQUIRE(getResponseBody(response) == content);
+
+            headers["If-Range"] = response->headers["ETag"];
+            response = handler->handleRequest(makeGetRequest("/small.bin", headers));
+            REQUIRE(response->statusCode == 206);
+        }
+    }
+
+    SECTION("Large files are sent with sendfile, and 304 responses have no body")
+    {
+        std::string large = makeRandomContent(HttpStaticFileHandler::kMaxCachedFileSize + 1);
+        writeStaticFile("large.bin", large);
+
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1");
+        auto handler = std::make_shared<HttpStaticFileHandler>(kStaticRoot);
+        server.setOnConnectionCallback(
+            [handler](HttpRequestPtr request,
+                      std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                return handler->handleRequest(request);
+            });
+        REQUIRE(server.listen().first);
+        server.start();
+
+        HttpClient httpClient;
+        std::string baseUrl("http://127.0.0.1:" + std::to_string(port));
+        auto args = httpClient.createRequest();
+        args->compress = false;
+
+        auto response = httpClient.get(baseUrl + "/large.bin", args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->body == large);
+        REQUIRE(handler->getCacheSize() == 0);
+
+        args->extraHeaders["If-None-Match"] = response->headers["ETag"];
+        response = httpClient.get(baseUrl + "/large.bin", args);
+        REQUIRE(response->errorCode == HttpErrorCode::Ok);
+        REQUIRE(response->statusCode == 304);
+        REQUIRE(response->headers.find("Content-Length") == response->headers.end());
+
+        // The connection is still usable after the 304
+        args->extraHeaders.clear();
+        response = httpClient.get(baseUrl + "/", args);
+        REQUIRE(response->statusCode == 200);
+        REQUIRE(response->body == html);
+
+        server.stop();
+        std::remove((kStaticRoot + "/large.bin").c_str());
+    }
+
+    for (auto name : {"index.html", "small.bin", "a.bin", "b.bin", "c.bin"})
+    {
+        std::remove((kStaticRoot + "/" + name).c_str());
+    }
+#ifdef _WIN32
+    _rmdir(kStaticRoot.c_str());
+#else
+    rmdir(kStaticRoot.c_str());
+#endif
+}
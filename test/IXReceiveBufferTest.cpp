@@ -0,0 +1,93 @@
+/*
+ *  IXReceiveBufferTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <ixwebsocket/IXReceiveBuffer.h>
+#include <string.h>
+
+using namespace ix;
+
+namespace
+{
+    std::string toString(const ReceiveBuffer& buffer)
+    {
+        return std::string((const char*) buffer.data(), buffer.size());
+    }
+} // namespace
+
+TEST_CASE("receive_buffer", "[receive_buffer]")
+{
+    SECTION("Append and consume")
+    {
+        ReceiveBuffer buffer;
+        REQUIRE(buffer.empty());
+
+        buffer.append(std::string("hello world"));
+        REQUIRE(buffer.size() == 11);
+        REQUIRE(buffer[0] == 'h');
+
+        buffer.consume(6);
+        REQUIRE(toString(buffer) == "world");
+
+        buffer.append(std::string("!"));
+        REQUIRE(toString(buffer) == "world!");
+
+        buffer.consume(100);
+        REQUIRE(buffer.empty());
+    }
+
+    SECTION("Receive into the free space at the end of the buffer")
+    {
+        ReceiveBuffer buffer;
+
+        uint8_t* tail = buffer.prepare(16);
+        REQUIRE(buffer.capacity() >= 16);
+        memcpy(tail, "abcd", 4);
+        buffer.commit(4);
+        REQUIRE(toString(buffer) == "abcd");
+
+        tail = buffer.prepare(16);
+        memcpy(tail, "efgh", 4);
+        buffer.commit(4);
+        REQUIRE(toString(buffer) == "abcdefgh");
+    }
+
+    SECTION("Unread bytes are preserved when the buffer is compacted or grows")
+    {
+        ReceiveBuffer buffer;
+        std::string expected;
+
+        for (int i = 0; i < 1000; ++i)
+        {
+            std::string chunk(37, (char) ('a' + i % 26));
+            buffer.append(chunk);
+            expected += chunk;
+
+            // Consume a bit less than what was appended, so that the buffer
+            // both moves its unread bytes and grows over time
+            buffer.consume(30);
+            expected.erase(0, 30);
+
+            REQUIRE(toString(buffer) == expected);
+        }
+    }
+
+    SECTION("A consumed buffer is rewound")
+    {
+        ReceiveBuffer buffer;
+        buffer.append(std::string(1024, 'x'));
+        size_t capacity = buffer.capacity();
+
+        for (int i = 0; i < 100; ++i)
+        {
+            buffer.consume(1024);
+            buffer.append(std::string(1024, 'x'));
+        }
+
+        REQUIRE(buffer.capacity() == capacity);
+    }
+}
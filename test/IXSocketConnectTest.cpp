@@ -6,12 +6,21 @@
 
 #include "IXTest.h"
 #include "catch.hpp"
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXSelectInterruptFactory.h>
+#include <ixwebsocket/IXSocket.h>
 #include <ixwebsocket/IXSocketConnect.h>
+#include <ixwebsocket/IXWebSocket.h>
+#include <sstream>
+#include <string.h>
+#include <thread>
+#include <vector>
 
 using namespace ix;
 
-
 TEST_CASE("socket_connect", "[net]")
 {
     SECTION("Test connecting to a known hostname")
@@ -48,3 +57,230 @@ TEST_CASE("socket_connect", "[net]")
         REQUIRE(fd == -1);
     }
 }
+
+namespace
+{
+    struct addrinfo makeAddress(struct sockaddr_in& sa, const char* host, int port)
+    {
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        ix::inet_pton(AF_INET, host, &sa.sin_addr);
+
+        struct addrinfo address;
+        memset(&address, 0, sizeof(address));
+        address.ai_family = AF_INET;
+        address.ai_socktype = SOCK_STREAM;
+        address.ai_protocol = IPPROTO_TCP;
+        address.ai_addr = (struct sockaddr*) &sa;
+        address.ai_addrlen = sizeof(sa);
+        return address;
+    }
+
+    // A listening socket whose backlog is full, and which never accepts. Connections
+    // to it are not refused, they hang like ones to a blackholed address.
+    class StalledListener
+    {
+    public:
+        StalledListener()
+            : _port(-1)
+        {
+            _fd = (int) socket(AF_INET, SOCK_STREAM, 0);
+
+            struct sockaddr_in sa;
+            makeAddress(sa, "127.0.0.1", 0);
+            if (bind(_fd, (struct sockaddr*) &sa, sizeof(sa)) != 0 || listen(_fd, 0) != 0)
+            {
+                return;
+            }
+
+            socklen_t len = sizeof(sa);
+            getsockname(_fd, (struct sockaddr*) &sa, &len);
+            _port = ntohs(sa.sin_port);
+
+            for (int i = 0; i < 4; ++i)
+            {
+                int fd = (int) socket(AF_INET, SOCK_STREAM, 0);
+                SocketConnect::configure(fd);
+                ::connect(fd, (struct sockaddr*) &sa, sizeof(sa));
+                _fillers.push_back(fd);
+            }
+            msleep(100);
+        }
+
+        ~StalledListener()
+        {
+            for (auto&& fd : _fillers)
+            {
+                Socket::closeSocket(fd);
+            }
+            Socket::closeSocket(_fd);
+        }
+
+        int getPort() const
+        {
+            return _port;
+        }
+
+    private:
+        int _fd;
+        int _port;
+        std::vector<int> _fillers;
+    };
+} // namespace
+
+TEST_CASE("socket_connect_happy_eyeballs", "[net]")
+{
+    int port = getFreePort();
+    ix::WebSocketServer server(port);
+    REQUIRE(startWebSocketEchoServer(server));
+
+    struct sockaddr_in sa[2];
+
+    SECTION("A non routable address first does not prevent connecting")
+    {
+        auto first = makeAddress(sa[0], "10.255.255.1", port);
+        auto second = makeAddress(sa[1], "127.0.0.1", port);
+        first.ai_next = &second;
+
+        auto start = std::chrono::steady_clock::now();
+        std::string errMsg;
+        int fd = SocketConnect::connectToAddresses(&first, errMsg, [] { return false; });
+        auto duration = std::chrono::steady_clock::now() - start;
+        std::cerr << "Error message: " << errMsg << std::endl;
+        REQUIRE(fd != -1);
+        Socket::closeSocket(fd);
+
+        // Without racing, a blackholed address costs a full connect timeout
+        REQUIRE(duration < std::chrono::seconds(2));
+    }
+
+    SECTION("The next address is tried while the first one is stalled")
+    {
+        StalledListener listener;
+        REQUIRE(listener.getPort() != -1);
+
+        auto first = makeAddress(sa[0], "127.0.0.1", listener.getPort());
+        auto second = makeAddress(sa[1], "127.0.0.1", port);
+        first.ai_next = &second;
+
+        auto start = std::chrono::steady_clock::now();
+        std::string errMsg;
+        int fd = SocketConnect::connectToAddresses(&first,
+                                                   errMsg,
+                                                   [] { return false; },
+                                                   nullptr,
+                                                   std::chrono::steady_clock::time_point::max(),
+                                                   50);
+        auto duration = std::chrono::steady_clock::now() - start;
+        std::cerr << "Error message: " << errMsg << std::endl;
+        REQUIRE(fd != -1);
+        Socket::closeSocket(fd);
+
+        REQUIRE(duration < std::chrono::seconds(2));
+    }
+
+    SECTION("A stalled race can be cancelled")
+    {
+        StalledListener listener;
+        REQUIRE(listener.getPort() != -1);
+
+        auto first = makeAddress(sa[0], "127.0.0.1", listener.getPort());
+
+        auto start = std::chrono::steady_clock::now();
+        auto isCancellationRequested = [start] {
+            return std::chrono::steady_clock::now() - start > std::chrono::milliseconds(100);
+        };
+
+        std::string errMsg;
+        int fd = SocketConnect::connectToAddresses(&first, errMsg, isCancellationRequested);
+        auto duration = std::chrono::steady_clock::now() - start;
+        std::cerr << "Error message: " << errMsg << std::endl;
+        REQUIRE(fd == -1);
+        REQUIRE(errMsg == "Cancelled");
+        REQUIRE(duration < std::chrono::seconds(2));
+    }
+}
+
+TEST_CASE("socket_connect_select_interrupt", "[net]")
+{
+    StalledListener listener;
+    REQUIRE(listener.getPort() != -1);
+
+    struct sockaddr_in sa;
+    auto address = makeAddress(sa, "127.0.0.1", listener.getPort());
+
+    std::string errMsg;
+    auto selectInterrupt = createSelectInterrupt();
+    REQUIRE(selectInterrupt->init(errMsg));
+
+    // Cancellation is checked when the connection wakes up, instead of every 10ms
+    std::atomic<int> checks(0);
+    auto isCancellationRequested = [&checks] {
+        checks++;
+        return false;
+    };
+
+    SECTION("A stalled connection is cancelled through the select interrupt")
+    {
+        std::thread thread([&selectInterrupt] {
+            msleep(300);
+            selectInterrupt->notify(SelectInterrupt::kCloseRequest);
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        int fd = SocketConnect::connectToAddresses(&address,
+                                                   errMsg,
+                                                   isCancellationRequested,
+                                                   selectInterrupt,
+                                                   start + std::chrono::seconds(10));
+        auto duration = std::chrono::steady_clock::now() - start;
+        thread.join();
+
+        std::cerr << "Error message: " << errMsg << std::endl;
+        REQUIRE(fd == -1);
+        REQUIRE(errMsg == "Cancelled");
+        REQUIRE(duration < std::chrono::seconds(2));
+        if (selectInterrupt->getFd() != -1) REQUIRE(checks < 5);
+    }
+
+    SECTION("A stalled connection fails at its deadline")
+    {
+        auto start = std::chrono::steady_clock::now();
+        int fd = SocketConnect::connectToAddresses(&address,
+                                                   errMsg,
+                                                   isCancellationRequested,
+                                                   selectInterrupt,
+                                                   start + std::chrono::milliseconds(300));
+        auto duration = std::chrono::steady_clock::now() - start;
+
+        std::cerr << "Error message: " << errMsg << std::endl;
+        REQUIRE(fd == -1);
+        REQUIRE(errMsg == "Connect timed out");
+        REQUIRE(duration >= std::chrono::milliseconds(300));
+        REQUIRE(duration < std::chrono::seconds(2));
+        if (selectInterrupt->getFd() != -1) REQUIRE(checks < 5);
+    }
+}
+
+TEST_CASE("websocket_stop_while_connecting", "[net]")
+{
+    StalledListener listener;
+    REQUIRE(listener.getPort() != -1);
+
+    std::stringstream ss;
+    ss << "ws://127.0.0.1:" << listener.getPort() << "/";
+
+    ix::WebSocket webSocket;
+    webSocket.setUrl(ss.str());
+    webSocket.setHandshakeTimeout(60);
+    webSocket.setOnMessageCallback([](const ix::WebSocketMessagePtr&) {});
+    webSocket.start();
+    msleep(200);
+
+    // The connection is woken up by close, it does not wait for its timeout
+    auto start = std::chrono::steady_clock::now();
+    webSocket.stop();
+    auto duration = std::chrono::steady_clock::now() - start;
+    REQUIRE(duration < std::chrono::seconds(2));
+}
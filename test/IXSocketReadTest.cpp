@@ -0,0 +1,218 @@
+/*
+ *  IXSocketReadTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <ixwebsocket/IXHttp.h>
+#include <ixwebsocket/IXSocket.h>
+#include <ixwebsocket/IXWebSocketHttpHeaders.h>
+#include <limits>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace ix;
+
+namespace
+{
+    // Count the recv system calls
+    class CountingSocket : public Socket
+    {
+    public:
+        CountingSocket(int fd)
+            : Socket(fd)
+            , recvCount(0)
+        {
+            ;
+        }
+
+        ssize_t recv(void* buffer, size_t length) final
+        {
+            recvCount++;
+            return Socket::recv(buffer, length);
+        }
+
+        int recvCount;
+    };
+
+    // The socket reads from one end of a socket pair, the test writes to the other one
+    struct SocketPair
+    {
+        SocketPair()
+            : peer(-1)
+        {
+            int fds[2];
+            REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+            peer = fds[1];
+
+            socket.reset(new CountingSocket(fds[0]));
+            std::string errorMsg;
+            REQUIRE(socket->init(errorMsg));
+        }
+
+        ~SocketPair()
+        {
+            ::close(peer);
+        }
+
+        void write(const std::string& data)
+        {
+            REQUIRE(::send(peer, data.data(), data.size(), 0) == (ssize_t) data.size());
+        }
+
+        CountingSocket& counting()
+        {
+            return static_cast<CountingSocket&>(*socket);
+        }
+
+        std::unique_ptr<Socket> socket;
+        int peer;
+    };
+} // namespace
+
+TEST_CASE("socket_read", "[socket_read]")
+{
+    SECTION("Lines and bytes are read from the same buffer")
+    {
+        SocketPair pair;
+        pair.write("first line\r\nsecond\r\n0123456789tail");
+
+        auto line = pair.socket->readLine(nullptr);
+        REQUIRE(line.first);
+        REQUIRE(line.second == "first line\r\n");
+
+        line = pair.socket->readLine(nullptr);
+        REQUIRE(line.first);
+        REQUIRE(line.second == "second\r\n");
+
+        auto bytes = pair.socket->readBytes(10, nullptr, nullptr);
+        REQUIRE(bytes.first);
+        REQUIRE(bytes.second == "0123456789");
+
+        char c;
+        REQUIRE(pair.socket->readByte(&c, nullptr));
+        REQUIRE(c == 't');
+
+        REQUIRE(pair.socket->takeReadBuffer() == "ail");
+        REQUIRE(pair.counting().recvCount == 1);
+    }
+
+    SECTION("A line split across several writes is reassembled")
+    {
+        SocketPair pair;
+        pair.write("GET / HT");
+
+        std::thread writer([&pair] {
+            ix::msleep(10);
+            pair.write("TP/1.1\r");
+            ix::msleep(10);
+            pair.write("\nHost: localhost\r\n\r\n");
+        });
+
+        auto line = pair.socket->readLine(nullptr);
+        writer.join();
+
+        REQUIRE(line.first);
+        REQUIRE(line.second == "GET / HTTP/1.1\r\n");
+    }
+
+    SECTION("Reading more bytes than buffered receives the rest in place")
+    {
+        SocketPair pair;
+        std::string body(100 * 1000, 'b');
+        pair.write("Content-Length: 100000\r\n" + body.substr(0, 50));
+
+        std::thread writer([&pair, &body] { pair.write(body.substr(50)); });
+
+        auto line = pair.socket->readLine(nullptr);
+        REQUIRE(line.first);
+
+        auto bytes = pair.socket->readBytes(body.size(), nullptr, nullptr);
+        writer.join();
+
+        REQUIRE(bytes.first);
+        REQUIRE(bytes.second == body);
+        REQUIRE(pair.socket->getReadBufferSize() == 0);
+    }
+
+    SECTION("The length announced by the peer is not allocated upfront")
+    {
+        SocketPair pair;
+        pair.write("short");
+        ::shutdown(pair.peer, SHUT_WR);
+
+        size_t length = (size_t) std::numeric_limits<int64_t>::max();
+        auto bytes = pair.socket->readBytes(length, nullptr, nullptr);
+        REQUIRE(!bytes.first);
+        REQUIRE(bytes.second == "Recv Error");
+    }
+
+    SECTION("Headers are parsed with a few system calls, and following bytes are kept")
+    {
+        SocketPair pair;
+        std::string request("Host: 127.0.0.1:8008\r\n"
+                            "Upgrade: websocket\r\n"
+                            "Connection: Upgrade\r\n"
+                            "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                            "Sec-WebSocket-Version: 13\r\n"
+                            "Sec-WebSocket-Extensions: permessage-deflate; "
+                            "client_max_window_bits\r\n"
+                            "User-Agent:no space\r\n"
+                            "\r\n");
+        pair.write(request + "\x81\x85" "frame");
+
+        auto headers = parseHttpHeaders(pair.socket, nullptr);
+        REQUIRE(headers.first);
+        REQUIRE(headers.second["upgrade"] == "websocket");
+        REQUIRE(headers.second["Sec-WebSocket-Version"] == "13");
+        REQUIRE(headers.second["User-Agent"] == "no space");
+        REQUIRE(headers.second.size() == 7);
+
+        REQUIRE(pair.counting().recvCount == 1);
+        REQUIRE(pair.socket->takeReadBuffer() == "\x81\x85" "frame");
+    }
+
+    SECTION("HTTP requests are parsed from the buffer")
+    {
+        SocketPair pair;
+        pair.write("POST /upload HTTP/1.1\r\n"
+                   "Content-Length: 5\r\n"
+                   "\r\n"
+                   "hello");
+
+        auto ret = Http::parseRequest(pair.socket, 10);
+        REQUIRE(std::get<0>(ret));
+
+        auto request = std::get<2>(ret);
+        REQUIRE(request->method == "POST");
+        REQUIRE(request->uri == "/upload");
+        REQUIRE(request->body == "hello");
+        REQUIRE(pair.counting().recvCount <= 2);
+    }
+
+    SECTION("HTTP requests with a header line over the limit are rejected")
+    {
+        SocketPair pair;
+        pair.write("GET / HTTP/1.1\r\n"
+                   "X-Long: " +
+                   std::string(2000, 'a') + "\r\n\r\n");
+
+        auto ret = Http::parseRequest(pair.socket, 10);
+        REQUIRE(!std::get<0>(ret));
+        REQUIRE(std::get<1>(ret) == "HTTP request header too large");
+    }
+
+    SECTION("A closed connection ends the line being read")
+    {
+        SocketPair pair;
+        pair.write("partial");
+        ::shutdown(pair.peer, SHUT_WR);
+
+        auto line = pair.socket->readLine(nullptr);
+        REQUIRE(!line.first);
+        REQUIRE(line.second == "partial");
+    }
+}
@@ -6,12 +6,18 @@
 
 #include "IXTest.h"
 #include "catch.hpp"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <ixwebsocket/IXCancellationRequest.h>
 #include <ixwebsocket/IXSocket.h>
 #include <ixwebsocket/IXSocketFactory.h>
 #include <string.h>
 
+#if defined(IXWEBSOCKET_USE_OPEN_SSL)
+#include <ixwebsocket/IXSocketOpenSSL.h>
+#endif
+
 using namespace ix;
 
 namespace ix
@@ -96,3 +102,76 @@ TEST_CASE("socket", "[socket]")
     }
 #endif
 }
+
+#if defined(IXWEBSOCKET_USE_OPEN_SSL)
+namespace
+{
+    void copyFile(const std::string& from, const std::string& to)
+    {
+        std::ifstream in(from, std::ios::binary);
+        std::ofstream out(to, std::ios::binary | std::ios::trunc);
+        out << in.rdbuf();
+    }
+
+    bool connectWithTLS(int port)
+    {
+        std::string errMsg;
+        SocketTLSOptions tlsOptions;
+        tlsOptions.caFile = "NONE";
+        auto socket = createSocket(true, -1, errMsg, tlsOptions);
+        auto isCancellationRequested = []() -> bool { return false; };
+
+        bool success =
+            socket && socket->connect("127.0.0.1", port, errMsg, isCancellationRequested);
+        TLogger() << "errMsg: " << errMsg;
+        return success;
+    }
+} // namespace
+
+TEST_CASE("openssl_server_context", "[socket]")
+{
+    copyFile(".certs/trusted-server-crt.pem", "reload-server-crt.pem");
+    copyFile(".certs/trusted-server-key.pem", "reload-server-key.pem");
+
+    SocketTLSOptions tlsOptions;
+    tlsOptions.certFile = "reload-server-crt.pem";
+    tlsOptions.keyFile = "reload-server-key.pem";
+    tlsOptions.caFile = "NONE";
+    tlsOptions.tls = true;
+
+    int port = getFreePort();
+    ix::WebSocketServer server(port);
+    server.setTLSOptions(tlsOptions);
+    REQUIRE(startWebSocketEchoServer(server));
+
+    SocketOpenSSL::clearServerContexts();
+    auto buildCount = SocketOpenSSL::getServerContextsBuildCount();
+
+    // Accepted connections share the context built by the first one
+    for (int i = 0; i < 3; ++i)
+    {
+        REQUIRE(connectWithTLS(port));
+    }
+    REQUIRE(SocketOpenSSL::getServerContextsBuildCount() == buildCount + 1);
+    REQUIRE(SocketOpenSSL::getServerContextsCount() == 1);
+
+    // A renewed certificate is used by the next connections
+    copyFile(".certs/selfsigned-client-crt.pem", "reload-server-crt.pem");
+    copyFile(".certs/selfsigned-client-key.pem", "reload-server-key.pem");
+    msleep(1100);
+
+    REQUIRE(connectWithTLS(port));
+    REQUIRE(SocketOpenSSL::getServerContextsBuildCount() == buildCount + 2);
+
+    // A certificate which does not match the key yet keeps the previous context in use
+    copyFile(".certs/trusted-server-crt.pem", "reload-server-crt.pem");
+    msleep(1100);
+
+    REQUIRE(connectWithTLS(port));
+    REQUIRE(SocketOpenSSL::getServerContextsBuildCount() == buildCount + 2);
+
+    server.stop();
+    std::remove("reload-server-crt.pem");
+    std::remove("reload-server-key.pem");
+}
+#endif
@@ -0,0 +1,295 @@
+/*
+ *  IXWebSocketClientLoopTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <atomic>
+#include <ixwebsocket/IXNetSystem.h>
+#include <ixwebsocket/IXSocket.h>
+#include <ixwebsocket/IXUniquePtr.h>
+#include <ixwebsocket/IXWebSocket.h>
+#include <ixwebsocket/IXWebSocketClientLoop.h>
+#include <ixwebsocket/IXWebSocketServer.h>
+#include <memory>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+using namespace ix;
+
+namespace
+{
+    bool startEchoServer(ix::WebSocketServer& server)
+    {
+        server.setOnClientMessageCallback(
+            [](std::shared_ptr<ConnectionState> /*connectionState*/,
+               WebSocket& webSocket,
+               const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    webSocket.send(msg->str, msg->binary);
+                }
+            });
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            TLogger() << res.second;
+            return false;
+        }
+
+        server.start();
+        return true;
+    }
+
+    std::string makeUrl(int port)
+    {
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+        return ss.str();
+    }
+
+    // The kernel completes the TCP handshakes, but the upgrade requests are never answered
+    int listenWithoutAnswering(int port)
+    {
+        int fd = (int) socket(AF_INET, SOCK_STREAM, 0);
+
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons(port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(fd, (struct sockaddr*) &sa, sizeof(sa)) != 0 || listen(fd, 16) != 0)
+        {
+            Socket::closeSocket(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    template<typename Predicate>
+    bool waitFor(Predicate predicate)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            if (predicate()) return true;
+            ix::msleep(50);
+        }
+        return predicate();
+    }
+} // namespace
+
+TEST_CASE("Websocket_client_loop", "[websocket_client_loop]")
+{
+#ifdef __linux__
+    SECTION("Many clients sharing a client loop exchange messages with an echo server")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        REQUIRE(startEchoServer(server));
+
+        auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(2, 2);
+        std::string errorMsg;
+        REQUIRE(clientLoop->start(errorMsg));
+
+        const int clientsCount = 50;
+        const int messagesCount = 20;
+
+        std::atomic<int> openCount(0);
+        std::atomic<int> receivedCount(0);
+        std::atomic<int> invalidCount(0);
+
+        std::vector<std::unique_ptr<ix::WebSocket>> webSockets;
+        for (int i = 0; i < clientsCount; ++i)
+        {
+            auto webSocket = ix::make_unique<ix::WebSocket>();
+            webSocket->setUrl(makeUrl(port));
+            webSocket->disableAutomaticReconnection();
+            webSocket->setClientLoop(clientLoop);
+
+            std::string expected = "hello from client " + std::to_string(i);
+            webSocket->setOnMessageCallback(
+                [&, expected](const ix::WebSocketMessagePtr& msg) {
+                    if (msg->type == ix::WebSocketMessageType::Open)
+                    {
+                        openCount++;
+                    }
+                    else if (msg->type == ix::WebSocketMessageType::Message)
+                    {
+                        if (msg->str != expected) invalidCount++;
+                        receivedCount++;
+                    }
+                });
+
+            webSocket->start();
+            webSockets.push_back(std::move(webSocket));
+        }
+
+        REQUIRE(waitFor([&] { return openCount == clientsCount; }));
+
+        for (int i = 0; i < clientsCount; ++i)
+        {
+            for (int j = 0; j < messagesCount; ++j)
+            {
+                webSockets[i]->sendText("hello from client " + std::to_string(i));
+            }
+        }
+
+        REQUIRE(waitFor([&] { return receivedCount == clientsCount * messagesCount; }));
+        REQUIRE(invalidCount == 0);
+
+        for (auto&& webSocket : webSockets)
+        {
+            webSocket->stop();
+            REQUIRE(webSocket->getReadyState() == ix::ReadyState::Closed);
+        }
+
+        server.stop();
+    }
+
+    SECTION("A client retries with a backoff and can be stopped while waiting")
+    {
+        // Nothing is listening on that port
+        int port = getFreePort();
+
+        auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(1, 1);
+        std::string errorMsg;
+        REQUIRE(clientLoop->start(errorMsg));
+
+        std::atomic<int> errorsCount(0);
+        std::atomic<uint32_t> lastRetries(0);
+
+        ix::WebSocket webSocket;
+        webSocket.setUrl(makeUrl(port));
+        webSocket.setMinWaitBetweenReconnectionRetries(10);
+        webSocket.setMaxWaitBetweenReconnectionRetries(100);
+        webSocket.setClientLoop(clientLoop);
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Error)
+            {
+                lastRetries = msg->errorInfo.retries;
+                errorsCount++;
+            }
+        });
+
+        webSocket.start();
+
+        REQUIRE(waitFor([&] { return errorsCount >= 3; }));
+        REQUIRE(lastRetries >= 3);
+
+        webSocket.stop();
+
+        int errors = errorsCount;
+        ix::msleep(300);
+        REQUIRE(errorsCount == errors);
+    }
+
+    SECTION("A client reconnects after the server goes away")
+    {
+        int port = getFreePort();
+        auto server = ix::make_unique<ix::WebSocketServer>(port);
+        REQUIRE(startEchoServer(*server));
+
+        auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(1, 1);
+        std::string errorMsg;
+        REQUIRE(clientLoop->start(errorMsg));
+
+        std::atomic<int> openCount(0);
+        std::atomic<int> closeCount(0);
+
+        ix::WebSocket webSocket;
+        webSocket.setUrl(makeUrl(port));
+        webSocket.setMinWaitBetweenReconnectionRetries(10);
+        webSocket.setMaxWaitBetweenReconnectionRetries(100);
+        webSocket.setClientLoop(clientLoop);
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                openCount++;
+            }
+            else if (msg->type == ix::WebSocketMessageType::Close)
+            {
+                closeCount++;
+            }
+        });
+
+        webSocket.start();
+        REQUIRE(waitFor([&] { return openCount == 1; }));
+
+        server->stop();
+        REQUIRE(waitFor([&] { return closeCount == 1; }));
+
+        server = ix::make_unique<ix::WebSocketServer>(port);
+        REQUIRE(startEchoServer(*server));
+        REQUIRE(waitFor([&] { return openCount == 2; }));
+
+        webSocket.stop();
+        server->stop();
+    }
+
+    SECTION("Clients are closed when their client loop goes away")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        REQUIRE(startEchoServer(server));
+
+        int silentPort = getFreePort();
+        int silentFd = listenWithoutAnswering(silentPort);
+        REQUIRE(silentFd != -1);
+
+        // The connect thread is busy with the first silent client while the second one waits
+        auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(1, 1);
+        std::string errorMsg;
+        REQUIRE(clientLoop->start(errorMsg));
+
+        std::atomic<int> openCount(0);
+        std::atomic<int> closeCount(0);
+
+        std::vector<std::unique_ptr<ix::WebSocket>> webSockets;
+        for (int i = 0; i < 3; ++i)
+        {
+            auto webSocket = ix::make_unique<ix::WebSocket>();
+            webSocket->setUrl(makeUrl(i == 0 ? port : silentPort));
+            webSocket->setHandshakeTimeout(2);
+            webSocket->disableAutomaticReconnection();
+            webSocket->setClientLoop(clientLoop);
+            webSocket->setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Open)
+                {
+                    openCount++;
+                }
+                else if (msg->type == ix::WebSocketMessageType::Close)
+                {
+                    closeCount++;
+                }
+            });
+
+            webSocket->start();
+            if (i == 0) REQUIRE(waitFor([&] { return openCount == 1; }));
+            webSockets.push_back(std::move(webSocket));
+        }
+
+        // Only the WebSockets were keeping the client loop alive
+        for (auto&& webSocket : webSockets)
+        {
+            webSocket->setClientLoop(nullptr);
+        }
+        clientLoop.reset();
+
+        REQUIRE(closeCount == 1);
+
+        for (auto&& webSocket : webSockets)
+        {
+            webSocket->stop();
+            REQUIRE(webSocket->getReadyState() == ix::ReadyState::Closed);
+        }
+
+        Socket::closeSocket(silentFd);
+        server.stop();
+    }
+#endif
+}
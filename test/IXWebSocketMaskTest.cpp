@@ -0,0 +1,98 @@
+/*
+ *  IXWebSocketMaskTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <algorithm>
+#include <ixwebsocket/IXWebSocketMask.h>
+#include <vector>
+
+using namespace ix;
+
+namespace
+{
+    std::vector<uint8_t> makePayload(size_t size)
+    {
+        std::vector<uint8_t> payload(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            payload[i] = (uint8_t)(i * 31 + 7);
+        }
+        return payload;
+    }
+
+    std::vector<uint8_t> maskReference(const std::vector<uint8_t>& payload,
+                                       const uint8_t maskingKey[4])
+    {
+        std::vector<uint8_t> masked(payload);
+        for (size_t i = 0; i < masked.size(); ++i)
+        {
+            masked[i] ^= maskingKey[i % 4];
+        }
+        return masked;
+    }
+} // namespace
+
+TEST_CASE("websocket_mask", "[websocket_mask]")
+{
+    const uint8_t maskingKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+    TLogger() << "Masking kernel: " << getMaskingKernelName();
+
+    SECTION("Masking in place matches the byte by byte reference, at any size and alignment")
+    {
+        for (size_t offset = 0; offset < 4; ++offset)
+        {
+            for (size_t size = 0; size < 300; ++size)
+            {
+                auto payload = makePayload(size);
+                auto expected = maskReference(payload, maskingKey);
+
+                std::vector<uint8_t> buffer(offset + size + 1, 0xee);
+                std::copy(payload.begin(), payload.end(), buffer.begin() + offset);
+
+                maskInPlace(buffer.data() + offset, size, maskingKey);
+
+                REQUIRE(std::equal(expected.begin(), expected.end(), buffer.begin() + offset));
+
+                // Bytes around the payload are untouched
+                for (size_t i = 0; i < offset; ++i)
+                {
+                    REQUIRE(buffer[i] == 0xee);
+                }
+                REQUIRE(buffer.back() == 0xee);
+            }
+        }
+    }
+
+    SECTION("Masking while copying matches the byte by byte reference")
+    {
+        for (size_t size : {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000, 4096, 65537})
+        {
+            auto payload = makePayload(size + 3);
+            std::vector<uint8_t> src(payload.begin() + 3, payload.end());
+            auto expected = maskReference(src, maskingKey);
+
+            std::vector<uint8_t> dst(size + 1, 0xee);
+            maskCopy(dst.data() + 1, payload.data() + 3, size, maskingKey);
+
+            REQUIRE(dst[0] == 0xee);
+            REQUIRE(std::equal(expected.begin(), expected.end(), dst.begin() + 1));
+        }
+    }
+
+    SECTION("Masking twice restores the payload")
+    {
+        auto payload = makePayload(10000);
+        auto buffer = payload;
+
+        maskInPlace(buffer.data(), buffer.size(), maskingKey);
+        REQUIRE(buffer != payload);
+
+        maskInPlace(buffer.data(), buffer.size(), maskingKey);
+        REQUIRE(buffer == payload);
+    }
+}
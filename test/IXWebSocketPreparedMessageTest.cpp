@@ -0,0 +1,206 @@
+/*
+ *  IXWebSocketPreparedMessageTest.cpp
+ *  Author: Benjamin Sergeant
+ *  Copyright (c) 2021 Machine Zone. All rights reserved.
+ */
+
+#include "IXTest.h"
+#include "catch.hpp"
+#include <atomic>
+#include <ixwebsocket/IXWebSocket.h>
+#include <ixwebsocket/IXWebSocketPreparedMessage.h>
+#include <ixwebsocket/IXWebSocketServer.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+using namespace ix;
+
+namespace
+{
+    struct PreparedMessageClient
+    {
+        ix::WebSocket webSocket;
+        std::atomic<bool> open {false};
+        std::mutex mutex;
+        std::vector<std::string> received;
+    };
+
+    // Send regular and prepared messages, interleaved, to clients with various
+    // compression settings
+    void broadcastPreparedMessages(bool useEventLoop)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        if (useEventLoop)
+        {
+            server.enableEventLoop(1);
+        }
+
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const ix::WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        // The compressed frame can only be used with the first two clients
+        std::vector<WebSocketPerMessageDeflateOptions> options = {
+            WebSocketPerMessageDeflateOptions(true, true, true),
+            WebSocketPerMessageDeflateOptions(true, true, true),
+            WebSocketPerMessageDeflateOptions(true, false, false),
+            WebSocketPerMessageDeflateOptions(false)};
+
+        std::vector<std::unique_ptr<PreparedMessageClient>> clients;
+        for (auto&& option : options)
+        {
+            clients.emplace_back(new PreparedMessageClient());
+            auto client = clients.back().get();
+
+            client->webSocket.setUrl(ss.str());
+            client->webSocket.disableAutomaticReconnection();
+            client->webSocket.setPerMessageDeflateOptions(option);
+            client->webSocket.setOnMessageCallback([client](const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Open)
+                {
+                    client->open = true;
+                }
+                else if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    std::lock_guard<std::mutex> lock(client->mutex);
+                    client->received.push_back(msg->str);
+                }
+            });
+            client->webSocket.start();
+        }
+
+        int attempts = 0;
+        while (attempts++ < 50)
+        {
+            bool allOpen = server.getClients().size() == clients.size();
+            for (auto&& client : clients)
+            {
+                allOpen = allOpen && client->open;
+            }
+            if (allOpen) break;
+            ix::msleep(100);
+        }
+        REQUIRE(server.getClients().size() == clients.size());
+
+        std::string text;
+        for (int i = 0; i < 1000; ++i)
+        {
+            text += "prepared message " + std::to_string(i) + " ";
+        }
+        std::string binary(100 * 1000, 0);
+        for (size_t i = 0; i < binary.size(); ++i)
+        {
+            binary[i] = (char) (i * 7);
+        }
+
+        WebSocketPreparedMessage preparedText(text);
+        WebSocketPreparedMessage preparedBinary(binary, true);
+
+        std::vector<std::string> expected = {"regular 1", text, "regular 2", binary, "regular 3"};
+
+        int compressedSends = 0;
+        for (auto&& webSocket : server.getClients())
+        {
+            REQUIRE(webSocket->sendText("regular 1").success);
+            auto sendInfo = webSocket->sendPrepared(preparedText);
+            REQUIRE(sendInfo.success);
+            if (sendInfo.wireSize < text.size()) compressedSends++;
+            REQUIRE(webSocket->sendText("regular 2").success);
+            REQUIRE(webSocket->sendPrepared(preparedBinary).success);
+            REQUIRE(webSocket->sendText("regular 3").success);
+        }
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+        REQUIRE(compressedSends == 2);
+#endif
+
+        for (auto&& client : clients)
+        {
+            attempts = 0;
+            while (attempts++ < 50)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(client->mutex);
+                    if (client->received.size() == expected.size()) break;
+                }
+                ix::msleep(100);
+            }
+
+            std::lock_guard<std::mutex> lock(client->mutex);
+            REQUIRE(client->received == expected);
+        }
+
+        for (auto&& client : clients)
+        {
+            client->webSocket.stop();
+        }
+        server.stop();
+    }
+} // namespace
+
+TEST_CASE("websocket_prepared_message", "[websocket_prepared_message]")
+{
+    SECTION("The frame holds the header and the payload")
+    {
+        WebSocketPreparedMessage message("hello", false, false);
+        REQUIRE(message.isValid());
+        REQUIRE(!message.getCompressedFrame());
+
+        // fin + text opcode, unmasked length
+        REQUIRE(*message.getFrame() == std::string("\x81\x05hello"));
+    }
+
+    SECTION("Large payloads use an extended length")
+    {
+        std::string payload(70000, 'a');
+        WebSocketPreparedMessage message(payload, true, false);
+
+        auto frame = message.getFrame();
+        REQUIRE(frame->size() == 10 + payload.size());
+        REQUIRE((uint8_t) (*frame)[0] == 0x82);
+        REQUIRE((uint8_t) (*frame)[1] == 127);
+        REQUIRE(frame->substr(10) == payload);
+    }
+
+    SECTION("Text which is not valid UTF-8 is rejected")
+    {
+        WebSocketPreparedMessage message("\xff\xfe", false);
+        REQUIRE(!message.isValid());
+        REQUIRE(!message.getFrame());
+    }
+
+#ifdef IXWEBSOCKET_USE_ZLIB
+    SECTION("The compressed frame sets rsv1 and is smaller")
+    {
+        std::string payload(10000, 'a');
+        WebSocketPreparedMessage message(payload);
+
+        auto frame = message.getCompressedFrame();
+        REQUIRE(frame);
+        REQUIRE((uint8_t) (*frame)[0] == 0xc1);
+        REQUIRE(message.getCompressedSize() < payload.size());
+        REQUIRE(frame->size() < message.getFrame()->size());
+    }
+#endif
+
+    SECTION("Clients receive prepared messages in order with regular messages")
+    {
+        broadcastPreparedMessages(false);
+    }
+
+#ifdef __linux__
+    SECTION("Clients of an event loop server receive prepared messages")
+    {
+        broadcastPreparedMessages(true);
+    }
+#endif
+}
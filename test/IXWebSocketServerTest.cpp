@@ -6,11 +6,14 @@
 
 #include "IXTest.h"
 #include "catch.hpp"
+#include <atomic>
 #include <iostream>
 #include <ixwebsocket/IXSocket.h>
 #include <ixwebsocket/IXSocketFactory.h>
 #include <ixwebsocket/IXWebSocket.h>
 #include <ixwebsocket/IXWebSocketServer.h>
+#include <set>
+#include <thread>
 
 using namespace ix;
 
@@ -196,3 +199,696 @@ TEST_CASE("Websocket_server", "[websocket_server]")
         REQUIRE(server.getClients().size() == 0);
     }
 }
+
+TEST_CASE("Websocket_server_event_loop", "[websocket_server]")
+{
+#ifdef __linux__
+    SECTION("Connect to the server, do not send anything. Should timeout and return 400")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.enableEventLoop(2);
+        std::string connectionId;
+        REQUIRE(startServer(server, connectionId));
+
+        std::string errMsg;
+        bool tls = false;
+        SocketTLSOptions tlsOptions;
+        std::shared_ptr<Socket> socket = createSocket(tls, -1, errMsg, tlsOptions);
+        std::string host("127.0.0.1");
+        auto isCancellationRequested = []() -> bool { return false; };
+        bool success = socket->connect(host, port, errMsg, isCancellationRequested);
+        REQUIRE(success);
+
+        auto lineResult = socket->readLine(isCancellationRequested);
+        auto lineValid = lineResult.first;
+        REQUIRE(lineValid);
+
+        auto line = lineResult.second;
+
+        int status = -1;
+        REQUIRE(sscanf(line.c_str(), "HTTP/1.1 %d", &status) == 1);
+        REQUIRE(status == 400);
+
+        // Give us 500ms for the server to notice that clients went away
+        ix::msleep(500);
+        server.stop();
+        REQUIRE(server.getClients().size() == 0);
+    }
+
+    SECTION("Connect to the server. Send GET request with correct header")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.enableEventLoop(2);
+        std::string connectionId;
+        REQUIRE(startServer(server, connectionId));
+
+        std::string errMsg;
+        bool tls = false;
+        SocketTLSOptions tlsOptions;
+        std::shared_ptr<Socket> socket = createSocket(tls, -1, errMsg, tlsOptions);
+        std::string host("127.0.0.1");
+        auto isCancellationRequested = []() -> bool { return false; };
+        bool success = socket->connect(host, port, errMsg, isCancellationRequested);
+        REQUIRE(success);
+
+        socket->writeBytes("GET / HTTP/1.1\r\n"
+                           "Upgrade: websocket\r\n"
+                           "Sec-WebSocket-Version: 13\r\n"
+                           "Sec-WebSocket-Key: foobar\r\n"
+                           "\r\n",
+                           isCancellationRequested);
+
+        auto lineResult = socket->readLine(isCancellationRequested);
+        auto lineValid = lineResult.first;
+        REQUIRE(lineValid);
+
+        auto line = lineResult.second;
+
+        int status = -1;
+        REQUIRE(sscanf(line.c_str(), "HTTP/1.1 %d", &status) == 1);
+        REQUIRE(status == 101);
+
+        // Give us 500ms for the server to notice that clients went away
+        ix::msleep(500);
+
+        server.stop();
+        REQUIRE(connectionId == "foobarConnectionId");
+        REQUIRE(server.getClients().size() == 0);
+    }
+
+    SECTION("Exchange messages between two clients through the server")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.enableEventLoop(2);
+        std::string connectionId;
+        REQUIRE(startServer(server, connectionId));
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+        std::string url = ss.str();
+
+        std::atomic<int> openCount(0);
+        std::atomic<int> receivedCount(0);
+        std::mutex mutex;
+        std::vector<std::string> received;
+
+        auto callback = [&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                openCount++;
+            }
+            else if (msg->type == ix::WebSocketMessageType::Message)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                received.push_back(msg->str);
+                receivedCount++;
+            }
+        };
+
+        ix::WebSocket sender;
+        sender.setUrl(url);
+        sender.disableAutomaticReconnection();
+        sender.setOnMessageCallback(callback);
+
+        ix::WebSocket receiver;
+        receiver.setUrl(url);
+        receiver.disableAutomaticReconnection();
+        receiver.setOnMessageCallback(callback);
+
+        sender.start();
+        receiver.start();
+
+        int attempts = 0;
+        while (openCount != 2 && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(openCount == 2);
+
+        // Wait for the server to register both connections
+        attempts = 0;
+        while (server.getClients().size() != 2 && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(server.getClients().size() == 2);
+
+        const int messages = 100;
+        std::string payload(32 * 1024, 'a');
+        for (int i = 0; i < messages; ++i)
+        {
+            sender.sendText(payload);
+        }
+
+        attempts = 0;
+        while (receivedCount != messages && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(receivedCount == messages);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto&& str : received)
+            {
+                REQUIRE(str == payload);
+            }
+        }
+
+        sender.stop();
+        receiver.stop();
+
+        // Give us 500ms for the server to notice that clients went away
+        ix::msleep(500);
+        server.stop();
+        REQUIRE(server.getClients().size() == 0);
+    }
+#endif
+}
+
+TEST_CASE("Websocket_server_zero_copy_messages", "[websocket_server]")
+{
+    SECTION("Unfragmented messages are delivered as a view, fragmented ones as a string")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.disablePerMessageDeflate();
+        server.enableZeroCopyMessages();
+
+        std::mutex mutex;
+        std::vector<std::string> received;
+        std::vector<bool> receivedAsView;
+        std::set<const ix::WebSocketMessage*> messagePointers;
+
+        server.setOnClientMessageCallback(
+            [&](std::shared_ptr<ConnectionState> /*connectionState*/,
+                WebSocket& /*webSocket*/,
+                const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    received.push_back(std::string(msg->data, msg->size));
+                    receivedAsView.push_back(msg->str.empty());
+                    messagePointers.insert(msg.get());
+                }
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        std::atomic<bool> open(false);
+        ix::WebSocket webSocket;
+        webSocket.setUrl(ss.str());
+        webSocket.disableAutomaticReconnection();
+        webSocket.disablePerMessageDeflate();
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                open = true;
+            }
+        });
+        webSocket.start();
+
+        int attempts = 0;
+        while (!open && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(open);
+
+        // Large messages are sent in 32K fragments
+        std::vector<std::string> payloads = {
+            "hello", std::string(1000, 'b'), std::string(100 * 1000, 'c'), "world"};
+        for (auto&& payload : payloads)
+        {
+            webSocket.sendBinary(payload);
+        }
+
+        attempts = 0;
+        while (attempts++ < 50)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (received.size() == payloads.size()) break;
+            }
+            ix::msleep(100);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(received == payloads);
+            REQUIRE(receivedAsView == std::vector<bool>({true, true, false, true}));
+
+            // The message struct is reused
+            REQUIRE(messagePointers.size() == 1);
+        }
+
+        webSocket.stop();
+        server.stop();
+    }
+}
+
+namespace
+{
+    // Echo a few large messages, which the server sends with writev, possibly
+    // queueing what the socket did not take
+    void echoLargeMessages(bool useEventLoop)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.disablePerMessageDeflate();
+        if (useEventLoop)
+        {
+            server.enableEventLoop(1);
+        }
+
+        server.setOnClientMessageCallback(
+            [](std::shared_ptr<ConnectionState> /*connectionState*/,
+               WebSocket& webSocket,
+               const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    webSocket.sendBinary(msg->str);
+                }
+            });
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        std::atomic<bool> open(false);
+        std::mutex mutex;
+        std::vector<std::string> received;
+
+        ix::WebSocket webSocket;
+        webSocket.setUrl(ss.str());
+        webSocket.disableAutomaticReconnection();
+        webSocket.disablePerMessageDeflate();
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                open = true;
+            }
+            else if (msg->type == ix::WebSocketMessageType::Message)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                received.push_back(msg->str);
+            }
+        });
+        webSocket.start();
+
+        int attempts = 0;
+        while (!open && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(open);
+
+        std::vector<std::string> payloads;
+        for (size_t size : {10 * 1000, 100 * 1000, 4 * 1000 * 1000})
+        {
+            std::string payload(size, 0);
+            for (size_t i = 0; i < size; ++i)
+            {
+                payload[i] = (char) (i * 7 + size);
+            }
+            payloads.push_back(payload);
+            webSocket.sendBinary(payload);
+        }
+
+        attempts = 0;
+        while (attempts++ < 100)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (received.size() == payloads.size()) break;
+            }
+            ix::msleep(100);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(received == payloads);
+        }
+
+        webSocket.stop();
+        server.stop();
+    }
+
+    // Connect a client which never reads, with a raw socket
+    std::unique_ptr<Socket> connectSlowClient(int port)
+    {
+        std::string errMsg;
+        SocketTLSOptions tlsOptions;
+        auto socket = createSocket(false, -1, errMsg, tlsOptions);
+        auto isCancellationRequested = []() -> bool { return false; };
+
+        REQUIRE(socket);
+        REQUIRE(socket->connect("127.0.0.1", port, errMsg, isCancellationRequested));
+
+        socket->writeBytes("GET / HTTP/1.1\r\n"
+                           "Host: 127.0.0.1\r\n"
+                           "Upgrade: websocket\r\n"
+                           "Connection: Upgrade\r\n"
+                           "Sec-WebSocket-Version: 13\r\n"
+                           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                           "\r\n",
+                           isCancellationRequested);
+
+        while (true)
+        {
+            auto line = socket->readLine(isCancellationRequested);
+            REQUIRE(line.first);
+            if (line.second == "\r\n") break;
+        }
+
+        return socket;
+    }
+
+    // Broadcast to a regular client and to a client which does not read, until the
+    // queue of the slow client overflows
+    void broadcastToSlowClient(SendQueueOverflowPolicy policy, bool useEventLoop)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.disablePerMessageDeflate();
+        server.setBroadcastHighWaterMark(1 << 20);
+        server.setBroadcastOverflowPolicy(policy);
+        if (useEventLoop)
+        {
+            server.enableEventLoop(1);
+        }
+
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const ix::WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        std::atomic<bool> open(false);
+        std::atomic<int> receivedCount(0);
+        ix::WebSocket webSocket;
+        webSocket.setUrl(ss.str());
+        webSocket.disableAutomaticReconnection();
+        webSocket.disablePerMessageDeflate();
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                open = true;
+            }
+            else if (msg->type == ix::WebSocketMessageType::Message)
+            {
+                receivedCount++;
+            }
+        });
+        webSocket.start();
+
+        auto slowClient = connectSlowClient(port);
+
+        int attempts = 0;
+        while ((!open || server.getClients().size() != 2) && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(open);
+        REQUIRE(server.getClients().size() == 2);
+
+        // Much more than what the socket buffers of the slow client can take
+        WebSocketPreparedMessage message(std::string(64 * 1024, 'a'), true);
+        const int msgCount = 500;
+
+        BroadcastResult total;
+        for (int i = 0; i < msgCount; ++i)
+        {
+            auto result = server.broadcast(message);
+            total.queued += result.queued;
+            total.coalesced += result.coalesced;
+            total.dropped += result.dropped;
+            total.disconnected += result.disconnected;
+
+            // Let the regular client keep up, so that it stays below the high-water mark
+            attempts = 0;
+            while (receivedCount < i - 4 && attempts++ < 1000)
+            {
+                ix::msleep(1);
+            }
+        }
+
+        if (policy == SendQueueOverflowPolicy::Drop)
+        {
+            REQUIRE(total.dropped > 0);
+        }
+        else if (policy == SendQueueOverflowPolicy::Coalesce)
+        {
+            REQUIRE(total.coalesced > 0);
+            REQUIRE(total.dropped == 0);
+        }
+        else
+        {
+            REQUIRE(total.disconnected == 1);
+        }
+
+        // The queue of the slow client stays bounded
+        for (auto&& client : server.getClients())
+        {
+            REQUIRE(client->bufferedAmount() <= (1 << 20) + 2 * message.getFrame()->size());
+        }
+
+        // The regular client is not affected
+        attempts = 0;
+        while (receivedCount != msgCount && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(receivedCount == msgCount);
+
+        if (policy == SendQueueOverflowPolicy::Disconnect)
+        {
+            attempts = 0;
+            while (server.getClients().size() != 1 && attempts++ < 50)
+            {
+                ix::msleep(100);
+            }
+            REQUIRE(server.getClients().size() == 1);
+        }
+
+        webSocket.stop();
+        slowClient->close();
+        server.stop();
+    }
+} // namespace
+
+TEST_CASE("Websocket_server_large_messages", "[websocket_server]")
+{
+    SECTION("Large messages sent by a server are received intact")
+    {
+        echoLargeMessages(false);
+    }
+
+#ifdef __linux__
+    SECTION("Large messages sent by an event loop server are received intact")
+    {
+        echoLargeMessages(true);
+    }
+#endif
+}
+
+TEST_CASE("Websocket_server_broadcast", "[websocket_server]")
+{
+    SECTION("Messages received by a broadcast server are forwarded to the other clients")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.makeBroadcastServer();
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        const int clientCount = 3;
+        std::atomic<int> openCount(0);
+        std::mutex mutex;
+        std::vector<std::vector<std::string>> received(clientCount);
+        std::vector<std::unique_ptr<ix::WebSocket>> webSockets;
+
+        for (int i = 0; i < clientCount; ++i)
+        {
+            webSockets.emplace_back(new ix::WebSocket());
+            webSockets[i]->setUrl(ss.str());
+            webSockets[i]->disableAutomaticReconnection();
+            webSockets[i]->setOnMessageCallback([&, i](const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Open)
+                {
+                    openCount++;
+                }
+                else if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    received[i].push_back(msg->str);
+                }
+            });
+            webSockets[i]->start();
+        }
+
+        int attempts = 0;
+        while ((openCount != clientCount || server.getClients().size() != clientCount) &&
+               attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(openCount == clientCount);
+
+        webSockets[0]->sendText("hello");
+        webSockets[0]->sendBinary(std::string(100 * 1000, 'x'));
+
+        attempts = 0;
+        while (attempts++ < 50)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (received[1].size() == 2 && received[2].size() == 2) break;
+            }
+            ix::msleep(100);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<std::string> expected = {"hello", std::string(100 * 1000, 'x')};
+            REQUIRE(received[0].empty());
+            REQUIRE(received[1] == expected);
+            REQUIRE(received[2] == expected);
+        }
+
+        for (auto&& webSocket : webSockets)
+        {
+            webSocket->stop();
+        }
+        server.stop();
+    }
+
+    SECTION("Broadcasts made during a large send from another thread are deferred, not lost")
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port);
+        server.disablePerMessageDeflate();
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const ix::WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        REQUIRE(res.first);
+        server.start();
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        // The client does not read for a while once connected, so that the large send
+        // blocks until then
+        std::atomic<bool> open(false);
+        std::mutex mutex;
+        std::vector<std::string> received;
+        ix::WebSocket webSocket;
+        webSocket.setUrl(ss.str());
+        webSocket.disableAutomaticReconnection();
+        webSocket.disablePerMessageDeflate();
+        webSocket.setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+            if (msg->type == ix::WebSocketMessageType::Open)
+            {
+                open = true;
+                ix::msleep(1000);
+            }
+            else if (msg->type == ix::WebSocketMessageType::Message)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                received.push_back(msg->str);
+            }
+        });
+        webSocket.start();
+
+        int attempts = 0;
+        while ((!open || server.getClients().size() != 1) && attempts++ < 50)
+        {
+            ix::msleep(100);
+        }
+        REQUIRE(open);
+        REQUIRE(server.getClients().size() == 1);
+
+        auto client = *server.getClients().begin();
+        std::string largeMessage(8 * 1024 * 1024, 'x');
+        std::thread sender([client, &largeMessage] { client->sendBinary(largeMessage); });
+        ix::msleep(200);
+
+        const int msgCount = 10;
+        BroadcastResult total;
+        for (int i = 0; i < msgCount; ++i)
+        {
+            WebSocketPreparedMessage message(std::to_string(i));
+            auto result = server.broadcast(message);
+            total.dropped += result.dropped;
+            total.deferred += result.deferred;
+        }
+        REQUIRE(total.dropped == 0);
+        REQUIRE(total.deferred == msgCount);
+
+        sender.join();
+
+        attempts = 0;
+        while (attempts++ < 50)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (received.size() == msgCount + 1) break;
+            }
+            ix::msleep(100);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            REQUIRE(received.size() == msgCount + 1);
+            REQUIRE(received[0] == largeMessage);
+            for (int i = 0; i < msgCount; ++i)
+            {
+                REQUIRE(received[i + 1] == std::to_string(i));
+            }
+        }
+
+        webSocket.stop();
+        server.stop();
+    }
+
+    SECTION("Slow clients do not block broadcasts, and the overflow policy applies to them")
+    {
+        std::vector<SendQueueOverflowPolicy> policies = {SendQueueOverflowPolicy::Drop,
+                                                         SendQueueOverflowPolicy::Disconnect,
+                                                         SendQueueOverflowPolicy::Coalesce};
+        for (auto&& policy : policies)
+        {
+            broadcastToSlowClient(policy, false);
+        }
+
+#ifdef __linux__
+        for (auto&& policy : policies)
+        {
+            broadcastToSlowClient(policy, true);
+        }
+#endif
+    }
+}
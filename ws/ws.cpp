@@ -13,23 +13,31 @@
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <ixwebsocket/IXBench.h>
+#include <ixwebsocket/IXDNSCache.h>
 #include <ixwebsocket/IXDNSLookup.h>
+#include <ixwebsocket/IXGetFreePort.h>
 #include <ixwebsocket/IXGzipCodec.h>
 #include <ixwebsocket/IXHttpClient.h>
+#include <ixwebsocket/IXHttpParser.h>
 #include <ixwebsocket/IXHttpServer.h>
 #include <ixwebsocket/IXNetSystem.h>
 #include <ixwebsocket/IXSetThreadName.h>
 #include <ixwebsocket/IXSocket.h>
+#include <ixwebsocket/IXSocketFactory.h>
 #include <ixwebsocket/IXSocketTLSOptions.h>
 #include <ixwebsocket/IXUserAgent.h>
 #include <ixwebsocket/IXUuid.h>
 #include <ixwebsocket/IXWebSocket.h>
+#include <ixwebsocket/IXWebSocketClientLoop.h>
 #include <ixwebsocket/IXWebSocketHttpHeaders.h>
+#include <ixwebsocket/IXWebSocketMask.h>
 #include <ixwebsocket/IXWebSocketProxyServer.h>
 #include <ixwebsocket/IXWebSocketServer.h>
+#include <limits>
 #include <msgpack11.hpp>
 #include <mutex>
 #include <queue>
@@ -42,6 +50,7 @@
 
 #ifndef _WIN32
 #include <signal.h>
+#include <sys/resource.h>
 #else
 #include <process.h>
 #define getpid _getpid
@@ -933,54 +942,1150 @@ namespace ix
         return 0;
     }
 
+    // Many clients resolving the same host at once, as when they all reconnect
+    int ws_dns_bench(const std::string& hostname, int clientCount, int lookupCount, bool noCache)
+    {
+        auto dnsCache = std::make_shared<DNSCache>();
+
+        for (int round = 0; round < 2; ++round)
+        {
+            std::atomic<int> failures(0);
+            std::vector<std::thread> threads;
+
+            Bench bench(round == 0 ? "cold" : "warm");
+            bench.setReported();
+
+            for (int i = 0; i < clientCount; ++i)
+            {
+                threads.emplace_back([&hostname, &failures, dnsCache, lookupCount, noCache] {
+                    std::string errMsg;
+                    auto isCancellationRequested = []() -> bool { return false; };
+                    for (int j = 0; j < lookupCount; ++j)
+                    {
+                        if (noCache)
+                        {
+                            auto dnsLookup = std::make_shared<DNSLookup>(hostname, 80);
+                            auto res = dnsLookup->resolve(errMsg, isCancellationRequested);
+                            if (res == nullptr) failures++;
+                            dnsLookup->release(res);
+                        }
+                        else if (!dnsCache->resolve(
+                                     hostname, 80, errMsg, isCancellationRequested))
+                        {
+                            failures++;
+                        }
+                    }
+                });
+            }
+
+            for (auto&& thread : threads)
+            {
+                thread.join();
+            }
+            bench.record();
+
+            uint64_t queries = (uint64_t) clientCount * lookupCount;
+            if (!noCache)
+            {
+                queries = dnsCache->getMissCount() - dnsCache->getCoalescedCount() +
+                          dnsCache->getRefreshCount();
+            }
+
+            spdlog::info("{} {} lookups of {}: {} ms, {} failures, {} getaddrinfo calls in total",
+                         round == 0 ? "cold" : "warm",
+                         clientCount * lookupCount,
+                         hostname,
+                         bench.getDuration() / 1000,
+                         failures,
+                         queries);
+        }
+
+        if (!noCache)
+        {
+            spdlog::info("cache hits: {}, misses: {}, coalesced: {}",
+                         dnsCache->getHitCount(),
+                         dnsCache->getMissCount(),
+                         dnsCache->getCoalescedCount());
+        }
+
+        return 0;
+    }
+
+    // Clients connecting to a local TLS server, each closing its connection once the
+    // TLS handshake is done
+    int ws_tls_bench(const ix::SocketTLSOptions& serverTLSOptions,
+                     int clientCount,
+                     int handshakeCount)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port, "127.0.0.1");
+
+        auto tlsOptions = serverTLSOptions;
+        tlsOptions.tls = true;
+        server.setTLSOptions(tlsOptions);
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            spdlog::error(res.second);
+            return 1;
+        }
+        server.start();
+
+        std::atomic<int> failures(0);
+        std::vector<std::thread> threads;
+
+        Bench bench("tls handshakes");
+        bench.setReported();
+
+        for (int i = 0; i < clientCount; ++i)
+        {
+            threads.emplace_back([port, handshakeCount, &failures] {
+                SocketTLSOptions clientTLSOptions;
+                clientTLSOptions.caFile = "NONE";
+                auto isCancellationRequested = []() -> bool { return false; };
+
+                for (int j = 0; j < handshakeCount; ++j)
+                {
+                    std::string errMsg;
+                    auto socket = createSocket(true, -1, errMsg, clientTLSOptions);
+                    if (!socket ||
+                        !socket->connect("127.0.0.1", port, errMsg, isCancellationRequested))
+                    {
+                        failures++;
+                    }
+                }
+            });
+        }
+
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+        bench.record();
+
+        uint64_t durationMs = std::max(bench.getDuration() / 1000, (uint64_t) 1);
+        uint64_t handshakes = (uint64_t) clientCount * handshakeCount;
+        spdlog::info("{} TLS handshakes: {} ms, {} handshakes/s, {} failures",
+                     handshakes,
+                     durationMs,
+                     handshakes * 1000 / durationMs,
+                     failures);
+
+        server.stop();
+        return (failures == 0) ? 0 : 1;
+    }
+
     int ws_gzip(const std::string& filename, int runCount)
     {
-        auto res = readAsString(filename);
-        bool found = res.first;
-        if (!found)
+        auto res = readAsString(filename);
+        bool found = res.first;
+        if (!found)
+        {
+            spdlog::error("Cannot read content of {}", filename);
+            return 1;
+        }
+
+        spdlog::info("gzip input: {} size {} cksum {}",
+                     filename,
+                     res.second.size(),
+                     djb2HashStr(res.second));
+
+        std::string compressedBytes;
+
+        spdlog::info("compressing {} times", runCount);
+        std::vector<uint64_t> durations;
+        {
+            Bench bench("compressing file");
+            bench.setReported();
+
+            for (int i = 0; i < runCount; ++i)
+            {
+                bench.reset();
+                compressedBytes = gzipCompress(res.second);
+                bench.record();
+                durations.push_back(bench.getDuration());
+            }
+
+            size_t medianIdx = durations.size() / 2;
+            uint64_t medianRuntime = durations[medianIdx];
+            spdlog::info("median runtime to compress file: {}", medianRuntime);
+        }
+
+        std::string outputFilename(filename);
+        outputFilename += ".gz";
+
+        std::ofstream f;
+        f.open(outputFilename);
+        f << compressedBytes;
+        f.close();
+
+        spdlog::info("gzip output: {} size {} cksum {}",
+                     outputFilename,
+                     compressedBytes.size(),
+                     djb2HashStr(compressedBytes));
+
+        return 0;
+    }
+
+    //
+    // Measure how many frames per second a server can receive and dispatch. Frames
+    // are prepared in advance and written on a raw socket, so that the sender side
+    // has a negligible cost.
+    //
+    std::string buildMaskedFrames(int frameSize, int framesCount)
+    {
+        std::string frame;
+        frame.push_back((char) 0x82); // FIN + binary
+
+        if (frameSize < 126)
+        {
+            frame.push_back((char) (0x80 | frameSize));
+        }
+        else if (frameSize < 65536)
+        {
+            frame.push_back((char) (0x80 | 126));
+            frame.push_back((char) ((frameSize >> 8) & 0xff));
+            frame.push_back((char) (frameSize & 0xff));
+        }
+        else
+        {
+            frame.push_back((char) (0x80 | 127));
+            for (int i = 7; i >= 0; --i)
+            {
+                frame.push_back((char) (((uint64_t) frameSize >> (8 * i)) & 0xff));
+            }
+        }
+
+        const uint8_t maskingKey[4] = {0x12, 0x34, 0x56, 0x78};
+        frame.append((char*) maskingKey, 4);
+
+        for (int i = 0; i < frameSize; ++i)
+        {
+            frame.push_back((char) ('a' ^ maskingKey[i & 0x3]));
+        }
+
+        std::string frames;
+        frames.reserve(frame.size() * framesCount);
+        for (int i = 0; i < framesCount; ++i)
+        {
+            frames += frame;
+        }
+        return frames;
+    }
+
+    // Connect to a local server and perform the upgrade handshake by hand, so that the
+    // benchmarks can read and write raw frames
+    std::unique_ptr<Socket> connectRawWebSocket(int port)
+    {
+        std::string errMsg;
+        SocketTLSOptions tlsOptions;
+        auto socket = createSocket(false, -1, errMsg, tlsOptions);
+        auto isCancellationRequested = []() -> bool { return false; };
+
+        if (!socket || !socket->connect("127.0.0.1", port, errMsg, isCancellationRequested))
+        {
+            spdlog::error("Cannot connect to the server: {}", errMsg);
+            return nullptr;
+        }
+
+        socket->writeBytes("GET / HTTP/1.1\r\n"
+                           "Host: 127.0.0.1\r\n"
+                           "Upgrade: websocket\r\n"
+                           "Connection: Upgrade\r\n"
+                           "Sec-WebSocket-Version: 13\r\n"
+                           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                           "\r\n",
+                           isCancellationRequested);
+
+        // Skip the response status line and headers
+        while (true)
+        {
+            auto line = socket->readLine(isCancellationRequested);
+            if (!line.first)
+            {
+                spdlog::error("Cannot read the upgrade response");
+                return nullptr;
+            }
+            if (line.second == "\r\n") break;
+        }
+
+        return socket;
+    }
+
+    bool ws_receive_bench_run(int msgCount, int msgSize, int eventLoopThreads, bool zeroCopy)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port, "127.0.0.1");
+        server.disablePerMessageDeflate();
+
+        if (zeroCopy)
+        {
+            server.enableZeroCopyMessages();
+        }
+
+        if (eventLoopThreads >= 0)
+        {
+            server.enableEventLoop(eventLoopThreads);
+        }
+
+        std::atomic<int> receivedCount(0);
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        server.setOnClientMessageCallback(
+            [&](std::shared_ptr<ConnectionState> /*connectionState*/,
+                WebSocket& /*webSocket*/,
+                const WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    if (++receivedCount == msgCount)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        condition.notify_one();
+                    }
+                }
+            });
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            spdlog::error(res.second);
+            return false;
+        }
+        server.start();
+
+        auto isCancellationRequested = []() -> bool { return false; };
+        auto socket = connectRawWebSocket(port);
+        if (!socket) return false;
+
+        // Send the frames by batches of about 1MB
+        int batchCount = std::max(1, (1 << 20) / (msgSize + 14));
+        std::string batch = buildMaskedFrames(msgSize, batchCount);
+
+        std::stringstream ss;
+        ss << "receiving " << msgCount << " frames of " << msgSize << " bytes";
+        Bench bench(ss.str());
+        bench.setReported();
+
+        int sentCount = 0;
+        while (sentCount < msgCount)
+        {
+            int count = std::min(batchCount, msgCount - sentCount);
+            if (count != batchCount)
+            {
+                batch = buildMaskedFrames(msgSize, count);
+            }
+
+            if (!socket->writeBytes(batch, isCancellationRequested))
+            {
+                spdlog::error("Cannot send frames");
+                return false;
+            }
+            sentCount += count;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait_for(
+                lock, std::chrono::seconds(60), [&] { return receivedCount == msgCount; });
+        }
+        bench.record();
+
+        if (receivedCount != msgCount)
+        {
+            spdlog::error("Only received {} frames out of {}", receivedCount, msgCount);
+            return false;
+        }
+
+        auto duration = std::max(bench.getDuration(), (uint64_t) 1);
+        spdlog::info("{} bytes frames: {} frames/s, {:.1f} MB/s ({} frames in {} us)",
+                     msgSize,
+                     (uint64_t) msgCount * 1000 * 1000 / duration,
+                     (double) msgCount * msgSize / duration,
+                     msgCount,
+                     duration);
+
+        socket->close();
+        server.stop();
+        return true;
+    }
+
+    int ws_receive_bench(int msgCount, int msgSize, int eventLoopThreads, bool zeroCopy)
+    {
+        std::vector<int> msgSizes;
+        if (msgSize > 0)
+        {
+            msgSizes.push_back(msgSize);
+        }
+        else
+        {
+            msgSizes = {16, 64, 256, 1024, 4096};
+        }
+
+        for (auto&& size : msgSizes)
+        {
+            if (!ws_receive_bench_run(msgCount, size, eventLoopThreads, zeroCopy)) return 1;
+        }
+
+        return 0;
+    }
+
+    // Read frames from a raw socket until msgCount complete messages were received,
+    // skipping the payloads
+    bool readFrames(Socket& socket, int msgCount)
+    {
+        std::vector<uint8_t> buffer(1 << 20);
+        uint8_t header[14];
+        size_t headerSize = 0;
+        uint64_t payloadLeft = 0;
+        int receivedCount = 0;
+
+        while (receivedCount < msgCount)
+        {
+            auto pollResult = socket.isReadyToRead(1000);
+            if (pollResult == PollResultType::Timeout) continue;
+            if (pollResult != PollResultType::ReadyForRead) return false;
+
+            ssize_t ret = socket.recv(buffer.data(), buffer.size());
+            if (ret < 0 && Socket::isWaitNeeded()) continue;
+            if (ret <= 0) return false;
+
+            size_t i = 0;
+            while (i < (size_t) ret)
+            {
+                if (payloadLeft > 0)
+                {
+                    size_t n = (size_t) std::min(payloadLeft, (uint64_t)(ret - i));
+                    payloadLeft -= n;
+                    i += n;
+                    continue;
+                }
+
+                header[headerSize++] = buffer[i++];
+                if (headerSize < 2) continue;
+
+                size_t lengthBytes = (header[1] & 0x7f) == 126   ? 2
+                                     : (header[1] & 0x7f) == 127 ? 8
+                                                                 : 0;
+                size_t expected = 2 + lengthBytes + ((header[1] & 0x80) ? 4 : 0);
+                if (headerSize < expected) continue;
+
+                payloadLeft = header[1] & 0x7f;
+                if (lengthBytes != 0)
+                {
+                    payloadLeft = 0;
+                    for (size_t j = 0; j < lengthBytes; ++j)
+                    {
+                        payloadLeft = (payloadLeft << 8) | header[2 + j];
+                    }
+                }
+
+                // fin bit set on a data or continuation frame
+                if ((header[0] & 0x80) && (header[0] & 0x0f) <= 0x2)
+                {
+                    receivedCount++;
+                }
+                headerSize = 0;
+            }
+        }
+
+        return true;
+    }
+
+    bool ws_send_bench_run(int msgSize, int eventLoopThreads)
+    {
+        int port = getFreePort();
+        ix::WebSocketServer server(port, "127.0.0.1");
+        server.disablePerMessageDeflate();
+
+        if (eventLoopThreads >= 0)
+        {
+            server.enableEventLoop(eventLoopThreads);
+        }
+
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            spdlog::error(res.second);
+            return false;
+        }
+        server.start();
+
+        auto socket = connectRawWebSocket(port);
+        if (!socket) return false;
+
+        std::shared_ptr<WebSocket> webSocket;
+        for (int i = 0; i < 100 && !webSocket; ++i)
+        {
+            // Clients are registered before the end of the handshake
+            auto clients = server.getClients();
+            if (clients.empty() ||
+                (*clients.begin())->getReadyState() != ix::ReadyState::Open)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            webSocket = *clients.begin();
+        }
+
+        if (!webSocket)
+        {
+            spdlog::error("The server did not register the connection");
+            return false;
+        }
+
+        // Send about 1GB of data
+        int msgCount = std::max(1, (1 << 30) / msgSize);
+        std::string payload(msgSize, 'a');
+
+        std::stringstream ss;
+        ss << "sending " << msgCount << " messages of " << msgSize << " bytes";
+        Bench bench(ss.str());
+        bench.setReported();
+
+        std::atomic<bool> success(false);
+        std::thread reader([&] { success = readFrames(*socket, msgCount); });
+
+        for (int i = 0; i < msgCount; ++i)
+        {
+            webSocket->sendBinary(payload);
+        }
+
+        reader.join();
+        bench.record();
+
+        if (!success)
+        {
+            spdlog::error("Cannot read all the messages");
+            return false;
+        }
+
+        auto duration = std::max(bench.getDuration(), (uint64_t) 1);
+        spdlog::info("{} bytes messages: {:.1f} MB/s ({} messages in {} us)",
+                     msgSize,
+                     (double) msgCount * msgSize / duration,
+                     msgCount,
+                     duration);
+
+        socket->close();
+        server.stop();
+        return true;
+    }
+
+    int ws_send_bench(int msgSize, int eventLoopThreads)
+    {
+        std::vector<int> msgSizes;
+        if (msgSize > 0)
+        {
+            msgSizes.push_back(msgSize);
+        }
+        else
+        {
+            msgSizes = {64 << 10, 256 << 10, 1 << 20, 4 << 20, 16 << 20};
+        }
+
+        for (auto&& size : msgSizes)
+        {
+            if (!ws_send_bench_run(size, eventLoopThreads)) return 1;
+        }
+
+        return 0;
+    }
+
+    // Each connection uses a few file descriptors on both ends (socket and select
+    // interrupt), raise the limit as much as allowed
+    void raiseOpenFilesLimit(int clientCount)
+    {
+#ifndef _WIN32
+        struct rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+
+        rlim_t needed = (rlim_t) clientCount * 6 + 64;
+        if (limit.rlim_cur < needed)
+        {
+            spdlog::warn("The open files limit ({}) is too low for {} clients, "
+                         "about {} are needed",
+                         (uint64_t) limit.rlim_cur,
+                         clientCount,
+                         (uint64_t) needed);
+        }
+#endif
+    }
+
+    int ws_broadcast_bench(
+        int clientCount, int msgCount, int msgSize, int eventLoopThreads, bool legacy)
+    {
+        raiseOpenFilesLimit(clientCount);
+
+        int port = getFreePort();
+        int backlog = 1024;
+        ix::WebSocketServer server(port, "127.0.0.1", backlog, (size_t) clientCount + 1);
+        server.disablePerMessageDeflate();
+
+        if (eventLoopThreads >= 0)
+        {
+            server.enableEventLoop(eventLoopThreads);
+        }
+
+        server.setOnClientMessageCallback([](std::shared_ptr<ConnectionState> /*connectionState*/,
+                                             WebSocket& /*webSocket*/,
+                                             const WebSocketMessagePtr& /*msg*/) {});
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            spdlog::error(res.second);
+            return 1;
+        }
+        server.start();
+
+        // The clients are served by a few threads
+        auto clientLoop = std::make_shared<ix::WebSocketClientLoop>(4);
+        std::string errorMsg;
+        if (!clientLoop->start(errorMsg))
+        {
+            spdlog::error("Cannot start the client loop: {}", errorMsg);
+            return 1;
+        }
+
+        std::atomic<int> openCount(0);
+        std::atomic<uint64_t> receivedCount(0);
+        uint64_t expectedCount = (uint64_t) clientCount * msgCount;
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        std::stringstream ss;
+        ss << "ws://127.0.0.1:" << port << "/";
+
+        std::vector<std::unique_ptr<ix::WebSocket>> webSockets;
+        for (int i = 0; i < clientCount; ++i)
+        {
+            webSockets.emplace_back(new ix::WebSocket());
+            auto& webSocket = webSockets.back();
+            webSocket->setUrl(ss.str());
+            webSocket->disableAutomaticReconnection();
+            webSocket->disablePerMessageDeflate();
+            webSocket->setClientLoop(clientLoop);
+            webSocket->setOnMessageCallback([&](const ix::WebSocketMessagePtr& msg) {
+                if (msg->type == ix::WebSocketMessageType::Open)
+                {
+                    openCount++;
+                }
+                else if (msg->type == ix::WebSocketMessageType::Message)
+                {
+                    if (++receivedCount == expectedCount)
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        condition.notify_one();
+                    }
+                }
+                else if (msg->type == ix::WebSocketMessageType::Error)
+                {
+                    spdlog::error("Connection error: {}", msg->errorInfo.reason);
+                }
+            });
+            webSocket->start();
+        }
+
+        for (int i = 0; i < 1200; ++i)
+        {
+            if (openCount == clientCount && server.getClients().size() == (size_t) clientCount)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        if (openCount != clientCount)
+        {
+            spdlog::error("Only {} clients out of {} are connected", openCount, clientCount);
+            return 1;
+        }
+
+        std::string payload(msgSize, 'a');
+        BroadcastResult total;
+        uint64_t broadcastDuration = 0;
+
+        std::stringstream name;
+        name << "broadcasting " << msgCount << " messages to " << clientCount << " clients";
+        Bench bench(name.str());
+        bench.setReported();
+
+        for (int i = 0; i < msgCount; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            if (legacy)
+            {
+                for (auto&& client : server.getClients())
+                {
+                    client->sendBinary(payload);
+                }
+            }
+            else
+            {
+                WebSocketPreparedMessage message(payload, true);
+                auto result = server.broadcast(message);
+                total.queued += result.queued;
+                total.dropped += result.dropped;
+            }
+
+            broadcastDuration += std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait_for(lock, std::chrono::seconds(120), [&] {
+                return receivedCount + total.dropped == expectedCount;
+            });
+        }
+        bench.record();
+
+        auto duration = std::max(bench.getDuration(), (uint64_t) 1);
+        spdlog::info("{} clients, {} bytes messages: {} deliveries/s, {} us per broadcast call, "
+                     "{} messages received and {} dropped in {} us",
+                     clientCount,
+                     msgSize,
+                     (uint64_t) receivedCount * 1000 * 1000 / duration,
+                     broadcastDuration / std::max(msgCount, 1),
+                     (uint64_t) receivedCount,
+                     total.dropped,
+                     duration);
+
+        server.stop();
+        for (auto&& webSocket : webSockets)
+        {
+            webSocket->stop();
+        }
+
+        return (receivedCount + total.dropped == expectedCount) ? 0 : 1;
+    }
+
+    // Send requests on a connection, pipelined by batches, and read the responses.
+    // Without keep-alive each request uses a new connection. The time taken by each
+    // batch, in microseconds, is added to latencies.
+    bool runHttpBenchConnection(int port,
+                                int requestCount,
+                                int pipelineDepth,
+                                bool keepAlive,
+                                std::vector<uint64_t>& latencies)
+    {
+        std::string request("GET /bench HTTP/1.1\r\nHost: 127.0.0.1\r\n");
+        if (!keepAlive) request += "Connection: close\r\n";
+        request += "\r\n";
+
+        std::string errMsg;
+        SocketTLSOptions tlsOptions;
+        auto isCancellationRequested = []() -> bool { return false; };
+        std::unique_ptr<Socket> socket;
+
+        int sentCount = 0;
+        while (sentCount < requestCount)
         {
-            spdlog::error("Cannot read content of {}", filename);
+            if (!socket)
+            {
+                socket = createSocket(false, -1, errMsg, tlsOptions);
+                if (!socket || !socket->connect("127.0.0.1", port, errMsg, isCancellationRequested))
+                {
+                    spdlog::error("Cannot connect to the server: {}", errMsg);
+                    return false;
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            int batchSize = keepAlive ? std::min(pipelineDepth, requestCount - sentCount) : 1;
+            std::string batch;
+            for (int i = 0; i < batchSize; ++i)
+            {
+                batch += request;
+            }
+
+            if (!socket->writeBytes(batch, isCancellationRequested))
+            {
+                spdlog::error("Cannot send requests");
+                return false;
+            }
+
+            for (int i = 0; i < batchSize; ++i)
+            {
+                HttpResponseHead head;
+                if (HttpParser::readResponse(*socket, isCancellationRequested, head) !=
+                    HttpParseResult::Complete)
+                {
+                    spdlog::error("Cannot read response");
+                    return false;
+                }
+
+                size_t contentLength = 0;
+                for (auto&& header : head.headers)
+                {
+                    if (header.name == "Content-Length")
+                    {
+                        contentLength = std::stoul(header.value.str());
+                    }
+                }
+
+                if (!socket->readBytes(contentLength, nullptr, isCancellationRequested).first)
+                {
+                    spdlog::error("Cannot read response body");
+                    return false;
+                }
+            }
+
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            latencies.push_back(
+                (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+
+            sentCount += batchSize;
+            if (!keepAlive) socket.reset();
+        }
+
+        return true;
+    }
+
+    // Small POST requests sent through a client shared by all the bench threads
+    bool runHttpClientBench(HttpClient& httpClient, int port, int requestCount)
+    {
+        std::string url("http://127.0.0.1:" + std::to_string(port) + "/bench");
+        auto args = httpClient.createRequest(url, HttpClient::kPost);
+
+        for (int i = 0; i < requestCount; ++i)
+        {
+            auto response = httpClient.post(url, std::string("{\"count\":1}"), args);
+            if (response->errorCode != HttpErrorCode::Ok)
+            {
+                spdlog::error("Request failed: {}", response->errorMsg);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // All the requests are given at once to an async client, which keeps up to
+    // inFlightCount of them in flight
+    bool runAsyncHttpClientBench(int port, int requestCount, int inFlightCount, bool keepAlive)
+    {
+        HttpClient httpClient(true);
+        httpClient.setMaxConnectionsPerHost((size_t) inFlightCount);
+        httpClient.setMaxInFlightRequests((size_t) inFlightCount);
+        if (!keepAlive) httpClient.setIdleConnectionTimeoutSecs(0);
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        int responseCount = 0;
+        bool success = true;
+
+        std::string url("http://127.0.0.1:" + std::to_string(port) + "/bench");
+        for (int i = 0; i < requestCount; ++i)
+        {
+            auto args = httpClient.createRequest(url, HttpClient::kPost);
+            args->body = "{\"count\":1}";
+
+            httpClient.performRequest(args, [&](const HttpResponsePtr& response) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (response->errorCode != HttpErrorCode::Ok)
+                {
+                    spdlog::error("Request failed: {}", response->errorMsg);
+                    success = false;
+                }
+                if (++responseCount == requestCount) condition.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&] { return responseCount == requestCount; });
+        return success;
+    }
+
+    // Responses sent delayMs after their request, in order, from a single thread
+    class DelayedResponder
+    {
+    public:
+        DelayedResponder(int delayMs, const HttpResponsePtr& response)
+            : _delay(std::chrono::milliseconds(delayMs))
+            , _response(response)
+            , _stop(false)
+            , _thread(&DelayedResponder::run, this)
+        {
+        }
+
+        ~DelayedResponder()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _condition.notify_one();
+            _thread.join();
+        }
+
+        void add(const HttpResponderPtr& responder)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::make_pair(std::chrono::steady_clock::now() + _delay, responder));
+            _condition.notify_one();
+        }
+
+    private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_stop)
+            {
+                if (_queue.empty())
+                {
+                    _condition.wait(lock);
+                }
+                else if (std::chrono::steady_clock::now() < _queue.front().first)
+                {
+                    _condition.wait_until(lock, _queue.front().first);
+                }
+                else
+                {
+                    auto responder = _queue.front().second;
+                    _queue.pop_front();
+                    responder->respond(_response);
+                }
+            }
+        }
+
+        std::chrono::steady_clock::duration _delay;
+        HttpResponsePtr _response;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, HttpResponderPtr>> _queue;
+        bool _stop;
+        std::thread _thread;
+    };
+
+    int ws_httpd_bench(int connectionCount,
+                       int requestCount,
+                       int pipelineDepth,
+                       bool keepAlive,
+                       bool useHttpClient,
+                       bool useAsyncHttpClient,
+                       int eventLoopThreads,
+                       int responseDelayMs)
+    {
+        int port = getFreePort();
+        ix::HttpServer server(port, "127.0.0.1", 1024, (size_t) connectionCount + 16);
+        server.setMaxRequestsPerConnection(std::numeric_limits<int>::max());
+
+        auto response = std::make_shared<HttpResponse>(
+            200, "OK", HttpErrorCode::Ok, WebSocketHttpHeaders(), std::string("hello world"));
+
+        // Handlers waiting for a backend, either holding their thread or responding later
+        // from another one
+        std::unique_ptr<DelayedResponder> delayedResponder;
+        if (eventLoopThreads >= 0)
+        {
+            if (responseDelayMs > 0)
+            {
+                delayedResponder.reset(new DelayedResponder(responseDelayMs, response));
+            }
+            auto delayed = delayedResponder.get();
+
+            server.setOnAsyncConnectionCallback(
+                [response, delayed](HttpRequestPtr /*request*/,
+                                    std::shared_ptr<ConnectionState> /*connectionState*/,
+                                    HttpResponderPtr responder) {
+                    if (delayed)
+                    {
+                        delayed->add(responder);
+                    }
+                    else
+                    {
+                        responder->respond(response);
+                    }
+                },
+                (size_t) eventLoopThreads);
+        }
+        else
+        {
+            server.setOnConnectionCallback(
+                [response, responseDelayMs](
+                    HttpRequestPtr /*request*/,
+                    std::shared_ptr<ConnectionState> /*connectionState*/) -> HttpResponsePtr {
+                    if (responseDelayMs > 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(responseDelayMs));
+                    }
+                    return response;
+                });
+        }
+
+        auto res = server.listen();
+        if (!res.first)
+        {
+            spdlog::error(res.second);
             return 1;
         }
+        server.start();
 
-        spdlog::info("gzip input: {} size {} cksum {}",
-                     filename,
-                     res.second.size(),
-                     djb2HashStr(res.second));
+        std::stringstream ss;
+        ss << requestCount << " requests on " << connectionCount << " connections";
+        Bench bench(ss.str());
+        bench.setReported();
 
-        std::string compressedBytes;
+        HttpClient httpClient;
+        httpClient.setMaxConnectionsPerHost((size_t) connectionCount);
+        if (!keepAlive) httpClient.setIdleConnectionTimeoutSecs(0);
 
-        spdlog::info("compressing {} times", runCount);
-        std::vector<uint64_t> durations;
+        std::atomic<bool> success(true);
+        std::vector<std::thread> threads;
+        std::vector<std::vector<uint64_t>> latencies((size_t) connectionCount);
+        if (useAsyncHttpClient)
         {
-            Bench bench("compressing file");
+            success = runAsyncHttpClientBench(port, requestCount, connectionCount, keepAlive);
+        }
+
+        for (int i = 0; i < connectionCount && !useAsyncHttpClient; ++i)
+        {
+            int count = requestCount / connectionCount + (i < requestCount % connectionCount);
+            auto& connectionLatencies = latencies[i];
+            threads.emplace_back([&success,
+                                  &httpClient,
+                                  &connectionLatencies,
+                                  port,
+                                  count,
+                                  pipelineDepth,
+                                  keepAlive,
+                                  useHttpClient] {
+                bool ok = useHttpClient
+                              ? runHttpClientBench(httpClient, port, count)
+                              : runHttpBenchConnection(
+                                    port, count, pipelineDepth, keepAlive, connectionLatencies);
+                if (!ok) success = false;
+            });
+        }
+
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+        bench.record();
+        server.stop();
+        delayedResponder.reset();
+
+        std::string mode(useAsyncHttpClient ? "async HttpClient" : "HttpClient");
+        if (!useHttpClient && !useAsyncHttpClient)
+        {
+            mode = "pipeline depth " + std::to_string(keepAlive ? pipelineDepth : 1);
+        }
+
+        auto duration = std::max(bench.getDuration(), (uint64_t) 1);
+        spdlog::info("{} requests, {} connections, keep-alive {}, {}: {} req/s",
+                     requestCount,
+                     connectionCount,
+                     keepAlive ? "on" : "off",
+                     mode,
+                     (uint64_t) requestCount * 1000 * 1000 / duration);
+
+        // Time to get the responses of a batch, measured without HttpClient
+        std::vector<uint64_t> allLatencies;
+        for (auto&& connectionLatencies : latencies)
+        {
+            allLatencies.insert(
+                allLatencies.end(), connectionLatencies.begin(), connectionLatencies.end());
+        }
+        if (!allLatencies.empty())
+        {
+            std::sort(allLatencies.begin(), allLatencies.end());
+            spdlog::info("latency: p50 {} us, p99 {} us, max {} us",
+                         allLatencies[allLatencies.size() / 2],
+                         allLatencies[allLatencies.size() * 99 / 100],
+                         allLatencies.back());
+        }
+
+        return success ? 0 : 1;
+    }
+
+    void maskBytewise(uint8_t* data, size_t size, const uint8_t maskingKey[4])
+    {
+        for (size_t i = 0; i != size; ++i)
+        {
+            data[i] ^= maskingKey[i & 0x3];
+        }
+    }
+
+    template<typename Function>
+    void ws_mask_bench_run(const std::string& name,
+                           size_t msgSize,
+                           int runCount,
+                           Function function)
+    {
+        // Run enough iterations to process at least 1GB
+        uint64_t iterations = std::max((uint64_t) 1, (uint64_t)(1 << 30) / msgSize);
+
+        uint64_t best = std::numeric_limits<uint64_t>::max();
+        for (int i = 0; i < runCount; ++i)
+        {
+            Bench bench(name);
             bench.setReported();
 
-            for (int i = 0; i < runCount; ++i)
+            for (uint64_t j = 0; j < iterations; ++j)
             {
-                bench.reset();
-                compressedBytes = gzipCompress(res.second);
-                bench.record();
-                durations.push_back(bench.getDuration());
+                function();
             }
 
-            size_t medianIdx = durations.size() / 2;
-            uint64_t medianRuntime = durations[medianIdx];
-            spdlog::info("median runtime to compress file: {}", medianRuntime);
+            bench.record();
+            best = std::min(best, std::max(bench.getDuration(), (uint64_t) 1));
         }
 
-        std::string outputFilename(filename);
-        outputFilename += ".gz";
+        // bytes per microsecond / 1000 = GB/s
+        spdlog::info("{} bytes {:<10} {:.2f} GB/s",
+                     msgSize,
+                     name,
+                     (double) iterations * msgSize / best / 1000);
+    }
 
-        std::ofstream f;
-        f.open(outputFilename);
-        f << compressedBytes;
-        f.close();
+    int ws_mask_bench(int msgSize, int runCount)
+    {
+        spdlog::info("masking kernel: {}", ix::getMaskingKernelName());
 
-        spdlog::info("gzip output: {} size {} cksum {}",
-                     outputFilename,
-                     compressedBytes.size(),
-                     djb2HashStr(compressedBytes));
+        std::vector<size_t> msgSizes;
+        if (msgSize > 0)
+        {
+            msgSizes.push_back(msgSize);
+        }
+        else
+        {
+            msgSizes = {16, 64, 256, 1024, 4096, 65536, 1 << 20};
+        }
+
+        const uint8_t maskingKey[4] = {0x12, 0x34, 0x56, 0x78};
+
+        for (auto&& size : msgSizes)
+        {
+            // Offset by one byte so that the payload is not aligned, as in a frame
+            std::vector<uint8_t> src(size + 1, 'a');
+            std::vector<uint8_t> dst(size + 1);
+            uint8_t* data = &src[1];
+
+            ws_mask_bench_run("bytewise", size, runCount, [&] {
+                maskBytewise(data, size, maskingKey);
+            });
+            ws_mask_bench_run("in place", size, runCount, [&] {
+                ix::maskInPlace(data, size, maskingKey);
+            });
+            ws_mask_bench_run("copy", size, runCount, [&] {
+                ix::maskCopy(&dst[1], data, size, maskingKey);
+            });
+        }
 
         return 0;
     }
@@ -1165,7 +2270,8 @@ namespace ix
                             bool ipv6,
                             bool disablePerMessageDeflate,
                             bool disablePong,
-                            const std::string& httpHeaderAuthorization)
+                            const std::string& httpHeaderAuthorization,
+                            int eventLoopThreads)
     {
         spdlog::info("Listening on {}:{}", hostname, port);
 
@@ -1190,6 +2296,12 @@ namespace ix
             server.disablePong();
         }
 
+        if (eventLoopThreads >= 0)
+        {
+            spdlog::info("Enable event loop mode, threads: {}", eventLoopThreads);
+            server.enableEventLoop(eventLoopThreads);
+        }
+
         server.setOnClientMessageCallback(
             [greetings, httpHeaderAuthorization](std::shared_ptr<ConnectionState> connectionState,
                                                  WebSocket& webSocket,
@@ -1359,6 +2471,7 @@ namespace ix
                             const std::string& data,
                             const std::string& formData,
                             const std::string& dataBinary,
+                            const std::string& uploadFile,
                             bool headersOnly,
                             int connectTimeout,
                             int transferTimeout,
@@ -1369,6 +2482,8 @@ namespace ix
                             const std::string& output,
                             bool compress,
                             bool compressRequest,
+                            bool resume,
+                            int parallel,
                             const ix::SocketTLSOptions& tlsOptions)
     {
         HttpClient httpClient;
@@ -1392,6 +2507,44 @@ namespace ix
             return true;
         };
 
+        // Downloads are streamed to disk, instead of being held in memory
+        std::ofstream out;
+        std::string filename;
+        if (!headersOnly && (save || !output.empty()))
+        {
+            // FIMXE we should decode the url first
+            filename = output.empty() ? extractFilename(url) : output;
+
+            if (filename.empty())
+            {
+                spdlog::error("Cannot save content to disk: No output file supplied, and not "
+                              "filename could be extracted from the url {}",
+                              url);
+                return 1;
+            }
+
+            spdlog::info("Writing to disk: {}", filename);
+            if (resume || parallel > 1)
+            {
+                // Range requests, done by HttpClient::download
+                if (!resume) std::remove(filename.c_str());
+            }
+            else
+            {
+                out.open(filename, std::ios::binary);
+                if (!out)
+                {
+                    spdlog::error("Cannot open {} for writing", filename);
+                    return 1;
+                }
+
+                args->onChunkCallback = [&out](const char* data, size_t size) -> bool {
+                    out.write(data, size);
+                    return (bool) out;
+                };
+            }
+        }
+
         HttpParameters httpParameters = parseHttpParameters(data);
         HttpFormDataParameters httpFormDataParameters = parseHttpFormDataParameters(formData);
 
@@ -1400,6 +2553,28 @@ namespace ix
         {
             response = httpClient.head(url, args);
         }
+        else if (!uploadFile.empty())
+        {
+            // Streamed from disk, and compressed on the fly with --compress_request
+            args->bodyProvider = HttpBodyProvider::fromFile(uploadFile);
+            if (!args->bodyProvider)
+            {
+                spdlog::error("Cannot read {}", uploadFile);
+                return 1;
+            }
+            args->onUploadProgressCallback = [verbose](uint64_t current, int64_t total) -> bool {
+                if (verbose)
+                {
+                    spdlog::info("Uploaded {} bytes out of {}", current, total);
+                }
+                return true;
+            };
+            response = httpClient.request(url, HttpClient::kPut, std::string(), args);
+        }
+        else if (!filename.empty() && (resume || parallel > 1))
+        {
+            response = httpClient.download(url, filename, args, parallel);
+        }
         else if (data.empty() && formData.empty() && dataBinary.empty())
         {
             response = httpClient.get(url, args);
@@ -1436,26 +2611,15 @@ namespace ix
 
         if (!headersOnly && response->errorCode == HttpErrorCode::Ok)
         {
-            if (save || !output.empty())
+            if (!filename.empty())
             {
-                // FIMXE we should decode the url first
-                std::string filename = extractFilename(url);
-                if (!output.empty())
-                {
-                    filename = output;
-                }
-
-                if (filename.empty())
+                if (out.is_open())
                 {
-                    spdlog::error("Cannot save content to disk: No output file supplied, and not "
-                                  "filename could be extracted from the url {}",
-                                  url);
+                    spdlog::info("Wrote {} bytes to {}", (uint64_t) out.tellp(), filename);
                 }
                 else
                 {
-                    spdlog::info("Writing to disk: {}", filename);
-                    std::ofstream out(filename);
-                    out << response->body;
+                    spdlog::info("Downloaded {}", filename);
                 }
             }
             else
@@ -1663,7 +2827,8 @@ namespace ix
                        bool ipv6,
                        bool disablePerMessageDeflate,
                        bool disablePong,
-                       const std::string& sendMsg)
+                       const std::string& sendMsg,
+                       int eventLoopThreads)
     {
         spdlog::info("Listening on {}:{}", hostname, port);
 
@@ -1688,6 +2853,12 @@ namespace ix
             server.disablePong();
         }
 
+        if (eventLoopThreads >= 0)
+        {
+            spdlog::info("Enable event loop mode, threads: {}", eventLoopThreads);
+            server.enableEventLoop(eventLoopThreads);
+        }
+
         // push one million messages
         std::atomic<bool> stop(false);
 
@@ -2458,6 +3629,7 @@ int main(int argc, char** argv)
     std::string data;
     std::string formData;
     std::string binaryData;
+    std::string uploadFile;
     std::string headers;
     std::string output;
     std::string hostname("127.0.0.1");
@@ -2489,6 +3661,7 @@ int main(int argc, char** argv)
     bool fluentd = false;
     bool compress = false;
     bool compressRequest = false;
+    bool resume = false;
     bool stress = false;
     bool disableAutomaticReconnection = false;
     bool disablePerMessageDeflate = false;
@@ -2504,13 +3677,29 @@ int main(int argc, char** argv)
     int connectTimeOut = 60;
     int transferTimeout = 1800;
     int maxRedirects = 5;
+    int parallel = 1;
     int delayMs = -1;
     int count = 1;
     int msgCount = 1000 * 1000;
+    int msgSize = 0;
     uint32_t maxWaitBetweenReconnectionRetries = 10 * 1000; // 10 seconds
     int pingIntervalSecs = 30;
     int runCount = 1;
+    int eventLoopThreads = -1;
     bool decompressGzipMessages = false;
+    bool zeroCopy = false;
+    int clientCount = 10 * 1000;
+    int broadcastCount = 100;
+    int broadcastSize = 64;
+    bool legacyBroadcast = false;
+    int connectionCount = 8;
+    int requestCount = 100 * 1000;
+    int pipelineDepth = 1;
+    bool disableKeepAlive = false;
+    bool useHttpClient = false;
+    bool useAsyncHttpClient = false;
+    int responseDelayMs = 0;
+    bool noDnsCache = false;
 
     auto addGenericOptions = [&pidfile](CLI::App* app) {
         app->add_option("--pidfile", pidfile, "Pid file");
@@ -2602,6 +3791,9 @@ int main(int argc, char** argv)
     echoServerApp->add_flag("-6", ipv6, "IpV6");
     echoServerApp->add_flag("-x", disablePerMessageDeflate, "Disable per message deflate");
     echoServerApp->add_flag("-p", disablePong, "Disable sending PONG in response to PING");
+    echoServerApp->add_option("--event_loop",
+                              eventLoopThreads,
+                              "Serve connections from N event loop threads (0: one per core)");
     addGenericOptions(echoServerApp);
     addTLSOptions(echoServerApp);
 
@@ -2614,6 +3806,9 @@ int main(int argc, char** argv)
     pushServerApp->add_flag("-x", disablePerMessageDeflate, "Disable per message deflate");
     pushServerApp->add_flag("-p", disablePong, "Disable sending PONG in response to PING");
     pushServerApp->add_option("--send_msg", sendMsg, "Send message");
+    pushServerApp->add_option("--event_loop",
+                              eventLoopThreads,
+                              "Serve connections from N event loop threads (0: one per core)");
     addTLSOptions(pushServerApp);
 
     CLI::App* broadcastServerApp = app.add_subcommand("broadcast_server", "Broadcasting server");
@@ -2633,6 +3828,7 @@ int main(int argc, char** argv)
     httpClientApp->add_option("-d", data, "Form data")->join();
     httpClientApp->add_option("-F", formData, "Form data")->join();
     httpClientApp->add_option("--data-binary", binaryData, "Body binary data")->join();
+    httpClientApp->add_option("-T,--upload-file", uploadFile, "Stream a file with a PUT request");
     httpClientApp->add_option("-H", headers, "Header")->join();
     httpClientApp->add_option("--output", output, "Output file");
     httpClientApp->add_flag("-I", headersOnly, "Send a HEAD request");
@@ -2644,6 +3840,9 @@ int main(int argc, char** argv)
     httpClientApp->add_flag("--compress_request", compressRequest, "Compress request with gzip");
     httpClientApp->add_option("--connect-timeout", connectTimeOut, "Connection timeout");
     httpClientApp->add_option("--transfer-timeout", transferTimeout, "Transfer timeout");
+    httpClientApp->add_flag("-C", resume, "Resume the download of an existing output file");
+    httpClientApp->add_option(
+        "--parallel", parallel, "Download the output file with parallel range requests");
     addTLSOptions(httpClientApp);
 
     CLI::App* httpServerApp = app.add_subcommand("httpd", "HTTP server");
@@ -2684,6 +3883,83 @@ int main(int argc, char** argv)
     gunzipApp->fallthrough();
     gunzipApp->add_option("filename", filename, "Filename")->required();
 
+    CLI::App* receiveBenchApp =
+        app.add_subcommand("receive_bench", "Benchmark the server receive path");
+    receiveBenchApp->fallthrough();
+    receiveBenchApp->add_option("--msg_count", msgCount, "Total message count to be sent");
+    receiveBenchApp->add_option(
+        "--msg_size", msgSize, "Message size in bytes (all sizes from 16 to 4K by default)");
+    receiveBenchApp->add_option("--event_loop",
+                                eventLoopThreads,
+                                "Serve connections from N event loop threads (0: one per core)");
+    receiveBenchApp->add_flag("--zero_copy", zeroCopy, "Deliver messages without copying them");
+
+    CLI::App* sendBenchApp =
+        app.add_subcommand("send_bench", "Benchmark the server send path with large messages");
+    sendBenchApp->fallthrough();
+    sendBenchApp->add_option(
+        "--msg_size", msgSize, "Message size in bytes (all sizes from 64K to 16M by default)");
+    sendBenchApp->add_option("--event_loop",
+                             eventLoopThreads,
+                             "Serve connections from N event loop threads (0: one per core)");
+
+    CLI::App* broadcastBenchApp = app.add_subcommand(
+        "broadcast_bench", "Benchmark broadcasting messages to many local clients");
+    broadcastBenchApp->fallthrough();
+    broadcastBenchApp->add_option("--clients", clientCount, "Number of clients");
+    broadcastBenchApp->add_option("--msg_count", broadcastCount, "Number of broadcast messages");
+    broadcastBenchApp->add_option("--msg_size", broadcastSize, "Message size in bytes");
+    broadcastBenchApp->add_option("--event_loop",
+                                  eventLoopThreads,
+                                  "Serve connections from N event loop threads (0: one per core)");
+    broadcastBenchApp->add_flag(
+        "--legacy", legacyBroadcast, "Call send for each client instead of broadcast");
+
+    CLI::App* httpdBenchApp =
+        app.add_subcommand("httpd_bench", "Benchmark the HTTP server with a local load generator");
+    httpdBenchApp->fallthrough();
+    httpdBenchApp->add_option("--connections", connectionCount, "Number of client connections");
+    httpdBenchApp->add_option("--requests", requestCount, "Total number of requests");
+    httpdBenchApp->add_option("--pipeline", pipelineDepth, "Requests sent at once on a connection");
+    httpdBenchApp->add_flag(
+        "--no_keep_alive", disableKeepAlive, "Use a new connection for each request");
+    httpdBenchApp->add_flag("--http_client",
+                            useHttpClient,
+                            "Send POST requests with a shared HttpClient (--pipeline is ignored)");
+    httpdBenchApp->add_flag(
+        "--async",
+        useAsyncHttpClient,
+        "Send POST requests with an async HttpClient, --connections requests in flight");
+    httpdBenchApp->add_option(
+        "--event_loop",
+        eventLoopThreads,
+        "Use an async handler, served from N event loop threads (0: one per core)");
+    httpdBenchApp->add_option(
+        "--delay_ms", responseDelayMs, "Respond after N ms, as if waiting for a backend");
+
+    CLI::App* dnsBenchApp =
+        app.add_subcommand("dns_bench", "Benchmark concurrent lookups of the same host");
+    dnsBenchApp->fallthrough();
+    dnsBenchApp->add_option("--host", hostname, "Hostname");
+    dnsBenchApp->add_option("--clients", clientCount, "Number of concurrent clients");
+    dnsBenchApp->add_option("--count", count, "Number of lookups per client, one after the other");
+    dnsBenchApp->add_flag(
+        "--no_cache", noDnsCache, "Use a DNSLookup per client instead of the DNS cache");
+
+    CLI::App* tlsBenchApp =
+        app.add_subcommand("tls_bench", "Benchmark TLS handshakes with a local server");
+    tlsBenchApp->fallthrough();
+    tlsBenchApp->add_option("--clients", clientCount, "Number of concurrent clients");
+    tlsBenchApp->add_option(
+        "--count", count, "Number of connections per client, one after the other");
+    addTLSOptions(tlsBenchApp);
+
+    CLI::App* maskBenchApp = app.add_subcommand("mask_bench", "Benchmark frame masking");
+    maskBenchApp->fallthrough();
+    maskBenchApp->add_option(
+        "--msg_size", msgSize, "Message size in bytes (all sizes from 16 to 1M by default)");
+    maskBenchApp->add_option("--run_count", runCount, "Number of runs, the best one is reported");
+
     CLI11_PARSE(app, argc, argv);
 
     // pid file handling
@@ -2779,12 +4055,19 @@ int main(int argc, char** argv)
                                       ipv6,
                                       disablePerMessageDeflate,
                                       disablePong,
-                                      httpHeaderAuthorization);
+                                      httpHeaderAuthorization,
+                                      eventLoopThreads);
     }
     else if (app.got_subcommand("push_server"))
     {
-        ret = ix::ws_push_server(
-            port, hostname, tlsOptions, ipv6, disablePerMessageDeflate, disablePong, sendMsg);
+        ret = ix::ws_push_server(port,
+                                 hostname,
+                                 tlsOptions,
+                                 ipv6,
+                                 disablePerMessageDeflate,
+                                 disablePong,
+                                 sendMsg,
+                                 eventLoopThreads);
     }
     else if (app.got_subcommand("transfer") || app.got_subcommand("broadcast_server"))
     {
@@ -2824,6 +4107,7 @@ int main(int argc, char** argv)
                                       data,
                                       formData,
                                       binaryData,
+                                      uploadFile,
                                       headersOnly,
                                       connectTimeOut,
                                       transferTimeout,
@@ -2834,6 +4118,8 @@ int main(int argc, char** argv)
                                       output,
                                       compress,
                                       compressRequest,
+                                      resume,
+                                      parallel,
                                       tlsOptions);
     }
     else if (app.got_subcommand("httpd"))
@@ -2894,6 +4180,42 @@ int main(int argc, char** argv)
     {
         ret = ix::ws_gunzip(filename);
     }
+    else if (app.got_subcommand("receive_bench"))
+    {
+        ret = ix::ws_receive_bench(msgCount, msgSize, eventLoopThreads, zeroCopy);
+    }
+    else if (app.got_subcommand("send_bench"))
+    {
+        ret = ix::ws_send_bench(msgSize, eventLoopThreads);
+    }
+    else if (app.got_subcommand("broadcast_bench"))
+    {
+        ret = ix::ws_broadcast_bench(
+            clientCount, broadcastCount, broadcastSize, eventLoopThreads, legacyBroadcast);
+    }
+    else if (app.got_subcommand("httpd_bench"))
+    {
+        ret = ix::ws_httpd_bench(connectionCount,
+                                 requestCount,
+                                 pipelineDepth,
+                                 !disableKeepAlive,
+                                 useHttpClient,
+                                 useAsyncHttpClient,
+                                 eventLoopThreads,
+                                 responseDelayMs);
+    }
+    else if (app.got_subcommand("dns_bench"))
+    {
+        ret = ix::ws_dns_bench(hostname, clientCount, count, noDnsCache);
+    }
+    else if (app.got_subcommand("tls_bench"))
+    {
+        ret = ix::ws_tls_bench(tlsOptions, clientCount, count);
+    }
+    else if (app.got_subcommand("mask_bench"))
+    {
+        ret = ix::ws_mask_bench(msgSize, runCount);
+    }
     else if (version)
     {
         std::cout << "ws " << ix::userAgent() << std::endl;